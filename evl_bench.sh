@@ -0,0 +1,75 @@
+#!/bin/sh
+#
+# eval benchmark, compares the cpu time of the bytecode vm scm with the
+# reference tree-walking interpreter scmref and with the program compiled
+# by scmc. best of three runs. allocs counts the blocks scm allocates for
+# the whole program.
+#
+
+BIN=$(mktemp)
+trap 'rm -f ${BIN}' EXIT
+
+_cpu() {
+    # the second line of times is the cpu time of the children
+    ( "$@" > /dev/null ; times ) | awk 'NR == 2 {
+	split($1, u, "m"); split($2, s, "m");
+	print u[1] * 60 + u[2] + s[1] * 60 + s[2] }'
+}
+
+_best() {
+    local _run _t _best=""
+
+    for _run in 1 2 3; do
+	_t=$(_cpu "$@")
+	if [ -z "$_best" ] || [ $(echo "$_t $_best" | awk '{ print ($1 < $2) }') = 1 ]; then
+	    _best=$_t
+	fi
+    done
+    echo $_best
+}
+
+_bench() {
+    local _desc=$1
+    local _prog=$2
+    local _line="$_desc"
+
+    scmc -o ${BIN} -c "${_prog}" || return
+    _line="$_line $(_best scm -c "${_prog}") $(_best scmref -c "${_prog}") $(_best ${BIN})"
+    _line="$_line $(scm -c "${_prog} (car (memory-stats))" | tail -n 1)"
+    echo "$_line" | awk '{ printf "%-10s %8.2fs %8.2fs %6.1fx %8.2fs %6.1fx %10d\n", $1,
+	$2, $3, ($2 > 0) ? $3 / $2 : 0, $4, ($4 > 0) ? $2 / $4 : 0, $5 }'
+}
+
+
+printf "%-10s %9s %9s %7s %9s %7s %10s\n" benchmark scm scmref speedup scmc speedup allocs
+
+_bench fib "
+(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))
+(fib 30)"
+
+_bench tak "
+(define (tak x y z)
+  (if (< y x)
+      (tak (tak (- x 1) y z) (tak (- y 1) z x) (tak (- z 1) x y))
+      z))
+(tak 24 16 8)"
+
+_bench lists "
+(define (iota n acc) (if (= n 0) acc (iota (- n 1) (cons n acc))))
+(define (sum l) (if (null? l) 0 (+ (car l) (sum (cdr l)))))
+(define (repeat n) (if (= n 0) 0 (begin (sum (iota 2000 nil)) (repeat (- n 1)))))
+(repeat 500)"
+
+_bench closures "
+(define (compose f g) (lambda (x) (f (g x))))
+(define (inc x) (+ x 1))
+(define (run n f acc) (if (= n 0) acc (run (- n 1) f (f acc))))
+(define (loop n) (if (= n 0) 0 (begin (run 1000 (compose inc (compose inc inc)) 0) (loop (- n 1)))))
+(loop 1000)"
+
+_bench macros "
+(define-macro (unless c a b) (list (quote if) c b a))
+(define-macro (dec! v) (list (quote set!) v (list (quote -) v 1)))
+(define (count n) (unless (= n 0) (begin (dec! n) (count n)) 0))
+(define (loop n) (unless (= n 0) (begin (count 1000) (loop (- n 1))) 0))
+(loop 1000)"
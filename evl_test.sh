@@ -0,0 +1,337 @@
+#!/bin/sh
+#
+# eval test, the bytecode vm scm and the reference interpreter scmref
+# must both produce the expected value of the last form
+#
+
+_test_eval() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_output=$4
+    local _exp_status=$5
+    local _bin
+
+    echo [TEST] $_desc >&2
+
+    for _bin in scm scmref; do
+	OUTPUT=$($_bin -c "${_input}")
+	STATUS=$?
+	OUTPUT=$(echo "${OUTPUT}" | tail -n 1)
+	if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	    echo "not ok $_num - unexpected status [${STATUS}] $_desc [${_bin}]"
+	elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	    echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [${_bin}]"
+	else
+	    echo "ok $_num - $_desc [${_bin}]"
+	fi
+	_num=$((_num + 1))
+    done
+}
+
+# scm only, in limited memory
+_test_vm() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_output=$4
+    local _exp_status=$5
+
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(ulimit -v 65536; scm -c "${_input}")
+    STATUS=$?
+    OUTPUT=$(echo "${OUTPUT}" | tail -n 1)
+    if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [scm]"
+    elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [scm]"
+    else
+	echo "ok $_num - $_desc [scm]"
+    fi
+}
+
+# scm with a pool of 4 threads, and scmref
+_test_par() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_output=$4
+    local _exp_status=$5
+    local _bin
+
+    echo [TEST] $_desc >&2
+
+    for _bin in "scm -t 4" scmref; do
+	OUTPUT=$($_bin -c "${_input}")
+	STATUS=$?
+	OUTPUT=$(echo "${OUTPUT}" | tail -n 1)
+	if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	    echo "not ok $_num - unexpected status [${STATUS}] $_desc [${_bin}]"
+	elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	    echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [${_bin}]"
+	else
+	    echo "ok $_num - $_desc [${_bin}]"
+	fi
+	_num=$((_num + 1))
+    done
+}
+
+# scm --profile, the folded stacks must hold the frame _exp_frame of the
+# source file and nothing but lines of frames and a count
+_test_profile() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_frame=$4
+    local _src=$(mktemp)
+    local _out=$(mktemp)
+
+    echo [TEST] $_desc >&2
+
+    printf "${_input}" > ${_src}
+    scm --profile=${_out} ${_src} > /dev/null
+    STATUS=$?
+    _exp_frame=$(echo "${_exp_frame}" | sed "s|FILE|${_src}|g")
+    if [ X"${STATUS}" != X"0" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [scm]"
+    elif ! grep -qF "${_exp_frame}" ${_out} ; then
+	echo "not ok $_num - no frame [${_exp_frame}] $_desc [scm]"
+    else
+	echo "ok $_num - $_desc [scm]"
+    fi
+    _num=$((_num + 1))
+    if grep -qvE '^[^;]+(;[^;]+)* [0-9]+$' ${_out} ; then
+	echo "not ok $_num - not folded $_desc [scm]"
+    else
+	echo "ok $_num - folded $_desc [scm]"
+    fi
+    rm -f ${_src} ${_out}
+}
+
+# -k, the definitions made before an error are kept and the forms after
+# it evaluated, the last line of the output is compared
+_test_keep() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_output=$4
+    local _bin
+
+    echo [TEST] $_desc >&2
+
+    for _bin in "scm -t 4" scmref; do
+	OUTPUT=$(printf "${_input}" | $_bin -k - 2>/dev/null)
+	STATUS=$?
+	OUTPUT=$(echo "${OUTPUT}" | tail -n 1)
+	if [ X"${STATUS}" != X"1" ] ; then
+	    echo "not ok $_num - unexpected status [${STATUS}] $_desc [${_bin}]"
+	elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	    echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [${_bin}]"
+	else
+	    echo "ok $_num - $_desc [${_bin}]"
+	fi
+	_num=$((_num + 1))
+    done
+}
+
+# -e, the records of standard input applied to proc, all of the output
+# is compared
+_test_records() {
+    local _num=$1
+    local _desc=$2
+    local _flags=$3
+    local _proc=$4
+    local _input=$5
+    local _exp_output=$6
+    local _exp_status=$7
+    local _bin
+
+    echo [TEST] $_desc >&2
+
+    for _bin in scm scmref; do
+	OUTPUT=$(printf "${_input}" | $_bin ${_flags} -e "${_proc}" - 2>/dev/null)
+	STATUS=$?
+	if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	    echo "not ok $_num - unexpected status [${STATUS}] $_desc [${_bin}]"
+	elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	    echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [${_bin}]"
+	else
+	    echo "ok $_num - $_desc [${_bin}]"
+	fi
+	_num=$((_num + 1))
+    done
+}
+
+RANGE="(define (range n acc) (if (= n 0) acc (range (- n 1) (cons n acc))))"
+SUM="(define (sum l acc) (if (null? l) acc (sum (cdr l) (+ acc (car l)))))"
+
+echo "1..149"
+
+_test_eval 1 integer "23" "23" 0
+_test_eval 3 string "\"hello\"" "\"hello\"" 0
+_test_eval 5 quote "(quote abc)" "abc" 0
+_test_eval 7 add "(+ 1 2 3)" "6" 0
+_test_eval 9 sub "(- 10 4 3)" "3" 0
+_test_eval 11 negate "(- 5)" "-5" 0
+_test_eval 13 mul "(* 2 3 4)" "24" 0
+_test_eval 15 lt "(< 1 2 3)" "true #t" 0
+_test_eval 17 num_eq "(= 1 2)" "false #f" 0
+_test_eval 19 if "(if (< 1 2) (quote yes) (quote no))" "yes" 0
+_test_eval 21 if_no_alternative "(if false 1)" "nil ()" 0
+_test_eval 23 define "(define x 42) x" "42" 0
+_test_eval 25 lambda "((lambda (x y) (- x y)) 7 2)" "5" 0
+_test_eval 27 closure "(define (adder n) (lambda (x) (+ x n))) ((adder 3) 4)" "7" 0
+_test_eval 29 set_local "((lambda (x) (set! x 3) x) 1)" "3" 0
+_test_eval 31 set_global "(define x 1) (set! x (+ x 1)) x" "2" 0
+_test_eval 33 internal_define "(define (f) (define a 5) (define (g) (* a 2)) (g)) (f)" "10" 0
+_test_eval 35 let "(let ((x 1) (y 2)) (+ x y))" "3" 0
+_test_eval 37 fib "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 15)" "610" 0
+_test_eval 39 list "(car (cdr (cons 1 (list 2 3))))" "2" 0
+_test_eval 41 begin "(begin 1 2 3)" "3" 0
+_test_eval 43 unbound "(+ y 1)" "" 1
+_test_eval 45 arity "((lambda (x) x))" "" 1
+_test_eval 47 not_a_procedure "(1 2)" "" 1
+_test_eval 49 overflow "(* 288230376151711743 2)" "" 1
+_test_eval 51 bad_syntax "(if)" "" 1
+_test_eval 53 shadowing "(define x 1) (define (f x) (lambda () (let ((y x) (x 3)) (+ x y)))) ((f 2))" "5" 0
+_test_eval 55 forward_global "(define (g) (h)) (define (h) 5) (g)" "5" 0
+_test_eval 57 unbound_set "(set! undefined-variable 1)" "" 1
+_test_eval 59 captured_frames "(define (mk n acc) (if (= n 0) acc (mk (- n 1) (cons (lambda () n) acc)))) ((car (mk 3 nil)))" "1" 0
+
+# proper tail calls: loops run in constant stack and frame memory
+_test_vm 61 tail_loop_100M "(define (loop n) (if (= n 0) (quote done) (loop (- n 1)))) (loop 100000000)" "done" 0
+_test_vm 62 tail_mutual "(define (even? n) (if (= n 0) true (odd? (- n 1)))) (define (odd? n) (if (= n 0) false (even? (- n 1)))) (even? 1000001)" "false #f" 0
+_test_vm 63 tail_let_begin "(define (loop n acc) (let ((m (- n 1))) (begin (if (< m 0) acc (loop m (+ acc 2)))))) (loop 1000000 0)" "2000000" 0
+_test_vm 64 deep_recursion "(define (f n) (if (= n 0) 0 (+ 1 (f (- n 1))))) (f 1000000)" "f" 1
+
+# inline caches of global calls
+_test_eval 65 redefined_global "(define (f) 1) (define (g) (f)) (g) (define (f) 2) (g)" "2" 0
+_test_eval 67 redefined_primitive "(define (g x) (car x)) (g (list 1 2)) (define (car x) 7) (g (list 1 2))" "7" 0
+_test_vm 69 ic_monomorphic "(define (loop n) (if (= n 0) (inline-cache-stats) (loop (- n 1)))) (car (cdr (loop 1000)))" "3" 0
+_test_vm 70 ic_megamorphic "(define (f) 1) (define (g) (f)) (g) (define (f) 2) (g) (define (f) 3) (g) (define (f) 4) (g) (define (f) 5) (g) (car (cdr (cdr (inline-cache-stats))))" "1" 0
+
+# integer operators, inline in the vm and as primitives
+_test_eval 71 add_overflow "(+ 288230376151711743 1)" "" 1
+_test_eval 73 sub_overflow "(- -288230376151711744 1)" "" 1
+_test_eval 75 negate_overflow "(- -288230376151711744)" "" 1
+_test_eval 77 mul_overflow "(* -1 -288230376151711744)" "" 1
+_test_eval 79 mul_min "(* 2 -144115188075855872)" "-288230376151711744" 0
+_test_eval 81 redefined_operator "(define (f a b) (+ a b)) (f 3 4) (define (+ a b) (* a b)) (f 3 4)" "12" 0
+_test_eval 83 operator_type "(define (f a b) (< a b)) (f 1 (quote a))" "f" 1
+
+# macros, expanded once per source form
+_test_eval 85 macro "(define-macro (unless c a b) (list (quote if) c b a)) (unless false 1 2)" "1" 0
+_test_eval 87 macro_once "(define n 0) (define-macro (m) (set! n (+ n 1)) n) (define (f) (m)) (f) (f) (f) n" "1" 0
+_test_eval 89 macro_redefined "(define n 0) (define-macro (m) (set! n (+ n 1)) n) (define (f) (m)) (f) (f) (define-macro (m) (set! n (+ n 10)) n) (f) (f) n" "11" 0
+_test_eval 91 macro_redefined_locals "(define-macro (w v) v) (define (mk x) (let ((z 2)) (w (lambda () (+ x z))))) ((mk 7)) (define-macro (w v) (list (quote let) (list (list (quote y) 5)) (list (quote +) (list v) (quote y)))) (mk 7)" "14" 0
+_test_eval 93 macro_set_local "(define-macro (inc v) (list (quote set!) v (list (quote +) v 1))) (define (g x) (inc x) x) (g 1) (define-macro (inc v) (list (quote set!) v (list (quote +) v 100))) (g 1)" "101" 0
+_test_eval 95 macro_shadowed "(define-macro (m x) x) (define (f m) (m 3)) (f (lambda (y) (+ y 1)))" "4" 0
+_test_eval 97 macro_not_toplevel "(let ((a 1)) (define-macro (m) 1))" "" 1
+
+# frames on the vm stack, flat closures and boxes of assigned variables
+_test_eval 99 shared_box "(define (mk) (let ((n 0)) (list (lambda () (set! n (+ n 1)) n) (lambda () n)))) (define p (mk)) ((car p)) ((car p)) ((car (cdr p)))" "2" 0
+_test_vm 101 internal_mutual "(define (f n) (define (ev? k) (if (= k 0) true (od? (- k 1)))) (define (od? k) (if (= k 0) false (ev? (- k 1)))) (ev? n)) (f 10)" "true #t" 0
+_test_eval 102 assigned_param "(define (f x) (let ((g (lambda () x))) (set! x 5) (g))) (f 1)" "5" 0
+_test_vm 104 call_allocates_nothing "(define (f n) (if (= n 0) 0 (+ 1 (f (- n 1))))) (define (g) (let ((a (car (memory-stats)))) (f 10000) (- (car (memory-stats)) a))) (g)" "2" 0
+_test_eval 105 lambda_applied "((lambda (x y) (+ x y)) 3 4)" "7" 0
+_test_eval 107 lambda_applied_define "(define (f n) ((lambda (k) (define (h) k) (h)) n)) (f 9)" "9" 0
+_test_eval 109 macro_redefined_outer "(define-macro (w v) v) (define (mk x) (lambda (q) (let ((z 2)) (w (+ x z q))))) ((mk 7) 1) (define-macro (w v) (list (quote begin) (list (quote set!) (quote x) 100) v)) ((mk 7) 1)" "103" 0
+_test_vm 111 macro_captured_assigned "(define-macro (w) 1) (define (f x) (let ((g (lambda () x))) (+ (w) (g)))) (f 1) (define-macro (w) (quote (begin (set! x 10) 0))) (f 1)" "w" 1
+
+# parallel map, in list order on any number of threads
+_test_par 112 pmap_order "${RANGE} (define (check l n) (if (null? l) n (if (= (car l) (* n n)) (check (cdr l) (+ n 1)) (quote wrong)))) (check (pmap (lambda (x) (* x x)) (range 1000 nil)) 1)" "1001" 0
+_test_par 114 pmap_short "(car (cdr (pmap (lambda (x) (+ x 1)) (list 1 2 3))))" "3" 0
+_test_par 116 pmap_allocates "${RANGE} ${SUM} (sum (pmap (lambda (x) (car (cdr (list x (+ x 1))))) (range 1000 nil)) 0)" "501500" 0
+_test_par 118 pfor_each "${RANGE} (pfor-each (lambda (x) (* x 2)) (range 1000 nil))" "nil ()" 0
+_test_par 120 pmap_not_a_list "(pmap car 5)" "" 1
+_test_par 122 pmap_macro_redefined "${RANGE} ${SUM} (define-macro (w x) x) (define (f x) (w x)) (f 1) (define-macro (w x) (list (quote *) 3 x)) (sum (pmap f (range 100 nil)) 0)" "15150" 0
+_test_par 124 pmap_nested "${RANGE} ${SUM} (sum (pmap (lambda (n) (sum (pmap (lambda (x) x) (range n nil)) 0)) (range 40 nil)) 0)" "11480" 0
+
+# sampled stacks of procedures with the location of their source
+_test_profile 126 profile_fib "(define x 1)\n(define (fib n)\n  (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n(fib 28)\n" "fib (FILE:2);fib (FILE:2)"
+
+# errors caught by the repl under -k
+_test_keep 128 keep_unbound "(define x 1)\n(+ x y)\n(+ x 2)\n" "3"
+_test_keep 130 keep_deep "(define (f n) (if (= n 0) (car 0) (+ 1 (f (- n 1)))))\n(f 100)\n(define x 5)\n(+ x 1)\n" "6"
+_test_keep 132 keep_pmap "${RANGE}\n(pmap (lambda (x) (if (= x 500) (car x) x)) (range 1000 nil))\n(car (pmap (lambda (x) (* x 2)) (range 1000 nil)))\n" "2"
+
+# records of -e, the lists of a batch are recycled: the records of the
+# second batch allocate nothing from the heap
+_test_records 134 records_map "" "(lambda (r) (* r r))" "1\n2 3\n" "1
+4
+9" 0
+_test_records 136 records_lists "" "(lambda (r) (car (cdr r)))" "(1 2)\n(3 (4 5))\n(6 7)\n" "2
+(
+4
+5
+)
+7" 0
+_test_records 138 records_keep "-k" "(lambda (r) (* r 10))" "1\n(2)\n3 (4 \"\\\\q\")\n5\n" "10
+30
+50" 1
+OUTPUT=$(seq 1 3000 | scm -e "(lambda (r) ((lambda (l) (car (memory-stats))) (list r r r)))" - | sed -n "1100p;2000p" | uniq | wc -l)
+if [ X"${OUTPUT}" != X"1" ] ; then
+    echo "not ok 140 - records allocate from the heap [scm]"
+else
+    echo "ok 140 - records_recycled [scm]"
+fi
+
+# an error in a transformer under -k, the arguments of the call are
+# released: each failed expansion adds one to the frees of --stats
+_test_keep 141 keep_macro "(define-macro (m x) (car x))\n(m 1)\n(define x 5)\n(+ x 1)\n" "6"
+_frees() {
+    printf "$1" | scm $2 -k --stats - 2>&1 >/dev/null | tail -n 1 |
+	sed -n 's/.*"frees": \([0-9]*\).*/\1/p'
+}
+OUTPUT=$(( $(_frees "(define-macro (m x) (car x))\n(m 1)\n(m 2)\n(m 3)\n") - $(_frees "(define-macro (m x) (car x))\n(m 1)\n") ))
+if [ X"${OUTPUT}" != X"2" ] ; then
+    echo "not ok 143 - unexpected frees [${OUTPUT}] keep_macro released [scm]"
+else
+    echo "ok 143 - keep_macro released [scm]"
+fi
+
+# a pmap failing on the calling thread under -k releases its code, its
+# input and its output: five frees each, mapped sequentially or not
+_n=144
+for _opts in "-t 1" "-t 4"; do
+    _pmap="${RANGE}\n(pmap car (range 100 nil))\n"
+    OUTPUT=$(( $(_frees "${_pmap}(pmap car (range 100 nil))\n(pmap car (range 100 nil))\n" "${_opts}") - $(_frees "${_pmap}" "${_opts}") ))
+    if [ X"${OUTPUT}" != X"10" ] ; then
+	echo "not ok $_n - unexpected frees [${OUTPUT}] pmap_released [scm ${_opts}]"
+    else
+	echo "ok $_n - pmap_released [scm ${_opts}]"
+    fi
+    _n=$((_n + 1))
+done
+
+# records of new strings and symbols, mapped by pmap or not, leave none of
+# their cells and strings behind: twice the records, no more allocations
+# of up to 32 bytes
+_small() {
+    awk -v n=$1 'BEGIN { for (i=0; i<n; i++) { printf "(k%d", i;
+	for (j=0; j<40; j++) printf " \"s%d-%d\"", i, j; print ")" } }' |
+	scm -t 4 --stats -e "$2" - 2>&1 >/dev/null | tail -n 1 |
+	sed -n 's/.*"16": {"allocs": \([0-9]*\),.*"32": {"allocs": \([0-9]*\),.*/\1 + \2/p'
+}
+_n=146
+for _proc in "(lambda (r) (car r))" "(lambda (r) (car (pmap list r)))"; do
+    OUTPUT=$(( ($(_small 4096 "${_proc}")) - ($(_small 2048 "${_proc}")) ))
+    if [ X"${OUTPUT}" != X"0" ] ; then
+	echo "not ok $_n - unexpected allocations [${OUTPUT}] records_released [scm ${_proc}]"
+    else
+	echo "ok $_n - records_released [scm ${_proc}]"
+    fi
+    _n=$((_n + 1))
+done
+
+# a new symbol of a batch is the same in each of its records, an old one
+# that of proc
+_test_records 148 records_symbols "" "(lambda (r) (list (eq? (car r) (quote a)) (eq? (car r) (car (cdr r)))))" "(a x)\n(x x)\n" "(
+true #t
+false #f
+)
+(
+false #f
+true #t
+)" 0
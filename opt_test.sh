@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# optimizer test, scm -p must print the expected optimized form and the
+# optimized program must have the value of the program as read
+#
+
+_test_opt() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_form=$4
+    local _plain
+
+    echo [TEST] $_desc >&2
+
+    # the form is printed one atom per line, join the lines
+    OUTPUT=$(scm -p -c "${_input}" 2>&1 | tr '\n' ' ')
+    if [ X"${OUTPUT}" != X"${_exp_form} " ] ; then
+	echo "not ok $_num - unexpected form [${OUTPUT}] $_desc [scm -p]"
+    else
+	echo "ok $_num - $_desc [scm -p]"
+    fi
+
+    _num=$((_num + 1))
+    _plain=$(scm -c "${_input}" 2>&1 | tail -n 1)
+    OUTPUT=$(scmref -O -c "${_input}" 2>&1 | tail -n 1)
+    if [ X"${OUTPUT}" != X"${_plain}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [scmref -O]"
+    else
+	echo "ok $_num - $_desc [scmref -O]"
+    fi
+}
+
+# a program not seen whole by the optimizer: the forms _first before -O,
+# then the forms _rest on standard input. the value must be the one of
+# the program as read
+_test_streamed() {
+    local _num=$1
+    local _desc=$2
+    local _first=$3
+    local _rest=$4
+    local _plain
+
+    echo [TEST] $_desc >&2
+
+    _plain=$(printf "${_rest}" | scm -c "${_first}" - 2>&1 | tail -n 1)
+    OUTPUT=$(printf "${_rest}" | scm -c "${_first}" -O - 2>&1 | tail -n 1)
+    if [ X"${OUTPUT}" != X"${_plain}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [scm -O -]"
+    else
+	echo "ok $_num - $_desc [scm -O -]"
+    fi
+}
+
+
+echo "1..35"
+
+# folding of builtins on literals
+_test_opt 1 fold_arith "(* 60 (+ 50 10))" "3600 3600"
+_test_opt 3 fold_table "(car (cdr (quote (1 2 3))))" "2 2"
+_test_opt 5 fold_quoted "(car (quote (a b)))" "( quote a ) a"
+_test_opt 7 fold_type "(+ 1 (quote a))" "error-010: wrong type: +: integer expected ( + 1 ( quote a ) )"
+_test_opt 9 fold_overflow "(+ 288230376151711743 1)" "error-003: integer overflow: + ( + 288230376151711743 1 )"
+
+# dead branches
+_test_opt 11 dead_else "(if (< 1 2) (quote yes) (undefined))" "( quote yes ) yes"
+_test_opt 13 dead_then "(if (null? (quote (1))) (undefined))" "nil () nil ()"
+
+# let and inlining
+_test_opt 15 let_literals "(let ((a 2) (b 3)) (+ a b))" "5 5"
+_test_opt 17 let_assigned "(let ((a 2)) (set! a 3) a)" "( let ( ( a 2 ) ) ( set! a 3 ) a ) 3"
+_test_opt 19 lambda_applied "((lambda (x y) (* x y)) 6 7)" "42 42"
+_test_opt 21 inline_known "(begin (define (sq x) (* x x)) (+ (sq 3) (sq 4)))" "( begin ( define ( sq x ) ( * x x ) ) 25 ) 25"
+_test_opt 23 inline_shadowed "(begin (define (f) y) (define y 1) (define (g y) (f)) (g 2))" "( begin ( define ( f ) y ) ( define y 1 ) ( define ( g y ) ( f ) ) ( f ) ) 1"
+_test_opt 25 redefined_builtin "(begin (define (+ a b) (* a b)) (+ 3 4))" "( begin ( define ( + a b ) ( * a b ) ) 12 ) 12"
+_test_opt 27 macro_call "(begin (define-macro (m x) (car x)) (m (+ 1 2)))" "( begin ( define-macro ( m x ) ( car x ) ) ( m ( + 1 2 ) ) ) #<procedure +>"
+
+# procedures redefined by later forms are not inlined
+_test_opt 29 redefined_later "(define (f) 1) (define (g) (f)) (define (f) 2) (g)" "( define ( f ) 1 ) f ( define ( g ) ( f ) ) g ( define ( f ) 2 ) f ( f ) 2"
+_test_opt 31 inline_in_procedure "(define (sq x) (* x x)) (define (f y) (+ (sq y) (sq 2))) (f 3)" "( define ( sq x ) ( * x x ) ) sq ( define ( f y ) ( + ( let ( ( x y ) ) ( * x x ) ) 4 ) ) f 13 13"
+_test_streamed 33 redefined_streamed "(define (+ a b) (* a b))" "(define (f) 1)\n(define (g) (+ (f) 3))\n(define (f) 2)\n(g)\n"
+
+# a macro call may rebind any global, nothing is inlined after one
+_test_opt 34 macro_redefines "(define-macro (redef) (quote (define (p) 2))) (define (p) 1) (define (q) (p)) (redef) (q)" "( define-macro ( redef ) ( quote ( define ( p ) 2 ) ) ) redef ( define ( p ) 1 ) p ( define ( q ) ( p ) ) q ( redef ) p ( q ) 2"
@@ -43,8 +43,167 @@ _test_c() {
     fi
 }
 
+# the same file read by scmrpl and by scmrpl -t, split into chunks. an
+# error is raised once the forms before it are printed, options in _opts
+_test_parallel() {
+    local _num=$1
+    local _desc=$2
+    local _file=$3
+    local _threads=$4
+    local _opts=$5
+    local _exp
+    local _status
+
+    echo [TEST] $_desc >&2
+
+    _exp=$(scmrpl ${_opts} ${_file} 2>&1)
+    _status=$?
+    OUTPUT=$(scmrpl ${_opts} -t ${_threads} ${_file} 2>&1)
+    STATUS=$?
+    if [ X"${STATUS}" != X"${_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [parallel]"
+    elif [ X"${OUTPUT}" != X"${_exp}" ] ; then
+	echo "not ok $_num - unexpected output $_desc [parallel]"
+    else
+	echo "ok $_num - $_desc [parallel]"
+    fi
+}
+
+# files read by scmrpl -j, their output in argument order, as without -j
+_test_jobs() {
+    local _num=$1
+    local _desc=$2
+    local _exp_output=$3
+    local _exp_status=$4
+    shift 4
 
-echo "1..34"
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(scmrpl -j 3 "$@" 2>&1)
+    STATUS=$?
+    OUTPUT=$(echo "${OUTPUT}" | tr '\n' ' ')
+    if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [jobs]"
+    elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [jobs]"
+    else
+	echo "ok $_num - $_desc [jobs]"
+    fi
+}
+
+# a file read ahead by scmrpl -a, as a file and as standard input
+_test_prefetch() {
+    local _num=$1
+    local _desc=$2
+    local _file=$3
+    local _exp
+    local _status
+
+    echo [TEST] $_desc >&2
+
+    _exp=$(scmrpl ${_file} 2>&1)
+    _status=$?
+    OUTPUT=$(scmrpl -a ${_file} 2>&1)
+    STATUS=$?
+    if [ X"${STATUS}" != X"${_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [prefetch]"
+    elif [ X"${OUTPUT}" != X"${_exp}" ] ; then
+	echo "not ok $_num - unexpected output $_desc [prefetch]"
+    else
+	echo "ok $_num - $_desc [prefetch]"
+    fi
+
+    _num=$((_num + 1))
+    _exp=$(cat ${_file} | scmrpl - 2>&1)
+    _status=$?
+    OUTPUT=$(cat ${_file} | scmrpl -a - 2>&1)
+    STATUS=$?
+    if [ X"${STATUS}" != X"${_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [prefetch stdin]"
+    elif [ X"${OUTPUT}" != X"${_exp}" ] ; then
+	echo "not ok $_num - unexpected output $_desc [prefetch stdin]"
+    else
+	echo "ok $_num - $_desc [prefetch stdin]"
+    fi
+}
+
+# bytes of printf format input, the last line of the output or the error
+_test_encoding() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_output=$4
+    local _exp_status=$5
+
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(printf "${_input}" | scmrpl - 2>&1)
+    STATUS=$?
+    OUTPUT=$(echo "${OUTPUT}" | tail -n 1)
+    if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [encoding]"
+    elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [encoding]"
+    else
+	echo "ok $_num - $_desc [encoding]"
+    fi
+}
+
+# the section of the json written by --stats to standard error
+_test_stats() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _section=$4
+    local _exp_output=$5
+    local _exp_status=$6
+
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(printf "${_input}" | scmrpl --stats - 2>&1 >/dev/null)
+    STATUS=$?
+    OUTPUT=$(echo "${OUTPUT}" | tail -n 1 | sed -n "s/.*\"${_section}\": {\([^}]*\)}.*/\1/p")
+    if [ X"${STATUS}" != X"${_exp_status}" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [stats]"
+    elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [stats]"
+    else
+	echo "ok $_num - $_desc [stats]"
+    fi
+}
+
+# scmrpl -k, the forms after an error are read. the frees counted by
+# --stats after the input show that the datum being read was released
+_test_keep() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_output=$4
+    local _exp_frees=$5
+
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(printf "${_input}" | scmrpl -k -)
+    STATUS=$?
+    if [ X"${STATUS}" != X"1" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [keep]"
+    elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [keep]"
+    else
+	echo "ok $_num - $_desc [keep]"
+    fi
+    _num=$((_num + 1))
+    OUTPUT=$(printf "${_input}" | scmrpl -k --stats - 2>&1 >/dev/null | tail -n 1 |
+	sed -n 's/.*"frees": \([0-9]*\).*/\1/p')
+    if [ X"${OUTPUT}" != X"${_exp_frees}" ] ; then
+	echo "not ok $_num - unexpected frees [${OUTPUT}] $_desc [keep]"
+    else
+	echo "ok $_num - $_desc released [keep]"
+    fi
+}
+
+
+echo "1..60"
 
 _test_stdin 1 number_23 23 23 0
 _test_stdin 2 bool_true true "true #t" 0
@@ -96,3 +255,59 @@ _test_stdin 34 "pos overflow" "+288230376151711744" "" 1
 # neg-overflow +1
 # pos-overflow -1
 # pos-overflow
+
+# files of a few chunks, with strings and lists spanning lines
+PARFILE=$(mktemp)
+trap 'rm -f ${PARFILE}' EXIT
+awk 'BEGIN { for (i = 0; i < 40000; i++) {
+    printf "(rec %d \"(%d\\\" \n x)\"\n  (k%d -%d))\n", i, i % 97, i % 50, i % 13;
+    if (i % 1000 == 0) printf "a\"b sym%d 12\"x\ny\"\n", i % 10 } }' > ${PARFILE}
+_test_parallel 35 "parallel read" ${PARFILE} 4
+echo '(x "bad \q")' >> ${PARFILE}
+_test_parallel 36 "parallel error location" ${PARFILE} 3
+: > ${PARFILE}
+_test_parallel 37 "parallel empty file" ${PARFILE} 2
+
+# sources of scmrpl -j
+JOBDIR=$(mktemp -d)
+trap 'rm -f ${PARFILE}; rm -rf ${JOBDIR}' EXIT
+for _i in 1 2 3 4 5; do
+    awk -v n=${_i} 'BEGIN { for (i = 0; i < 20000 * (6 - n); i++) print i; print "f" n }' > ${JOBDIR}/${_i}
+done
+echo '"bad' > ${JOBDIR}/bad
+_test_jobs 38 "jobs in order" "$(scmrpl ${JOBDIR}/1 ${JOBDIR}/2 -c 7 ${JOBDIR}/3 ${JOBDIR}/4 ${JOBDIR}/5 | tr '\n' ' ')" 0 \
+    ${JOBDIR}/1 ${JOBDIR}/2 -c 7 ${JOBDIR}/3 ${JOBDIR}/4 ${JOBDIR}/5
+_test_jobs 39 "jobs with error" "f1 ${JOBDIR}/bad: error-007: premature end-of-file: ${JOBDIR}/bad:2:0 f5 " 1 \
+    -c f1 ${JOBDIR}/bad -c f5
+
+# more than one buffer read ahead
+awk 'BEGIN { for (i = 0; i < 40000; i++) {
+    printf "(rec %d \"(%d\\\" \n x)\"\n  (k%d -%d))\n", i, i % 97, i % 50, i % 13 } }' > ${PARFILE}
+_test_prefetch 40 "prefetch read" ${PARFILE}
+echo '(x "bad \q")' >> ${PARFILE}
+_test_prefetch 42 "prefetch error location" ${PARFILE}
+
+# utf-8 of strings and symbols, errors at the first byte of a bad sequence
+_test_encoding 44 "utf8 string" '"h\303\251llo \360\237\230\200"' "$(printf '"h\303\251llo \360\237\230\200"')" 0
+_test_encoding 45 "utf8 symbol" '\316\273' "$(printf '\316\273')" 0
+_test_encoding 46 "truncated sequence" '"abc\303"' "error-002: bad encoding: <stdin>:1:4" 1
+_test_encoding 47 "continuation byte" '(a\n\tb\200)' "error-002: bad encoding: <stdin>:2:9" 1
+_test_encoding 48 "overlong form" '"\340\200\257"' "error-002: bad encoding: <stdin>:1:1" 1
+_test_encoding 49 "surrogate" '"\355\240\200"' "error-002: bad encoding: <stdin>:1:1" 1
+_test_encoding 50 "above U+10FFFF" '"\364\220\200\200"' "error-002: bad encoding: <stdin>:1:1" 1
+_test_encoding 51 "after a long ascii run" '"abcdefghijklmnopqrstuvwxyz0123456789\377"' "error-002: bad encoding: <stdin>:1:37" 1
+
+# counters of --stats
+_test_stats 52 "reader counters" '(a (b "c"))\n7\n' reader '"bytes": 14, "datums": 2, "max_depth": 2' 0
+_test_stats 53 "intern counters" 'a b a' intern '"lookups": 3, "hits": 1, "probes": 3, "max_probes": 1, "strings": 2, "slots": 1024' 0
+_test_stats 54 "printer counters" '(a 7)' printer '"bytes": 8' 0
+_test_stats 55 "counters after an error" '(a "b' reader '"bytes": 5, "datums": 1, "max_depth": 1' 1
+_test_keep 56 "read after a bad datum" 'a\n(b "\\q" c) d\ne\n' "a
+e" 3
+_test_keep 58 "read after a bad nested datum" '(1 (2 3) "\\q")\n' "" 6
+
+# scmrpl -k -t, the errors of the workers in the order of the file
+awk 'BEGIN { for (i = 0; i < 40000; i++) {
+    printf "(rec %d\n  (k%d))\n", i, i % 50;
+    if (i % 7000 == 0) print "(x \"bad \\q\") y" } }' > ${PARFILE}
+_test_parallel 60 "parallel keep going" ${PARFILE} 4 -k
@@ -19,28 +19,187 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "scmerr.h"
+#include "scmctx.h"
 #include "scmmem.h"
 #include "scmval.h"
 #include "scmrdr.h"
 #include "scmprt.h"
+#include "scmspl.h"
 #include "scmevl.h"
+#include "scmtwi.h"
+#include "scmopt.h"
+#include "scmprf.h"
 
 #ifdef NO_EVAL
-#define scmevl(v) (v)
+#define scmevl(ctx, v) (v)
+#define scmevl_set_listing(ctx, fp) ((void)(fp))
+#define scmevl_set_workers(ctx, n) ((void)(n))
+#define scmopt_optimize(ctx, v) (v)
+#define scmopt_scan(ctx, v) ((void)(v))
+#define scmopt_seal(ctx) ((void)(ctx))
+#define scmprf_start(hz) ((void)(hz))
+#define scmprf_write(fp) ((void)(fp))
+#define scmevl_recover(ctx) ((void)(ctx))
+#define scmevl_map(ctx, proc, argv, out, i, n) scmerr(SCMERR_UNDEFINED, "-e: no evaluator")
 #endif
 
+#ifdef TWI_EVAL
+#define scmevl(ctx, v) scmtwi_eval((ctx), (v))
+#define scmevl_set_listing(ctx, fp) ((void)(fp))
+#define scmevl_set_workers(ctx, n) ((void)(n))
+#define scmprf_start(hz) ((void)(hz))
+#define scmprf_write(fp) ((void)(fp))
+#define scmevl_recover(ctx) ((void)(ctx))
+#define scmevl_map(ctx, proc, argv, out, i, n) map((ctx), (proc), (argv), (out), (i), (n))
+#endif
+
+// samples per second of cpu time taken by --profile
+#define PROFILE_HZ 1000
+
+// records read, applied and printed at once by -e
+#define RECORD_BATCH 1024
+
+// a source run by a child process, its output is kept until it is written
+struct job {
+  const char *name;
+  pid_t pid;
+  FILE *out;
+  FILE *err;
+  int status;
+  int done;
+};
+
+// a form read, evaluated and printed by the repl, under -k
+struct step {
+  scmctx *ctx;
+  scmrdr *rdr;
+  int reading;                  // an error was raised by the reader
+  int eof;
+  scmval forms;                 // read ahead, SCMVAL_UNBOUND if not
+  scmval *tail;                 // of forms, while they are read
+};
+
+// a batch of records of -e, read, applied and printed in turn
+struct batch {
+  scmctx *ctx;
+  scmrdr *rdr;
+  size_t n;                     // records read
+  size_t i;                     // of them applied
+  size_t printed;               // of them printed
+  int reading;                  // an error was raised by the reader
+  int eof;
+  int done;
+};
+
+// phases of the repl timed by --stats
+enum phase {
+  PHASE_READ,
+  PHASE_OPTIMIZE,
+  PHASE_EVAL,
+  PHASE_PRINT,
+  PHASES
+};
+
 /* static prototypes */
 static _Noreturn void usage(void);
-static void repl(scmrdr *rdr);
+static void repl(scmctx *ctx, scmrdr *rdr);
+static void program(scmctx *ctx, scmrdr *rdr);
+static void keep(struct step *st, void (*fn)(void *arg));
+static void step(void *arg);
+static void ahead(void *arg);
+static void records(scmctx *ctx, scmrdr *rdr);
+static void batch(void *arg);
+static scmval procedure(scmctx *ctx, char *source);
+#ifdef TWI_EVAL
+static void map(scmctx *ctx, scmval proc, scmval *argv, scmval *out, size_t *i, size_t n);
+#endif
+static void run(scmctx *ctx, char *source, int form);
+static void start(scmctx *ctx, char *source, int form);
+static void reap(void);
+static void copy(FILE *from, FILE *to, const char *prefix);
+static double now(void);
+static double lap(enum phase phase, double t);
+static void report(void);
+static void profile(void);
+
+static int optimize = 0;
+static int print_optimized = 0;
+static int nthreads = 0;
+static int prefetch = 0;
+static int keep_going = 0;
+static int scanning = 0;
+static int last = 0;
+
+// the procedure of -e, applied to the records of each following source
+static scmval record_proc = SCMVAL_NIL;
+static scmval record_in[RECORD_BATCH];
+static scmval record_out[RECORD_BATCH];
+
+// counters and timers of --stats, reported by the process setting it
+static int stats = 0;
+static scmctx *stats_ctx;
+static pid_t stats_pid;
+static double stats_start;
+static double phases[PHASES];
+static const char *phase_names[PHASES] = { "read", "optimize", "eval", "print" };
+
+// folded stacks of --profile, written by the process setting it
+static FILE *profile_fp;
+static pid_t profile_pid;
+
+// sources run at once by -j, in argument order
+static int maxjobs = 0;
+static struct job *jobs;
+static int nstarted = 0;
+static int nrunning = 0;
+static int nwritten = 0;
+static int failed = 0;
 
 static _Noreturn void
 usage(void)
 {
   fputs("synopsis:\n"
-	"  scm [ - | -c form | file ] ...\n"
+	"  scm [ --stats ] [ --profile=file ] [ -d ] [ -O ] [ -p ] [ -a ] [ -k ] [ -t threads ]\n"
+	"      [ -j jobs ] [ -e proc ]"
+	"      [ - | -c form | file ] ...\n"
 	"\n"
+	"    --stats    writes counters of the allocations, the intern pool,\n"
+	"               the reader and the printer, and the time spent in each\n"
+	"               phase of the repl to standard error at exit, as json.\n"
+	"               sources run by -j are not counted.\n"
+	"    -d         lists the bytecode of each following form.\n"
+	"    -O         optimizes each following form before evaluation. the\n"
+	"               last source, unless it is standard input, is read whole\n"
+	"               first: the procedures it never redefines are inlined in\n"
+	"               the procedures calling them.\n"
+	"    -p         prints each following form after optimization, implies -O.\n"
+	"    -a         reads standard input and each following file ahead\n"
+	"               on a thread of its own while the forms are parsed.\n"
+	"    -k         keeps going after an error in a form: the error is\n"
+	"               written, the rest of the line of a form that could\n"
+	"               not be read is skipped, and the definitions made so\n"
+	"               far are kept. scm fails at exit.\n"
+	"    -t threads reads each following file on threads threads, mapped\n"
+	"               and split at top-level forms, unless -e is given. the\n"
+	"               forms are evaluated in order. pmap and pfor-each run on\n"
+	"               threads threads, one per processor by default.\n"
+	"    -j jobs    runs up to jobs of the following sources at once, each\n"
+	"               in a process of its own, seeing the definitions of the\n"
+	"               sources before -j only. the output of each source is\n"
+	"               written in argument order, its errors prefixed with its\n"
+	"               name. a failed source fails scm after all are written.\n"
+	"    -e proc    evaluates the string proc to a procedure of one argument.\n"
+	"               the data of each following source are records: proc\n"
+	"               is applied to each and its values are printed. records\n"
+	"               are read, applied and printed in batches, the lists,\n"
+	"               closures and new strings and symbols of a batch are\n"
+	"               released after it is printed. proc must not keep them,\n"
+	"               in a global or otherwise.\n"
 	"    -          reads from standard input.\n"
 	"    -c form    reads from the string form.\n"
 	"    file       reads from the file.\n"
@@ -49,44 +208,554 @@ usage(void)
   exit(EXIT_FAILURE);
 }
 
+// read, evaluate and print the forms of rdr
+static void
+repl(scmctx *ctx, scmrdr *rdr)
+{
+  struct step st = { ctx, rdr, 0, 0, SCMVAL_UNBOUND, NULL };
+
+  keep(&st, step);
+}
+
+/*
+ * the forms of the last source under -O, scanned by the optimizer before
+ * the first is evaluated: it has seen the whole program.
+ */
+static void
+program(scmctx *ctx, scmrdr *rdr)
+{
+  struct step st = { ctx, rdr, 0, 0, SCMVAL_NIL, NULL };
+
+  st.tail = &st.forms;
+  keep(&st, ahead);
+  scmopt_seal(ctx);
+  st.eof = 0;
+  keep(&st, step);
+}
+
+/*
+ * run fn until the end of the forms. under -k an error ends the form
+ * only: the datum being read is released and the vm is reset, the
+ * definitions made so far are kept. errors of the system stay fatal.
+ */
+static void
+keep(struct step *st, void (*fn)(void *arg))
+{
+  struct scmerr_caught err;
+
+  while (!st->eof) {
+    if (!keep_going) {
+      fn(st);
+      continue;
+    }
+    if (!scmerr_catch(fn, st, &err)) {
+      continue;
+    }
+    if (SCMERR_SYSCALL == err.no) {
+      scmerr_raise(&err);
+    }
+    fprintf(stderr, "%s\n", err.msg);
+    failed = 1;
+    if (st->reading) {
+      scmrdr_recover(st->rdr);
+    } else {
+      scmevl_recover(st->ctx);
+    }
+  }
+}
+
+static void
+step(void *arg)
+{
+  struct step *st = arg;
+  scmctx *ctx = st->ctx;
+  scmval v;
+  double t = 0;
+
+  if (stats) {
+    t = now();
+  }
+  if (SCMVAL_UNBOUND == st->forms) {
+    st->reading = 1;
+    v = scmrdr_read(st->rdr);
+    st->reading = 0;
+    if (scanning && !optimize) {
+      scmopt_scan(ctx, v);
+    }
+  } else if (SCMVAL_NIL == st->forms) {
+    v = SCMVAL_EOF;
+  } else {
+    v = SCMVAL_CAR(st->forms);
+    st->forms = SCMVAL_CDR(st->forms);
+  }
+  if (stats) {
+    t = lap(PHASE_READ, t);
+  }
+  if (optimize) {
+    v = scmopt_optimize(ctx, v);
+    if (print_optimized) {
+      scmprt_print(ctx, v);
+    }
+    if (stats) {
+      t = lap(PHASE_OPTIMIZE, t);
+    }
+  }
+  v = scmevl(ctx, v);
+  if (stats) {
+    t = lap(PHASE_EVAL, t);
+  }
+  if (SCMVAL_EOF == v) {
+    st->eof = 1;
+    return;
+  }
+  scmprt_print(ctx, v);
+  if (stats) {
+    (void)lap(PHASE_PRINT, t);
+  }
+}
+
+// read a form of program, the optimizer notes what it defines
 static void
-repl(scmrdr *rdr)
+ahead(void *arg)
 {
+  struct step *st = arg;
   scmval v;
+  double t = 0;
+
+  if (stats) {
+    t = now();
+  }
+  st->reading = 1;
+  v = scmrdr_read(st->rdr);
+  st->reading = 0;
+  if (SCMVAL_EOF == v) {
+    st->eof = 1;
+  } else {
+    scmopt_scan(st->ctx, v);
+    *st->tail = SCMVAL_MAKE_LIST(scmval_cons(st->ctx, v, SCMVAL_NIL));
+    st->tail = &SCMVAL_CDR(*st->tail);
+  }
+  if (stats) {
+    (void)lap(PHASE_READ, t);
+  }
+}
 
-  for(;;) {
-    v = scmevl(scmrdr_read(rdr));
-    if (SCMVAL_EOF == v) {
+/*
+ * apply the procedure of -e to the records of rdr. the cells, closures and
+ * new strings and symbols of a batch are allocated in an arena of ctx,
+ * those of pmap in arenas of its workers, all reset once the batch is
+ * printed, so a stream of records runs in the memory of its largest batch.
+ * under -k an error ends its record only.
+ */
+static void
+records(scmctx *ctx, scmrdr *rdr)
+{
+  struct batch b = { ctx, rdr, 0, 0, 0, 0, 0, 0 };
+  struct scmerr_caught err;
+
+  scmmem_arena_new(ctx);
+  while (!b.done) {
+    if (!keep_going) {
+      batch(&b);
+      continue;
+    }
+    if (!scmerr_catch(batch, &b, &err)) {
+      continue;
+    }
+    if (SCMERR_SYSCALL == err.no) {
+      scmerr_raise(&err);
+    }
+    fprintf(stderr, "%s\n", err.msg);
+    failed = 1;
+    if (b.reading) {
+      scmrdr_recover(rdr);
+      continue;
+    }
+    scmevl_recover(ctx);
+    for (; b.printed < b.i; b.printed++) {
+      scmprt_print(ctx, record_out[b.printed]);
+    }
+    // the record raising the error has no value
+    b.i++;
+    b.printed++;
+  }
+  scmmem_arena_free(ctx);
+}
+
+static void
+batch(void *arg)
+{
+  struct batch *b = arg;
+  scmctx *ctx = b->ctx;
+  scmval v;
+  double t = 0;
+
+  if (stats) {
+    t = now();
+  }
+  if (!b->reading && (b->printed == b->n)) {
+    if (b->eof) {
+      b->done = 1;
+      return;
+    }
+    scmmem_arena_reset(ctx);
+    b->n = b->i = b->printed = 0;
+    b->reading = 1;
+  }
+  while (b->reading && (b->n < RECORD_BATCH)) {
+    if (SCMVAL_EOF == (v = scmrdr_read(b->rdr))) {
+      b->eof = 1;
       break;
     }
-    scmprt_print(v);
+    record_in[b->n++] = v;
+  }
+  b->reading = 0;
+  if (stats) {
+    t = lap(PHASE_READ, t);
+  }
+  scmevl_map(ctx, record_proc, record_in, record_out, &b->i, b->n);
+  if (stats) {
+    t = lap(PHASE_EVAL, t);
+  }
+  for (; b->printed < b->n; b->printed++) {
+    scmprt_print(ctx, record_out[b->printed]);
+  }
+  if (stats) {
+    (void)lap(PHASE_PRINT, t);
+  }
+}
+
+// the procedure of -e, the value of the string source
+static scmval
+procedure(scmctx *ctx, char *source)
+{
+  scmrdr *rdr = scmrdr_open_buffer(ctx, source, strlen(source));
+  scmval v = scmrdr_read(rdr);
+
+  scmrdr_close(rdr);
+  if (optimize) {
+    v = scmopt_optimize(ctx, v);
+  }
+  v = scmevl(ctx, v);
+  if (!SCMVAL_IS_PROCEDURE(v)) {
+    scmerr(SCMERR_WRONG_TYPE, "-e: procedure expected");
+  }
+  return v;
+}
+
+#ifdef TWI_EVAL
+// scmevl_map of the tree-walking interpreter, evaluating (proc (quote v))
+static void
+map(scmctx *ctx, scmval proc, scmval *argv, scmval *out, size_t *i, size_t n)
+{
+  scmval quote = scmspl_intern_symbol(ctx, "quote");
+  scmval form;
+
+  for (; *i < n; (*i)++) {
+    form = SCMVAL_MAKE_LIST(scmval_cons(ctx, argv[*i], SCMVAL_NIL));
+    form = SCMVAL_MAKE_LIST(scmval_cons(ctx, quote, form));
+    form = SCMVAL_MAKE_LIST(scmval_cons(ctx, form, SCMVAL_NIL));
+    out[*i] = scmtwi_eval(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, proc, form)));
+  }
+}
+#endif
+
+// read and evaluate a file, the string form, or standard input for -
+static void
+run(scmctx *ctx, char *source, int form)
+{
+  scmrdr *rdr;
+
+  if (form) {
+    rdr = scmrdr_open_buffer(ctx, source, strlen(source));
+  } else if (!strcmp("-", source)) {
+    rdr = prefetch ? scmrdr_open_prefetch(ctx, NULL) : scmrdr_open_stdin(ctx);
+  } else if (nthreads && (SCMVAL_NIL == record_proc)) {
+    // records are read into the arena of ctx, by this thread
+    rdr = scmrdr_open_parallel(ctx, source, nthreads);
+  } else if (prefetch) {
+    rdr = scmrdr_open_prefetch(ctx, source);
+  } else {
+    rdr = scmrdr_open_file(ctx, source);
+  }
+  if (SCMVAL_NIL != record_proc) {
+    records(ctx, rdr);
+  } else if (optimize && last && (form || strcmp("-", source))) {
+    program(ctx, rdr);
+  } else {
+    repl(ctx, rdr);
+  }
+  scmrdr_close(rdr);
+}
+
+// run the source in a child process, once less than maxjobs are running
+static void
+start(scmctx *ctx, char *source, int form)
+{
+  struct job *job;
+
+  while (nrunning == maxjobs) {
+    reap();
+  }
+  job = &jobs[nstarted];
+  job->name = form ? "-c" : source;
+  job->done = 0;
+  if ((NULL == (job->out = tmpfile())) || (NULL == (job->err = tmpfile()))) {
+    scmerr(SCMERR_SYSCALL, "tmpfile");
+  }
+  (void)fflush(stdout);
+  (void)fflush(stderr);
+  if (-1 == (job->pid = fork())) {
+    scmerr(SCMERR_SYSCALL, "fork");
+  }
+  if (0 == job->pid) {
+    if ((-1 == dup2(fileno(job->out), STDOUT_FILENO)) ||
+	(-1 == dup2(fileno(job->err), STDERR_FILENO))) {
+      scmerr(SCMERR_SYSCALL, "dup2");
+    }
+    run(ctx, source, form);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+  nstarted++;
+  nrunning++;
+}
+
+// wait for a child, then write the output of the sources done in order
+static void
+reap(void)
+{
+  struct job *job;
+  pid_t pid;
+  int status, i;
+
+  if (-1 == (pid = waitpid(-1, &status, 0))) {
+    scmerr(SCMERR_SYSCALL, "waitpid");
+  }
+  for (i=nwritten; i<nstarted; i++) {
+    if (jobs[i].pid == pid) {
+      jobs[i].status = status;
+      jobs[i].done = 1;
+      nrunning--;
+    }
+  }
+  while ((nwritten < nstarted) && jobs[nwritten].done) {
+    job = &jobs[nwritten++];
+    copy(job->out, stdout, NULL);
+    (void)fflush(stdout);
+    copy(job->err, stderr, job->name);
+    if (!WIFEXITED(job->status) || (EXIT_SUCCESS != WEXITSTATUS(job->status))) {
+      if (WIFSIGNALED(job->status)) {
+	fprintf(stderr, "%s: signal %d\n", job->name, WTERMSIG(job->status));
+      }
+      failed = 1;
+    }
+    (void)fclose(job->out);
+    (void)fclose(job->err);
+  }
+}
+
+// write the file from to to, each line after prefix and a colon if any
+static void
+copy(FILE *from, FILE *to, const char *prefix)
+{
+  char buf[BUFSIZ];
+  size_t n;
+  int c, bol = 1;
+
+  rewind(from);
+  if (!prefix) {
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0) {
+      (void)fwrite(buf, 1, n, to);
+    }
+    return;
+  }
+  while (EOF != (c = getc(from))) {
+    if (bol) {
+      fprintf(to, "%s: ", prefix);
+    }
+    (void)putc(c, to);
+    bol = ('\n' == c);
+  }
+}
+
+// seconds of the monotonic clock
+static double
+now(void)
+{
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// add the time since t to phase, the time of its end
+static double
+lap(enum phase phase, double t)
+{
+  double n = now();
+
+  phases[phase] += n - t;
+  return n;
+}
+
+// write the counters of --stats as one json object, on exit or error
+static void
+report(void)
+{
+  scmctx *ctx = stats_ctx;
+  size_t strings, slots;
+  int i;
+
+  if (getpid() != stats_pid) {
+    return;
+  }
+  scmspl_size(ctx, &strings, &slots);
+  fprintf(stderr, "{\"memory\": {\"allocs\": %lu, \"reallocs\": %lu, \"frees\": %lu, "
+	  "\"bytes\": %zu, \"classes\": {",
+	  ctx->mem.allocs, ctx->mem.reallocs, ctx->mem.frees, ctx->mem.bytes);
+  for (i=0; i<SCMMEM_CLASSES; i++) {
+    if (SCMMEM_CLASSES - 1 == i) {
+      fprintf(stderr, "\"more\": ");
+    } else {
+      fprintf(stderr, "\"%d\": ", 16 << i);
+    }
+    fprintf(stderr, "{\"allocs\": %lu, \"bytes\": %zu}%s",
+	    ctx->mem.class_allocs[i], ctx->mem.class_bytes[i],
+	    (SCMMEM_CLASSES - 1 == i) ? "}}, " : ", ");
+  }
+  fprintf(stderr, "\"intern\": {\"lookups\": %lu, \"hits\": %lu, \"probes\": %lu, "
+	  "\"max_probes\": %lu, \"strings\": %zu, \"slots\": %zu}, ",
+	  ctx->splst.lookups, ctx->splst.hits, ctx->splst.probes, ctx->splst.max_probes,
+	  strings, slots);
+  fprintf(stderr, "\"reader\": {\"bytes\": %lu, \"datums\": %lu, \"max_depth\": %lu}, ",
+	  ctx->rdr.bytes, ctx->rdr.datums, ctx->rdr.max_depth);
+  fprintf(stderr, "\"printer\": {\"bytes\": %lu}, ", ctx->prt.bytes);
+  fprintf(stderr, "\"seconds\": {");
+  for (i=0; i<PHASES; i++) {
+    fprintf(stderr, "\"%s\": %.6f, ", phase_names[i], phases[i]);
   }
+  fprintf(stderr, "\"total\": %.6f}}\n", now() - stats_start);
+}
+
+// write the samples of --profile, on exit or error
+static void
+profile(void)
+{
+  if (getpid() != profile_pid) {
+    return;
+  }
+  scmprf_write(profile_fp);
+  (void)fclose(profile_fp);
 }
 
 int
 main(int argc, char **argv)
 {
-  int i;
-  scmrdr *rdr;
+  int i, form;
+  scmctx *ctx;
 
   if (1 == argc) {
     usage();
   }
 
+  ctx = scmctx_new();
+
+  // the optimizer sees the forms before -O too
+  for (i=1; i<argc; i++) {
+    if (!strcmp("-O", argv[i]) || !strcmp("-p", argv[i])) {
+      scanning = 1;
+    }
+  }
+
   for (i=1; i<argc; i++) {
-    if (!strcmp("-", argv[i])) {
-      rdr = scmrdr_open_stdin();
-    } else if (!strcmp("-c", argv[i])) {
+    if (!strcmp("--stats", argv[i])) {
+      if (!stats) {
+	stats = ctx->stats = 1;
+	stats_ctx = ctx;
+	stats_pid = getpid();
+	stats_start = now();
+	(void)atexit(report);
+      }
+      continue;
+    }
+    if (!strncmp("--profile=", argv[i], strlen("--profile="))) {
+      if (profile_fp) {
+	usage();
+      }
+      if (NULL == (profile_fp = fopen(argv[i] + strlen("--profile="), "w"))) {
+	scmerr(SCMERR_SYSCALL, "%s", argv[i] + strlen("--profile="));
+      }
+      profile_pid = getpid();
+      (void)atexit(profile);
+      scmrdr_track(ctx);
+      scmprf_start(PROFILE_HZ);
+      continue;
+    }
+    if (!strcmp("-d", argv[i])) {
+      scmevl_set_listing(ctx, stdout);
+      continue;
+    }
+    if (!strcmp("-O", argv[i])) {
+      optimize = 1;
+      continue;
+    }
+    if (!strcmp("-p", argv[i])) {
+      optimize = 1;
+      print_optimized = 1;
+      continue;
+    }
+    if (!strcmp("-a", argv[i])) {
+      prefetch = 1;
+      continue;
+    }
+    if (!strcmp("-k", argv[i])) {
+      keep_going = 1;
+      continue;
+    }
+    if (!strcmp("-e", argv[i])) {
+      i++;
+      if (i == argc) {
+	usage();
+      }
+      record_proc = procedure(ctx, argv[i]);
+      continue;
+    }
+    if (!strcmp("-t", argv[i])) {
+      i++;
+      if ((i == argc) || ((nthreads = atoi(argv[i])) < 1)) {
+	usage();
+      }
+      scmevl_set_workers(ctx, nthreads);
+      continue;
+    }
+    if (!strcmp("-j", argv[i])) {
+      i++;
+      if ((i == argc) || ((maxjobs = atoi(argv[i])) < 1)) {
+	usage();
+      }
+      if (!jobs) {
+	jobs = scmmem_alloc(ctx, argc, sizeof(struct job));
+      }
+      continue;
+    }
+    form = 0;
+    if (!strcmp("-c", argv[i])) {
       i++;
       if (i == argc) {
 	usage();
       }
-      rdr = scmrdr_open_buffer(argv[i], strlen(argv[i]) + 1);
+      form = 1;
+    }
+    last = (i == argc - 1);
+    if (maxjobs) {
+      start(ctx, argv[i], form);
     } else {
-      rdr = scmrdr_open_file(argv[i]);
+      run(ctx, argv[i], form);
     }
-    repl(rdr);
- 
-    scmrdr_close(rdr);
   }
+
+  while (nrunning > 0) {
+    reap();
+  }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
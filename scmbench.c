@@ -0,0 +1,461 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+
+scmbench measures the reader, the intern pool and the printer on
+synthetic corpora generated in memory, the same for every run:
+
+  nested    lists nested 200 deep
+  wide      lists of 1000 short symbols
+  symbols   lists of distinct symbols
+  strings   strings of 200 bytes
+  integers  lists of large integers
+
+each benchmark is run once to warm up, then timed runs times. the output
+is one json object per line and benchmark:
+
+  {"bench":"read","corpus":"nested","bytes":...,"items":...,"runs":5,
+   "min_s":...,"median_s":...,"mb_s":...,"items_s":...,"allocs_per_item":...}
+
+bytes are read, printed or interned per run, items are the datums read or
+printed, or the names interned. mb_s and items_s are of the fastest run.
+
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scmerr.h"
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmspl.h"
+#include "scmrdr.h"
+#include "scmprt.h"
+
+// Implementation limits:
+#define MAXRUNS      100
+#define NNAMES       (1 << 17)  // names interned by the intern benchmarks
+
+// a generated corpus
+struct corpus {
+  const char *name;
+  void (*gen)(FILE *fp, uint64_t *seed);        // writes one datum
+  char *buf;
+  size_t size;
+};
+
+// a timed benchmark
+struct bench {
+  const char *name;
+  const char *corpus;
+  size_t bytes;
+  size_t items;
+  double t[MAXRUNS];
+  unsigned long allocs;         // of the last run
+};
+
+static _Noreturn void usage(void);
+static uint64_t rnd(uint64_t *seed);
+static void gen_nested(FILE *fp, uint64_t *seed);
+static void gen_wide(FILE *fp, uint64_t *seed);
+static void gen_symbols(FILE *fp, uint64_t *seed);
+static void gen_strings(FILE *fp, uint64_t *seed);
+static void gen_integers(FILE *fp, uint64_t *seed);
+static void generate(struct corpus *c, size_t size);
+static double now(void);
+static void release(scmctx *ctx, scmval v);
+static void report(struct bench *b);
+static void bench_read(struct corpus *c);
+static void bench_print(struct corpus *c);
+static void bench_intern(void);
+static int cmp(const void *a, const void *b);
+
+static int runs = 5;
+
+static struct corpus corpora[] = {
+  { "nested", gen_nested, NULL, 0 },
+  { "wide", gen_wide, NULL, 0 },
+  { "symbols", gen_symbols, NULL, 0 },
+  { "strings", gen_strings, NULL, 0 },
+  { "integers", gen_integers, NULL, 0 },
+};
+#define NCORPORA (sizeof(corpora) / sizeof(corpora[0]))
+
+static _Noreturn void
+usage(void)
+{
+  fputs("synopsis:\n"
+	"  scmbench [ -n runs ] [ -s kbytes ]\n"
+	"\n"
+	"    -n runs    times each benchmark runs times, 5 by default.\n"
+	"    -s kbytes  generates corpora of about kbytes, 4096 by default.\n"
+	"\n", stderr);
+
+  exit(EXIT_FAILURE);
+}
+
+// xorshift64*
+static uint64_t
+rnd(uint64_t *seed)
+{
+  *seed ^= *seed >> 12;
+  *seed ^= *seed << 25;
+  *seed ^= *seed >> 27;
+  return *seed * UINT64_C(2685821657736338717);
+}
+
+static void
+gen_nested(FILE *fp, uint64_t *seed)
+{
+  int i, depth = 200;
+
+  for (i=0; i<depth; i++) {
+    fprintf(fp, "(n%i ", (int)(rnd(seed) % 8));
+  }
+  for (i=0; i<depth; i++) {
+    fputc(')', fp);
+  }
+  fputc('\n', fp);
+}
+
+static void
+gen_wide(FILE *fp, uint64_t *seed)
+{
+  int i;
+
+  fputc('(', fp);
+  for (i=0; i<1000; i++) {
+    fprintf(fp, "%s%c", i ? " " : "", 'a' + (int)(rnd(seed) % 26));
+  }
+  fputs(")\n", fp);
+}
+
+static void
+gen_symbols(FILE *fp, uint64_t *seed)
+{
+  int i;
+
+  fputc('(', fp);
+  for (i=0; i<16; i++) {
+    fprintf(fp, "%ssym-%016llx", i ? " " : "", (unsigned long long)rnd(seed));
+  }
+  fputs(")\n", fp);
+}
+
+// the reader keeps strings below 256 bytes
+static void
+gen_strings(FILE *fp, uint64_t *seed)
+{
+  int i;
+
+  static const char chars[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 .,;:-+*/()";
+
+  fputc('"', fp);
+  for (i=0; i<200; i++) {
+    fputc(chars[rnd(seed) % (sizeof(chars) - 1)], fp);
+  }
+  fputs("\"\n", fp);
+}
+
+static void
+gen_integers(FILE *fp, uint64_t *seed)
+{
+  int i;
+
+  fputc('(', fp);
+  for (i=0; i<64; i++) {
+    fprintf(fp, "%s%lli", i ? " " : "",
+	    (long long)(rnd(seed) % (UINT64_C(1) << 50)) - (INT64_C(1) << 49));
+  }
+  fputs(")\n", fp);
+}
+
+// a corpus of at least size bytes, the same for each run of scmbench
+static void
+generate(struct corpus *c, size_t size)
+{
+  uint64_t seed = UINT64_C(0x9e3779b97f4a7c15);
+  FILE *fp;
+
+  if (NULL == (fp = open_memstream(&c->buf, &c->size))) {
+    scmerr(SCMERR_SYSCALL, "open_memstream");
+  }
+  while ((size_t)ftell(fp) < size) {
+    c->gen(fp, &seed);
+  }
+  if (fclose(fp)) {
+    scmerr(SCMERR_SYSCALL, "fclose");
+  }
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// the cons cells of a datum, interned strings belong to the pool
+static void
+release(scmctx *ctx, scmval v)
+{
+  scmval cell, next;
+
+  while (SCMVAL_IS_LIST(v)) {
+    next = SCMVAL_CDR(v);
+    release(ctx, SCMVAL_CAR(v));
+    cell = SCMVAL_TO_LIST(v);
+    scmmem_free(ctx, (void **)&cell);
+    v = next;
+  }
+}
+
+static int
+cmp(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+report(struct bench *b)
+{
+  double min, median;
+
+  qsort(b->t, runs, sizeof(double), cmp);
+  min = b->t[0];
+  median = (runs % 2) ? b->t[runs / 2] : (b->t[runs / 2 - 1] + b->t[runs / 2]) / 2;
+  if (min <= 0) {
+    min = 1e-9;
+  }
+  printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"bytes\":%zu,\"items\":%zu,\"runs\":%i,"
+	 "\"min_s\":%.6f,\"median_s\":%.6f,\"mb_s\":%.2f,\"items_s\":%.0f,"
+	 "\"allocs_per_item\":%.3f}\n",
+	 b->name, b->corpus, b->bytes, b->items, runs, min, median,
+	 b->bytes / min / 1e6, b->items / min,
+	 b->items ? (double)b->allocs / b->items : 0.0);
+  (void)fflush(stdout);
+}
+
+// scmrdr_read of the whole corpus into a fresh context, interning included
+static void
+bench_read(struct corpus *c)
+{
+  struct bench b = { "read", c->name, c->size, 0, { 0 }, 0 };
+  scmval v, *vals = NULL;
+  size_t n, a = 0;
+  scmctx *ctx;
+  scmrdr *rdr;
+  unsigned long allocs;
+  double t;
+  int run;
+
+  for (run = -1; run < runs; run++) {
+    ctx = scmctx_new();
+    rdr = scmrdr_open_buffer(ctx, c->buf, c->size);
+    allocs = ctx->mem.allocs;
+    n = 0;
+    t = now();
+    while (SCMVAL_EOF != (v = scmrdr_read(rdr))) {
+      if (n == a) {
+	a = a ? 2 * a : 1024;
+	if (NULL == (vals = realloc(vals, a * sizeof(scmval)))) {
+	  scmerr(SCMERR_SYSCALL, "realloc");
+	}
+      }
+      vals[n++] = v;
+    }
+    t = now() - t;
+    if (run >= 0) {
+      b.t[run] = t;
+    }
+    b.items = n;
+    b.allocs = ctx->mem.allocs - allocs;
+    while (n > 0) {
+      release(ctx, vals[--n]);
+    }
+    scmrdr_close(rdr);
+    scmctx_free(ctx);
+  }
+  free(vals);
+  report(&b);
+}
+
+// scmprt_print of the datums of the corpus to memory
+static void
+bench_print(struct corpus *c)
+{
+  struct bench b = { "print", c->name, 0, 0, { 0 }, 0 };
+  scmctx *ctx = scmctx_new();
+  scmrdr *rdr = scmrdr_open_buffer(ctx, c->buf, c->size);
+  scmval v, *vals = NULL;
+  size_t n = 0, a = 0, i, size;
+  unsigned long allocs;
+  char *out = NULL;
+  double t;
+  int run;
+
+  while (SCMVAL_EOF != (v = scmrdr_read(rdr))) {
+    if (n == a) {
+      a = a ? 2 * a : 1024;
+      if (NULL == (vals = realloc(vals, a * sizeof(scmval)))) {
+	scmerr(SCMERR_SYSCALL, "realloc");
+      }
+    }
+    vals[n++] = v;
+  }
+  scmrdr_close(rdr);
+
+  for (run = -1; run < runs; run++) {
+    if (NULL == (ctx->out = open_memstream(&out, &size))) {
+      scmerr(SCMERR_SYSCALL, "open_memstream");
+    }
+    allocs = ctx->mem.allocs;
+    t = now();
+    for (i=0; i<n; i++) {
+      scmprt_print(ctx, vals[i]);
+    }
+    (void)fflush(ctx->out);
+    t = now() - t;
+    if (run >= 0) {
+      b.t[run] = t;
+    }
+    b.allocs = ctx->mem.allocs - allocs;
+    b.bytes = size;
+    (void)fclose(ctx->out);
+    free(out);
+  }
+  b.items = n;
+  ctx->out = stdout;
+  for (i=0; i<n; i++) {
+    release(ctx, vals[i]);
+  }
+  free(vals);
+  scmctx_free(ctx);
+  report(&b);
+}
+
+/*
+ * scmspl_intern_symbol and scmspl_intern_string of distinct names into a
+ * fresh pool, then of the same names again, found in the pool.
+ */
+static void
+bench_intern(void)
+{
+  struct bench insert = { "intern", "symbols-new", 0, NNAMES, { 0 }, 0 };
+  struct bench hit = { "intern", "symbols-found", 0, NNAMES, { 0 }, 0 };
+  struct bench str = { "intern", "strings-new", 0, NNAMES, { 0 }, 0 };
+  uint64_t seed = UINT64_C(0x2545f4914f6cdd1d);
+  char (*names)[32];
+  size_t i, bytes = 0;
+  unsigned long allocs;
+  scmctx *ctx;
+  double t;
+  int run;
+
+  if (NULL == (names = malloc(NNAMES * sizeof(*names)))) {
+    scmerr(SCMERR_SYSCALL, "malloc");
+  }
+  for (i=0; i<NNAMES; i++) {
+    bytes += snprintf(names[i], sizeof(*names), "name-%llx", (unsigned long long)rnd(&seed));
+  }
+  insert.bytes = hit.bytes = str.bytes = bytes;
+
+  for (run = -1; run < runs; run++) {
+    ctx = scmctx_new();
+    allocs = ctx->mem.allocs;
+    t = now();
+    for (i=0; i<NNAMES; i++) {
+      (void)scmspl_intern_symbol(ctx, names[i]);
+    }
+    t = now() - t;
+    if (run >= 0) {
+      insert.t[run] = t;
+    }
+    insert.allocs = ctx->mem.allocs - allocs;
+
+    allocs = ctx->mem.allocs;
+    t = now();
+    for (i=0; i<NNAMES; i++) {
+      (void)scmspl_intern_symbol(ctx, names[i]);
+    }
+    t = now() - t;
+    if (run >= 0) {
+      hit.t[run] = t;
+    }
+    hit.allocs = ctx->mem.allocs - allocs;
+    scmctx_free(ctx);
+
+    ctx = scmctx_new();
+    allocs = ctx->mem.allocs;
+    t = now();
+    for (i=0; i<NNAMES; i++) {
+      (void)scmspl_intern_string(ctx, names[i]);
+    }
+    t = now() - t;
+    if (run >= 0) {
+      str.t[run] = t;
+    }
+    str.allocs = ctx->mem.allocs - allocs;
+    scmctx_free(ctx);
+  }
+  free(names);
+  report(&insert);
+  report(&hit);
+  report(&str);
+}
+
+int
+main(int argc, char *argv[])
+{
+  size_t size = 4096;
+  size_t i;
+  int j;
+
+  for (j=1; j<argc; j++) {
+    if (!strcmp("-n", argv[j]) && (j + 1 < argc)) {
+      runs = atoi(argv[++j]);
+      if ((runs < 1) || (runs > MAXRUNS)) {
+	usage();
+      }
+    } else if (!strcmp("-s", argv[j]) && (j + 1 < argc)) {
+      if (0 == (size = strtoul(argv[++j], NULL, 10))) {
+	usage();
+      }
+    } else {
+      usage();
+    }
+  }
+
+  for (i=0; i<NCORPORA; i++) {
+    generate(&corpora[i], size * 1024);
+    bench_read(&corpora[i]);
+    bench_print(&corpora[i]);
+    free(corpora[i].buf);
+  }
+  bench_intern();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "scmerr.h"
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmrdr.h"
+#include "scmopt.h"
+#include "scmgen.h"
+
+// directory of the headers and libscm.a, $SCMC_HOME overrides it
+#ifndef SCMC_HOME
+#define SCMC_HOME "."
+#endif
+
+extern char **environ;
+
+/* static prototypes */
+static _Noreturn void usage(void);
+static void compile(scmctx *ctx, scmrdr *rdr);
+static void generate(scmctx *ctx);
+static void build(scmctx *ctx, const char *out);
+
+static int optimize = 0;
+
+// the forms of all sources, generated once the optimizer has seen them all
+static scmval forms = SCMVAL_NIL;
+static scmval *tail = &forms;
+static size_t nforms = 0;
+static size_t noptimized = 0;   // forms read before -O
+
+static _Noreturn void
+usage(void)
+{
+  fputs("synopsis:\n"
+	"  scmc [ -O ] [ -S ] [ -o out ] [ - | -c form | file ] ...\n"
+	"\n"
+	"    -O         optimizes each following form, like scm -O. all sources\n"
+	"               are read before the first form is compiled.\n"
+	"    -S         writes the c program instead of an executable.\n"
+	"    -o out     names the output, a.out or standard output for -S.\n"
+	"    -          reads from standard input.\n"
+	"    -c form    reads from the string form.\n"
+	"    file       reads from the file.\n"
+	"\n"
+	"  the program runs the forms of all sources in order, like scm.\n"
+	"  $SCMC_CC is the c compiler, cc by default.\n"
+	"\n", stderr);
+
+  exit(EXIT_FAILURE);
+}
+
+// read the forms of rdr
+static void
+compile(scmctx *ctx, scmrdr *rdr)
+{
+  scmval v;
+
+  for(;;) {
+    v = scmrdr_read(rdr);
+    if (SCMVAL_EOF == v) {
+      break;
+    }
+    *tail = SCMVAL_MAKE_LIST(scmval_cons(ctx, v, SCMVAL_NIL));
+    tail = &SCMVAL_CDR(*tail);
+    nforms++;
+  }
+}
+
+// generate the forms read, optimized from -O on in the sealed program
+static void
+generate(scmctx *ctx)
+{
+  scmval l, v;
+  size_t i;
+
+  if (optimize) {
+    for (l = forms; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+      scmopt_scan(ctx, SCMVAL_CAR(l));
+    }
+    scmopt_seal(ctx);
+  }
+  for (i = 0, l = forms; SCMVAL_NIL != l; i++, l = SCMVAL_CDR(l)) {
+    v = SCMVAL_CAR(l);
+    if (optimize && (i >= noptimized)) {
+      v = scmopt_optimize(ctx, v);
+    }
+    scmgen_form(v);
+  }
+}
+
+// compile the c program and link it with the runtime into out
+static void
+build(scmctx *ctx, const char *out)
+{
+  char path[] = "/tmp/scmcXXXXXX";
+  const char *cc = getenv("SCMC_CC");
+  const char *home = getenv("SCMC_HOME");
+  char *lib;
+  char *args[14];
+  FILE *fp;
+  pid_t pid;
+  int fd, status, err;
+
+  if (!cc) {
+    cc = "cc";
+  }
+  if (!home) {
+    home = SCMC_HOME;
+  }
+  if (-1 == (fd = mkstemp(path))) {
+    scmerr(SCMERR_SYSCALL, "mkstemp(%s)", path);
+  }
+  if (NULL == (fp = fdopen(fd, "w"))) {
+    scmerr(SCMERR_SYSCALL, "fdopen(%s)", path);
+  }
+  scmgen_write(fp);
+  if (fclose(fp)) {
+    scmerr(SCMERR_SYSCALL, "fclose(%s)", path);
+  }
+
+  lib = scmmem_alloc(ctx, strlen(home) + sizeof("/libscm.a"), 1);
+  strcpy(lib, home);
+  strcat(lib, "/libscm.a");
+  args[0] = (char *)(uintptr_t)cc;
+  args[1] = "-O2";
+  args[2] = "-I";
+  args[3] = (char *)(uintptr_t)home;
+  args[4] = "-o";
+  args[5] = (char *)(uintptr_t)out;
+  args[6] = "-x";
+  args[7] = "c";
+  args[8] = path;
+  args[9] = "-x";
+  args[10] = "none";
+  args[11] = lib;
+  args[12] = "-pthread";
+  args[13] = NULL;
+
+  if (0 != (err = posix_spawnp(&pid, cc, NULL, NULL, args, environ))) {
+    errno = err;
+    (void)unlink(path);
+    scmerr(SCMERR_SYSCALL, "%s", cc);
+  }
+  if (-1 == waitpid(pid, &status, 0)) {
+    scmerr(SCMERR_SYSCALL, "waitpid");
+  }
+  (void)unlink(path);
+  scmmem_free(ctx, (void **)&lib);
+  if (!WIFEXITED(status) || (EXIT_SUCCESS != WEXITSTATUS(status))) {
+    fprintf(stderr, "scmc: %s failed\n", cc);
+    exit(EXIT_FAILURE);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *out = NULL;
+  int assemble = 0;
+  int sources = 0;
+  int i;
+  scmctx *ctx;
+  scmrdr *rdr;
+  FILE *fp;
+
+  if (1 == argc) {
+    usage();
+  }
+
+  ctx = scmctx_new();
+  scmgen_begin(ctx);
+  for (i=1; i<argc; i++) {
+    if (!strcmp("-O", argv[i])) {
+      if (!optimize) {
+	optimize = 1;
+	noptimized = nforms;
+      }
+      continue;
+    }
+    if (!strcmp("-S", argv[i])) {
+      assemble = 1;
+      continue;
+    }
+    if (!strcmp("-o", argv[i])) {
+      i++;
+      if (i == argc) {
+	usage();
+      }
+      out = argv[i];
+      continue;
+    }
+    if (!strcmp("-", argv[i])) {
+      rdr = scmrdr_open_stdin(ctx);
+    } else if (!strcmp("-c", argv[i])) {
+      i++;
+      if (i == argc) {
+	usage();
+      }
+      rdr = scmrdr_open_buffer(ctx, argv[i], strlen(argv[i]));
+    } else {
+      rdr = scmrdr_open_file(ctx, argv[i]);
+    }
+    compile(ctx, rdr);
+    scmrdr_close(rdr);
+    sources++;
+  }
+  if (0 == sources) {
+    usage();
+  }
+  generate(ctx);
+
+  if (!assemble) {
+    build(ctx, out ? out : "a.out");
+  } else if (!out) {
+    scmgen_write(stdout);
+  } else {
+    if (NULL == (fp = fopen(out, "w"))) {
+      scmerr(SCMERR_SYSCALL, "fopen(%s)", out);
+    }
+    scmgen_write(fp);
+    if (fclose(fp)) {
+      scmerr(SCMERR_SYSCALL, "fclose(%s)", out);
+    }
+  }
+  return EXIT_SUCCESS;
+}
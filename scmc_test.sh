@@ -0,0 +1,107 @@
+#!/bin/sh
+#
+# compiler test, a program compiled by scmc must print the same values
+# and errors and exit with the same status as scm running it
+#
+
+BIN=$(mktemp)
+trap 'rm -f ${BIN}' EXIT
+
+_test_scmc() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _flags=$4
+    local _expected
+
+    echo [TEST] $_desc >&2
+
+    _expected=$(scm ${_flags} -c "${_input}" 2>&1; echo "status $?")
+    if ! scmc ${_flags} -o ${BIN} -c "${_input}" 2>/dev/null; then
+	echo "not ok $_num - compilation failed $_desc [scmc]"
+	return
+    fi
+    OUTPUT=$(${BIN} 2>&1; echo "status $?")
+    if [ X"${OUTPUT}" != X"${_expected}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [scmc]"
+    else
+	echo "ok $_num - $_desc [scmc]"
+    fi
+}
+
+# a program scmc cannot compile the way scm runs it, scmc must fail
+# with the error expected
+_test_rejected() {
+    local _num=$1
+    local _desc=$2
+    local _input=$3
+    local _exp_error=$4
+
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(scmc -o ${BIN} -c "${_input}" 2>&1 >/dev/null)
+    STATUS=$?
+    if [ X"${STATUS}" != X"1" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [scmc]"
+    elif [ X"${OUTPUT}" != X"${_exp_error}" ] ; then
+	echo "not ok $_num - unexpected error [${OUTPUT}] $_desc [scmc]"
+    else
+	echo "ok $_num - $_desc [scmc]"
+    fi
+}
+
+
+echo "1..41"
+
+_test_scmc 1 constants "23 \"hello\" (quote abc) (quote (1 (\"s\" b) . 2)) nil true false"
+_test_scmc 2 arith "(+ 1 2 3) (- 10 4 3) (- 5) (* 2 3 4) (< 1 2 3) (= 1 2) (<= 2 2) (>= 1 2) (> 3 2)"
+_test_scmc 3 if "(if (< 1 2) (quote yes) (quote no)) (if false 1)"
+_test_scmc 4 define "(define x 42) x (define (f) x) f (define g (lambda () 1)) g (lambda (y) y)"
+_test_scmc 5 closure "(define (adder n) (lambda (x) (+ x n))) ((adder 3) 4)"
+_test_scmc 6 set "((lambda (x) (set! x 3) x) 1) (define x 1) (set! x (+ x 1)) x"
+_test_scmc 7 internal_define "(define (f) (define a 5) (define (g) (* a 2)) (g)) (f)"
+_test_scmc 8 let "(let ((x 1) (y 2)) (+ x y)) (define (f x) (let ((x (+ x 1)) (y x)) (list x y))) (f 1)"
+_test_scmc 9 fib "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2))))) (fib 20)"
+_test_scmc 10 lists "(car (cdr (cons 1 (list 2 3)))) (null? nil) (pair? 1) (eq? (quote a) (quote a)) (not 1)"
+_test_scmc 11 begin "(begin 1 2 3) (begin)"
+_test_scmc 12 shadowing "(define x 1) (define (f x) (lambda () (let ((y x) (x 3)) (+ x y)))) ((f 2))"
+_test_scmc 13 forward_global "(define (g) (h)) (define (h) 5) (g)"
+_test_scmc 14 captured_frames "(define (mk n acc) (if (= n 0) acc (mk (- n 1) (cons (lambda () n) acc)))) ((car (mk 3 nil)))"
+_test_scmc 15 shared_box "(define (mk) (let ((n 0)) (list (lambda () (set! n (+ n 1)) n) (lambda () n)))) (define p (mk)) ((car p)) ((car p)) ((car (cdr p)))"
+_test_scmc 16 internal_mutual "(define (f n) (define (ev? k) (if (= k 0) true (od? (- k 1)))) (define (od? k) (if (= k 0) false (ev? (- k 1)))) (ev? n)) (f 10)"
+_test_scmc 17 assigned_param "(define (f x) (let ((g (lambda () x))) (set! x 5) (g))) (f 1)"
+_test_scmc 18 lambda_applied "((lambda (x y) (+ x y)) 3 4) (define (f n) ((lambda (k) (define (h) k) (h)) n)) (f 9)"
+_test_scmc 19 redefined "(define (f) 1) (define (g) (f)) (g) (define (f) 2) (g) (define (g x) (car x)) (define (car x) 7) (g 1)"
+_test_scmc 20 redefined_operator "(define (f a b) (+ a b)) (f 3 4) (define (+ a b) (* a b)) (f 3 4)"
+_test_scmc 21 macro "(define-macro (unless c a b) (list (quote if) c b a)) (unless false 1 2) (define-macro (m x) x) (define (f m) (m 3)) (f (lambda (y) (+ y 1)))"
+_test_scmc 22 self_loop "(define (loop n acc) (let ((m (- n 1))) (if (< m 0) acc (loop m (+ acc 2))))) (loop 100000 0)"
+
+# proper tail calls
+_test_scmc 23 tail_loop_100M "(define (loop n) (if (= n 0) (quote done) (loop (- n 1)))) (loop 100000000)"
+_test_scmc 24 tail_mutual "(define (even? n) (if (= n 0) true (odd? (- n 1)))) (define (odd? n) (if (= n 0) false (even? (- n 1)))) (even? 1000001)"
+_test_scmc 25 tail_closure "(define (f k n) (if (= n 0) (k 0) (f (lambda (v) (k (+ v 1))) (- n 1)))) (f (lambda (v) v) 10000)"
+
+# errors, after the values of the forms before
+_test_scmc 26 unbound "1 (+ y 1) 2"
+_test_scmc 27 arity "1 ((lambda (x) x))"
+_test_scmc 28 not_a_procedure "1 (1 2)"
+_test_scmc 29 overflow "1 (* 288230376151711743 2)"
+_test_scmc 30 bad_syntax "1 (if) 2"
+_test_scmc 31 unbound_set "(set! undefined-variable 1)"
+_test_scmc 32 operator_type "(define (f a b) (< a b)) (f 1 (quote a))"
+_test_scmc 33 deep_recursion "(define (f n) (if (= n 0) 0 (+ 1 (f (- n 1))))) (f 10000) (f 1000000)"
+_test_scmc 34 unbound_internal "(define (f) (g) (define (g) 1)) (f)"
+_test_scmc 35 macro_not_toplevel "(let ((a 1)) (define-macro (m) 1))"
+
+# scmc -O compiles the optimized forms
+_test_scmc 36 optimized "(define (sq x) (* x x)) (define (f y) (+ (sq y) (* 60 60))) (f 3)" -O
+
+# pmap and pfor-each of the runtime map sequentially
+_test_scmc 37 pmap "(car (cdr (pmap (lambda (x) (+ x 1)) (list 1 2 3)))) (define n 0) (pfor-each (lambda (x) (set! n (+ n x))) (list 1 2 3)) n"
+_test_scmc 38 pmap_errors "(pmap car 5) (pmap (lambda (x) (if (= x 3) (car x) x)) (list 1 2 3 4))"
+
+# macros are expanded once at compile time, programs that would expand
+# differently at run time are rejected
+_test_rejected 39 macro_redefined "(define-macro (w v) v) (define (mk x) (w x)) (define-macro (w v) 1) (mk 2)" "error-008: bad syntax: define-macro: w redefined after it was expanded at compile time"
+_test_rejected 40 macro_global "(define n 0) (define-macro (m) (set! n (+ n 1)) n) (m)" "error-008: bad syntax: define-macro: m refers to the global n of the program, transformers run at compile time"
+_test_rejected 41 macro_primitive_written "(define-macro (m x) (list (quote quote) (car x))) (define (car x) 7) (m (1))" "error-008: bad syntax: car: written by the program, but a macro expanded at compile time refers to it"
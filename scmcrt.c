@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>   /* errno */
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmprm.h"
+#include "scmcrt.h"
+
+int scmcrt_depth = 0;
+scmctx *scmcrt_ctx = NULL;
+
+// the tail call a native procedure returned SCMCRT_TAILCALL for
+static struct {
+  scmval proc;
+  int argc;
+  scmval argv[SCMCRT_MAXARGS];
+} _scmcrt_pending;
+
+// globals of the program being initialized
+static struct scmcrt_global *_scmcrt_globals;
+static size_t _scmcrt_nglobals;
+
+/* inlined */
+extern scmval scmcrt_call(scmval proc, int argc, scmval *argv);
+
+/* static prototypes */
+static void _scmcrt_define_primitive(scmctx *ctx, const char *name, scmval proc);
+static void _scmcrt_mappable(scmval proc, scmval l, const char *name);
+static scmval _scmcrt_pmap(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmcrt_pfor_each(scmctx *ctx, int argc, scmval *argv);
+
+
+// create the context, bind the globals named like a primitive to the primitive
+void
+scmcrt_init(struct scmcrt_global *globals, size_t nglobals)
+{
+  scmcrt_ctx = scmctx_new();
+  _scmcrt_globals = globals;
+  _scmcrt_nglobals = nglobals;
+  scmprm_define_all(scmcrt_ctx, _scmcrt_define_primitive);
+  _scmcrt_define_primitive(scmcrt_ctx, "pmap",
+			   scmprm_make(scmcrt_ctx, "pmap", _scmcrt_pmap, 2));
+  _scmcrt_define_primitive(scmcrt_ctx, "pfor-each",
+			   scmprm_make(scmcrt_ctx, "pfor-each", _scmcrt_pfor_each, 2));
+}
+
+static void
+_scmcrt_define_primitive(scmctx *ctx, const char *name, scmval proc)
+{
+  size_t i;
+
+  for (i=0; i<_scmcrt_nglobals; i++) {
+    if (!strcmp(name, _scmcrt_globals[i].name)) {
+      *_scmcrt_globals[i].val = proc;
+    }
+  }
+}
+
+// proc and l of (name proc l) are checked before the first call, like scmevl does
+static void
+_scmcrt_mappable(scmval proc, scmval l, const char *name)
+{
+  for (; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+  }
+  if (SCMVAL_NIL != l) {
+    scmerr(SCMERR_WRONG_TYPE, "%s: list expected", name);
+  }
+  if (!SCMVAL_IS_PROCEDURE(proc)) {
+    scmerr(SCMERR_WRONG_TYPE, "procedure expected");
+  }
+}
+
+// (pmap proc list) of a compiled program, a sequential map
+static scmval
+_scmcrt_pmap(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval head = SCMVAL_NIL, tail = SCMVAL_NIL, cell, l;
+
+  _scmcrt_mappable(argv[0], argv[1], "pmap");
+  for (l = argv[1]; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    cell = SCMVAL_MAKE_LIST(scmval_cons(ctx, scmcrt_apply(argv[0], 1, &SCMVAL_CAR(l)),
+					SCMVAL_NIL));
+    if (SCMVAL_NIL == head) {
+      head = cell;
+    } else {
+      SCMVAL_CDR(tail) = cell;
+    }
+    tail = cell;
+  }
+  return head;
+}
+
+// (pfor-each proc list) of a compiled program
+static scmval
+_scmcrt_pfor_each(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval l;
+
+  _scmcrt_mappable(argv[0], argv[1], "pfor-each");
+  for (l = argv[1]; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    (void)scmcrt_apply(argv[0], 1, &SCMVAL_CAR(l));
+  }
+  return SCMVAL_NIL;
+}
+
+// allocate a native procedure with room for nfree free variables
+struct _scmprc *
+scmcrt_closure(const char *name, scmprc_native_fn fn, int arity, int nfree)
+{
+  struct _scmprc *prc = scmmem_alloc(scmcrt_ctx, 1, sizeof(struct _scmprc) + nfree * sizeof(scmval));
+
+  prc->type = SCMPRC_NATIVE;
+  prc->name = name;
+  prc->u.nat.fn = fn;
+  prc->u.nat.arity = arity;
+  prc->u.nat.free = (scmval *)(prc + 1);
+  return prc;
+}
+
+/*
+ * call any procedure, with the checks and errors of the vm of scmevl. the
+ * tail calls of a native procedure are made here, in a loop.
+ */
+scmval
+scmcrt_apply(scmval proc, int argc, scmval *argv)
+{
+  struct _scmprc *prc;
+  scmval v;
+
+  for (;;) {
+    if (!SCMVAL_IS_PROCEDURE(proc)) {
+      scmerr(SCMERR_WRONG_TYPE, "procedure expected");
+    }
+    prc = SCMVAL_TO_PROCEDURE(proc);
+    switch (prc->type) {
+    case SCMPRC_PRIMITIVE:
+      if ((prc->u.prim.arity >= 0) && (prc->u.prim.arity != argc)) {
+	scmerr(SCMERR_WRONG_ARITY, "%s", prc->name);
+      }
+      return prc->u.prim.fn(scmcrt_ctx, argc, argv);
+    case SCMPRC_NATIVE:
+      if (prc->u.nat.arity != argc) {
+	scmerr(SCMERR_WRONG_ARITY, "%s", prc->name ? prc->name : "lambda");
+      }
+      break;
+    default:
+      scmerr(SCMERR_WRONG_TYPE, "procedure of another interpreter");
+    }
+
+    if (scmcrt_depth == SCMCRT_FRAMES) {
+      scmerr(SCMERR_STACK_OVERFLOW, "%s", prc->name ? prc->name : "lambda");
+    }
+    scmcrt_depth++;
+    v = prc->u.nat.fn(prc, argv);
+    scmcrt_depth--;
+    if (SCMCRT_TAILCALL != v) {
+      return v;
+    }
+    proc = _scmcrt_pending.proc;
+    argc = _scmcrt_pending.argc;
+    argv = _scmcrt_pending.argv;
+  }
+}
+
+// call the operator bound to the global g with two arguments
+scmval
+scmcrt_call2(scmval g, const char *name, scmval a, scmval b)
+{
+  scmval argv[2];
+
+  argv[0] = a;
+  argv[1] = b;
+  return scmcrt_apply(SCMCRT_REF(g, name), 2, argv);
+}
+
+/*
+ * leave the call of proc to the caller, the value of a tail call. the
+ * arguments are copied, the frame of the caller is gone when the call
+ * is made. a primitive runs in constant stack, it is called right away.
+ */
+scmval
+scmcrt_tail(scmval proc, int argc, scmval *argv)
+{
+  struct _scmprc *prc = SCMVAL_TO_PROCEDURE(proc);
+
+  if (SCMVAL_IS_PROCEDURE(proc) && (SCMPRC_PRIMITIVE == prc->type)) {
+    return scmcrt_apply(proc, argc, argv);
+  }
+  _scmcrt_pending.proc = proc;
+  _scmcrt_pending.argc = argc;
+  if (argc > 0) {
+    memcpy(_scmcrt_pending.argv, argv, argc * sizeof(scmval));
+  }
+  return SCMCRT_TAILCALL;
+}
+
+// the value of a top-level form, making its pending tail call
+scmval
+scmcrt_run(scmval v)
+{
+  if (SCMCRT_TAILCALL != v) {
+    return v;
+  }
+  return scmcrt_apply(_scmcrt_pending.proc, _scmcrt_pending.argc, _scmcrt_pending.argv);
+}
+
+_Noreturn void
+scmcrt_unbound(const char *name)
+{
+  scmerr(SCMERR_UNBOUND_VARIABLE, "%s", name);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCMCRT_H
+#define _SCMCRT_H
+
+/*
+
+scmcrt is the runtime of programs compiled to c by scmc, see scmgen.
+
+  - each lambda is a c function of its closure and an argument vector,
+    see scmprc_native_fn. it copies its arguments into locals before it
+    does anything else.
+  - a call in tail position hands the call to scmcrt_tail and returns
+    SCMCRT_TAILCALL, the caller in scmcrt_call makes the call. tail
+    recursive loops run in constant c stack.
+  - calls nest at most SCMCRT_FRAMES deep, like the frames of scmevl.
+  - globals are c variables, bound to the primitives by scmcrt_init.
+    pmap and pfor-each map sequentially, like those of scmref.
+  - a compiled program is one interpreter, its context is scmcrt_ctx.
+
+*/
+
+// Implementation limits:
+#define SCMCRT_FRAMES   (1 << 14)
+#define SCMCRT_MAXARGS  256             // of a tail call
+
+// value of a procedure whose tail call is pending
+#define SCMCRT_TAILCALL             (scmval)0x27
+
+// boxes hold the variables that closures capture and the program assigns
+#define SCMCRT_BOX(v)       scmval_cons(scmcrt_ctx, (v), SCMVAL_NIL)
+#define SCMCRT_UNBOX(box)   SCMVAL_CAR(box)
+
+// the value of the variable v named name, which must be bound
+#define SCMCRT_REF(v, name) \
+  ((SCMVAL_UNBOUND == (v)) ? (scmcrt_unbound(name), (v)) : (v))
+
+// tagged integers compare like the integers they represent
+#define SCMCRT_CMP(a, op, b) \
+  (((intptr_t)(a) op (intptr_t)(b)) ? SCMVAL_TRUE : SCMVAL_FALSE)
+
+// global variable of a compiled program
+struct scmcrt_global {
+  const char *name;
+  scmval *val;
+};
+
+// depth of the calls of native procedures
+extern int scmcrt_depth;
+
+// context of the program, created by scmcrt_init
+extern scmctx *scmcrt_ctx;
+
+// create the context, bind the globals named like a primitive to the primitive
+void scmcrt_init(struct scmcrt_global *globals, size_t nglobals);
+
+// allocate a native procedure with room for nfree free variables
+struct _scmprc *scmcrt_closure(const char *name, scmprc_native_fn fn, int arity, int nfree);
+
+// call any procedure, with all checks
+scmval scmcrt_apply(scmval proc, int argc, scmval *argv);
+
+// call the operator bound to the global g with two arguments
+scmval scmcrt_call2(scmval g, const char *name, scmval a, scmval b);
+
+// leave the call of proc to the caller, the value of a tail call
+scmval scmcrt_tail(scmval proc, int argc, scmval *argv);
+
+// the value of a top-level form, making its pending tail call
+scmval scmcrt_run(scmval v);
+
+_Noreturn void scmcrt_unbound(const char *name);
+
+// call a procedure, a native procedure of the right arity directly
+inline scmval
+scmcrt_call(scmval proc, int argc, scmval *argv)
+{
+  struct _scmprc *prc = SCMVAL_TO_PROCEDURE(proc);
+  scmval v;
+
+  if (SCMVAL_IS_PROCEDURE(proc) && (SCMPRC_NATIVE == prc->type) &&
+      (prc->u.nat.arity == argc) && (scmcrt_depth < SCMCRT_FRAMES)) {
+    scmcrt_depth++;
+    v = prc->u.nat.fn(prc, argv);
+    scmcrt_depth--;
+    if (SCMCRT_TAILCALL != v) {
+      return v;
+    }
+    return scmcrt_run(v);
+  }
+  return scmcrt_apply(proc, argc, argv);
+}
+
+#endif
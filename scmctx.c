@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>   /* errno */
+#include <stdio.h>
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+
+// create an interpreter context
+scmctx *
+scmctx_new(void)
+{
+  scmctx *ctx;
+
+  // the context counts its own allocations from here on
+  if (NULL == (ctx = calloc(1, sizeof(struct _scmctx)))) {
+    scmerr(SCMERR_SYSCALL, "scmctx_new");
+  }
+  ctx->out = stdout;
+  return ctx;
+}
+
+// release the context and the state of its modules
+void
+scmctx_free(scmctx *ctx)
+{
+  while (ctx->natfree > 0) {
+    ctx->natfree--;
+    ctx->atfree[ctx->natfree](ctx);
+  }
+  free(ctx);
+}
+
+// add the counters of from to ctx and clear them in from
+void
+scmctx_merge(scmctx *ctx, scmctx *from)
+{
+  int i;
+
+  ctx->mem.allocs += from->mem.allocs;
+  ctx->mem.reallocs += from->mem.reallocs;
+  ctx->mem.frees += from->mem.frees;
+  ctx->mem.bytes += from->mem.bytes;
+  for (i=0; i<SCMMEM_CLASSES; i++) {
+    ctx->mem.class_allocs[i] += from->mem.class_allocs[i];
+    ctx->mem.class_bytes[i] += from->mem.class_bytes[i];
+  }
+  ctx->splst.lookups += from->splst.lookups;
+  ctx->splst.hits += from->splst.hits;
+  ctx->splst.probes += from->splst.probes;
+  if (from->splst.max_probes > ctx->splst.max_probes) {
+    ctx->splst.max_probes = from->splst.max_probes;
+  }
+  ctx->rdr.bytes += from->rdr.bytes;
+  ctx->rdr.datums += from->rdr.datums;
+  if (from->rdr.max_depth > ctx->rdr.max_depth) {
+    ctx->rdr.max_depth = from->rdr.max_depth;
+  }
+  ctx->prt.bytes += from->prt.bytes;
+  memset(&from->mem, 0, sizeof(struct scmmem_stats));
+  memset(&from->splst, 0, sizeof(struct scmspl_stats));
+  memset(&from->rdr, 0, sizeof(struct scmrdr_stats));
+  memset(&from->prt, 0, sizeof(struct scmprt_stats));
+}
+
+// call fn when ctx is released, in reverse order of registration
+void
+scmctx_atfree(scmctx *ctx, void (*fn)(scmctx *ctx))
+{
+  if (SCMCTX_ATFREE == ctx->natfree) {
+    scmerr(SCMERR_UNDEFINED, "scmctx_atfree: too many functions");
+  }
+  ctx->atfree[ctx->natfree++] = fn;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCMCTX_H
+#define _SCMCTX_H
+
+/*
+
+a scmctx is one interpreter: the memory it allocates, the strings and
+symbols it interned, where it prints, and the state the evaluators keep
+between forms. nothing of it is shared with other contexts, so each thread
+can run its own interpreter without locking. values of one context must
+not be used in another, its symbols are different pointers, unless the
+contexts share the intern pool, see scmspl_share.
+
+the modules of an interpreter create their state in the context when it
+is first used, and register a function releasing it with scmctx_atfree.
+
+*/
+
+// Implementation limits:
+#define SCMCTX_ATFREE   8
+#define SCMMEM_CLASSES  10
+
+typedef struct _scmctx scmctx;
+
+// allocation counters
+struct scmmem_stats {
+  unsigned long allocs;         // blocks allocated
+  unsigned long reallocs;       // blocks resized
+  unsigned long frees;          // blocks released
+  size_t bytes;                 // allocated in total
+  // by size class, up to 16 bytes, 32, ... 4096 and more, only counted
+  // while the context keeps stats
+  unsigned long class_allocs[SCMMEM_CLASSES];
+  size_t class_bytes[SCMMEM_CLASSES];
+};
+
+// intern pool counters
+struct scmspl_stats {
+  unsigned long lookups;        // strings and symbols interned
+  unsigned long hits;           // of them already in the pool
+  unsigned long probes;         // slots compared in total
+  unsigned long max_probes;     // by one lookup
+};
+
+// reader counters
+struct scmrdr_stats {
+  unsigned long bytes;          // read
+  unsigned long datums;         // top-level data read
+  unsigned long max_depth;      // of nested lists
+};
+
+// printer counters
+struct scmprt_stats {
+  unsigned long bytes;          // written
+};
+
+struct _scmctx {
+  struct scmmem_stats mem;      // of scmmem
+  struct scmspl_stats splst;    // of scmspl
+  struct scmrdr_stats rdr;      // of scmrdr
+  struct scmprt_stats prt;      // of scmprt
+  int stats;                    // count what costs more than an increment
+  struct _scmmem_arena *arena;  // of scmmem, see scmmem_arena_new
+  struct _scmspl_pool *spl;     // interned strings and symbols
+  FILE *out;                    // of scmprt, stdout by default
+  struct _scmevl_state *evl;    // globals and vm of scmevl
+  struct _scmmac_state *mac;    // macros and cached expansions
+  struct _scmopt_state *opt;    // globals known to scmopt
+  struct _scmtwi_state *twi;    // globals of scmtwi
+  struct _scmrdr_srcs *srcs;    // where lists were read, see scmrdr_track
+  void (*atfree[SCMCTX_ATFREE])(scmctx *ctx);
+  int natfree;
+};
+
+// create an interpreter context
+scmctx *scmctx_new(void);
+
+// release the context and the state of its modules
+void scmctx_free(scmctx *ctx);
+
+// add the counters of from to ctx and clear them in from
+void scmctx_merge(scmctx *ctx, scmctx *from);
+
+// call fn when ctx is released, in reverse order of registration
+void scmctx_atfree(scmctx *ctx, void (*fn)(scmctx *ctx));
+
+#endif
@@ -15,6 +15,7 @@
  */
 
 #include <errno.h>
+#include <setjmp.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -27,19 +28,53 @@ static const char *const scmerr_list[] = {
   "error-000: ",                            /* SCMERR_SYSCALL */
   "error-001: undefined error: ",           /* SCMERR_UNDEFINED */
   "error-002: bad encoding: ",              /* SCMERR_BAD_ENCODING */
-  "error-003: integer literal overflow: ",  /* SCMERR_OVERFLOW */
+  "error-003: integer overflow: ",          /* SCMERR_OVERFLOW */
   "error-004: unknown type: ",              /* SCMERR_UNKNOWN_TYPE */
   "error-005: unknown escape sequence: ",   /* SCMERR_UNKNOWN_ESCAPE */
   "error-006: internal reader error: ",     /* SCMERR_INTERNAL_READER */
   "error-007: premature end-of-file: ",     /* SCMERR_PREMATURE_EOF */
+  "error-008: bad syntax: ",                /* SCMERR_BAD_SYNTAX */
+  "error-009: unbound variable: ",          /* SCMERR_UNBOUND_VARIABLE */
+  "error-010: wrong type: ",                /* SCMERR_WRONG_TYPE */
+  "error-011: wrong number of arguments: ", /* SCMERR_WRONG_ARITY */
+  "error-012: stack overflow: ",            /* SCMERR_STACK_OVERFLOW */
 };
 
+// a scmerr_catch running on the thread, the innermost first
+struct _scmerr_handler {
+  jmp_buf env;
+  struct scmerr_caught *err;
+  struct _scmerr_handler *next;
+};
+
+static _Thread_local struct _scmerr_handler *_scmerr_handlers;
+
 _Noreturn void
 scmerr(enum scmerr_no no, const char *fmt, ...)
 {
+  struct _scmerr_handler *h = _scmerr_handlers;
   const char *errstr;
+  size_t len;
   va_list ap;
 
+  /* the message is returned by the handler, if any */
+  if (h) {
+    h->err->no = no;
+    len = strlen(scmerr_list[no]);
+    (void)memcpy(h->err->msg, scmerr_list[no], len + 1);
+    if (no == SCMERR_SYSCALL) {
+      (void)snprintf(h->err->msg + len, SCMERR_MSGSIZE - len, "%s: ", strerror(errno));
+      len = strlen(h->err->msg);
+    }
+    if (fmt != NULL) {
+      va_start(ap, fmt);
+      (void)vsnprintf(h->err->msg + len, SCMERR_MSGSIZE - len, fmt, ap);
+      va_end(ap);
+    }
+    _scmerr_handlers = h->next;
+    longjmp(h->env, 1);
+  }
+
   /* SCMERR_SYSCALL uses errno */
   if (no == SCMERR_SYSCALL) {
     errstr = (const char *)strerror(errno);
@@ -63,3 +98,36 @@ scmerr(enum scmerr_no no, const char *fmt, ...)
   /* exit failure */
   exit(EXIT_FAILURE);
 }
+
+// call fn(arg), 1 if it raised an error, which is stored in err
+int
+scmerr_catch(void (*fn)(void *arg), void *arg, struct scmerr_caught *err)
+{
+  struct _scmerr_handler h;
+
+  h.err = err;
+  h.next = _scmerr_handlers;
+  if (setjmp(h.env)) {
+    return 1;
+  }
+  _scmerr_handlers = &h;
+  fn(arg);
+  _scmerr_handlers = h.next;
+  return 0;
+}
+
+// raise the caught error err again
+_Noreturn void
+scmerr_raise(const struct scmerr_caught *err)
+{
+  struct _scmerr_handler *h = _scmerr_handlers;
+
+  if (h) {
+    *h->err = *err;
+    _scmerr_handlers = h->next;
+    longjmp(h->env, 1);
+  }
+  (void)fputs(err->msg, stderr);
+  (void)fputc('\n', stderr);
+  exit(EXIT_FAILURE);
+}
@@ -17,6 +17,19 @@
 #ifndef _SCMERR_H
 #define _SCMERR_H
 
+/*
+
+an error raised by scmerr prints its message and exits, unless it is
+raised below scmerr_catch on the same thread. then the c stack is unwound
+to scmerr_catch, which returns the error. the unwound code does not
+release what it held: scmrdr_recover releases the datum being read and
+scmevl_recover resets the vm.
+
+*/
+
+// Implementation limits:
+#define SCMERR_MSGSIZE  512
+
 enum scmerr_no {
   SCMERR_SYSCALL = 0,
   SCMERR_UNDEFINED,
@@ -26,9 +39,26 @@ enum scmerr_no {
   SCMERR_UNKNOWN_ESCAPE,
   SCMERR_INTERNAL_READER,
   SCMERR_PREMATURE_EOF,
+  SCMERR_BAD_SYNTAX,
+  SCMERR_UNBOUND_VARIABLE,
+  SCMERR_WRONG_TYPE,
+  SCMERR_WRONG_ARITY,
+  SCMERR_STACK_OVERFLOW,
+};
+
+// an error caught by scmerr_catch
+struct scmerr_caught {
+  enum scmerr_no no;
+  char msg[SCMERR_MSGSIZE];     // the message, without the line break
 };
 
 /* prints an error message and exits with failure */
 _Noreturn void scmerr(enum scmerr_no, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 
+// call fn(arg), 1 if it raised an error, which is stored in err
+int scmerr_catch(void (*fn)(void *arg), void *arg, struct scmerr_caught *err);
+
+// raise the caught error err again
+_Noreturn void scmerr_raise(const struct scmerr_caught *err);
+
 #endif
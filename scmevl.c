@@ -14,19 +14,2420 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+
 #include <errno.h>   /* errno */
+#include <stdio.h>
 #include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
 #include <string.h>
 #include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 #include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
 #include "scmmem.h"
 #include "scmval.h"
+#include "scmspl.h"
+#include "scmprm.h"
+#include "scmmac.h"
+#include "scmpar.h"
+#include "scmrdr.h"
+#include "scmprf.h"
 #include "scmevl.h"
 
+// Implementation limits:
+#define _SCMEVL_STACKSIZE  (1 << 16)
+#define _SCMEVL_FRAMES     (1 << 14)
+#define _SCMEVL_BUCKETS    256
+#define _SCMEVL_IC_WAYS    4
+#define _SCMEVL_PMAP_MIN   32   // shorter lists are mapped sequentially
+#define _SCMEVL_PMAP_GRAIN 8    // elements a worker takes at once
+
+
+/*
+ * opcodes
+ *
+ *  CONST k      push constant k
+ *  LREF i       push local i of the frame
+ *  LSET i       assign the top of stack to local i of the frame
+ *  BREF i       push the content of the box in local i
+ *  BSET i       assign the top of stack to the box in local i
+ *  FREF j       push free variable j of the closure
+ *  FBREF j      push the content of the box in free variable j
+ *  FBSET j      assign the top of stack to the box in free variable j
+ *  BOX i        replace the value of local i by a box holding it
+ *  MKBOX i      store a new box without a value in local i
+ *  GREF g       push the global of cell g
+ *  GSET g       assign the top of stack to the global of cell g
+ *  GDEF g       pop a value, bind it to the global of cell g, push its name
+ *  POP          drop the top of stack
+ *  JUMP a       continue at address a
+ *  JUMPF a      pop a value, continue at address a if it is false
+ *  CLOSURE k    push a closure of nested lambda k, copying its free
+ *               variables from the frame and the current closure
+ *  CALL n       call the procedure below n arguments, push the result
+ *  TCALL n      call the procedure below n arguments in place of the
+ *               current call
+ *  GCALL k n    call the global of inline cache k with n arguments
+ *  GTCALL k n   call the global of inline cache k in place of the current
+ *               call
+ *  RETURN       pop the result, return to the caller
+ *  MRETURN n    copy the first n locals to the frame of the caller, then
+ *               RETURN; ends a fresh expansion of a macro call
+ *  MACRO k a    continue with the inline expansion of macro call k if the
+ *               macro is unchanged, otherwise call a fresh expansion and
+ *               continue at address a
+ *  ADD k ... GE k
+ *               apply the builtin integer operator of inline cache k to
+ *               the two values on top of the stack, fall back to a call
+ *               through the cache if the global was redefined or an
+ *               operand is not an integer
+ */
+#define _SCMEVL_OPCODES(X)			\
+  X(CONST, 1)					\
+  X(LREF, 1)					\
+  X(LSET, 1)					\
+  X(BREF, 1)					\
+  X(BSET, 1)					\
+  X(FREF, 1)					\
+  X(FBREF, 1)					\
+  X(FBSET, 1)					\
+  X(BOX, 1)					\
+  X(MKBOX, 1)					\
+  X(GREF, 1)					\
+  X(GSET, 1)					\
+  X(GDEF, 1)					\
+  X(POP, 0)					\
+  X(JUMP, 1)					\
+  X(JUMPF, 1)					\
+  X(CLOSURE, 1)					\
+  X(CALL, 1)					\
+  X(TCALL, 1)					\
+  X(GCALL, 2)					\
+  X(GTCALL, 2)					\
+  X(RETURN, 0)					\
+  X(MRETURN, 1)					\
+  X(MACRO, 2)					\
+  X(ADD, 1)					\
+  X(SUB, 1)					\
+  X(MUL, 1)					\
+  X(NUMEQ, 1)					\
+  X(LT, 1)					\
+  X(GT, 1)					\
+  X(LE, 1)					\
+  X(GE, 1)
+
+#define _SCMEVL_ENUM(op, nargs) _SCMEVL_OP_##op,
+enum {
+  _SCMEVL_OPCODES(_SCMEVL_ENUM)
+  _SCMEVL_NOPCODES
+};
+
+#define _SCMEVL_NAME(op, nargs) #op,
+static const char *const _scmevl_op_names[] = {
+  _SCMEVL_OPCODES(_SCMEVL_NAME)
+};
+
+#define _SCMEVL_NARGS(op, nargs) nargs,
+static const int _scmevl_op_nargs[] = {
+  _SCMEVL_OPCODES(_SCMEVL_NARGS)
+};
+
+
+// globals with an integer opcode for calls of two arguments
+static const struct {
+  const char *name;
+  int op;
+} _scmevl_arith_ops[] = {
+  {"+", _SCMEVL_OP_ADD},
+  {"-", _SCMEVL_OP_SUB},
+  {"*", _SCMEVL_OP_MUL},
+  {"=", _SCMEVL_OP_NUMEQ},
+  {"<", _SCMEVL_OP_LT},
+  {">", _SCMEVL_OP_GT},
+  {"<=", _SCMEVL_OP_LE},
+  {">=", _SCMEVL_OP_GE},
+};
+#define _SCMEVL_NARITH (sizeof(_scmevl_arith_ops) / sizeof(_scmevl_arith_ops[0]))
+
+// global variables
+struct _scmevl_global {
+  scmval sym;
+  scmval val;
+  struct _scmevl_global *next;
+};
+
+/*
+ * inline cache of a call site of a global procedure. each way holds a
+ * procedure the global was bound to when the site called it, checked to
+ * accept the number of arguments of the site. a hit skips the type and
+ * arity checks and enters the cached code directly. redefining the global
+ * changes the value of its cell, which no longer matches the cached
+ * procedure; the site misses and caches the new binding in the next way.
+ * after _SCMEVL_IC_WAYS bindings the site is megamorphic and takes the
+ * generic path.
+ */
+struct _scmevl_ic {
+  struct _scmevl_global *cell;
+  int nways;            // -1 once megamorphic
+  struct {
+    scmval proc;
+    scmcod *cod;        // entry of a closure, NULL for a primitive
+  } way[_SCMEVL_IC_WAYS];
+};
+
+/*
+ * macro call, compiled inline with the expansion of version. if the macro
+ * was redefined since, the call is expanded again and compiled in the
+ * saved lexical context as code that is called instead of the inline code.
+ * it gets a copy of the locals of the frame of the call, copied back when
+ * it returns, and shares the free variables of the closure. the lambda of
+ * the call captures every variable visible at the call, so that the fresh
+ * expansion finds each of them as a local or a free variable.
+ */
+struct _scmevl_macsite {
+  struct scmmac *mac;
+  unsigned long version;
+  scmval form;
+  scmcod *cod;                          // code containing the call
+  int *scope;                           // slots of the visible locals
+  int nscope;
+  scmval captured;                      // names captured and assigned in
+  scmval assigned;                      // the code, see _scmevl_scan
+  scmcod *thunk;                        // code of the fresh expansion
+  unsigned long thunk_version;
+};
+
+// compiler state of one code object
+struct _scmevl_comp {
+  scmctx *ctx;
+  struct _scmevl_comp *outer;   // enclosing lambda
+  scmcod *cod;
+  int *scope;           // slots of the visible locals, innermost last
+  int nscope;
+  int anames;           // allocated names and scope entries
+  int afree;            // allocated free variables
+  int depth;            // stack depth at the current instruction
+  int toplevel;         // defines bind globals
+  scmval captured;      // names referenced in nested lambdas, see _scmevl_scan
+  scmval assigned;      // names assigned by set! or define
+  scmval boxes;         // names of the locals held in a box
+  int boxall;           // box every local, see _scmevl_boxes
+};
+
+// how the compiler resolved a variable
+enum {
+  _SCMEVL_GLOBAL,
+  _SCMEVL_LOCAL,
+  _SCMEVL_FREE,
+};
+
+// saved state of a caller
+struct _scmevl_frame {
+  scmcod *cod;
+  const int32_t *pc;
+  scmval *bp;           // locals of the call, followed by its stack
+  scmval *fv;           // free variables of the closure
+};
+
+
+/*
+ * evaluator state of a context. the workers of pmap run in contexts of
+ * their own, sharing the globals, macros and intern pool of their owner.
+ * a worker leaves the inline caches of the shared code as they are, and
+ * compiles a fresh macro expansion only while it holds the lock of the
+ * owner, which waits for the workers meanwhile.
+ */
+struct _scmevl_state {
+  struct _scmevl_global **globals;      // _SCMEVL_BUCKETS lists
+
+  scmval *stack;                        // _SCMEVL_STACKSIZE values
+  scmval *sp;
+  struct _scmevl_frame *frames;         // _SCMEVL_FRAMES frames and one
+                                        // of a primitive call at the top
+  struct _scmevl_frame *fp;
+
+  FILE *listing;
+
+  struct scmevl_icstats icstats;
+
+  scmval sym_quote;
+  scmval sym_if;
+  scmval sym_define;
+  scmval sym_set;
+  scmval sym_lambda;
+  scmval sym_begin;
+  scmval sym_let;
+  scmval sym_define_macro;
+
+  // symbols and builtin procedures of _scmevl_arith_ops
+  scmval arith_syms[_SCMEVL_NARITH];
+  scmval arith_procs[_SCMEVL_NARITH];
+
+  scmctx *owner;                        // of a worker, NULL otherwise
+  unsigned long resets;                 // of the arena of the owner, see _scmevl_worker_arena
+  pthread_mutex_t lock;                 // of the compiler, for the workers
+  scmpar *pool;                         // threads of pmap
+  scmctx **workers;                     // their contexts
+  int nworkers;                         // 0 for one per processor
+};
+
+// a parallel map
+struct _scmevl_pmap {
+  scmctx **workers;
+  scmval proc;
+  scmval *in;
+  scmval *out;                          // NULL for pfor-each
+  atomic_int failed;                    // a call raised err
+  struct scmerr_caught err;
+};
+
+// the calls [begin, end) of a worker or of the caller, run under an error handler
+struct _scmevl_pmap_part {
+  struct _scmevl_pmap *pm;
+  scmctx *ctx;
+  scmcod *cod;
+  size_t begin;
+  size_t end;
+};
+
+// the calls of scmevl_map, run under an error handler
+struct _scmevl_map {
+  scmctx *ctx;
+  scmcod *cod;
+  scmval *argv;
+  scmval *out;
+  size_t *i;
+  size_t n;
+};
+
+// a macro call expanded and compiled by a worker
+struct _scmevl_thunk {
+  scmctx *ctx;
+  struct _scmevl_macsite *site;
+  scmcod *cod;
+};
+
+
+/* static prototypes */
+static void _scmevl_init(scmctx *ctx);
+static void _scmevl_release(scmctx *ctx);
+static struct _scmevl_global *_scmevl_global(scmctx *ctx, scmval sym, int create);
+static void _scmevl_define_primitive(scmctx *ctx, const char *name, scmval proc);
+static scmctx *_scmevl_worker(scmctx *ctx);
+
+static int _scmevl_length(scmval l);
+static int _scmevl_member(scmval x, scmval l);
+static scmcod *_scmevl_cod_new(scmctx *ctx, const char *name);
+static int _scmevl_const(struct _scmevl_comp *c, scmval v);
+static int _scmevl_cell(struct _scmevl_comp *c, scmval sym);
+static int _scmevl_ic(struct _scmevl_comp *c, scmval sym);
+static int _scmevl_macsite(struct _scmevl_comp *c, struct scmmac *mac, scmval x);
+static void _scmevl_comp_init(struct _scmevl_comp *c, scmctx *ctx,
+			      struct _scmevl_comp *outer, scmcod *cod);
+static void _scmevl_scan(struct _scmevl_comp *c, scmval x, int inner);
+static void _scmevl_boxes(struct _scmevl_comp *c, scmval body);
+static int _scmevl_scoped(struct _scmevl_comp *c, scmval sym);
+static int _scmevl_resolve(struct _scmevl_comp *c, scmval sym, int *index);
+static int _scmevl_free(struct _scmevl_comp *c, scmval sym, int src, int boxed);
+static int _scmevl_local(struct _scmevl_comp *c, scmval name);
+static size_t _scmevl_emit(struct _scmevl_comp *c, int op, int32_t arg, int32_t arg2);
+static void _scmevl_patch(struct _scmevl_comp *c, size_t at);
+static void _scmevl_compile(struct _scmevl_comp *c, scmval x, int tail);
+static void _scmevl_compile_ref(struct _scmevl_comp *c, scmval sym);
+static void _scmevl_compile_assign(struct _scmevl_comp *c, scmval sym);
+static void _scmevl_compile_body(struct _scmevl_comp *c, scmval body, int tail);
+static void _scmevl_compile_scope(struct _scmevl_comp *c, scmval body, int nscope, int tail);
+static void _scmevl_compile_if(struct _scmevl_comp *c, scmval x, int tail);
+static void _scmevl_compile_define(struct _scmevl_comp *c, scmval x);
+static void _scmevl_compile_set(struct _scmevl_comp *c, scmval x);
+static void _scmevl_compile_lambda(struct _scmevl_comp *c, const char *name,
+				   scmval params, scmval body, scmval src);
+static void _scmevl_compile_let(struct _scmevl_comp *c, scmval x, int tail);
+static void _scmevl_compile_apply_lambda(struct _scmevl_comp *c, scmval x, int tail);
+static void _scmevl_compile_bindings(struct _scmevl_comp *c, int first, int n,
+				     int nscope, scmval body, int tail);
+static void _scmevl_compile_call(struct _scmevl_comp *c, scmval x, int tail);
+static void _scmevl_compile_define_macro(struct _scmevl_comp *c, scmval x);
+static void _scmevl_compile_macro(struct _scmevl_comp *c, struct scmmac *mac, scmval x, int tail);
+static scmcod *_scmevl_macro_thunk(scmctx *ctx, struct _scmevl_macsite *site);
+static scmcod *_scmevl_macro_locked(scmctx *ctx, struct _scmevl_macsite *site);
+static void _scmevl_macro_locked_run(void *arg);
+
+static struct _scmprc *_scmevl_closure(scmctx *ctx, scmcod *cod, scmval *bp, scmval *fv);
+static struct _scmprc *_scmevl_callable(scmval v, int n);
+static scmval _scmevl_icstats_list(scmctx *ctx, int argc, scmval *argv);
+static scmcod *_scmevl_caller(scmctx *ctx, scmval proc, int argc);
+static scmval _scmevl_call(scmctx *ctx, scmcod *cod, scmval *argv);
+static void _scmevl_caller_free(scmctx *ctx, scmcod *cod);
+static void _scmevl_map(void *arg);
+static scmval _scmevl_run(scmctx *ctx, scmcod *cod);
+static void _scmevl_sample(scmctx *ctx, struct _scmevl_frame *fp, scmcod *cod, const char *leaf);
+static int _scmevl_sample_cod(struct scmprf_frame *frames, int n, scmcod *cod);
+
+static scmval _scmevl_pmap(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmevl_pfor_each(scmctx *ctx, int argc, scmval *argv);
+static int _scmevl_pmap_list(scmctx *ctx, scmval proc, scmval l, scmval *out, struct scmerr_caught *err);
+static void _scmevl_pmap_run(void *arg, int worker, size_t begin, size_t end);
+static void _scmevl_pmap_part(void *arg);
+static void _scmevl_worker_arena(scmctx *ctx, scmctx *w);
+
+static void _scmevl_write(FILE *fp, scmval v);
+static void _scmevl_list(FILE *fp, scmcod *cod);
+
+
+// the state of ctx, created on first use
+static void
+_scmevl_init(scmctx *ctx)
+{
+  struct _scmevl_state *st;
+  pthread_mutexattr_t attr;
+  size_t i;
+
+  if (ctx->evl) {
+    return;
+  }
+  st = ctx->evl = scmmem_alloc(ctx, 1, sizeof(struct _scmevl_state));
+  memset(st, 0, sizeof(struct _scmevl_state));
+  scmctx_atfree(ctx, _scmevl_release);
+
+  st->globals = scmmem_alloc(ctx, _SCMEVL_BUCKETS, sizeof(struct _scmevl_global *));
+  memset(st->globals, 0, _SCMEVL_BUCKETS * sizeof(struct _scmevl_global *));
+  // a transformer run by the compiler may meet a stale macro call itself
+  if (pthread_mutexattr_init(&attr) ||
+      pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) ||
+      pthread_mutex_init(&st->lock, &attr)) {
+    scmerr(SCMERR_SYSCALL, "pthread_mutex_init");
+  }
+  (void)pthread_mutexattr_destroy(&attr);
+  st->stack = scmmem_alloc(ctx, _SCMEVL_STACKSIZE, sizeof(scmval));
+  st->sp = st->stack;
+  st->frames = scmmem_alloc(ctx, _SCMEVL_FRAMES + 1, sizeof(struct _scmevl_frame));
+  st->fp = st->frames;
+
+  st->sym_quote = scmspl_intern_symbol(ctx, "quote");
+  st->sym_if = scmspl_intern_symbol(ctx, "if");
+  st->sym_define = scmspl_intern_symbol(ctx, "define");
+  st->sym_set = scmspl_intern_symbol(ctx, "set!");
+  st->sym_lambda = scmspl_intern_symbol(ctx, "lambda");
+  st->sym_begin = scmspl_intern_symbol(ctx, "begin");
+  st->sym_let = scmspl_intern_symbol(ctx, "let");
+  st->sym_define_macro = scmspl_intern_symbol(ctx, "define-macro");
+
+  scmprm_define_all(ctx, _scmevl_define_primitive);
+  for (i=0; i<_SCMEVL_NARITH; i++) {
+    st->arith_syms[i] = scmspl_intern_symbol(ctx, _scmevl_arith_ops[i].name);
+    st->arith_procs[i] = _scmevl_global(ctx, st->arith_syms[i], 1)->val;
+  }
+  _scmevl_define_primitive(ctx, "inline-cache-stats",
+			   scmprm_make(ctx, "inline-cache-stats", _scmevl_icstats_list, 0));
+  _scmevl_define_primitive(ctx, "pmap", scmprm_make(ctx, "pmap", _scmevl_pmap, 2));
+  _scmevl_define_primitive(ctx, "pfor-each",
+			   scmprm_make(ctx, "pfor-each", _scmevl_pfor_each, 2));
+}
+
+// a worker sharing the globals of ctx, with a vm of its own
+static scmctx *
+_scmevl_worker(scmctx *ctx)
+{
+  scmctx *wctx = scmctx_new();
+  struct _scmevl_state *st;
+
+  wctx->stats = ctx->stats;
+  scmspl_share(wctx, ctx);
+  st = wctx->evl = scmmem_alloc(wctx, 1, sizeof(struct _scmevl_state));
+  memcpy(st, ctx->evl, sizeof(struct _scmevl_state));
+  scmctx_atfree(wctx, _scmevl_release);
+
+  st->stack = scmmem_alloc(wctx, _SCMEVL_STACKSIZE, sizeof(scmval));
+  st->sp = st->stack;
+  st->frames = scmmem_alloc(wctx, _SCMEVL_FRAMES + 1, sizeof(struct _scmevl_frame));
+  st->fp = st->frames;
+  st->listing = NULL;
+  memset(&st->icstats, 0, sizeof(struct scmevl_icstats));
+  st->owner = ctx;
+  st->resets = 0;
+  st->pool = NULL;
+  st->workers = NULL;
+  return wctx;
+}
+
+// code and procedures are values of the heap of ctx
+static void
+_scmevl_release(scmctx *ctx)
+{
+  struct _scmevl_state *st = ctx->evl;
+  struct _scmevl_global *g, *next;
+  size_t i;
+
+  if (st->pool) {
+    scmpar_free(ctx, st->pool);
+    for (i=0; i<(size_t)scmpar_workers(st->pool); i++) {
+      if (st->workers[i]->arena) {
+	scmmem_arena_free(st->workers[i]);
+      }
+      scmctx_free(st->workers[i]);
+    }
+    scmmem_free(ctx, (void **)&st->workers);
+  }
+  for (i=0; !st->owner && (i<_SCMEVL_BUCKETS); i++) {
+    for (g = st->globals[i]; g; g = next) {
+      next = g->next;
+      scmmem_free(ctx, (void **)&g);
+    }
+  }
+  if (!st->owner) {
+    scmmem_free(ctx, (void **)&st->globals);
+    (void)pthread_mutex_destroy(&st->lock);
+  }
+  scmmem_free(ctx, (void **)&st->stack);
+  scmmem_free(ctx, (void **)&st->frames);
+  scmmem_free(ctx, (void **)&ctx->evl);
+}
+
+static void
+_scmevl_define_primitive(scmctx *ctx, const char *name, scmval proc)
+{
+  _scmevl_global(ctx, scmspl_intern_symbol(ctx, name), 1)->val = proc;
+}
+
+// bind a global variable
+void
+scmevl_define(scmctx *ctx, const char *name, scmval v)
+{
+  _scmevl_init(ctx);
+  _scmevl_global(ctx, scmspl_intern_symbol(ctx, name), 1)->val = v;
+}
+
+// find the global of an interned symbol, symbols are unique pointers
+static struct _scmevl_global *
+_scmevl_global(scmctx *ctx, scmval sym, int create)
+{
+  struct _scmevl_state *st = ctx->evl;
+  size_t h = ((uintptr_t)sym >> 3) % _SCMEVL_BUCKETS;
+  struct _scmevl_global *g;
+
+  for (g = st->globals[h]; g; g = g->next) {
+    if (sym == g->sym) {
+      return g;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+
+  g = scmmem_alloc(ctx, 1, sizeof(struct _scmevl_global));
+  g->sym = sym;
+  g->val = SCMVAL_UNBOUND;
+  g->next = st->globals[h];
+  st->globals[h] = g;
+  return g;
+}
+
+
+
+/*
+ * compiler
+ */
+
+// length of a proper list, -1 otherwise
+static int
+_scmevl_length(scmval l)
+{
+  int len = 0;
+
+  for (; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    len++;
+  }
+  return (SCMVAL_NIL == l) ? len : -1;
+}
+
+// x is an element of the list l
+static int
+_scmevl_member(scmval x, scmval l)
+{
+  for (; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    if (x == SCMVAL_CAR(l)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static scmcod *
+_scmevl_cod_new(scmctx *ctx, const char *name)
+{
+  scmcod *cod = scmmem_alloc(ctx, 1, sizeof(scmcod));
+
+  memset(cod, 0, sizeof(scmcod));
+  cod->name = name;
+  return cod;
+}
+
+// compiler state of a new code object, nested in outer
+static void
+_scmevl_comp_init(struct _scmevl_comp *c, scmctx *ctx, struct _scmevl_comp *outer,
+		  scmcod *cod)
+{
+  memset(c, 0, sizeof(struct _scmevl_comp));
+  c->ctx = ctx;
+  c->outer = outer;
+  c->cod = cod;
+  c->captured = SCMVAL_NIL;
+  c->assigned = SCMVAL_NIL;
+  c->boxes = SCMVAL_NIL;
+}
+
+// index of v in the constant pool
+static int
+_scmevl_const(struct _scmevl_comp *c, scmval v)
+{
+  scmctx *ctx = c->ctx;
+  scmcod *cod = c->cod;
+  size_t i;
+
+  for (i=0; i<cod->nconsts; i++) {
+    if (v == cod->consts[i]) {
+      return i;
+    }
+  }
+  if (cod->nconsts == cod->aconsts) {
+    cod->aconsts = cod->aconsts ? 2 * cod->aconsts : 8;
+    cod->consts = scmmem_realloc(ctx, cod->consts, cod->aconsts, sizeof(scmval));
+  }
+  cod->consts[cod->nconsts] = v;
+  return cod->nconsts++;
+}
+
+// index of the global cell of sym, the cell is created unbound if needed
+static int
+_scmevl_cell(struct _scmevl_comp *c, scmval sym)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_global *g = _scmevl_global(ctx, sym, 1);
+  scmcod *cod = c->cod;
+  size_t i;
+
+  for (i=0; i<cod->ncells; i++) {
+    if (g == cod->cells[i]) {
+      return i;
+    }
+  }
+  if (cod->ncells == cod->acells) {
+    cod->acells = cod->acells ? 2 * cod->acells : 8;
+    cod->cells = scmmem_realloc(ctx, cod->cells, cod->acells, sizeof(struct _scmevl_global *));
+  }
+  cod->cells[cod->ncells] = g;
+  return cod->ncells++;
+}
+
+// index of a new inline cache for a call of the global sym
+static int
+_scmevl_ic(struct _scmevl_comp *c, scmval sym)
+{
+  scmctx *ctx = c->ctx;
+  scmcod *cod = c->cod;
+
+  cod->ics = scmmem_realloc(ctx, cod->ics, cod->nics + 1, sizeof(struct _scmevl_ic));
+  memset(&cod->ics[cod->nics], 0, sizeof(struct _scmevl_ic));
+  cod->ics[cod->nics].cell = _scmevl_global(ctx, sym, 1);
+  return cod->nics++;
+}
+
+// index of a new macro call site, saves the lexical context of the call
+static int
+_scmevl_macsite(struct _scmevl_comp *c, struct scmmac *mac, scmval x)
+{
+  scmctx *ctx = c->ctx;
+  scmcod *cod = c->cod;
+  struct _scmevl_macsite *site;
+  struct _scmevl_comp *o;
+  int i, j;
+
+  // a fresh expansion may refer to any variable in scope
+  for (o = c->outer; o; o = o->outer) {
+    for (i=0; i<o->nscope; i++) {
+      (void)_scmevl_resolve(c, o->cod->names[o->scope[i]], &j);
+    }
+    for (i=0; i<o->cod->nfree; i++) {
+      (void)_scmevl_resolve(c, o->cod->frees[i], &j);
+    }
+  }
+
+  cod->macros = scmmem_realloc(ctx, cod->macros, cod->nmacros + 1, sizeof(struct _scmevl_macsite));
+  site = &cod->macros[cod->nmacros];
+  memset(site, 0, sizeof(struct _scmevl_macsite));
+  site->mac = mac;
+  site->version = mac->version;
+  site->form = x;
+  site->cod = cod;
+  site->scope = scmmem_alloc(ctx, c->nscope + 1, sizeof(int));
+  memcpy(site->scope, c->scope, c->nscope * sizeof(int));
+  site->nscope = c->nscope;
+  site->captured = c->captured;
+  site->assigned = c->assigned;
+  return cod->nmacros++;
+}
+
+/*
+ * collect the variables referenced in lambdas nested in x and the
+ * variables assigned by set! or define, looking into the expansions of
+ * macro calls. names are compared regardless of shadowing, which at worst
+ * boxes a variable that needs no box.
+ */
+static void
+_scmevl_scan(struct _scmevl_comp *c, scmval x, int inner)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_state *st = ctx->evl;
+  struct scmmac *mac;
+  scmval op, target;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    if (inner && !_scmevl_member(x, c->captured)) {
+      c->captured = SCMVAL_MAKE_LIST(scmval_cons(ctx, x, c->captured));
+    }
+    return;
+  }
+  if (!SCMVAL_IS_LIST(x) || (_scmevl_length(x) < 0)) {
+    return;
+  }
+
+  op = SCMVAL_CAR(x);
+  if ((st->sym_quote == op) || (st->sym_define_macro == op)) {
+    return;
+  }
+  if ((st->sym_lambda == op) && SCMVAL_IS_LIST(SCMVAL_CDR(x))) {
+    inner = 1;
+    x = SCMVAL_CDR(x);
+  } else if (((st->sym_set == op) || (st->sym_define == op)) &&
+	     SCMVAL_IS_LIST(SCMVAL_CDR(x))) {
+    target = SCMVAL_CAR(SCMVAL_CDR(x));
+    if (SCMVAL_IS_LIST(target)) {
+      target = SCMVAL_CAR(target);
+    }
+    if (!_scmevl_member(target, c->assigned)) {
+      c->assigned = SCMVAL_MAKE_LIST(scmval_cons(ctx, target, c->assigned));
+    }
+    _scmevl_scan(c, target, inner);
+    // the body of (define (name params ...) body ...) is a lambda
+    if (SCMVAL_IS_LIST(SCMVAL_CAR(SCMVAL_CDR(x)))) {
+      inner = 1;
+    }
+    x = SCMVAL_CDR(x);
+  } else if (SCMVAL_IS_SYMBOL(op) && (mac = scmmac_lookup(ctx, op))) {
+    // the expansion is cached, the compiler reuses it
+    _scmevl_scan(c, scmmac_expand(ctx, mac, x, scmevl_apply), inner);
+    c->boxall |= inner;
+  } else {
+    _scmevl_scan(c, op, inner);
+  }
+  for (x = SCMVAL_CDR(x); SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    _scmevl_scan(c, SCMVAL_CAR(x), inner);
+  }
+}
+
+/*
+ * find the variables of a lambda body that need a box: those a closure
+ * captures and that are assigned. all others are copied into closures.
+ * a fresh expansion of a macro call in a nested lambda could assign any
+ * variable it captures, so then every local is boxed.
+ */
+static void
+_scmevl_boxes(struct _scmevl_comp *c, scmval body)
+{
+  scmctx *ctx = c->ctx;
+  scmval l;
+
+  for (; SCMVAL_IS_LIST(body); body = SCMVAL_CDR(body)) {
+    _scmevl_scan(c, SCMVAL_CAR(body), 0);
+  }
+  for (l = c->assigned; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (_scmevl_member(SCMVAL_CAR(l), c->captured)) {
+      c->boxes = SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_CAR(l), c->boxes));
+    }
+  }
+}
+
+// slot of a visible local of the lambda, -1 otherwise
+static int
+_scmevl_scoped(struct _scmevl_comp *c, scmval sym)
+{
+  int i;
+
+  // inner scopes shadow outer ones
+  for (i=c->nscope-1; i>=0; i--) {
+    if (sym == c->cod->names[c->scope[i]]) {
+      return c->scope[i];
+    }
+  }
+  return -1;
+}
+
+/*
+ * resolve a variable to a local slot, a free variable of the closure or
+ * a global. a local of an enclosing lambda becomes a free variable of
+ * each lambda in between.
+ */
+static int
+_scmevl_resolve(struct _scmevl_comp *c, scmval sym, int *index)
+{
+  int kind, src, boxed;
+
+  if ((*index = _scmevl_scoped(c, sym)) >= 0) {
+    return _SCMEVL_LOCAL;
+  }
+  for (*index = 0; *index < c->cod->nfree; (*index)++) {
+    if (sym == c->cod->frees[*index]) {
+      return _SCMEVL_FREE;
+    }
+  }
+  if (!c->outer) {
+    return _SCMEVL_GLOBAL;
+  }
+
+  kind = _scmevl_resolve(c->outer, sym, index);
+  if (_SCMEVL_LOCAL == kind) {
+    src = *index;
+    boxed = c->outer->cod->boxed[*index];
+  } else if (_SCMEVL_FREE == kind) {
+    src = -*index - 1;
+    boxed = c->outer->cod->fboxed[*index];
+  } else {
+    return _SCMEVL_GLOBAL;
+  }
+  *index = _scmevl_free(c, sym, src, boxed);
+  return _SCMEVL_FREE;
+}
+
+// add a free variable, copied from src by CLOSURE, see scmcod
+static int
+_scmevl_free(struct _scmevl_comp *c, scmval sym, int src, int boxed)
+{
+  scmctx *ctx = c->ctx;
+  scmcod *cod = c->cod;
+
+  if (cod->nfree == c->afree) {
+    c->afree = c->afree ? 2 * c->afree : 4;
+    cod->frees = scmmem_realloc(ctx, cod->frees, c->afree, sizeof(scmval));
+    cod->fsrc = scmmem_realloc(ctx, cod->fsrc, c->afree, sizeof(int));
+    cod->fboxed = scmmem_realloc(ctx, cod->fboxed, c->afree, sizeof(char));
+  }
+  cod->frees[cod->nfree] = sym;
+  cod->fsrc[cod->nfree] = src;
+  cod->fboxed[cod->nfree] = boxed;
+  return cod->nfree++;
+}
+
+// allocate a slot in the frame for a local and make it visible
+static int
+_scmevl_local(struct _scmevl_comp *c, scmval name)
+{
+  scmctx *ctx = c->ctx;
+  scmcod *cod = c->cod;
+
+  if (cod->nlocals == c->anames) {
+    c->anames = c->anames ? 2 * c->anames : 8;
+    cod->names = scmmem_realloc(ctx, cod->names, c->anames, sizeof(scmval));
+    cod->boxed = scmmem_realloc(ctx, cod->boxed, c->anames, sizeof(char));
+    c->scope = scmmem_realloc(ctx, c->scope, c->anames, sizeof(int));
+  }
+  cod->names[cod->nlocals] = name;
+  cod->boxed[cod->nlocals] = c->boxall || _scmevl_member(name, c->boxes);
+  c->scope[c->nscope++] = cod->nlocals;
+  return cod->nlocals++;
+}
+
+// append an instruction, returns the address of its last operand
+static size_t
+_scmevl_emit(struct _scmevl_comp *c, int op, int32_t arg, int32_t arg2)
+{
+  scmctx *ctx = c->ctx;
+  scmcod *cod = c->cod;
+
+  if (cod->ncode + 3 > cod->acode) {
+    cod->acode = cod->acode ? 2 * cod->acode : 32;
+    cod->code = scmmem_realloc(ctx, cod->code, cod->acode, sizeof(int32_t));
+  }
+  cod->code[cod->ncode++] = op;
+  if (_scmevl_op_nargs[op] > 0) {
+    cod->code[cod->ncode++] = arg;
+  }
+  if (_scmevl_op_nargs[op] > 1) {
+    cod->code[cod->ncode++] = arg2;
+  }
+
+  // keep track of the stack depth
+  switch (op) {
+  case _SCMEVL_OP_CONST:
+  case _SCMEVL_OP_LREF:
+  case _SCMEVL_OP_BREF:
+  case _SCMEVL_OP_FREF:
+  case _SCMEVL_OP_FBREF:
+  case _SCMEVL_OP_GREF:
+  case _SCMEVL_OP_CLOSURE:
+    c->depth++;
+    break;
+  case _SCMEVL_OP_POP:
+  case _SCMEVL_OP_JUMPF:
+  case _SCMEVL_OP_RETURN:
+  case _SCMEVL_OP_MRETURN:
+  case _SCMEVL_OP_ADD:
+  case _SCMEVL_OP_SUB:
+  case _SCMEVL_OP_MUL:
+  case _SCMEVL_OP_NUMEQ:
+  case _SCMEVL_OP_LT:
+  case _SCMEVL_OP_GT:
+  case _SCMEVL_OP_LE:
+  case _SCMEVL_OP_GE:
+    c->depth--;
+    break;
+  case _SCMEVL_OP_CALL:
+  case _SCMEVL_OP_TCALL:
+    c->depth -= arg;
+    break;
+  case _SCMEVL_OP_GCALL:
+  case _SCMEVL_OP_GTCALL:
+    c->depth += 1 - arg2;
+    break;
+  }
+  if (c->depth > cod->maxstack) {
+    cod->maxstack = c->depth;
+  }
+
+  return cod->ncode - 1;
+}
+
+// let the jump with operand at address at continue at the next instruction
+static void
+_scmevl_patch(struct _scmevl_comp *c, size_t at)
+{
+  c->cod->code[at] = c->cod->ncode;
+}
+
+// compile x, tail is set if its value is the value of the procedure
+static void
+_scmevl_compile(struct _scmevl_comp *c, scmval x, int tail)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_state *st = ctx->evl;
+  struct scmmac *mac;
+  scmval op;
+  int index;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    _scmevl_compile_ref(c, x);
+    return;
+  }
+  if (!SCMVAL_IS_LIST(x)) {
+    (void)_scmevl_emit(c, _SCMEVL_OP_CONST, _scmevl_const(c, x), 0);
+    return;
+  }
+  if (_scmevl_length(x) < 0) {
+    scmerr(SCMERR_BAD_SYNTAX, "improper list in form");
+  }
+
+  op = SCMVAL_CAR(x);
+  if (st->sym_quote == op) {
+    if (_scmevl_length(x) != 2) {
+      scmerr(SCMERR_BAD_SYNTAX, "quote: one datum expected");
+    }
+    (void)_scmevl_emit(c, _SCMEVL_OP_CONST, _scmevl_const(c, SCMVAL_CAR(SCMVAL_CDR(x))), 0);
+  } else if (st->sym_if == op) {
+    _scmevl_compile_if(c, x, tail);
+  } else if (st->sym_define == op) {
+    _scmevl_compile_define(c, x);
+  } else if (st->sym_set == op) {
+    _scmevl_compile_set(c, x);
+  } else if (st->sym_lambda == op) {
+    if (_scmevl_length(x) < 3) {
+      scmerr(SCMERR_BAD_SYNTAX, "lambda: parameters and body expected");
+    }
+    _scmevl_compile_lambda(c, NULL, SCMVAL_CAR(SCMVAL_CDR(x)), SCMVAL_CDR(SCMVAL_CDR(x)), x);
+  } else if (st->sym_begin == op) {
+    _scmevl_compile_body(c, SCMVAL_CDR(x), tail);
+  } else if (st->sym_let == op) {
+    _scmevl_compile_let(c, x, tail);
+  } else if (st->sym_define_macro == op) {
+    _scmevl_compile_define_macro(c, x);
+  } else if (SCMVAL_IS_SYMBOL(op) && (mac = scmmac_lookup(ctx, op)) &&
+	     (_SCMEVL_GLOBAL == _scmevl_resolve(c, op, &index))) {
+    _scmevl_compile_macro(c, mac, x, tail);
+  } else if (SCMVAL_IS_LIST(op) && (st->sym_lambda == SCMVAL_CAR(op)) &&
+	     (_scmevl_length(op) >= 3) &&
+	     (_scmevl_length(SCMVAL_CAR(SCMVAL_CDR(op))) == _scmevl_length(x) - 1)) {
+    _scmevl_compile_apply_lambda(c, x, tail);
+  } else {
+    _scmevl_compile_call(c, x, tail);
+  }
+}
+
+// push the value of a variable
+static void
+_scmevl_compile_ref(struct _scmevl_comp *c, scmval sym)
+{
+  int index;
+
+  switch (_scmevl_resolve(c, sym, &index)) {
+  case _SCMEVL_LOCAL:
+    (void)_scmevl_emit(c, c->cod->boxed[index] ? _SCMEVL_OP_BREF : _SCMEVL_OP_LREF, index, 0);
+    break;
+  case _SCMEVL_FREE:
+    (void)_scmevl_emit(c, c->cod->fboxed[index] ? _SCMEVL_OP_FBREF : _SCMEVL_OP_FREF, index, 0);
+    break;
+  default:
+    (void)_scmevl_emit(c, _SCMEVL_OP_GREF, _scmevl_cell(c, sym), 0);
+    break;
+  }
+}
+
+// assign the top of stack to a variable
+static void
+_scmevl_compile_assign(struct _scmevl_comp *c, scmval sym)
+{
+  int index;
+
+  switch (_scmevl_resolve(c, sym, &index)) {
+  case _SCMEVL_LOCAL:
+    (void)_scmevl_emit(c, c->cod->boxed[index] ? _SCMEVL_OP_BSET : _SCMEVL_OP_LSET, index, 0);
+    break;
+  case _SCMEVL_FREE:
+    // _scmevl_boxes boxes every captured variable that is assigned
+    if (!c->cod->fboxed[index]) {
+      scmerr(SCMERR_BAD_SYNTAX, "set!: %s captured without a box", SCMVAL_TO_C_STR(sym));
+    }
+    (void)_scmevl_emit(c, _SCMEVL_OP_FBSET, index, 0);
+    break;
+  default:
+    (void)_scmevl_emit(c, _SCMEVL_OP_GSET, _scmevl_cell(c, sym), 0);
+    break;
+  }
+}
+
+// a sequence of forms, the value is the value of the last form
+static void
+_scmevl_compile_body(struct _scmevl_comp *c, scmval body, int tail)
+{
+  if (SCMVAL_NIL == body) {
+    (void)_scmevl_emit(c, _SCMEVL_OP_CONST, _scmevl_const(c, SCMVAL_NIL), 0);
+    return;
+  }
+  for (; SCMVAL_NIL != SCMVAL_CDR(body); body = SCMVAL_CDR(body)) {
+    _scmevl_compile(c, SCMVAL_CAR(body), 0);
+    (void)_scmevl_emit(c, _SCMEVL_OP_POP, 0, 0);
+  }
+  _scmevl_compile(c, SCMVAL_CAR(body), tail);
+}
+
+/*
+ * the body of a lambda or let, its internal definitions are locals in
+ * the frame. the locals of the scope are visible until the body ends.
+ */
+static void
+_scmevl_compile_scope(struct _scmevl_comp *c, scmval body, int nscope, int tail)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_state *st = ctx->evl;
+  scmval l, def, target;
+  int first = c->cod->nlocals;
+  int i;
+
+  if (_scmevl_length(body) < 1) {
+    scmerr(SCMERR_BAD_SYNTAX, "body expected");
+  }
+  for (l = body; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    def = SCMVAL_CAR(l);
+    if (!SCMVAL_IS_LIST(def) || (st->sym_define != SCMVAL_CAR(def)) ||
+	(_scmevl_length(def) < 3)) {
+      continue;
+    }
+    target = SCMVAL_CAR(SCMVAL_CDR(def));
+    if (SCMVAL_IS_LIST(target)) {
+      target = SCMVAL_CAR(target);
+    }
+    // a name bound twice in the same scope is one local
+    for (i=nscope; i<c->nscope; i++) {
+      if (target == c->cod->names[c->scope[i]]) {
+	break;
+      }
+    }
+    if (i == c->nscope) {
+      (void)_scmevl_local(c, target);
+    }
+  }
+  // the box of a definition exists before its value, closures share it
+  for (i=first; i<c->cod->nlocals; i++) {
+    if (c->cod->boxed[i]) {
+      (void)_scmevl_emit(c, _SCMEVL_OP_MKBOX, i, 0);
+    }
+  }
+
+  _scmevl_compile_body(c, body, tail);
+  c->nscope = nscope;
+}
+
+// (if test consequent [alternative]), a missing alternative is nil
+static void
+_scmevl_compile_if(struct _scmevl_comp *c, scmval x, int tail)
+{
+  int len = _scmevl_length(x);
+  size_t jumpf, jump;
+
+  if ((len != 3) && (len != 4)) {
+    scmerr(SCMERR_BAD_SYNTAX, "if: test, consequent and optional alternative expected");
+  }
+  x = SCMVAL_CDR(x);
+  _scmevl_compile(c, SCMVAL_CAR(x), 0);
+  jumpf = _scmevl_emit(c, _SCMEVL_OP_JUMPF, 0, 0);
+
+  x = SCMVAL_CDR(x);
+  _scmevl_compile(c, SCMVAL_CAR(x), tail);
+  jump = _scmevl_emit(c, _SCMEVL_OP_JUMP, 0, 0);
+
+  // both branches start at the same depth
+  c->depth--;
+  _scmevl_patch(c, jumpf);
+  x = SCMVAL_CDR(x);
+  if (SCMVAL_NIL == x) {
+    (void)_scmevl_emit(c, _SCMEVL_OP_CONST, _scmevl_const(c, SCMVAL_NIL), 0);
+  } else {
+    _scmevl_compile(c, SCMVAL_CAR(x), tail);
+  }
+  _scmevl_patch(c, jump);
+}
+
+// (define name expr) or (define (name params ...) body ...)
+static void
+_scmevl_compile_define(struct _scmevl_comp *c, scmval x)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_state *st = ctx->evl;
+  scmval target, name;
+  int len = _scmevl_length(x);
+  int slot;
+
+  if (len < 3) {
+    scmerr(SCMERR_BAD_SYNTAX, "define: name and value expected");
+  }
+  target = SCMVAL_CAR(SCMVAL_CDR(x));
+  name = SCMVAL_IS_LIST(target) ? SCMVAL_CAR(target) : target;
+  if (!SCMVAL_IS_SYMBOL(name)) {
+    scmerr(SCMERR_BAD_SYNTAX, "define: name expected");
+  }
+
+  // internal definitions are locals, allocated by _scmevl_compile_scope
+  slot = _scmevl_scoped(c, name);
+  if ((slot < 0) && !c->toplevel) {
+    scmerr(SCMERR_BAD_SYNTAX, "define: %s not in a body", SCMVAL_TO_C_STR(name));
+  }
+
+  if (SCMVAL_IS_LIST(target)) {
+    _scmevl_compile_lambda(c, SCMVAL_TO_C_STR(name), SCMVAL_CDR(target),
+			   SCMVAL_CDR(SCMVAL_CDR(x)), x);
+  } else {
+    if (len != 3) {
+      scmerr(SCMERR_BAD_SYNTAX, "define: name and one value expected");
+    }
+    x = SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x)));
+    // name the procedure of (define name (lambda ...))
+    if (SCMVAL_IS_LIST(x) && (st->sym_lambda == SCMVAL_CAR(x)) && (_scmevl_length(x) >= 3)) {
+      _scmevl_compile_lambda(c, SCMVAL_TO_C_STR(name), SCMVAL_CAR(SCMVAL_CDR(x)),
+			     SCMVAL_CDR(SCMVAL_CDR(x)), x);
+    } else {
+      _scmevl_compile(c, x, 0);
+    }
+  }
+
+  if (slot < 0) {
+    (void)_scmevl_emit(c, _SCMEVL_OP_GDEF, _scmevl_cell(c, name), 0);
+  } else {
+    (void)_scmevl_emit(c, c->cod->boxed[slot] ? _SCMEVL_OP_BSET : _SCMEVL_OP_LSET, slot, 0);
+    (void)_scmevl_emit(c, _SCMEVL_OP_POP, 0, 0);
+    (void)_scmevl_emit(c, _SCMEVL_OP_CONST, _scmevl_const(c, name), 0);
+  }
+}
+
+// (set! name expr)
+static void
+_scmevl_compile_set(struct _scmevl_comp *c, scmval x)
+{
+  scmval name;
+
+  if (_scmevl_length(x) != 3) {
+    scmerr(SCMERR_BAD_SYNTAX, "set!: name and value expected");
+  }
+  name = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (!SCMVAL_IS_SYMBOL(name)) {
+    scmerr(SCMERR_BAD_SYNTAX, "set!: name expected");
+  }
+  _scmevl_compile(c, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))), 0);
+  _scmevl_compile_assign(c, name);
+}
+
+// compile a lambda into a nested code object and emit its closure, src
+// is the form defining it
+static void
+_scmevl_compile_lambda(struct _scmevl_comp *c, const char *name, scmval params, scmval body,
+		       scmval src)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_comp lc;
+  scmval l;
+  int n = _scmevl_length(params);
+  int i;
+
+  if (n < 0) {
+    scmerr(SCMERR_BAD_SYNTAX, "lambda: parameter list expected");
+  }
+
+  _scmevl_comp_init(&lc, ctx, c, _scmevl_cod_new(ctx, name));
+  lc.cod->nparams = n;
+  // the lambdas of a macro expansion are located at the code expanding it
+  if (!scmrdr_source(ctx, src, &lc.cod->file, &lc.cod->line)) {
+    lc.cod->file = c->cod->file;
+    lc.cod->line = c->cod->line;
+  }
+  _scmevl_boxes(&lc, body);
+  for (l = params; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (!SCMVAL_IS_SYMBOL(SCMVAL_CAR(l))) {
+      scmerr(SCMERR_BAD_SYNTAX, "lambda: parameter name expected");
+    }
+    (void)_scmevl_local(&lc, SCMVAL_CAR(l));
+  }
+  for (i=0; i<n; i++) {
+    if (lc.cod->boxed[i]) {
+      (void)_scmevl_emit(&lc, _SCMEVL_OP_BOX, i, 0);
+    }
+  }
+  _scmevl_compile_scope(&lc, body, lc.nscope, 1);
+  (void)_scmevl_emit(&lc, _SCMEVL_OP_RETURN, 0, 0);
+  if (lc.scope) {
+    scmmem_free(ctx, (void **)&lc.scope);
+  }
+
+  if (c->cod->nprocs == c->cod->aprocs) {
+    c->cod->aprocs = c->cod->aprocs ? 2 * c->cod->aprocs : 4;
+    c->cod->procs = scmmem_realloc(ctx, c->cod->procs, c->cod->aprocs, sizeof(scmcod *));
+  }
+  c->cod->procs[c->cod->nprocs] = lc.cod;
+  (void)_scmevl_emit(c, _SCMEVL_OP_CLOSURE, c->cod->nprocs++, 0);
+}
+
+/*
+ * (let ((name init) ...) body ...)
+ * the names are fresh locals of the current frame, no closure is created.
+ * the inits are evaluated before any of the names is visible.
+ */
+static void
+_scmevl_compile_let(struct _scmevl_comp *c, scmval x, int tail)
+{
+  scmval bindings, b;
+  int nscope = c->nscope;
+  int first, n = 0;
+
+  if (_scmevl_length(x) < 3) {
+    scmerr(SCMERR_BAD_SYNTAX, "let: bindings and body expected");
+  }
+  bindings = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (_scmevl_length(bindings) < 0) {
+    scmerr(SCMERR_BAD_SYNTAX, "let: binding list expected");
+  }
+  for (b = bindings; SCMVAL_NIL != b; b = SCMVAL_CDR(b)) {
+    if ((_scmevl_length(SCMVAL_CAR(b)) != 2) || !SCMVAL_IS_SYMBOL(SCMVAL_CAR(SCMVAL_CAR(b)))) {
+      scmerr(SCMERR_BAD_SYNTAX, "let: (name init) expected");
+    }
+    _scmevl_compile(c, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CAR(b))), 0);
+    n++;
+  }
+  first = c->cod->nlocals;
+  for (b = bindings; SCMVAL_NIL != b; b = SCMVAL_CDR(b)) {
+    (void)_scmevl_local(c, SCMVAL_CAR(SCMVAL_CAR(b)));
+  }
+  _scmevl_compile_bindings(c, first, n, nscope, SCMVAL_CDR(SCMVAL_CDR(x)), tail);
+}
+
+/*
+ * ((lambda (param ...) body ...) arg ...) is a let, the lambda never
+ * escapes and needs no closure.
+ */
+static void
+_scmevl_compile_apply_lambda(struct _scmevl_comp *c, scmval x, int tail)
+{
+  scmval lambda = SCMVAL_CAR(x);
+  scmval l;
+  int nscope = c->nscope;
+  int first, n = 0;
+
+  for (l = SCMVAL_CDR(x); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    _scmevl_compile(c, SCMVAL_CAR(l), 0);
+    n++;
+  }
+  first = c->cod->nlocals;
+  for (l = SCMVAL_CAR(SCMVAL_CDR(lambda)); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (!SCMVAL_IS_SYMBOL(SCMVAL_CAR(l))) {
+      scmerr(SCMERR_BAD_SYNTAX, "lambda: parameter name expected");
+    }
+    (void)_scmevl_local(c, SCMVAL_CAR(l));
+  }
+  _scmevl_compile_bindings(c, first, n, nscope, SCMVAL_CDR(SCMVAL_CDR(lambda)), tail);
+}
+
+// store the n values on top of the stack in the locals from first on
+static void
+_scmevl_compile_bindings(struct _scmevl_comp *c, int first, int n, int nscope,
+			 scmval body, int tail)
+{
+  int i;
+
+  for (i=n-1; i>=0; i--) {
+    (void)_scmevl_emit(c, _SCMEVL_OP_LSET, first + i, 0);
+    (void)_scmevl_emit(c, _SCMEVL_OP_POP, 0, 0);
+  }
+  for (i=0; i<n; i++) {
+    if (c->cod->boxed[first + i]) {
+      (void)_scmevl_emit(c, _SCMEVL_OP_BOX, first + i, 0);
+    }
+  }
+
+  _scmevl_compile_scope(c, body, nscope, tail);
+}
+
+// (operator operand ...), a global operator is called through an inline cache
+static void
+_scmevl_compile_call(struct _scmevl_comp *c, scmval x, int tail)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_state *st = ctx->evl;
+  int n = _scmevl_length(x) - 1;
+  scmval op = SCMVAL_CAR(x);
+  int index;
+  size_t i;
+
+  if (SCMVAL_IS_SYMBOL(op) && (_SCMEVL_GLOBAL == _scmevl_resolve(c, op, &index))) {
+    for (x = SCMVAL_CDR(x); SCMVAL_NIL != x; x = SCMVAL_CDR(x)) {
+      _scmevl_compile(c, SCMVAL_CAR(x), 0);
+    }
+    for (i=0; (2 == n) && (i < _SCMEVL_NARITH); i++) {
+      if (op == st->arith_syms[i]) {
+	(void)_scmevl_emit(c, _scmevl_arith_ops[i].op, _scmevl_ic(c, op), 0);
+	return;
+      }
+    }
+    (void)_scmevl_emit(c, tail ? _SCMEVL_OP_GTCALL : _SCMEVL_OP_GCALL, _scmevl_ic(c, op), n);
+    return;
+  }
+
+  for (; SCMVAL_NIL != x; x = SCMVAL_CDR(x)) {
+    _scmevl_compile(c, SCMVAL_CAR(x), 0);
+  }
+  (void)_scmevl_emit(c, tail ? _SCMEVL_OP_TCALL : _SCMEVL_OP_CALL, n, 0);
+}
+
+/*
+ * (define-macro (name param ...) body ...) at top level. the transformer
+ * is needed by the forms compiled next, so it is defined while compiling.
+ */
+static void
+_scmevl_compile_define_macro(struct _scmevl_comp *c, scmval x)
+{
+  scmctx *ctx = c->ctx;
+  struct _scmevl_comp tc;
+  scmval target;
+
+  if (_scmevl_length(x) < 3) {
+    scmerr(SCMERR_BAD_SYNTAX, "define-macro: (name param ...) and body expected");
+  }
+  target = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (!SCMVAL_IS_LIST(target) || !SCMVAL_IS_SYMBOL(SCMVAL_CAR(target))) {
+    scmerr(SCMERR_BAD_SYNTAX, "define-macro: (name param ...) expected");
+  }
+  if (c->outer || c->nscope) {
+    scmerr(SCMERR_BAD_SYNTAX, "define-macro: %s not at top level",
+	   SCMVAL_TO_C_STR(SCMVAL_CAR(target)));
+  }
+
+  _scmevl_comp_init(&tc, ctx, NULL, _scmevl_cod_new(ctx, NULL));
+  tc.toplevel = 1;
+  _scmevl_compile_lambda(&tc, SCMVAL_TO_C_STR(SCMVAL_CAR(target)),
+			 SCMVAL_CDR(target), SCMVAL_CDR(SCMVAL_CDR(x)), x);
+  (void)_scmevl_emit(&tc, _SCMEVL_OP_RETURN, 0, 0);
+  scmmac_define(ctx, SCMVAL_CAR(target), _scmevl_run(ctx, tc.cod));
+
+  (void)_scmevl_emit(c, _SCMEVL_OP_CONST, _scmevl_const(c, SCMVAL_CAR(target)), 0);
+}
+
+// a macro call compiles to its expansion, guarded by the macro version
+static void
+_scmevl_compile_macro(struct _scmevl_comp *c, struct scmmac *mac, scmval x, int tail)
+{
+  scmctx *ctx = c->ctx;
+  scmval expansion = scmmac_expand(ctx, mac, x, scmevl_apply);
+  size_t at;
+
+  at = _scmevl_emit(c, _SCMEVL_OP_MACRO, _scmevl_macsite(c, mac, x), 0);
+  _scmevl_compile(c, expansion, tail);
+  _scmevl_patch(c, at);
+}
+
+/*
+ * code of the current expansion of a macro call site. its first locals
+ * are the locals of the code of the call, with the same slots and boxes,
+ * and it has the same free variables. the code of a fresh expansion never
+ * runs in tail position: it returns to copy the locals back.
+ */
+static scmcod *
+_scmevl_macro_thunk(scmctx *ctx, struct _scmevl_macsite *site)
+{
+  struct _scmevl_comp tc;
+  scmcod *cod = site->cod;
+  scmval body, name;
+  int i;
+
+  if (site->thunk && (site->thunk_version == site->mac->version)) {
+    return site->thunk;
+  }
+
+  _scmevl_comp_init(&tc, ctx, NULL, _scmevl_cod_new(ctx, SCMVAL_TO_C_STR(site->mac->name)));
+  tc.anames = cod->nlocals + 1;
+  tc.cod->names = scmmem_alloc(ctx, tc.anames, sizeof(scmval));
+  tc.cod->boxed = scmmem_alloc(ctx, tc.anames, sizeof(char));
+  tc.scope = scmmem_alloc(ctx, tc.anames, sizeof(int));
+  memcpy(tc.cod->names, cod->names, cod->nlocals * sizeof(scmval));
+  memcpy(tc.cod->boxed, cod->boxed, cod->nlocals * sizeof(char));
+  memcpy(tc.scope, site->scope, site->nscope * sizeof(int));
+  tc.cod->nlocals = cod->nlocals;
+  tc.nscope = site->nscope;
+  for (i=0; i<cod->nfree; i++) {
+    (void)_scmevl_free(&tc, cod->frees[i], cod->fsrc[i], cod->fboxed[i]);
+  }
+
+  body = SCMVAL_MAKE_LIST(scmval_cons(ctx, scmmac_expand(ctx, site->mac, site->form, scmevl_apply),
+				      SCMVAL_NIL));
+  _scmevl_boxes(&tc, body);
+  // closures hold copies of the locals without a box, none may be assigned
+  for (i=0; i<site->nscope; i++) {
+    name = cod->names[site->scope[i]];
+    if (!cod->boxed[site->scope[i]] &&
+	((_scmevl_member(name, tc.captured) &&
+	  (_scmevl_member(name, tc.assigned) || _scmevl_member(name, site->assigned))) ||
+	 (_scmevl_member(name, site->captured) && _scmevl_member(name, tc.assigned)))) {
+      scmerr(SCMERR_BAD_SYNTAX, "%s: expansion captures assigned variable %s",
+	     SCMVAL_TO_C_STR(site->mac->name), SCMVAL_TO_C_STR(name));
+    }
+  }
+  _scmevl_compile_scope(&tc, body, tc.nscope, 0);
+  (void)_scmevl_emit(&tc, _SCMEVL_OP_MRETURN, cod->nlocals, 0);
+  scmmem_free(ctx, (void **)&tc.scope);
+
+  site->thunk = tc.cod;
+  site->thunk_version = site->mac->version;
+  return site->thunk;
+}
+
+/*
+ * the expansion of a worker, under the lock of its owner. an error in the
+ * expansion is raised again once the lock is released.
+ */
+static scmcod *
+_scmevl_macro_locked(scmctx *ctx, struct _scmevl_macsite *site)
+{
+  struct _scmevl_thunk t = { ctx, site, NULL };
+  struct scmerr_caught err;
+  int failed;
+
+  (void)pthread_mutex_lock(&ctx->evl->owner->evl->lock);
+  failed = scmerr_catch(_scmevl_macro_locked_run, &t, &err);
+  (void)pthread_mutex_unlock(&ctx->evl->owner->evl->lock);
+  if (failed) {
+    scmerr_raise(&err);
+  }
+  return t.cod;
+}
+
+static void
+_scmevl_macro_locked_run(void *arg)
+{
+  struct _scmevl_thunk *t = arg;
+
+  t->cod = _scmevl_macro_thunk(t->ctx, t->site);
+}
+
+// call a procedure from outside of the vm, or with its state saved
 scmval
-scmevl(scmval v)
+scmevl_apply(scmctx *ctx, scmval proc, int argc, scmval *argv)
 {
+  scmcod *cod;
+  scmval v;
+
+  _scmevl_init(ctx);
+  cod = _scmevl_caller(ctx, proc, argc);
+  v = _scmevl_call(ctx, cod, argv);
+  _scmevl_caller_free(ctx, cod);
   return v;
 }
 
+/*
+ * apply proc to argv[*i] ... argv[n - 1] in turn, storing the values in
+ * out. the code of the call is made once for all of them. *i counts the
+ * calls done, so that after an error raised by the call of argv[*i] the
+ * caller can go on with the next argument.
+ */
+void
+scmevl_map(scmctx *ctx, scmval proc, scmval *argv, scmval *out, size_t *i, size_t n)
+{
+  struct _scmevl_map m = { ctx, NULL, argv, out, i, n };
+  struct scmerr_caught err;
+
+  _scmevl_init(ctx);
+  (void)_scmevl_callable(proc, 1);
+  m.cod = _scmevl_caller(ctx, proc, 1);
+  if (scmerr_catch(_scmevl_map, &m, &err)) {
+    _scmevl_caller_free(ctx, m.cod);
+    scmerr_raise(&err);
+  }
+  _scmevl_caller_free(ctx, m.cod);
+}
+
+static void
+_scmevl_map(void *arg)
+{
+  struct _scmevl_map *m = arg;
+
+  for (; *m->i < m->n; (*m->i)++) {
+    m->out[*m->i] = _scmevl_call(m->ctx, m->cod, &m->argv[*m->i]);
+  }
+}
+
+/*
+ * code calling proc with argc arguments, its constants are the procedure
+ * followed by the arguments. it can be run with other arguments of the
+ * same number.
+ */
+static scmcod *
+_scmevl_caller(scmctx *ctx, scmval proc, int argc)
+{
+  struct _scmevl_comp c;
+  int i;
+
+  _scmevl_comp_init(&c, ctx, NULL, _scmevl_cod_new(ctx, NULL));
+  (void)_scmevl_emit(&c, _SCMEVL_OP_CONST, _scmevl_const(&c, proc), 0);
+  for (i=0; i<argc; i++) {
+    // distinct placeholders, each argument gets a constant of its own
+    (void)_scmevl_emit(&c, _SCMEVL_OP_CONST, _scmevl_const(&c, SCMVAL_MAKE_INTEGER(i)), 0);
+  }
+  (void)_scmevl_emit(&c, _SCMEVL_OP_CALL, argc, 0);
+  (void)_scmevl_emit(&c, _SCMEVL_OP_RETURN, 0, 0);
+  return c.cod;
+}
+
+// run the code of _scmevl_caller with the arguments argv
+static scmval
+_scmevl_call(scmctx *ctx, scmcod *cod, scmval *argv)
+{
+  int i;
+
+  for (i=1; i<(int)cod->nconsts; i++) {
+    cod->consts[i] = argv[i - 1];
+  }
+  return _scmevl_run(ctx, cod);
+}
+
+static void
+_scmevl_caller_free(scmctx *ctx, scmcod *cod)
+{
+  scmmem_free(ctx, (void **)&cod->code);
+  scmmem_free(ctx, (void **)&cod->consts);
+  scmmem_free(ctx, (void **)&cod);
+}
+
+// compile a top-level form
+scmcod *
+scmevl_compile(scmctx *ctx, scmval form)
+{
+  struct _scmevl_comp c;
+
+  _scmevl_init(ctx);
+
+  _scmevl_comp_init(&c, ctx, NULL, _scmevl_cod_new(ctx, NULL));
+  c.toplevel = 1;
+  c.cod->toplevel = 1;
+  (void)scmrdr_source(ctx, form, &c.cod->file, &c.cod->line);
+  if (SCMVAL_IS_LIST(form)) {
+    _scmevl_boxes(&c, SCMVAL_MAKE_LIST(scmval_cons(ctx, form, SCMVAL_NIL)));
+  }
+  _scmevl_compile(&c, form, 1);
+  (void)_scmevl_emit(&c, _SCMEVL_OP_RETURN, 0, 0);
+  if (c.scope) {
+    scmmem_free(ctx, (void **)&c.scope);
+  }
+
+  return c.cod;
+}
+
+
+
+/*
+ * virtual machine
+ */
+
+// boxes hold the variables that closures capture and the program assigns
+#define _SCMEVL_BOX(ctx, v)  scmval_cons((ctx), (v), SCMVAL_NIL)
+#define _SCMEVL_UNBOX(box)   SCMVAL_CAR(box)
+
+/*
+ * a closure of cod. its free variables are copied from the locals at bp
+ * and the free variables fv of the running closure, in one allocation
+ * with the procedure.
+ */
+static struct _scmprc *
+_scmevl_closure(scmctx *ctx, scmcod *cod, scmval *bp, scmval *fv)
+{
+  struct _scmprc *prc = scmmem_arena_alloc(ctx, sizeof(struct _scmprc) + cod->nfree * sizeof(scmval));
+  int j;
+
+  prc->type = SCMPRC_CLOSURE;
+  prc->name = cod->name;
+  prc->u.clo.cod = cod;
+  prc->u.clo.free = (scmval *)(prc + 1);
+  for (j=0; j<cod->nfree; j++) {
+    prc->u.clo.free[j] = (cod->fsrc[j] >= 0) ? bp[cod->fsrc[j]] : fv[-cod->fsrc[j] - 1];
+  }
+  return prc;
+}
+
+// check that v is a procedure accepting n arguments
+static struct _scmprc *
+_scmevl_callable(scmval v, int n)
+{
+  struct _scmprc *prc;
+
+  if (!SCMVAL_IS_PROCEDURE(v)) {
+    scmerr(SCMERR_WRONG_TYPE, "procedure expected");
+  }
+  prc = SCMVAL_TO_PROCEDURE(v);
+  switch (prc->type) {
+  case SCMPRC_PRIMITIVE:
+    if ((prc->u.prim.arity >= 0) && (prc->u.prim.arity != n)) {
+      scmerr(SCMERR_WRONG_ARITY, "%s", prc->name);
+    }
+    break;
+  case SCMPRC_CLOSURE:
+    if (prc->u.clo.cod->nparams != n) {
+      scmerr(SCMERR_WRONG_ARITY, "%s", prc->name ? prc->name : "lambda");
+    }
+    break;
+  default:
+    break;
+  }
+  return prc;
+}
+
+/*
+ * the dispatch jumps directly from one instruction to the next through
+ * a table of label addresses where the compiler supports it.
+ */
+#if defined(__GNUC__)
+#define _SCMEVL_LABEL(op, nargs) &&_scmevl_op_##op,
+#define _SCMEVL_CASE(op)         _scmevl_op_##op:
+#define _SCMEVL_NEXT()           goto *dispatch[*pc++]
+#else
+#define _SCMEVL_CASE(op)         case _SCMEVL_OP_##op:
+#define _SCMEVL_NEXT()           break
+#endif
+
+/*
+ * a sample of the stack of the vm: the code running, the frames below fp
+ * and in a worker the frames of its owner, waiting in pmap. the frames
+ * are filled from the innermost, at the end of frames.
+ */
+static void
+_scmevl_sample(scmctx *ctx, struct _scmevl_frame *fp, scmcod *cod, const char *leaf)
+{
+  struct scmprf_frame frames[SCMPRF_DEPTH];
+  struct _scmevl_frame *f;
+  int n = SCMPRF_DEPTH;
+
+  // another thread may have taken it
+  if (!atomic_exchange(&scmprf_pending, 0)) {
+    return;
+  }
+  if (leaf) {
+    frames[--n] = (struct scmprf_frame){ leaf, NULL, 0 };
+  }
+  for (;;) {
+    n = _scmevl_sample_cod(frames, n, cod);
+    for (f = fp; (f > ctx->evl->frames) && (n > 0); ) {
+      f--;
+      n = _scmevl_sample_cod(frames, n, f->cod);
+    }
+    if (!ctx->evl->owner || (0 == n)) {
+      break;
+    }
+    ctx = ctx->evl->owner;
+    fp = ctx->evl->fp;
+    cod = NULL;
+  }
+  if (n < SCMPRF_DEPTH) {
+    scmprf_sample(frames + n, SCMPRF_DEPTH - n);
+  }
+}
+
+// add cod before the n-th frame, the code scmevl_apply compiles is left out
+static int
+_scmevl_sample_cod(struct scmprf_frame *frames, int n, scmcod *cod)
+{
+  if ((0 == n) || !cod || (!cod->name && !cod->file)) {
+    return n;
+  }
+  n--;
+  frames[n].name = cod->name ? cod->name : (cod->toplevel ? "toplevel" : "lambda");
+  frames[n].file = cod->file;
+  frames[n].line = cod->line;
+  return n;
+}
+
+// take the sample scmprf marked as due, leaf is the primitive returning
+#define _SCMEVL_SAMPLE(leaf)						\
+  if (atomic_load_explicit(&scmprf_pending, memory_order_relaxed)) {	\
+    _scmevl_sample(ctx, fp, cod, (leaf));				\
+  }
+
+/*
+ * the locals of a call are the bottom of its part of the value stack, at
+ * bp. the arguments are moved there and become the parameters, the stack
+ * of the call starts above its locals.
+ */
+static scmval
+_scmevl_run(scmctx *ctx, scmcod *cod)
+{
+  struct _scmevl_state *st = ctx->evl;
+
+#if defined(__GNUC__)
+  static void *const dispatch[] = {
+    _SCMEVL_OPCODES(_SCMEVL_LABEL)
+  };
+#endif
+  struct _scmevl_frame *fbase = st->fp;
+  struct _scmevl_frame *fp = st->fp;
+  scmval *bp = st->sp;
+  scmval *sp = bp;
+  scmval *fv = NULL;
+  const int32_t *pc = cod->code;
+  struct _scmprc *prc;
+  struct _scmevl_global *g;
+  struct _scmevl_ic *ic;
+  struct _scmevl_macsite *site;
+  struct _scmprc mprc;
+  scmcod *callee;
+  scmval v, *base;
+  int n, i, tail;
+
+  if (bp + cod->nlocals + cod->maxstack > st->stack + _SCMEVL_STACKSIZE) {
+    scmerr(SCMERR_STACK_OVERFLOW, "value stack");
+  }
+  for (i=0; i<cod->nlocals; i++) {
+    *sp++ = SCMVAL_UNBOUND;
+  }
+
+#if defined(__GNUC__)
+  _SCMEVL_NEXT();
+#else
+  for (;;) {
+    switch (*pc++) {
+#endif
+
+  _SCMEVL_CASE(CONST)
+    *sp++ = cod->consts[*pc++];
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(LREF)
+    v = bp[*pc++];
+    if (SCMVAL_UNBOUND == v) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(cod->names[pc[-1]]));
+    }
+    *sp++ = v;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(LSET)
+    bp[*pc++] = sp[-1];
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(BREF)
+    v = _SCMEVL_UNBOX(bp[*pc++]);
+    if (SCMVAL_UNBOUND == v) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(cod->names[pc[-1]]));
+    }
+    *sp++ = v;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(BSET)
+    _SCMEVL_UNBOX(bp[*pc++]) = sp[-1];
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(FREF)
+    *sp++ = fv[*pc++];
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(FBREF)
+    v = _SCMEVL_UNBOX(fv[*pc++]);
+    if (SCMVAL_UNBOUND == v) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(cod->frees[pc[-1]]));
+    }
+    *sp++ = v;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(FBSET)
+    _SCMEVL_UNBOX(fv[*pc++]) = sp[-1];
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(BOX)
+    i = *pc++;
+    bp[i] = _SCMEVL_BOX(ctx, bp[i]);
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(MKBOX)
+    bp[*pc++] = _SCMEVL_BOX(ctx, SCMVAL_UNBOUND);
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(GREF)
+    g = cod->cells[*pc++];
+    if (SCMVAL_UNBOUND == g->val) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(g->sym));
+    }
+    *sp++ = g->val;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(GSET)
+    g = cod->cells[*pc++];
+    if (SCMVAL_UNBOUND == g->val) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(g->sym));
+    }
+    g->val = sp[-1];
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(GDEF)
+    g = cod->cells[*pc++];
+    g->val = sp[-1];
+    sp[-1] = g->sym;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(POP)
+    sp--;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(JUMP)
+    pc = cod->code + *pc;
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(JUMPF)
+    if (SCMVAL_FALSE == *--sp) {
+      pc = cod->code + *pc;
+    } else {
+      pc++;
+    }
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(CLOSURE)
+    prc = _scmevl_closure(ctx, cod->procs[*pc++], bp, fv);
+    *sp++ = SCMVAL_MAKE_PROCEDURE(prc);
+    _SCMEVL_NEXT();
+
+  _SCMEVL_CASE(CALL)
+    n = *pc++;
+    base = sp - n - 1;
+    tail = 0;
+    goto _scmevl_call;
+
+  /*
+   * a call in tail position replaces the frame of the caller, so loops
+   * written as tail recursion run in constant stack. the arguments are
+   * moved to the locals of the caller.
+   */
+  _SCMEVL_CASE(TCALL)
+    n = *pc++;
+    base = sp - n - 1;
+    tail = 1;
+  _scmevl_call:
+    prc = _scmevl_callable(*base, n);
+    switch (prc->type) {
+    case SCMPRC_PRIMITIVE:
+      goto _scmevl_primitive;
+    case SCMPRC_CLOSURE:
+      callee = prc->u.clo.cod;
+      // the arguments of a new frame replace the procedure
+      for (i=0; !tail && (i<n); i++) {
+	base[i] = base[i + 1];
+      }
+      goto _scmevl_enter;
+    default:
+      scmerr(SCMERR_WRONG_TYPE, "procedure of another interpreter");
+    }
+
+  _SCMEVL_CASE(GCALL)
+    tail = 0;
+    goto _scmevl_gcall;
+
+  _SCMEVL_CASE(GTCALL)
+    tail = 1;
+  _scmevl_gcall:
+    ic = &cod->ics[*pc++];
+    n = *pc++;
+  _scmevl_gcall_ic:
+    base = sp - n;
+    v = ic->cell->val;
+    for (i=0; i<ic->nways; i++) {
+      if (v == ic->way[i].proc) {
+	st->icstats.hits++;
+	prc = SCMVAL_TO_PROCEDURE(v);
+	callee = ic->way[i].cod;
+	if (callee) {
+	  goto _scmevl_enter;
+	}
+	goto _scmevl_primitive;
+      }
+    }
+    if (SCMVAL_UNBOUND == v) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(ic->cell->sym));
+    }
+    prc = _scmevl_callable(v, n);
+    if (SCMPRC_CLOSURE == prc->type) {
+      callee = prc->u.clo.cod;
+    } else if (SCMPRC_PRIMITIVE == prc->type) {
+      callee = NULL;
+    } else {
+      scmerr(SCMERR_WRONG_TYPE, "procedure of another interpreter");
+    }
+    if (ic->nways < 0) {
+      st->icstats.megamorphic++;
+    } else if (st->owner) {
+      st->icstats.misses++;
+    } else if (ic->nways == _SCMEVL_IC_WAYS) {
+      st->icstats.megamorphic++;
+      ic->nways = -1;
+    } else {
+      st->icstats.misses++;
+      ic->way[ic->nways].proc = v;
+      ic->way[ic->nways].cod = callee;
+      ic->nways++;
+    }
+    if (callee) {
+      goto _scmevl_enter;
+    }
+    goto _scmevl_primitive;
+
+  // prc accepts the n arguments on top of the stack, it may call back
+  // into the vm above them
+  _scmevl_primitive:
+    st->sp = sp;
+    fp->cod = cod;
+    st->fp = fp + 1;
+    v = prc->u.prim.fn(ctx, n, sp - n);
+    st->fp = fbase;
+    _SCMEVL_SAMPLE(prc->name);
+    if (tail) {
+      goto _scmevl_return;
+    }
+    sp = base;
+    *sp++ = v;
+    _SCMEVL_NEXT();
+
+  /*
+   * callee is the code of the closure prc and accepts the n arguments at
+   * the top of the stack, a new frame has them at base already.
+   */
+  _scmevl_enter:
+    if (!tail) {
+      if (fp >= st->frames + _SCMEVL_FRAMES) {
+	scmerr(SCMERR_STACK_OVERFLOW, "%s", prc->name ? prc->name : "lambda");
+      }
+      fp->cod = cod;
+      fp->pc = pc;
+      fp->bp = bp;
+      fp->fv = fv;
+      fp++;
+      bp = base;
+    } else {
+      for (i=0; i<n; i++) {
+	bp[i] = sp[i - n];
+      }
+    }
+    cod = callee;
+    fv = prc->u.clo.free;
+    pc = cod->code;
+    if (bp + cod->nlocals + cod->maxstack > st->stack + _SCMEVL_STACKSIZE) {
+      scmerr(SCMERR_STACK_OVERFLOW, "value stack");
+    }
+    for (sp = bp + n, i = n; i < cod->nlocals; i++) {
+      *sp++ = SCMVAL_UNBOUND;
+    }
+    _SCMEVL_SAMPLE(NULL);
+    _SCMEVL_NEXT();
+
+  /*
+   * the inline expansion is stale after a redefinition of its macro. the
+   * fresh expansion is called with the locals of the frame as arguments,
+   * it shares the free variables. the compiler may run code through the
+   * vm, it starts above the saved state.
+   */
+  _SCMEVL_CASE(MACRO)
+    site = &cod->macros[*pc++];
+    if (site->version == site->mac->version) {
+      pc++;
+      _SCMEVL_NEXT();
+    }
+    st->sp = sp;
+    fp->cod = cod;
+    st->fp = fp + 1;
+    if (st->owner) {
+      callee = _scmevl_macro_locked(ctx, site);
+    } else {
+      callee = _scmevl_macro_thunk(ctx, site);
+    }
+    st->fp = fbase;
+    pc = cod->code + *pc;
+    mprc.type = SCMPRC_CLOSURE;
+    mprc.name = callee->name;
+    mprc.u.clo.cod = callee;
+    mprc.u.clo.free = fv;
+    prc = &mprc;
+    n = cod->nlocals;
+    base = sp;
+    for (i=0; i<n; i++) {
+      base[i] = bp[i];
+    }
+    tail = 0;
+    goto _scmevl_enter;
+
+  _SCMEVL_CASE(MRETURN)
+    v = sp[-1];
+    for (i=0, n = *pc++; i<n; i++) {
+      fp[-1].bp[i] = bp[i];
+    }
+    goto _scmevl_return;
+
+  /*
+   * integer operators. the operands stay tagged, see scmprm_fx_add. if the
+   * global no longer holds the builtin or an operand is not an integer the
+   * operator is called through the inline cache. that call is never a tail
+   * call, a RETURN follows in tail position.
+   */
+#define _SCMEVL_ARITH(op, expr)						\
+  _SCMEVL_CASE(op)							\
+    ic = &cod->ics[*pc++];						\
+    if ((ic->cell->val != st->arith_procs[_SCMEVL_OP_##op - _SCMEVL_OP_ADD]) || \
+	!SCMVAL_ARE_INTEGERS(sp[-2], sp[-1])) {				\
+      n = 2;								\
+      tail = 0;								\
+      goto _scmevl_gcall_ic;						\
+    }									\
+    sp--;								\
+    sp[-1] = (expr);							\
+    _SCMEVL_NEXT();
+
+#define _SCMEVL_CMP(a, op, b) \
+  (((intptr_t)(a) op (intptr_t)(b)) ? SCMVAL_TRUE : SCMVAL_FALSE)
+
+  _SCMEVL_ARITH(ADD, scmprm_fx_add(sp[-1], sp[0]))
+  _SCMEVL_ARITH(SUB, scmprm_fx_sub(sp[-1], sp[0]))
+  _SCMEVL_ARITH(MUL, scmprm_fx_mul(sp[-1], sp[0]))
+  _SCMEVL_ARITH(NUMEQ, _SCMEVL_CMP(sp[-1], ==, sp[0]))
+  _SCMEVL_ARITH(LT, _SCMEVL_CMP(sp[-1], <, sp[0]))
+  _SCMEVL_ARITH(GT, _SCMEVL_CMP(sp[-1], >, sp[0]))
+  _SCMEVL_ARITH(LE, _SCMEVL_CMP(sp[-1], <=, sp[0]))
+  _SCMEVL_ARITH(GE, _SCMEVL_CMP(sp[-1], >=, sp[0]))
+
+  _SCMEVL_CASE(RETURN)
+    v = sp[-1];
+  _scmevl_return:
+    _SCMEVL_SAMPLE(NULL);
+    sp = bp;
+    if (fp == fbase) {
+      st->sp = sp;
+      return v;
+    }
+    fp--;
+    cod = fp->cod;
+    pc = fp->pc;
+    bp = fp->bp;
+    fv = fp->fv;
+    *sp++ = v;
+    _SCMEVL_NEXT();
+
+#if !defined(__GNUC__)
+    }
+  }
+#endif
+}
+
+// inline cache counters of global calls
+void
+scmevl_icstats(scmctx *ctx, struct scmevl_icstats *st)
+{
+  _scmevl_init(ctx);
+  *st = ctx->evl->icstats;
+}
+
+// (inline-cache-stats) is (hits misses megamorphic)
+static scmval
+_scmevl_icstats_list(scmctx *ctx, int argc, scmval *argv)
+{
+  struct _scmevl_state *st = ctx->evl;
+
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_INTEGER((intptr_t)st->icstats.hits),
+    SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_INTEGER((intptr_t)st->icstats.misses),
+      SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_INTEGER((intptr_t)st->icstats.megamorphic),
+				   SCMVAL_NIL))))));
+}
+
+/*
+ * (pmap proc list) is the list of the values of proc applied to each
+ * element, in the order of the list. a worker runs the calls of a part of
+ * the list in its own context; cells are allocated without locking there,
+ * and its counters are added to ctx when the map is done. proc is applied
+ * to the first element by the caller, which fills the inline caches of its
+ * code before the workers start. the calls run in no particular order, so
+ * proc must not assign globals or rely on the effects of other calls.
+ */
+static scmval
+_scmevl_pmap(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval *out, l = SCMVAL_NIL;
+  struct scmerr_caught err;
+  int n = _scmevl_length(argv[1]);
+
+  if (n < 0) {
+    scmerr(SCMERR_WRONG_TYPE, "pmap: list expected");
+  }
+  (void)_scmevl_callable(argv[0], 1);
+  out = scmmem_alloc(ctx, n + 1, sizeof(scmval));
+  if (_scmevl_pmap_list(ctx, argv[0], argv[1], out, &err)) {
+    scmmem_free(ctx, (void **)&out);
+    scmerr_raise(&err);
+  }
+  while (n-- > 0) {
+    l = SCMVAL_MAKE_LIST(scmval_cons(ctx, out[n], l));
+  }
+  scmmem_free(ctx, (void **)&out);
+  return l;
+}
+
+// (pfor-each proc list) applies proc to each element like pmap
+static scmval
+_scmevl_pfor_each(scmctx *ctx, int argc, scmval *argv)
+{
+  struct scmerr_caught err;
+
+  if (_scmevl_length(argv[1]) < 0) {
+    scmerr(SCMERR_WRONG_TYPE, "pfor-each: list expected");
+  }
+  (void)_scmevl_callable(argv[0], 1);
+  if (_scmevl_pmap_list(ctx, argv[0], argv[1], NULL, &err)) {
+    scmerr_raise(&err);
+  }
+  return SCMVAL_NIL;
+}
+
+/*
+ * apply proc to the elements of the proper list l, storing the values in
+ * out unless it is NULL. short lists, maps in a worker and contexts with
+ * a single worker run sequentially. the calls of the caller run under an
+ * error handler too, and an error in a worker stops the map: the first
+ * error is returned in err for the caller to raise once it has released
+ * its own allocations.
+ */
+static int
+_scmevl_pmap_list(scmctx *ctx, scmval proc, scmval l, scmval *out, struct scmerr_caught *err)
+{
+  struct _scmevl_state *st = ctx->evl;
+  struct _scmevl_pmap pm;
+  struct _scmevl_pmap_part part;
+  scmval *in;
+  scmctx *w;
+  size_t n, i;
+  int nw, seq, failed;
+
+  n = (size_t)_scmevl_length(l);
+  nw = st->nworkers ? st->nworkers : scmpar_ncpu();
+  seq = (n < _SCMEVL_PMAP_MIN) || st->owner || (nw < 2);
+  if (!seq && !st->pool) {
+    st->pool = scmpar_new(ctx, nw);
+    st->workers = scmmem_alloc(ctx, scmpar_workers(st->pool), sizeof(scmctx *));
+    for (i=0; i<(size_t)scmpar_workers(st->pool); i++) {
+      st->workers[i] = _scmevl_worker(ctx);
+    }
+  }
+  in = scmmem_alloc(ctx, n + 1, sizeof(scmval));
+  for (i=0; i<n; i++, l = SCMVAL_CDR(l)) {
+    in[i] = SCMVAL_CAR(l);
+  }
+
+  // all calls or the first one by the caller
+  pm.proc = proc;
+  pm.in = in;
+  pm.out = out;
+  atomic_init(&pm.failed, 0);
+  part.pm = &pm;
+  part.ctx = ctx;
+  part.cod = _scmevl_caller(ctx, proc, 1);
+  part.begin = 0;
+  part.end = seq ? n : 1;
+  failed = scmerr_catch(_scmevl_pmap_part, &part, err);
+  _scmevl_caller_free(ctx, part.cod);
+  if (failed || seq) {
+    scmmem_free(ctx, (void **)&in);
+    return failed;
+  }
+
+  pm.workers = st->workers;
+  pm.in = in + 1;
+  pm.out = out ? out + 1 : NULL;
+  for (i=0; i<(size_t)scmpar_workers(st->pool); i++) {
+    // the workers see macros defined since the last map
+    st->workers[i]->mac = ctx->mac;
+    st->workers[i]->out = ctx->out;
+    _scmevl_worker_arena(ctx, st->workers[i]);
+  }
+  scmpar_for(st->pool, n - 1, _SCMEVL_PMAP_GRAIN, _scmevl_pmap_run, &pm);
+
+  for (i=0; i<(size_t)scmpar_workers(st->pool); i++) {
+    w = st->workers[i];
+    scmctx_merge(ctx, w);
+    st->icstats.hits += w->evl->icstats.hits;
+    st->icstats.misses += w->evl->icstats.misses;
+    st->icstats.megamorphic += w->evl->icstats.megamorphic;
+    memset(&w->evl->icstats, 0, sizeof(struct scmevl_icstats));
+  }
+  scmmem_free(ctx, (void **)&in);
+  if (atomic_load(&pm.failed)) {
+    *err = pm.err;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * calls of a worker, in its context. the first worker to fail stores its
+ * error in the map, the others skip the indices they have left.
+ */
+static void
+_scmevl_pmap_run(void *arg, int worker, size_t begin, size_t end)
+{
+  struct _scmevl_pmap *pm = arg;
+  struct _scmevl_pmap_part part;
+  struct scmerr_caught err;
+
+  if (atomic_load_explicit(&pm->failed, memory_order_relaxed)) {
+    return;
+  }
+  part.pm = pm;
+  part.ctx = pm->workers[worker];
+  part.cod = _scmevl_caller(part.ctx, pm->proc, 1);
+  part.begin = begin;
+  part.end = end;
+  if (scmerr_catch(_scmevl_pmap_part, &part, &err)) {
+    scmevl_recover(part.ctx);
+    if (!atomic_exchange(&pm->failed, 1)) {
+      pm->err = err;
+    }
+  }
+  _scmevl_caller_free(part.ctx, part.cod);
+}
+
+static void
+_scmevl_pmap_part(void *arg)
+{
+  struct _scmevl_pmap_part *part = arg;
+  struct _scmevl_pmap *pm = part->pm;
+  scmval v;
+  size_t i;
+
+  for (i=part->begin; i<part->end; i++) {
+    if (atomic_load_explicit(&pm->failed, memory_order_relaxed)) {
+      break;
+    }
+    v = _scmevl_call(part->ctx, part->cod, &pm->in[i]);
+    if (pm->out) {
+      pm->out[i] = v;
+    }
+  }
+}
+
+/*
+ * the worker w allocates from an arena of its own while ctx has one. it is
+ * reset once that of ctx was, when the values of the worker are no longer
+ * used, and released once ctx has none.
+ */
+static void
+_scmevl_worker_arena(scmctx *ctx, scmctx *w)
+{
+  if (!ctx->arena) {
+    if (w->arena) {
+      scmmem_arena_free(w);
+    }
+    return;
+  }
+  if (!w->arena) {
+    scmmem_arena_new(w);
+  } else if (w->evl->resets != ctx->arena->resets) {
+    scmmem_arena_reset(w);
+  }
+  w->evl->resets = ctx->arena->resets;
+}
+
+// reset the vm of ctx after an error raised in it was caught outside of it
+void
+scmevl_recover(scmctx *ctx)
+{
+  if (ctx->evl) {
+    ctx->evl->sp = ctx->evl->stack;
+    ctx->evl->fp = ctx->evl->frames;
+  }
+}
+
+// number of threads of pmap, 0 for one per processor
+void
+scmevl_set_workers(scmctx *ctx, int n)
+{
+  _scmevl_init(ctx);
+  ctx->evl->nworkers = n;
+}
+
+// run compiled top-level code
+scmval
+scmevl_execute(scmctx *ctx, scmcod *cod)
+{
+  _scmevl_init(ctx);
+  return _scmevl_run(ctx, cod);
+}
+
+// eval()
+scmval
+scmevl(scmctx *ctx, scmval v)
+{
+  scmcod *cod;
+
+  if (SCMVAL_EOF == v) {
+    return v;
+  }
+  cod = scmevl_compile(ctx, v);
+  if (ctx->evl->listing) {
+    scmevl_disassemble(ctx->evl->listing, cod);
+  }
+  return scmevl_execute(ctx, cod);
+}
+
+
+
+/*
+ * disassembler
+ */
+
+// if fp is not NULL, scmevl() writes the listing of each form to fp
+void
+scmevl_set_listing(scmctx *ctx, FILE *fp)
+{
+  _scmevl_init(ctx);
+  ctx->evl->listing = fp;
+}
+
+// short external representation of a constant
+static void
+_scmevl_write(FILE *fp, scmval v)
+{
+  if (SCMVAL_IS_INTEGER(v)) {
+    fprintf(fp, "%li", SCMVAL_TO_C_INT(v));
+  } else if (SCMVAL_IS_NIL(v)) {
+    fputs("nil", fp);
+  } else if (SCMVAL_IS_TRUE(v)) {
+    fputs("true", fp);
+  } else if (SCMVAL_IS_FALSE(v)) {
+    fputs("false", fp);
+  } else if (SCMVAL_IS_STRING(v)) {
+    fprintf(fp, "\"%s\"", SCMVAL_TO_C_STR(v));
+  } else if (SCMVAL_IS_SYMBOL(v)) {
+    fputs(SCMVAL_TO_C_STR(v), fp);
+  } else if (SCMVAL_IS_LIST(v)) {
+    fputs("(", fp);
+    _scmevl_write(fp, SCMVAL_CAR(v));
+    fputs(SCMVAL_NIL == SCMVAL_CDR(v) ? ")" : " ...)", fp);
+  } else if (SCMVAL_IS_PROCEDURE(v)) {
+    fputs("#<procedure>", fp);
+  } else {
+    fputs("#<unknown>", fp);
+  }
+}
+
+// listing of one code object, followed by its nested lambdas
+static void
+_scmevl_list(FILE *fp, scmcod *cod)
+{
+  size_t pc, i;
+  int op;
+
+  fprintf(fp, "; %s params=%i locals=%i free=%i stack=%i\n",
+	  cod->name ? cod->name : "lambda", cod->nparams, cod->nlocals, cod->nfree,
+	  cod->maxstack);
+
+  for (pc = 0; pc < cod->ncode; pc += 1 + _scmevl_op_nargs[op]) {
+    op = cod->code[pc];
+    fprintf(fp, "%04zu  %-8s", pc, _scmevl_op_names[op]);
+    for (i=1; i<=(size_t)_scmevl_op_nargs[op]; i++) {
+      fprintf(fp, " %i", cod->code[pc + i]);
+    }
+    switch (op) {
+    case _SCMEVL_OP_CONST:
+      fputs("\t; ", fp);
+      _scmevl_write(fp, cod->consts[cod->code[pc + 1]]);
+      break;
+    case _SCMEVL_OP_LREF:
+    case _SCMEVL_OP_LSET:
+    case _SCMEVL_OP_BREF:
+    case _SCMEVL_OP_BSET:
+    case _SCMEVL_OP_BOX:
+    case _SCMEVL_OP_MKBOX:
+      fprintf(fp, "\t; %s", SCMVAL_TO_C_STR(cod->names[cod->code[pc + 1]]));
+      break;
+    case _SCMEVL_OP_FREF:
+    case _SCMEVL_OP_FBREF:
+    case _SCMEVL_OP_FBSET:
+      fprintf(fp, "\t; %s", SCMVAL_TO_C_STR(cod->frees[cod->code[pc + 1]]));
+      break;
+    case _SCMEVL_OP_GREF:
+    case _SCMEVL_OP_GSET:
+    case _SCMEVL_OP_GDEF:
+      fprintf(fp, "\t; %s", SCMVAL_TO_C_STR(cod->cells[cod->code[pc + 1]]->sym));
+      break;
+    case _SCMEVL_OP_GCALL:
+    case _SCMEVL_OP_GTCALL:
+    case _SCMEVL_OP_ADD:
+    case _SCMEVL_OP_SUB:
+    case _SCMEVL_OP_MUL:
+    case _SCMEVL_OP_NUMEQ:
+    case _SCMEVL_OP_LT:
+    case _SCMEVL_OP_GT:
+    case _SCMEVL_OP_LE:
+    case _SCMEVL_OP_GE:
+      fprintf(fp, "\t; %s", SCMVAL_TO_C_STR(cod->ics[cod->code[pc + 1]].cell->sym));
+      break;
+    case _SCMEVL_OP_MACRO:
+      fprintf(fp, "\t; %s", SCMVAL_TO_C_STR(cod->macros[cod->code[pc + 1]].mac->name));
+      break;
+    case _SCMEVL_OP_CLOSURE:
+      fprintf(fp, "\t; %s", cod->procs[cod->code[pc + 1]]->name ?
+	      cod->procs[cod->code[pc + 1]]->name : "lambda");
+      break;
+    }
+    fputc('\n', fp);
+  }
+
+  for (i=0; i<cod->nprocs; i++) {
+    _scmevl_list(fp, cod->procs[i]);
+  }
+}
+
+// write a listing of compiled code and its nested lambdas
+void
+scmevl_disassemble(FILE *fp, scmcod *cod)
+{
+  _scmevl_list(fp, cod);
+}
@@ -14,10 +14,135 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+
 #ifndef _SCMEVL_H
 #define _SCMEVL_H
 
+/*
+
+scmevl compiles each form to bytecode and runs it on a stack machine.
+
+  - a code object holds the opcodes with their operands, a constant pool
+    and the code objects of nested lambdas.
+  - procedure calls push a frame onto the frame stack of the vm, not onto
+    the c stack.
+  - every call of a compiled procedure keeps its parameters, internal
+    definitions and let variables in a frame on the value stack of the
+    vm, below the operands of its code. a call allocates nothing.
+  - a closure holds copies of the variables of enclosing lambdas it refers
+    to, allocated with the procedure. a variable that a closure captures
+    and that is assigned lives in a box on the heap instead, shared by the
+    frame and the closures; the compiler finds these before compiling a
+    body. a lambda applied directly is compiled as a let.
+  - calls in tail position replace the frame of the caller in place, so
+    tail recursive loops run in constant space.
+  - calls of global procedures go through an inline cache at the call
+    site, which remembers the procedures already checked there.
+  - two argument calls of the global integer operators + - * = < > <= >=
+    compile to an opcode that works on the tagged integers directly, as
+    long as the global holds the builtin.
+  - macro calls are expanded by the compiler, once per source form. the
+    expansion is compiled in place behind a check of the macro version;
+    after a redefinition the form is expanded and compiled again when it
+    is next run, working on a copy of the locals of the frame. a fresh
+    expansion that would assign a variable some closure holds a copy of
+    is an error.
+  - variables are resolved by the compiler: locals to a slot of the frame,
+    variables of enclosing lambdas to a free variable of the closure and
+    globals to their cell. the vm never looks up a name.
+  - the vm takes the samples of scmprf when it enters or leaves a
+    procedure and when a primitive returns. the code objects know the
+    location of their source, if the reader tracked it.
+  - pmap and pfor-each apply a procedure to the elements of a list on a
+    pool of threads, see scmpar. each thread runs a vm of its own that
+    shares the globals and the code.
+
+*/
+
+// compiled code of a lambda or a top-level form
+typedef struct _scmcod scmcod;
+
+// binding of a global variable
+struct _scmevl_global;
+
+// inline cache of a call site
+struct _scmevl_ic;
+
+// macro call compiled into the code
+struct _scmevl_macsite;
+
+// inline cache counters of global calls
+struct scmevl_icstats {
+  unsigned long hits;           // calls of a cached procedure
+  unsigned long misses;         // calls that cached a procedure
+  unsigned long megamorphic;    // calls at sites with too many procedures
+};
+
+struct _scmcod {
+  const char *name;     // NULL for top-level forms and anonymous lambdas
+  const char *file;     // where the source was read, NULL if not known
+  int line;
+  int toplevel;         // code of a top-level form
+  int nparams;          // number of parameters
+  int nlocals;          // parameters and internal definitions
+  int maxstack;         // stack slots used by the code
+  scmval *names;        // names of the locals
+  char *boxed;          // locals held in a box
+  scmval *frees;        // names of the free variables
+  int *fsrc;            // where CLOSURE copies each free variable from, a
+                        // local of the frame or -1 - index of a free
+                        // variable of the running closure
+  char *fboxed;         // free variables holding a box
+  int nfree;
+  int32_t *code;        // opcodes, each followed by its operands
+  size_t ncode;
+  size_t acode;
+  scmval *consts;       // constant pool
+  size_t nconsts;
+  size_t aconsts;
+  struct _scmevl_global **cells;  // globals referenced by the code
+  size_t ncells;
+  size_t acells;
+  struct _scmevl_ic *ics;         // inline caches of global calls
+  size_t nics;
+  struct _scmevl_macsite *macros; // expanded macro calls
+  size_t nmacros;
+  scmcod **procs;       // code of nested lambdas
+  size_t nprocs;
+  size_t aprocs;
+};
+
 // eval()
-scmval scmevl(scmval);
+scmval scmevl(scmctx *ctx, scmval v);
+
+// compile a top-level form
+scmcod *scmevl_compile(scmctx *ctx, scmval form);
+
+// call a procedure from outside of the vm, or with its state saved
+scmval scmevl_apply(scmctx *ctx, scmval proc, int argc, scmval *argv);
+
+// apply proc to argv[*i] ... argv[n - 1], the values in out, *i counts the calls
+void scmevl_map(scmctx *ctx, scmval proc, scmval *argv, scmval *out, size_t *i, size_t n);
+
+// run compiled top-level code
+scmval scmevl_execute(scmctx *ctx, scmcod *cod);
+
+// write a listing of compiled code and its nested lambdas
+void scmevl_disassemble(FILE *fp, scmcod *cod);
+
+// if fp is not NULL, scmevl() writes the listing of each form to fp
+void scmevl_set_listing(scmctx *ctx, FILE *fp);
+
+// inline cache counters of global calls
+void scmevl_icstats(scmctx *ctx, struct scmevl_icstats *st);
+
+// bind a global variable
+void scmevl_define(scmctx *ctx, const char *name, scmval v);
+
+// number of threads of pmap and pfor-each, 0 for one per processor
+void scmevl_set_workers(scmctx *ctx, int n);
+
+// reset the vm of ctx after an error raised in it was caught outside of it
+void scmevl_recover(scmctx *ctx);
 
 #endif
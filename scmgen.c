@@ -0,0 +1,1519 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>   /* errno */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmspl.h"
+#include "scmmac.h"
+#include "scmprm.h"
+#include "scmevl.h"
+#include "scmcrt.h"
+#include "scmgen.h"
+
+// Implementation limits:
+#define _SCMGEN_MSGSIZE    256
+
+// compiler state of one c function
+struct _scmgen_comp {
+  struct _scmgen_comp *outer;   // enclosing lambda
+  int fn;               // number of the function
+  FILE *fp;             // its body
+  char *buf;
+  size_t size;
+  const char *name;     // NULL for top-level forms and anonymous lambdas
+  int nparams;
+  int toplevel;         // defines bind globals
+  scmval *names;        // names of the locals
+  char *boxed;          // locals held in a box
+  char *defined;        // locals of internal definitions, maybe unbound
+  int nlocals;
+  int anames;
+  int *scope;           // slots of the visible locals, innermost last
+  int nscope;
+  scmval *frees;        // names of the free variables
+  int *fsrc;            // local of the enclosing function or -1 - index
+  char *fboxed;         // of its free variable, see scmcod
+  int nfree;
+  int afree;
+  scmval captured;      // names referenced in nested lambdas
+  scmval assigned;      // names assigned by set! or define
+  scmval boxes;         // names of the locals held in a box
+  int ntemps;           // c variables of intermediate values
+  int self;             // a tail call of the function to itself
+  int indent;           // of the statements
+};
+
+// how a variable resolved
+enum {
+  _SCMGEN_GLOBAL,
+  _SCMGEN_LOCAL,
+  _SCMGEN_FREE,
+};
+
+// globals with an integer operator for calls of two arguments
+static const struct {
+  const char *name;
+  const char *expr;     // of the operands a and b
+} _scmgen_arith_ops[] = {
+  {"+", "scmprm_fx_add(%s, %s)"},
+  {"-", "scmprm_fx_sub(%s, %s)"},
+  {"*", "scmprm_fx_mul(%s, %s)"},
+  {"=", "SCMCRT_CMP(%s, ==, %s)"},
+  {"<", "SCMCRT_CMP(%s, <, %s)"},
+  {">", "SCMCRT_CMP(%s, >, %s)"},
+  {"<=", "SCMCRT_CMP(%s, <=, %s)"},
+  {">=", "SCMCRT_CMP(%s, >=, %s)"},
+};
+#define _SCMGEN_NARITH (sizeof(_scmgen_arith_ops) / sizeof(_scmgen_arith_ops[0]))
+
+// context expanding the macros, the symbols are its symbols
+static scmctx *_scmgen_ctx;
+static scmval _scmgen_sym_quote;
+static scmval _scmgen_sym_if;
+static scmval _scmgen_sym_define;
+static scmval _scmgen_sym_set;
+static scmval _scmgen_sym_lambda;
+static scmval _scmgen_sym_begin;
+static scmval _scmgen_sym_let;
+static scmval _scmgen_sym_define_macro;
+static scmval _scmgen_arith_syms[_SCMGEN_NARITH];
+
+// the program: functions by number, top-level forms in order
+static char **_scmgen_funcs;
+static int _scmgen_nfuncs;
+static int _scmgen_afuncs;
+static int *_scmgen_forms;
+static int _scmgen_nforms;
+static int _scmgen_aforms;
+
+// globals, the flag is set for an operator that needs a copy of the builtin
+static scmval *_scmgen_globals;
+static char *_scmgen_builtins;
+static int _scmgen_nglobals;
+static int _scmgen_aglobals;
+
+/*
+ * macros are expanded once, at compile time, by transformers that cannot
+ * see the globals of the program. the macros expanded so far may not be
+ * redefined, the globals the program writes not be referenced by a
+ * transformer and the primitives transformers refer to not be written.
+ */
+static scmval _scmgen_prims;        // symbols of the primitives
+static scmval _scmgen_expanded;     // macros expanded so far
+static scmval _scmgen_written;      // globals defined or assigned so far
+static scmval _scmgen_referenced;   // globals referenced by transformers
+
+// constants other than immediate values
+static scmval *_scmgen_consts;
+static int _scmgen_nconsts;
+static int _scmgen_aconsts;
+
+// syntax errors unwind to scmgen_form
+static jmp_buf _scmgen_error;
+static char _scmgen_msg[_SCMGEN_MSGSIZE];
+static struct _scmgen_comp *_scmgen_current;
+
+/* static prototypes */
+static void _scmgen_init(void);
+static _Noreturn void _scmgen_syntax(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+static int _scmgen_length(scmval l);
+static int _scmgen_member(scmval x, scmval l);
+static void _scmgen_cstr(FILE *fp, const char *s);
+static void _scmgen_emit(struct _scmgen_comp *c, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void _scmgen_indent(struct _scmgen_comp *c);
+static void _scmgen_line(struct _scmgen_comp *c, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
+static void _scmgen_value(struct _scmgen_comp *c, int tail);
+static void _scmgen_end(struct _scmgen_comp *c, int tail);
+static int _scmgen_temp(struct _scmgen_comp *c);
+static int _scmgen_global(scmval sym);
+static void _scmgen_const(struct _scmgen_comp *c, scmval v);
+static void _scmgen_quotable(scmval v);
+static void _scmgen_datum(FILE *fp, scmval v);
+static void _scmgen_comp_init(struct _scmgen_comp *c, struct _scmgen_comp *outer, const char *name);
+static void _scmgen_comp_free(struct _scmgen_comp *c);
+static void _scmgen_finish(struct _scmgen_comp *c);
+static void _scmgen_scan(struct _scmgen_comp *c, scmval x, int inner);
+static void _scmgen_boxes(struct _scmgen_comp *c, scmval body);
+static int _scmgen_scoped(struct _scmgen_comp *c, scmval sym);
+static int _scmgen_resolve(struct _scmgen_comp *c, scmval sym, int *index);
+static int _scmgen_free(struct _scmgen_comp *c, scmval sym, int src, int boxed);
+static int _scmgen_local(struct _scmgen_comp *c, scmval name, int defined);
+static void _scmgen_compile(struct _scmgen_comp *c, scmval x, int tail);
+static void _scmgen_compile_ref(struct _scmgen_comp *c, scmval sym);
+static void _scmgen_compile_assign(struct _scmgen_comp *c, scmval sym, scmval x);
+static void _scmgen_compile_body(struct _scmgen_comp *c, scmval body, int tail);
+static void _scmgen_compile_scope(struct _scmgen_comp *c, scmval body, int nscope, int tail);
+static void _scmgen_compile_if(struct _scmgen_comp *c, scmval x, int tail);
+static void _scmgen_compile_define(struct _scmgen_comp *c, scmval x);
+static void _scmgen_compile_set(struct _scmgen_comp *c, scmval x);
+static void _scmgen_compile_lambda(struct _scmgen_comp *c, const char *name,
+				   scmval params, scmval body);
+static void _scmgen_closure(struct _scmgen_comp *c, const char *name, struct _scmgen_comp *lc);
+static void _scmgen_compile_let(struct _scmgen_comp *c, scmval x, int tail);
+static void _scmgen_compile_apply_lambda(struct _scmgen_comp *c, scmval x, int tail);
+static void _scmgen_compile_bindings(struct _scmgen_comp *c, scmval names, scmval inits,
+				     int let, int nscope, scmval body, int tail);
+static void _scmgen_compile_call(struct _scmgen_comp *c, scmval x, int tail);
+static void _scmgen_compile_define_macro(struct _scmgen_comp *c, scmval x);
+static void _scmgen_primitive(scmctx *ctx, const char *name, scmval proc);
+static scmval _scmgen_expand(struct scmmac *mac, scmval x);
+static void _scmgen_write_global(scmval sym);
+static void _scmgen_macro_ref(scmval mac, scmval sym);
+static void _scmgen_macro_refs_body(scmval mac, scmval body, scmval bound);
+static void _scmgen_macro_refs(scmval mac, scmval x, scmval bound);
+
+
+static void
+_scmgen_init(void)
+{
+  size_t i;
+
+  _scmgen_sym_quote = scmspl_intern_symbol(_scmgen_ctx, "quote");
+  _scmgen_sym_if = scmspl_intern_symbol(_scmgen_ctx, "if");
+  _scmgen_sym_define = scmspl_intern_symbol(_scmgen_ctx, "define");
+  _scmgen_sym_set = scmspl_intern_symbol(_scmgen_ctx, "set!");
+  _scmgen_sym_lambda = scmspl_intern_symbol(_scmgen_ctx, "lambda");
+  _scmgen_sym_begin = scmspl_intern_symbol(_scmgen_ctx, "begin");
+  _scmgen_sym_let = scmspl_intern_symbol(_scmgen_ctx, "let");
+  _scmgen_sym_define_macro = scmspl_intern_symbol(_scmgen_ctx, "define-macro");
+  for (i=0; i<_SCMGEN_NARITH; i++) {
+    _scmgen_arith_syms[i] = scmspl_intern_symbol(_scmgen_ctx, _scmgen_arith_ops[i].name);
+  }
+}
+
+/*
+ * a syntax error in the form being compiled. the functions of the form
+ * compiled so far are dropped before unwinding.
+ */
+static _Noreturn void
+_scmgen_syntax(const char *fmt, ...)
+{
+  struct _scmgen_comp *c, *outer;
+  va_list ap;
+
+  va_start(ap, fmt);
+  (void)vsnprintf(_scmgen_msg, sizeof(_scmgen_msg), fmt, ap);
+  va_end(ap);
+
+  for (c = _scmgen_current; c; c = outer) {
+    outer = c->outer;
+    _scmgen_comp_free(c);
+    if (c->buf) {
+      scmmem_free(_scmgen_ctx, (void **)&c->buf);
+    }
+  }
+  longjmp(_scmgen_error, 1);
+}
+
+// length of a proper list, -1 otherwise
+static int
+_scmgen_length(scmval l)
+{
+  int len = 0;
+
+  for (; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    len++;
+  }
+  return (SCMVAL_NIL == l) ? len : -1;
+}
+
+// x is an element of the list l
+static int
+_scmgen_member(scmval x, scmval l)
+{
+  for (; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    if (x == SCMVAL_CAR(l)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// write s as a c string literal
+static void
+_scmgen_cstr(FILE *fp, const char *s)
+{
+  const unsigned char *p;
+
+  fputc('"', fp);
+  for (p = (const unsigned char *)s; *p; p++) {
+    if (('"' == *p) || ('\\' == *p) || ('?' == *p)) {
+      fprintf(fp, "\\%c", *p);
+    } else if ((*p < 0x20) || (*p >= 0x7f)) {
+      fprintf(fp, "\\%03o", *p);
+    } else {
+      fputc(*p, fp);
+    }
+  }
+  fputc('"', fp);
+}
+
+// append to the body of the function
+static void
+_scmgen_emit(struct _scmgen_comp *c, const char *fmt, ...)
+{
+  va_list ap;
+
+  va_start(ap, fmt);
+  (void)vfprintf(c->fp, fmt, ap);
+  va_end(ap);
+}
+
+// start a statement on a new line
+static void
+_scmgen_indent(struct _scmgen_comp *c)
+{
+  fprintf(c->fp, "%*s", 2 * c->indent, "");
+}
+
+static void
+_scmgen_line(struct _scmgen_comp *c, const char *fmt, ...)
+{
+  va_list ap;
+
+  _scmgen_indent(c);
+  va_start(ap, fmt);
+  (void)vfprintf(c->fp, fmt, ap);
+  va_end(ap);
+}
+
+// an expression follows, in tail position it is returned
+static void
+_scmgen_value(struct _scmgen_comp *c, int tail)
+{
+  if (tail) {
+    _scmgen_line(c, "return ");
+  }
+}
+
+static void
+_scmgen_end(struct _scmgen_comp *c, int tail)
+{
+  if (tail) {
+    _scmgen_emit(c, ";\n");
+  }
+}
+
+// number of a fresh c variable of the function
+static int
+_scmgen_temp(struct _scmgen_comp *c)
+{
+  return c->ntemps++;
+}
+
+// index of the global sym
+static int
+_scmgen_global(scmval sym)
+{
+  int i;
+
+  for (i=0; i<_scmgen_nglobals; i++) {
+    if (sym == _scmgen_globals[i]) {
+      return i;
+    }
+  }
+  if (_scmgen_nglobals == _scmgen_aglobals) {
+    _scmgen_aglobals = _scmgen_aglobals ? 2 * _scmgen_aglobals : 32;
+    _scmgen_globals = scmmem_realloc(_scmgen_ctx, _scmgen_globals, _scmgen_aglobals, sizeof(scmval));
+    _scmgen_builtins = scmmem_realloc(_scmgen_ctx, _scmgen_builtins, _scmgen_aglobals, sizeof(char));
+  }
+  _scmgen_globals[_scmgen_nglobals] = sym;
+  _scmgen_builtins[_scmgen_nglobals] = 0;
+  return _scmgen_nglobals++;
+}
+
+// the c expression of a constant
+static void
+_scmgen_const(struct _scmgen_comp *c, scmval v)
+{
+  int i;
+
+  if (SCMVAL_IS_INTEGER(v)) {
+    _scmgen_emit(c, "SCMVAL_MAKE_INTEGER(%ldL)", (long)SCMVAL_TO_C_INT(v));
+    return;
+  }
+  if (SCMVAL_IS_NIL(v)) {
+    _scmgen_emit(c, "SCMVAL_NIL");
+    return;
+  }
+  if (SCMVAL_IS_TRUE(v)) {
+    _scmgen_emit(c, "SCMVAL_TRUE");
+    return;
+  }
+  if (SCMVAL_IS_FALSE(v)) {
+    _scmgen_emit(c, "SCMVAL_FALSE");
+    return;
+  }
+  for (i=0; i<_scmgen_nconsts; i++) {
+    if (v == _scmgen_consts[i]) {
+      break;
+    }
+  }
+  if (i == _scmgen_nconsts) {
+    if (_scmgen_nconsts == _scmgen_aconsts) {
+      _scmgen_aconsts = _scmgen_aconsts ? 2 * _scmgen_aconsts : 32;
+      _scmgen_consts = scmmem_realloc(_scmgen_ctx, _scmgen_consts, _scmgen_aconsts, sizeof(scmval));
+    }
+    _scmgen_quotable(v);
+    _scmgen_consts[_scmgen_nconsts++] = v;
+  }
+  _scmgen_emit(c, "k%d", i);
+}
+
+// a procedure made by a macro has no c expression
+static void
+_scmgen_quotable(scmval v)
+{
+  for (; SCMVAL_IS_LIST(v); v = SCMVAL_CDR(v)) {
+    _scmgen_quotable(SCMVAL_CAR(v));
+  }
+  if (SCMVAL_IS_PROCEDURE(v)) {
+    _scmgen_syntax("procedure in a constant");
+  }
+}
+
+// the c expression building a constant at run time
+static void
+_scmgen_datum(FILE *fp, scmval v)
+{
+  if (SCMVAL_IS_SYMBOL(v)) {
+    fputs("scmspl_intern_symbol(scmcrt_ctx, ", fp);
+    _scmgen_cstr(fp, SCMVAL_TO_C_STR(v));
+    fputs(")", fp);
+  } else if (SCMVAL_IS_STRING(v)) {
+    fputs("scmspl_intern_string(scmcrt_ctx, ", fp);
+    _scmgen_cstr(fp, SCMVAL_TO_C_STR(v));
+    fputs(")", fp);
+  } else if (SCMVAL_IS_LIST(v)) {
+    fputs("SCMVAL_MAKE_LIST(scmval_cons(scmcrt_ctx, ", fp);
+    _scmgen_datum(fp, SCMVAL_CAR(v));
+    fputs(", ", fp);
+    _scmgen_datum(fp, SCMVAL_CDR(v));
+    fputs("))", fp);
+  } else if (SCMVAL_IS_INTEGER(v)) {
+    fprintf(fp, "SCMVAL_MAKE_INTEGER(%ldL)", (long)SCMVAL_TO_C_INT(v));
+  } else if (SCMVAL_IS_NIL(v)) {
+    fputs("SCMVAL_NIL", fp);
+  } else if (SCMVAL_IS_TRUE(v)) {
+    fputs("SCMVAL_TRUE", fp);
+  } else {
+    fputs("SCMVAL_FALSE", fp);
+  }
+}
+
+// compiler state of a new function, nested in outer
+static void
+_scmgen_comp_init(struct _scmgen_comp *c, struct _scmgen_comp *outer, const char *name)
+{
+  memset(c, 0, sizeof(struct _scmgen_comp));
+  c->outer = outer;
+  c->name = name;
+  c->captured = SCMVAL_NIL;
+  c->assigned = SCMVAL_NIL;
+  c->boxes = SCMVAL_NIL;
+  c->indent = 1;
+  if (NULL == (c->fp = open_memstream(&c->buf, &c->size))) {
+    scmerr(SCMERR_SYSCALL, "open_memstream");
+  }
+
+  if (_scmgen_nfuncs == _scmgen_afuncs) {
+    _scmgen_afuncs = _scmgen_afuncs ? 2 * _scmgen_afuncs : 32;
+    _scmgen_funcs = scmmem_realloc(_scmgen_ctx, _scmgen_funcs, _scmgen_afuncs, sizeof(char *));
+  }
+  _scmgen_funcs[_scmgen_nfuncs] = NULL;
+  c->fn = _scmgen_nfuncs++;
+  _scmgen_current = c;
+}
+
+// release the state, the function is in c->buf until it is finished
+static void
+_scmgen_comp_free(struct _scmgen_comp *c)
+{
+  if (c->fp) {
+    fclose(c->fp);
+  }
+  if (c->names) {
+    scmmem_free(_scmgen_ctx, (void **)&c->names);
+    scmmem_free(_scmgen_ctx, (void **)&c->boxed);
+    scmmem_free(_scmgen_ctx, (void **)&c->defined);
+    scmmem_free(_scmgen_ctx, (void **)&c->scope);
+  }
+  if (c->frees) {
+    scmmem_free(_scmgen_ctx, (void **)&c->frees);
+    scmmem_free(_scmgen_ctx, (void **)&c->fsrc);
+    scmmem_free(_scmgen_ctx, (void **)&c->fboxed);
+  }
+  _scmgen_current = c->outer;
+}
+
+/*
+ * the function of a compiled body. the parameters are copied from the
+ * arguments, the other locals start unbound. a tail call of the function
+ * to itself jumps to top with new parameters.
+ */
+static void
+_scmgen_finish(struct _scmgen_comp *c)
+{
+  char *buf;
+  size_t size;
+  FILE *fp;
+  int i;
+
+  fclose(c->fp);
+  c->fp = NULL;
+  if (NULL == (fp = open_memstream(&buf, &size))) {
+    scmerr(SCMERR_SYSCALL, "open_memstream");
+  }
+  fprintf(fp, "static scmval\nf%d(struct _scmprc *self, scmval *argv)\n{\n", c->fn);
+  for (i=0; i<c->nlocals; i++) {
+    fprintf(fp, "  scmval l%d = ", i);
+    if (i < c->nparams) {
+      fprintf(fp, "argv[%d];\n", i);
+    } else {
+      fprintf(fp, "SCMVAL_UNBOUND;\n");
+    }
+  }
+  if (c->nlocals > 0) {
+    fprintf(fp, "\n");
+  }
+  if (c->self) {
+    fprintf(fp, "top: ;\n");
+    for (i=c->nparams; i<c->nlocals; i++) {
+      fprintf(fp, "  l%d = SCMVAL_UNBOUND;\n", i);
+    }
+  }
+  for (i=0; i<c->nparams; i++) {
+    if (c->boxed[i]) {
+      fprintf(fp, "  l%d = SCMCRT_BOX(l%d);\n", i, i);
+    }
+  }
+  fprintf(fp, "%s}\n", c->buf);
+  fclose(fp);
+  scmmem_free(_scmgen_ctx, (void **)&c->buf);
+
+  _scmgen_funcs[c->fn] = buf;
+}
+
+/*
+ * collect the variables referenced in lambdas nested in x and the
+ * variables assigned by set! or define, looking into the expansions of
+ * macro calls, see _scmevl_scan.
+ */
+static void
+_scmgen_scan(struct _scmgen_comp *c, scmval x, int inner)
+{
+  struct scmmac *mac;
+  scmval op, target;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    if (inner && !_scmgen_member(x, c->captured)) {
+      c->captured = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, x, c->captured));
+    }
+    return;
+  }
+  if (!SCMVAL_IS_LIST(x) || (_scmgen_length(x) < 0)) {
+    return;
+  }
+
+  op = SCMVAL_CAR(x);
+  if ((_scmgen_sym_quote == op) || (_scmgen_sym_define_macro == op)) {
+    return;
+  }
+  if ((_scmgen_sym_lambda == op) && SCMVAL_IS_LIST(SCMVAL_CDR(x))) {
+    inner = 1;
+    x = SCMVAL_CDR(x);
+  } else if (((_scmgen_sym_set == op) || (_scmgen_sym_define == op)) &&
+	     SCMVAL_IS_LIST(SCMVAL_CDR(x))) {
+    target = SCMVAL_CAR(SCMVAL_CDR(x));
+    if (SCMVAL_IS_LIST(target)) {
+      target = SCMVAL_CAR(target);
+    }
+    if (!_scmgen_member(target, c->assigned)) {
+      c->assigned = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, target, c->assigned));
+    }
+    _scmgen_scan(c, target, inner);
+    if (SCMVAL_IS_LIST(SCMVAL_CAR(SCMVAL_CDR(x)))) {
+      inner = 1;
+    }
+    x = SCMVAL_CDR(x);
+  } else if (SCMVAL_IS_SYMBOL(op) && (mac = scmmac_lookup(_scmgen_ctx, op))) {
+    // the expansion is cached, the compiler reuses it
+    _scmgen_scan(c, _scmgen_expand(mac, x), inner);
+  } else {
+    _scmgen_scan(c, op, inner);
+  }
+  for (x = SCMVAL_CDR(x); SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    _scmgen_scan(c, SCMVAL_CAR(x), inner);
+  }
+}
+
+// the variables of a body that a closure captures and that are assigned
+static void
+_scmgen_boxes(struct _scmgen_comp *c, scmval body)
+{
+  scmval l;
+
+  for (; SCMVAL_IS_LIST(body); body = SCMVAL_CDR(body)) {
+    _scmgen_scan(c, SCMVAL_CAR(body), 0);
+  }
+  for (l = c->assigned; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (_scmgen_member(SCMVAL_CAR(l), c->captured)) {
+      c->boxes = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, SCMVAL_CAR(l), c->boxes));
+    }
+  }
+}
+
+// slot of a visible local of the function, -1 otherwise
+static int
+_scmgen_scoped(struct _scmgen_comp *c, scmval sym)
+{
+  int i;
+
+  for (i=c->nscope-1; i>=0; i--) {
+    if (sym == c->names[c->scope[i]]) {
+      return c->scope[i];
+    }
+  }
+  return -1;
+}
+
+/*
+ * resolve a variable to a local, a free variable of the closure or a
+ * global. a local of an enclosing lambda becomes a free variable of each
+ * lambda in between.
+ */
+static int
+_scmgen_resolve(struct _scmgen_comp *c, scmval sym, int *index)
+{
+  int kind, src, boxed;
+
+  if ((*index = _scmgen_scoped(c, sym)) >= 0) {
+    return _SCMGEN_LOCAL;
+  }
+  for (*index = 0; *index < c->nfree; (*index)++) {
+    if (sym == c->frees[*index]) {
+      return _SCMGEN_FREE;
+    }
+  }
+  if (!c->outer) {
+    return _SCMGEN_GLOBAL;
+  }
+
+  kind = _scmgen_resolve(c->outer, sym, index);
+  if (_SCMGEN_LOCAL == kind) {
+    src = *index;
+    boxed = c->outer->boxed[*index];
+  } else if (_SCMGEN_FREE == kind) {
+    src = -*index - 1;
+    boxed = c->outer->fboxed[*index];
+  } else {
+    return _SCMGEN_GLOBAL;
+  }
+  *index = _scmgen_free(c, sym, src, boxed);
+  return _SCMGEN_FREE;
+}
+
+// add a free variable, copied from src when the closure is made
+static int
+_scmgen_free(struct _scmgen_comp *c, scmval sym, int src, int boxed)
+{
+  if (c->nfree == c->afree) {
+    c->afree = c->afree ? 2 * c->afree : 4;
+    c->frees = scmmem_realloc(_scmgen_ctx, c->frees, c->afree, sizeof(scmval));
+    c->fsrc = scmmem_realloc(_scmgen_ctx, c->fsrc, c->afree, sizeof(int));
+    c->fboxed = scmmem_realloc(_scmgen_ctx, c->fboxed, c->afree, sizeof(char));
+  }
+  c->frees[c->nfree] = sym;
+  c->fsrc[c->nfree] = src;
+  c->fboxed[c->nfree] = boxed;
+  return c->nfree++;
+}
+
+// a new local of the function, visible from now on
+static int
+_scmgen_local(struct _scmgen_comp *c, scmval name, int defined)
+{
+  if (c->nlocals == c->anames) {
+    c->anames = c->anames ? 2 * c->anames : 8;
+    c->names = scmmem_realloc(_scmgen_ctx, c->names, c->anames, sizeof(scmval));
+    c->boxed = scmmem_realloc(_scmgen_ctx, c->boxed, c->anames, sizeof(char));
+    c->defined = scmmem_realloc(_scmgen_ctx, c->defined, c->anames, sizeof(char));
+    c->scope = scmmem_realloc(_scmgen_ctx, c->scope, c->anames, sizeof(int));
+  }
+  c->names[c->nlocals] = name;
+  c->boxed[c->nlocals] = _scmgen_member(name, c->boxes);
+  c->defined[c->nlocals] = defined;
+  c->scope[c->nscope++] = c->nlocals;
+  return c->nlocals++;
+}
+
+/*
+ * compile x to a c expression. in tail position x compiles to statements
+ * that return its value instead.
+ */
+static void
+_scmgen_compile(struct _scmgen_comp *c, scmval x, int tail)
+{
+  struct scmmac *mac;
+  scmval op;
+  int index;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    _scmgen_value(c, tail);
+    _scmgen_compile_ref(c, x);
+    _scmgen_end(c, tail);
+    return;
+  }
+  if (!SCMVAL_IS_LIST(x)) {
+    _scmgen_value(c, tail);
+    _scmgen_const(c, x);
+    _scmgen_end(c, tail);
+    return;
+  }
+  if (_scmgen_length(x) < 0) {
+    _scmgen_syntax("improper list in form");
+  }
+
+  op = SCMVAL_CAR(x);
+  if (_scmgen_sym_quote == op) {
+    if (_scmgen_length(x) != 2) {
+      _scmgen_syntax("quote: one datum expected");
+    }
+    _scmgen_value(c, tail);
+    _scmgen_const(c, SCMVAL_CAR(SCMVAL_CDR(x)));
+    _scmgen_end(c, tail);
+  } else if (_scmgen_sym_if == op) {
+    _scmgen_compile_if(c, x, tail);
+  } else if (_scmgen_sym_define == op) {
+    _scmgen_value(c, tail);
+    _scmgen_compile_define(c, x);
+    _scmgen_end(c, tail);
+  } else if (_scmgen_sym_set == op) {
+    _scmgen_value(c, tail);
+    _scmgen_compile_set(c, x);
+    _scmgen_end(c, tail);
+  } else if (_scmgen_sym_lambda == op) {
+    if (_scmgen_length(x) < 3) {
+      _scmgen_syntax("lambda: parameters and body expected");
+    }
+    _scmgen_value(c, tail);
+    _scmgen_compile_lambda(c, NULL, SCMVAL_CAR(SCMVAL_CDR(x)), SCMVAL_CDR(SCMVAL_CDR(x)));
+    _scmgen_end(c, tail);
+  } else if (_scmgen_sym_begin == op) {
+    _scmgen_compile_body(c, SCMVAL_CDR(x), tail);
+  } else if (_scmgen_sym_let == op) {
+    _scmgen_compile_let(c, x, tail);
+  } else if (_scmgen_sym_define_macro == op) {
+    _scmgen_value(c, tail);
+    _scmgen_compile_define_macro(c, x);
+    _scmgen_end(c, tail);
+  } else if (SCMVAL_IS_SYMBOL(op) && (mac = scmmac_lookup(_scmgen_ctx, op)) &&
+	     (_SCMGEN_GLOBAL == _scmgen_resolve(c, op, &index))) {
+    _scmgen_compile(c, _scmgen_expand(mac, x), tail);
+  } else if (SCMVAL_IS_LIST(op) && (_scmgen_sym_lambda == SCMVAL_CAR(op)) &&
+	     (_scmgen_length(op) >= 3) &&
+	     (_scmgen_length(SCMVAL_CAR(SCMVAL_CDR(op))) == _scmgen_length(x) - 1)) {
+    _scmgen_compile_apply_lambda(c, x, tail);
+  } else {
+    _scmgen_compile_call(c, x, tail);
+  }
+}
+
+// the value of a variable
+static void
+_scmgen_compile_ref(struct _scmgen_comp *c, scmval sym)
+{
+  int index;
+
+  switch (_scmgen_resolve(c, sym, &index)) {
+  case _SCMGEN_LOCAL:
+    if (!c->defined[index]) {
+      _scmgen_emit(c, c->boxed[index] ? "SCMCRT_UNBOX(l%d)" : "l%d", index);
+      return;
+    }
+    _scmgen_emit(c, c->boxed[index] ? "SCMCRT_REF(SCMCRT_UNBOX(l%d), " : "SCMCRT_REF(l%d, ",
+		 index);
+    break;
+  case _SCMGEN_FREE:
+    if (!c->fboxed[index]) {
+      _scmgen_emit(c, "self->u.nat.free[%d]", index);
+      return;
+    }
+    _scmgen_emit(c, "SCMCRT_REF(SCMCRT_UNBOX(self->u.nat.free[%d]), ", index);
+    break;
+  default:
+    _scmgen_emit(c, "SCMCRT_REF(g%d, ", _scmgen_global(sym));
+    break;
+  }
+  _scmgen_cstr(c->fp, SCMVAL_TO_C_STR(sym));
+  _scmgen_emit(c, ")");
+}
+
+// assign the value of x to a variable, the value of the assignment
+static void
+_scmgen_compile_assign(struct _scmgen_comp *c, scmval sym, scmval x)
+{
+  int index, t, g;
+
+  switch (_scmgen_resolve(c, sym, &index)) {
+  case _SCMGEN_LOCAL:
+    _scmgen_emit(c, c->boxed[index] ? "(SCMCRT_UNBOX(l%d) = " : "(l%d = ", index);
+    break;
+  case _SCMGEN_FREE:
+    if (!c->fboxed[index]) {
+      _scmgen_syntax("set!: %s captured without a box", SCMVAL_TO_C_STR(sym));
+    }
+    _scmgen_emit(c, "(SCMCRT_UNBOX(self->u.nat.free[%d]) = ", index);
+    break;
+  default:
+    _scmgen_write_global(sym);
+    t = _scmgen_temp(c);
+    g = _scmgen_global(sym);
+    _scmgen_emit(c, "({ scmval t%d = ", t);
+    _scmgen_compile(c, x, 0);
+    _scmgen_emit(c, "; if (SCMVAL_UNBOUND == g%d) { scmcrt_unbound(", g);
+    _scmgen_cstr(c->fp, SCMVAL_TO_C_STR(sym));
+    _scmgen_emit(c, "); } g%d = t%d; })", g, t);
+    return;
+  }
+  _scmgen_compile(c, x, 0);
+  _scmgen_emit(c, ")");
+}
+
+// a sequence of forms, the value is the value of the last form
+static void
+_scmgen_compile_body(struct _scmgen_comp *c, scmval body, int tail)
+{
+  if (SCMVAL_NIL == body) {
+    _scmgen_value(c, tail);
+    _scmgen_emit(c, "SCMVAL_NIL");
+    _scmgen_end(c, tail);
+    return;
+  }
+  if (!tail) {
+    _scmgen_emit(c, "({ ");
+  }
+  for (; SCMVAL_NIL != body; body = SCMVAL_CDR(body)) {
+    if (tail && (SCMVAL_NIL == SCMVAL_CDR(body))) {
+      _scmgen_compile(c, SCMVAL_CAR(body), 1);
+      break;
+    }
+    if (tail) {
+      _scmgen_indent(c);
+    }
+    _scmgen_compile(c, SCMVAL_CAR(body), 0);
+    _scmgen_emit(c, tail ? ";\n" : "; ");
+  }
+  if (!tail) {
+    _scmgen_emit(c, "})");
+  }
+}
+
+/*
+ * the body of a lambda or let, its internal definitions are locals of
+ * the function. the locals of the scope are visible until the body ends.
+ * not in tail position, this is part of a statement expression.
+ */
+static void
+_scmgen_compile_scope(struct _scmgen_comp *c, scmval body, int nscope, int tail)
+{
+  scmval l, def, target;
+  int first = c->nlocals;
+  int i;
+
+  if (_scmgen_length(body) < 1) {
+    _scmgen_syntax("body expected");
+  }
+  for (l = body; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    def = SCMVAL_CAR(l);
+    if (!SCMVAL_IS_LIST(def) || (_scmgen_sym_define != SCMVAL_CAR(def)) ||
+	(_scmgen_length(def) < 3)) {
+      continue;
+    }
+    target = SCMVAL_CAR(SCMVAL_CDR(def));
+    if (SCMVAL_IS_LIST(target)) {
+      target = SCMVAL_CAR(target);
+    }
+    // a name bound twice in the same scope is one local
+    for (i=nscope; i<c->nscope; i++) {
+      if (target == c->names[c->scope[i]]) {
+	break;
+      }
+    }
+    if (i == c->nscope) {
+      (void)_scmgen_local(c, target, 1);
+    }
+  }
+  // the box of a definition exists before its value, closures share it
+  for (i=first; i<c->nlocals; i++) {
+    if (c->boxed[i]) {
+      if (tail) {
+	_scmgen_line(c, "l%d = SCMCRT_BOX(SCMVAL_UNBOUND);\n", i);
+      } else {
+	_scmgen_emit(c, "l%d = SCMCRT_BOX(SCMVAL_UNBOUND); ", i);
+      }
+    }
+  }
+
+  if (tail) {
+    _scmgen_compile_body(c, body, 1);
+  } else {
+    for (; SCMVAL_NIL != body; body = SCMVAL_CDR(body)) {
+      _scmgen_compile(c, SCMVAL_CAR(body), 0);
+      _scmgen_emit(c, "; ");
+    }
+  }
+  c->nscope = nscope;
+}
+
+// (if test consequent [alternative]), a missing alternative is nil
+static void
+_scmgen_compile_if(struct _scmgen_comp *c, scmval x, int tail)
+{
+  int len = _scmgen_length(x);
+
+  if ((len != 3) && (len != 4)) {
+    _scmgen_syntax("if: test, consequent and optional alternative expected");
+  }
+  x = SCMVAL_CDR(x);
+  if (tail) {
+    _scmgen_line(c, "if (SCMVAL_FALSE != ");
+  } else {
+    _scmgen_emit(c, "((SCMVAL_FALSE != ");
+  }
+  _scmgen_compile(c, SCMVAL_CAR(x), 0);
+
+  x = SCMVAL_CDR(x);
+  if (tail) {
+    _scmgen_emit(c, ") {\n");
+    c->indent++;
+  } else {
+    _scmgen_emit(c, ") ? ");
+  }
+  _scmgen_compile(c, SCMVAL_CAR(x), tail);
+
+  x = SCMVAL_CDR(x);
+  if (tail) {
+    c->indent--;
+    _scmgen_line(c, "} else {\n");
+    c->indent++;
+  } else {
+    _scmgen_emit(c, " : ");
+  }
+  if (SCMVAL_NIL == x) {
+    _scmgen_value(c, tail);
+    _scmgen_emit(c, "SCMVAL_NIL");
+    _scmgen_end(c, tail);
+  } else {
+    _scmgen_compile(c, SCMVAL_CAR(x), tail);
+  }
+  if (tail) {
+    c->indent--;
+    _scmgen_line(c, "}\n");
+  } else {
+    _scmgen_emit(c, ")");
+  }
+}
+
+// (define name expr) or (define (name params ...) body ...)
+static void
+_scmgen_compile_define(struct _scmgen_comp *c, scmval x)
+{
+  scmval target, name;
+  int len = _scmgen_length(x);
+  int slot;
+
+  if (len < 3) {
+    _scmgen_syntax("define: name and value expected");
+  }
+  target = SCMVAL_CAR(SCMVAL_CDR(x));
+  name = SCMVAL_IS_LIST(target) ? SCMVAL_CAR(target) : target;
+  if (!SCMVAL_IS_SYMBOL(name)) {
+    _scmgen_syntax("define: name expected");
+  }
+
+  // internal definitions are locals, allocated by _scmgen_compile_scope
+  slot = _scmgen_scoped(c, name);
+  if ((slot < 0) && !c->toplevel) {
+    _scmgen_syntax("define: %s not in a body", SCMVAL_TO_C_STR(name));
+  }
+  if (slot < 0) {
+    _scmgen_write_global(name);
+    _scmgen_emit(c, "(g%d = ", _scmgen_global(name));
+  } else {
+    _scmgen_emit(c, c->boxed[slot] ? "(SCMCRT_UNBOX(l%d) = " : "(l%d = ", slot);
+  }
+
+  if (SCMVAL_IS_LIST(target)) {
+    _scmgen_compile_lambda(c, SCMVAL_TO_C_STR(name), SCMVAL_CDR(target), SCMVAL_CDR(SCMVAL_CDR(x)));
+  } else {
+    if (len != 3) {
+      _scmgen_syntax("define: name and one value expected");
+    }
+    x = SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x)));
+    // name the procedure of (define name (lambda ...))
+    if (SCMVAL_IS_LIST(x) && (_scmgen_sym_lambda == SCMVAL_CAR(x)) && (_scmgen_length(x) >= 3)) {
+      _scmgen_compile_lambda(c, SCMVAL_TO_C_STR(name), SCMVAL_CAR(SCMVAL_CDR(x)), SCMVAL_CDR(SCMVAL_CDR(x)));
+    } else {
+      _scmgen_compile(c, x, 0);
+    }
+  }
+
+  _scmgen_emit(c, ", ");
+  _scmgen_const(c, name);
+  _scmgen_emit(c, ")");
+}
+
+// (set! name expr)
+static void
+_scmgen_compile_set(struct _scmgen_comp *c, scmval x)
+{
+  scmval name;
+
+  if (_scmgen_length(x) != 3) {
+    _scmgen_syntax("set!: name and value expected");
+  }
+  name = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (!SCMVAL_IS_SYMBOL(name)) {
+    _scmgen_syntax("set!: name expected");
+  }
+  _scmgen_compile_assign(c, name, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))));
+}
+
+// compile a lambda into a function of its own, the value is its closure
+static void
+_scmgen_compile_lambda(struct _scmgen_comp *c, const char *name, scmval params, scmval body)
+{
+  struct _scmgen_comp lc;
+  scmval l;
+  int n = _scmgen_length(params);
+  int t, j;
+
+  if (n < 0) {
+    _scmgen_syntax("lambda: parameter list expected");
+  }
+
+  _scmgen_comp_init(&lc, c, name);
+  lc.nparams = n;
+  _scmgen_boxes(&lc, body);
+  for (l = params; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (!SCMVAL_IS_SYMBOL(SCMVAL_CAR(l))) {
+      _scmgen_syntax("lambda: parameter name expected");
+    }
+    (void)_scmgen_local(&lc, SCMVAL_CAR(l), 0);
+  }
+  _scmgen_compile_scope(&lc, body, lc.nscope, 1);
+  _scmgen_finish(&lc);
+
+  if (0 == lc.nfree) {
+    _scmgen_emit(c, "SCMVAL_MAKE_PROCEDURE(");
+    _scmgen_closure(c, name, &lc);
+    _scmgen_emit(c, ")");
+  } else {
+    // the free variables are copied into a temp holding the closure
+    t = _scmgen_temp(c);
+    _scmgen_emit(c, "({ struct _scmprc *t%d = ", t);
+    _scmgen_closure(c, name, &lc);
+    _scmgen_emit(c, "; ");
+    for (j=0; j<lc.nfree; j++) {
+      if (lc.fsrc[j] >= 0) {
+	_scmgen_emit(c, "t%d->u.nat.free[%d] = l%d; ", t, j, lc.fsrc[j]);
+      } else {
+	_scmgen_emit(c, "t%d->u.nat.free[%d] = self->u.nat.free[%d]; ", t, j, -lc.fsrc[j] - 1);
+      }
+    }
+    _scmgen_emit(c, "SCMVAL_MAKE_PROCEDURE(t%d); })", t);
+  }
+  _scmgen_comp_free(&lc);
+}
+
+// the call creating a closure of the function of lc
+static void
+_scmgen_closure(struct _scmgen_comp *c, const char *name, struct _scmgen_comp *lc)
+{
+  _scmgen_emit(c, "scmcrt_closure(");
+  if (name) {
+    _scmgen_cstr(c->fp, name);
+  } else {
+    _scmgen_emit(c, "NULL");
+  }
+  _scmgen_emit(c, ", f%d, %d, %d)", lc->fn, lc->nparams, lc->nfree);
+}
+
+/*
+ * (let ((name init) ...) body ...)
+ * the names are fresh locals of the function, the inits are evaluated
+ * before any of the names is visible.
+ */
+static void
+_scmgen_compile_let(struct _scmgen_comp *c, scmval x, int tail)
+{
+  scmval bindings, b;
+
+  if (_scmgen_length(x) < 3) {
+    _scmgen_syntax("let: bindings and body expected");
+  }
+  bindings = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (_scmgen_length(bindings) < 0) {
+    _scmgen_syntax("let: binding list expected");
+  }
+  for (b = bindings; SCMVAL_NIL != b; b = SCMVAL_CDR(b)) {
+    if ((_scmgen_length(SCMVAL_CAR(b)) != 2) || !SCMVAL_IS_SYMBOL(SCMVAL_CAR(SCMVAL_CAR(b)))) {
+      _scmgen_syntax("let: (name init) expected");
+    }
+  }
+  _scmgen_compile_bindings(c, bindings, bindings, 1, c->nscope, SCMVAL_CDR(SCMVAL_CDR(x)), tail);
+}
+
+/*
+ * ((lambda (param ...) body ...) arg ...) is a let, the lambda never
+ * escapes and needs no closure.
+ */
+static void
+_scmgen_compile_apply_lambda(struct _scmgen_comp *c, scmval x, int tail)
+{
+  scmval lambda = SCMVAL_CAR(x);
+  scmval l;
+
+  for (l = SCMVAL_CAR(SCMVAL_CDR(lambda)); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (!SCMVAL_IS_SYMBOL(SCMVAL_CAR(l))) {
+      _scmgen_syntax("lambda: parameter name expected");
+    }
+  }
+  _scmgen_compile_bindings(c, SCMVAL_CAR(SCMVAL_CDR(lambda)), SCMVAL_CDR(x), 0, c->nscope,
+			   SCMVAL_CDR(SCMVAL_CDR(lambda)), tail);
+}
+
+/*
+ * bind fresh locals to the values of inits and compile body in their
+ * scope. for a let, names and inits are both its bindings.
+ */
+static void
+_scmgen_compile_bindings(struct _scmgen_comp *c, scmval names, scmval inits, int let,
+			 int nscope, scmval body, int tail)
+{
+  int n = _scmgen_length(inits);
+  int t = c->ntemps;
+  int first, i;
+
+  // the values are held in n temps until all are known
+  c->ntemps += n;
+  if (!tail) {
+    _scmgen_emit(c, "({ ");
+  }
+  for (i = 0; SCMVAL_NIL != inits; i++, inits = SCMVAL_CDR(inits)) {
+    if (tail) {
+      _scmgen_indent(c);
+    }
+    _scmgen_emit(c, "scmval t%d = ", t + i);
+    _scmgen_compile(c, let ? SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CAR(inits))) : SCMVAL_CAR(inits), 0);
+    _scmgen_emit(c, tail ? ";\n" : "; ");
+  }
+
+  first = c->nlocals;
+  for (; SCMVAL_NIL != names; names = SCMVAL_CDR(names)) {
+    (void)_scmgen_local(c, let ? SCMVAL_CAR(SCMVAL_CAR(names)) : SCMVAL_CAR(names), 0);
+  }
+  for (i=0; i<n; i++) {
+    if (tail) {
+      _scmgen_indent(c);
+    }
+    _scmgen_emit(c, c->boxed[first + i] ? "l%d = SCMCRT_BOX(t%d);" : "l%d = t%d;",
+		 first + i, t + i);
+    _scmgen_emit(c, tail ? "\n" : " ");
+  }
+
+  _scmgen_compile_scope(c, body, nscope, tail);
+  if (!tail) {
+    _scmgen_emit(c, "})");
+  }
+}
+
+/*
+ * (operator operand ...), the operands are evaluated before a global
+ * operator and after any other, as in scmevl. a call in tail position of
+ * a lambda to itself jumps to the start of its function.
+ */
+static void
+_scmgen_compile_call(struct _scmgen_comp *c, scmval x, int tail)
+{
+  int n = _scmgen_length(x) - 1;
+  scmval op = SCMVAL_CAR(x);
+  char ta[16], tb[16];
+  int g = -1;
+  int index, p, a, i;
+
+  if (SCMVAL_IS_SYMBOL(op) && (_SCMGEN_GLOBAL == _scmgen_resolve(c, op, &index))) {
+    g = _scmgen_global(op);
+    for (i=0; (2 == n) && (i < (int)_SCMGEN_NARITH); i++) {
+      if (op == _scmgen_arith_syms[i]) {
+	_scmgen_builtins[g] = 1;
+	(void)snprintf(ta, sizeof(ta), "t%d", _scmgen_temp(c));
+	(void)snprintf(tb, sizeof(tb), "t%d", _scmgen_temp(c));
+	_scmgen_value(c, tail);
+	_scmgen_emit(c, "({ scmval %s = ", ta);
+	_scmgen_compile(c, SCMVAL_CAR(SCMVAL_CDR(x)), 0);
+	_scmgen_emit(c, "; scmval %s = ", tb);
+	_scmgen_compile(c, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))), 0);
+	_scmgen_emit(c, "; ((b%d == g%d) && SCMVAL_ARE_INTEGERS(%s, %s)) ? ", g, g, ta, tb);
+	_scmgen_emit(c, _scmgen_arith_ops[i].expr, ta, tb);
+	_scmgen_emit(c, " : scmcrt_call2(g%d, ", g);
+	_scmgen_cstr(c->fp, SCMVAL_TO_C_STR(op));
+	_scmgen_emit(c, ", %s, %s); })", ta, tb);
+	_scmgen_end(c, tail);
+	return;
+      }
+    }
+  }
+
+  p = _scmgen_temp(c);
+  a = _scmgen_temp(c);
+  if (tail) {
+    _scmgen_line(c, "{ ");
+  } else {
+    _scmgen_emit(c, "({ ");
+  }
+  if (g < 0) {
+    _scmgen_emit(c, "scmval t%d = ", p);
+    _scmgen_compile(c, op, 0);
+    _scmgen_emit(c, "; ");
+  }
+  if (n > 0) {
+    _scmgen_emit(c, "scmval t%d[%d]; ", a, n);
+  }
+  for (i = 0, x = SCMVAL_CDR(x); SCMVAL_NIL != x; i++, x = SCMVAL_CDR(x)) {
+    _scmgen_emit(c, "t%d[%d] = ", a, i);
+    _scmgen_compile(c, SCMVAL_CAR(x), 0);
+    _scmgen_emit(c, "; ");
+  }
+  if (g >= 0) {
+    _scmgen_emit(c, "scmval t%d = SCMCRT_REF(g%d, ", p, g);
+    _scmgen_cstr(c->fp, SCMVAL_TO_C_STR(op));
+    _scmgen_emit(c, "); ");
+  }
+  (void)snprintf(ta, sizeof(ta), (n > 0) ? "t%d" : "NULL", a);
+
+  if (!tail) {
+    _scmgen_emit(c, "scmcrt_call(t%d, %d, %s); })", p, n, ta);
+    return;
+  }
+  if (c->outer && (n == c->nparams)) {
+    c->self = 1;
+    _scmgen_emit(c, "if (SCMVAL_MAKE_PROCEDURE(self) == t%d) { ", p);
+    for (i=0; i<n; i++) {
+      _scmgen_emit(c, "l%d = t%d[%d]; ", i, a, i);
+    }
+    _scmgen_emit(c, "goto top; } ");
+  }
+  // the arguments of a tail call are copied to a buffer of limited size
+  _scmgen_emit(c, "return scmcrt_%s(t%d, %d, %s); }\n",
+	       (n > SCMCRT_MAXARGS) ? "call" : "tail", p, n, ta);
+}
+
+/*
+ * (define-macro (name param ...) body ...) at top level. the transformer
+ * is defined by scmevl while compiling, for the forms compiled next. a
+ * program that would expand differently at run time is rejected.
+ */
+static void
+_scmgen_compile_define_macro(struct _scmgen_comp *c, scmval x)
+{
+  scmval target, name;
+
+  if (_scmgen_length(x) < 3) {
+    _scmgen_syntax("define-macro: (name param ...) and body expected");
+  }
+  target = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (!SCMVAL_IS_LIST(target) || !SCMVAL_IS_SYMBOL(SCMVAL_CAR(target))) {
+    _scmgen_syntax("define-macro: (name param ...) expected");
+  }
+  if (c->outer || c->nscope) {
+    _scmgen_syntax("define-macro: %s not at top level", SCMVAL_TO_C_STR(SCMVAL_CAR(target)));
+  }
+  name = SCMVAL_CAR(target);
+  if (_scmgen_member(name, _scmgen_expanded)) {
+    scmerr(SCMERR_BAD_SYNTAX, "define-macro: %s redefined after it was expanded at compile time",
+	   SCMVAL_TO_C_STR(name));
+  }
+  _scmgen_macro_refs_body(name, SCMVAL_CDR(SCMVAL_CDR(x)), SCMVAL_CDR(target));
+  (void)scmevl(_scmgen_ctx, x);
+  _scmgen_const(c, name);
+}
+
+static void
+_scmgen_primitive(scmctx *ctx, const char *name, scmval proc)
+{
+  _scmgen_prims = SCMVAL_MAKE_LIST(scmval_cons(ctx, scmspl_intern_symbol(ctx, name), _scmgen_prims));
+}
+
+// the expansion of the call x of mac, which may not be redefined from now on
+static scmval
+_scmgen_expand(struct scmmac *mac, scmval x)
+{
+  if (!_scmgen_member(mac->name, _scmgen_expanded)) {
+    _scmgen_expanded = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, mac->name, _scmgen_expanded));
+  }
+  return scmmac_expand(_scmgen_ctx, mac, x, scmevl_apply);
+}
+
+// the program defines or assigns the global sym
+static void
+_scmgen_write_global(scmval sym)
+{
+  if (_scmgen_member(sym, _scmgen_referenced)) {
+    scmerr(SCMERR_BAD_SYNTAX, "%s: written by the program, but a macro expanded at compile time "
+	   "refers to it", SCMVAL_TO_C_STR(sym));
+  }
+  if (!_scmgen_member(sym, _scmgen_written)) {
+    _scmgen_written = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, sym, _scmgen_written));
+  }
+}
+
+// the transformer of mac refers to the global sym, a primitive not written
+static void
+_scmgen_macro_ref(scmval mac, scmval sym)
+{
+  if (!_scmgen_member(sym, _scmgen_prims) || _scmgen_member(sym, _scmgen_written)) {
+    scmerr(SCMERR_BAD_SYNTAX, "define-macro: %s refers to the global %s of the program, "
+	   "transformers run at compile time", SCMVAL_TO_C_STR(mac), SCMVAL_TO_C_STR(sym));
+  }
+  if (!_scmgen_member(sym, _scmgen_referenced)) {
+    _scmgen_referenced = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, sym, _scmgen_referenced));
+  }
+}
+
+// the globals a body of the transformer of mac refers to, bound are its locals
+static void
+_scmgen_macro_refs_body(scmval mac, scmval body, scmval bound)
+{
+  scmval l, def, target;
+
+  for (l = body; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    def = SCMVAL_CAR(l);
+    if (SCMVAL_IS_LIST(def) && (_scmgen_sym_define == SCMVAL_CAR(def)) &&
+	SCMVAL_IS_LIST(SCMVAL_CDR(def))) {
+      target = SCMVAL_CAR(SCMVAL_CDR(def));
+      target = SCMVAL_IS_LIST(target) ? SCMVAL_CAR(target) : target;
+      bound = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, target, bound));
+    }
+  }
+  for (l = body; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    _scmgen_macro_refs(mac, SCMVAL_CAR(l), bound);
+  }
+}
+
+/*
+ * the globals x refers to. a macro call is looked into as if it were a
+ * call, a malformed form like any list.
+ */
+static void
+_scmgen_macro_refs(scmval mac, scmval x, scmval bound)
+{
+  scmval op, l, target;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    if (!_scmgen_member(x, bound)) {
+      _scmgen_macro_ref(mac, x);
+    }
+    return;
+  }
+  if (!SCMVAL_IS_LIST(x) || (_scmgen_length(x) < 0)) {
+    return;
+  }
+
+  op = SCMVAL_CAR(x);
+  if ((_scmgen_sym_quote == op) || (_scmgen_sym_define_macro == op)) {
+    return;
+  }
+  if ((_scmgen_sym_lambda == op) && (_scmgen_length(x) >= 3)) {
+    for (l = SCMVAL_CAR(SCMVAL_CDR(x)); SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+      bound = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, SCMVAL_CAR(l), bound));
+    }
+    _scmgen_macro_refs_body(mac, SCMVAL_CDR(SCMVAL_CDR(x)), bound);
+    return;
+  }
+  if ((_scmgen_sym_define == op) && (_scmgen_length(x) >= 3)) {
+    target = SCMVAL_CAR(SCMVAL_CDR(x));
+    if (!SCMVAL_IS_LIST(target)) {
+      _scmgen_macro_refs(mac, target, bound);
+      _scmgen_macro_refs_body(mac, SCMVAL_CDR(SCMVAL_CDR(x)), bound);
+      return;
+    }
+    _scmgen_macro_refs(mac, SCMVAL_CAR(target), bound);
+    for (l = SCMVAL_CDR(target); SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+      bound = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, SCMVAL_CAR(l), bound));
+    }
+    _scmgen_macro_refs_body(mac, SCMVAL_CDR(SCMVAL_CDR(x)), bound);
+    return;
+  }
+  if ((_scmgen_sym_let == op) && (_scmgen_length(x) >= 3)) {
+    for (l = SCMVAL_CAR(SCMVAL_CDR(x)); SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+      if (SCMVAL_IS_LIST(SCMVAL_CAR(l)) && SCMVAL_IS_LIST(SCMVAL_CDR(SCMVAL_CAR(l)))) {
+	_scmgen_macro_refs(mac, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CAR(l))), bound);
+      }
+    }
+    for (l = SCMVAL_CAR(SCMVAL_CDR(x)); SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+      if (SCMVAL_IS_LIST(SCMVAL_CAR(l))) {
+	bound = SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, SCMVAL_CAR(SCMVAL_CAR(l)), bound));
+      }
+    }
+    _scmgen_macro_refs_body(mac, SCMVAL_CDR(SCMVAL_CDR(x)), bound);
+    return;
+  }
+  if ((_scmgen_sym_if == op) || (_scmgen_sym_set == op) || (_scmgen_sym_begin == op) ||
+      (_scmgen_sym_let == op) || (_scmgen_sym_define == op) || (_scmgen_sym_lambda == op) ||
+      (SCMVAL_IS_SYMBOL(op) && !_scmgen_member(op, bound) && scmmac_lookup(_scmgen_ctx, op))) {
+    x = SCMVAL_CDR(x);
+  }
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    _scmgen_macro_refs(mac, SCMVAL_CAR(x), bound);
+  }
+}
+
+// start a new program, its macros are expanded in ctx
+void
+scmgen_begin(scmctx *ctx)
+{
+  _scmgen_ctx = ctx;
+  _scmgen_init();
+  _scmgen_prims = SCMVAL_NIL;
+  scmprm_define_all(ctx, _scmgen_primitive);
+  _scmgen_expanded = SCMVAL_NIL;
+  _scmgen_written = SCMVAL_NIL;
+  _scmgen_referenced = SCMVAL_NIL;
+  _scmgen_nfuncs = 0;
+  _scmgen_nforms = 0;
+  _scmgen_nglobals = 0;
+  _scmgen_nconsts = 0;
+}
+
+// compile a top-level form, bad syntax raises its error when it is run
+void
+scmgen_form(scmval form)
+{
+  struct _scmgen_comp c;
+  FILE *fp;
+  size_t size;
+  int fn;
+
+  _scmgen_comp_init(&c, NULL, NULL);
+  c.toplevel = 1;
+  fn = c.fn;
+  if (_scmgen_nforms == _scmgen_aforms) {
+    _scmgen_aforms = _scmgen_aforms ? 2 * _scmgen_aforms : 32;
+    _scmgen_forms = scmmem_realloc(_scmgen_ctx, _scmgen_forms, _scmgen_aforms, sizeof(int));
+  }
+  _scmgen_forms[_scmgen_nforms++] = fn;
+
+  if (setjmp(_scmgen_error)) {
+    fprintf(stderr, "warning: bad syntax: %s\n", _scmgen_msg);
+    if (NULL == (fp = open_memstream(&_scmgen_funcs[fn], &size))) {
+      scmerr(SCMERR_SYSCALL, "open_memstream");
+    }
+    fprintf(fp, "static scmval\nf%d(struct _scmprc *self, scmval *argv)\n{\n", fn);
+    fprintf(fp, "  scmerr(SCMERR_BAD_SYNTAX, \"%%s\", ");
+    _scmgen_cstr(fp, _scmgen_msg);
+    fprintf(fp, ");\n}\n");
+    fclose(fp);
+    return;
+  }
+
+  if (SCMVAL_IS_LIST(form)) {
+    _scmgen_boxes(&c, SCMVAL_MAKE_LIST(scmval_cons(_scmgen_ctx, form, SCMVAL_NIL)));
+  }
+  _scmgen_compile(&c, form, 1);
+  _scmgen_finish(&c);
+  _scmgen_comp_free(&c);
+}
+
+// write the c program of the forms compiled since scmgen_begin
+void
+scmgen_write(FILE *fp)
+{
+  int i;
+
+  fputs("#include <errno.h>\n"
+	"#include <stdint.h>\n"
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"#include <string.h>\n"
+	"\n"
+	"#include \"scmerr.h\"\n"
+	"#include \"scmctx.h\"\n"
+	"#include \"scmmem.h\"\n"
+	"#include \"scmval.h\"\n"
+	"#include \"scmspl.h\"\n"
+	"#include \"scmprt.h\"\n"
+	"#include \"scmprm.h\"\n"
+	"#include \"scmcrt.h\"\n"
+	"\n", fp);
+
+  for (i=0; i<_scmgen_nglobals; i++) {
+    fprintf(fp, "static scmval g%d = SCMVAL_UNBOUND;\n", i);
+    if (_scmgen_builtins[i]) {
+      fprintf(fp, "static scmval b%d;\n", i);
+    }
+  }
+  for (i=0; i<_scmgen_nconsts; i++) {
+    fprintf(fp, "static scmval k%d;\n", i);
+  }
+  fprintf(fp, "\nstatic struct scmcrt_global globals[] = {\n");
+  for (i=0; i<_scmgen_nglobals; i++) {
+    fprintf(fp, "  { ");
+    _scmgen_cstr(fp, SCMVAL_TO_C_STR(_scmgen_globals[i]));
+    fprintf(fp, ", &g%d },\n", i);
+  }
+  fprintf(fp, "  { NULL, NULL }\n};\n\n");
+
+  for (i=0; i<_scmgen_nfuncs; i++) {
+    if (_scmgen_funcs[i]) {
+      fprintf(fp, "static scmval f%d(struct _scmprc *self, scmval *argv);\n", i);
+    }
+  }
+  for (i=0; i<_scmgen_nfuncs; i++) {
+    if (_scmgen_funcs[i]) {
+      fprintf(fp, "\n%s", _scmgen_funcs[i]);
+    }
+  }
+
+  fprintf(fp, "\nint\nmain(void)\n{\n");
+  fprintf(fp, "  scmcrt_init(globals, %d);\n", _scmgen_nglobals);
+  for (i=0; i<_scmgen_nglobals; i++) {
+    if (_scmgen_builtins[i]) {
+      fprintf(fp, "  b%d = g%d;\n", i, i);
+    }
+  }
+  for (i=0; i<_scmgen_nconsts; i++) {
+    fprintf(fp, "  k%d = ", i);
+    _scmgen_datum(fp, _scmgen_consts[i]);
+    fprintf(fp, ";\n");
+  }
+  fprintf(fp, "\n");
+  for (i=0; i<_scmgen_nforms; i++) {
+    fprintf(fp, "  scmprt_print(scmcrt_ctx, scmcrt_run(f%d(NULL, NULL)));\n", _scmgen_forms[i]);
+  }
+  fprintf(fp, "  return EXIT_SUCCESS;\n}\n");
+}
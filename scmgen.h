@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCMGEN_H
+#define _SCMGEN_H
+
+/*
+
+scmgen compiles top-level forms to a c program that runs them like scm,
+linked with the runtime scmcrt by scmc.
+
+  - each lambda and each top-level form is a c function, its locals are
+    c variables. the variables are resolved and boxed like in scmevl.
+  - a call in tail position of a procedure to itself jumps back to the
+    start of the function, other tail calls return to a trampoline.
+  - two argument calls of the global integer operators work on the tagged
+    integers directly, as long as the global holds the builtin.
+  - globals are static variables, constants are built before the first
+    form runs.
+  - macros are expanded while compiling, by transformers that scmevl
+    runs. expansions see the macros defined by the forms compiled so far,
+    and the side effects of a transformer happen at compile time. as the
+    program would expand differently when run, scmgen_form fails on a
+    define-macro of a macro already expanded, on a transformer referring
+    to a global other than a primitive, and on a form writing a primitive
+    some transformer refers to.
+  - a form with bad syntax compiles to code raising the error when the
+    form is reached, as in scm.
+
+*/
+
+// start a new program, its macros are expanded in ctx
+void scmgen_begin(scmctx *ctx);
+
+// compile a top-level form
+void scmgen_form(scmval form);
+
+// write the c program of the forms compiled since scmgen_begin
+void scmgen_write(FILE *fp);
+
+#endif
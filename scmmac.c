@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#include <errno.h>   /* errno */
+#include <stdio.h>
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmmac.h"
+
+// Implementation limits:
+#define _SCMMAC_BUCKETS    64
+
+// cached expansion of a call
+struct _scmmac_entry {
+  scmval form;
+  struct scmmac *mac;
+  unsigned long version;        // of mac at expansion time
+  scmval expansion;
+  struct _scmmac_entry *next;
+};
+
+// macros of a context
+struct _scmmac_state {
+  struct scmmac *macros[_SCMMAC_BUCKETS];
+  unsigned long version;
+
+  // expansion cache, grows with the number of expanded forms
+  struct _scmmac_entry **cache;
+  size_t nbuckets;
+  size_t nentries;
+
+  struct scmmac_stats stats;
+};
+
+// a call of a transformer under scmerr_catch
+struct _scmmac_call {
+  scmctx *ctx;
+  scmmac_apply_fn apply;
+  scmval proc;
+  int argc;
+  scmval *argv;
+  scmval result;
+};
+
+/* static prototypes */
+static struct _scmmac_state *_scmmac_state(scmctx *ctx);
+static void _scmmac_release(scmctx *ctx);
+static size_t _scmmac_hash(scmval v, size_t nbuckets);
+static void _scmmac_grow(scmctx *ctx);
+static struct _scmmac_entry *_scmmac_entry(scmctx *ctx, scmval form);
+static void _scmmac_call(void *arg);
+
+
+// the macros of ctx, created on first use
+static struct _scmmac_state *
+_scmmac_state(scmctx *ctx)
+{
+  if (!ctx->mac) {
+    ctx->mac = scmmem_alloc(ctx, 1, sizeof(struct _scmmac_state));
+    memset(ctx->mac, 0, sizeof(struct _scmmac_state));
+    scmctx_atfree(ctx, _scmmac_release);
+  }
+  return ctx->mac;
+}
+
+static void
+_scmmac_release(scmctx *ctx)
+{
+  struct _scmmac_state *st = ctx->mac;
+  struct scmmac *mac, *mnext;
+  struct _scmmac_entry *e, *enext;
+  size_t i;
+
+  for (i=0; i<_SCMMAC_BUCKETS; i++) {
+    for (mac = st->macros[i]; mac; mac = mnext) {
+      mnext = mac->next;
+      scmmem_free(ctx, (void **)&mac);
+    }
+  }
+  for (i=0; i<st->nbuckets; i++) {
+    for (e = st->cache[i]; e; e = enext) {
+      enext = e->next;
+      scmmem_free(ctx, (void **)&e);
+    }
+  }
+  if (st->cache) {
+    scmmem_free(ctx, (void **)&st->cache);
+  }
+  scmmem_free(ctx, (void **)&ctx->mac);
+}
+
+
+// values are unique pointers, drop the tag bits
+static size_t
+_scmmac_hash(scmval v, size_t nbuckets)
+{
+  return ((uintptr_t)v >> 3) % nbuckets;
+}
+
+void
+scmmac_define(scmctx *ctx, scmval name, scmval proc)
+{
+  struct _scmmac_state *st = _scmmac_state(ctx);
+  struct scmmac *mac = scmmac_lookup(ctx, name);
+  size_t h;
+
+  if (!SCMVAL_IS_PROCEDURE(proc)) {
+    scmerr(SCMERR_WRONG_TYPE, "define-macro: procedure expected");
+  }
+  if (!mac) {
+    h = _scmmac_hash(name, _SCMMAC_BUCKETS);
+    mac = scmmem_alloc(ctx, 1, sizeof(struct scmmac));
+    mac->name = name;
+    mac->next = st->macros[h];
+    st->macros[h] = mac;
+  }
+  mac->proc = proc;
+  mac->version = ++st->version;
+}
+
+struct scmmac *
+scmmac_lookup(scmctx *ctx, scmval sym)
+{
+  struct scmmac *mac;
+
+  for (mac = _scmmac_state(ctx)->macros[_scmmac_hash(sym, _SCMMAC_BUCKETS)]; mac; mac = mac->next) {
+    if (sym == mac->name) {
+      return mac;
+    }
+  }
+  return NULL;
+}
+
+// double the buckets of the cache
+static void
+_scmmac_grow(scmctx *ctx)
+{
+  struct _scmmac_state *st = ctx->mac;
+  struct _scmmac_entry **old = st->cache;
+  size_t nold = st->nbuckets;
+  struct _scmmac_entry *e, *next;
+  size_t i, h;
+
+  st->nbuckets = nold ? 2 * nold : 256;
+  st->cache = scmmem_alloc(ctx, st->nbuckets, sizeof(struct _scmmac_entry *));
+  memset(st->cache, 0, st->nbuckets * sizeof(struct _scmmac_entry *));
+  for (i=0; i<nold; i++) {
+    for (e = old[i]; e; e = next) {
+      next = e->next;
+      h = _scmmac_hash(e->form, st->nbuckets);
+      e->next = st->cache[h];
+      st->cache[h] = e;
+    }
+  }
+  if (old) {
+    scmmem_free(ctx, (void **)&old);
+  }
+}
+
+// the cache entry of form, created empty if there is none
+static struct _scmmac_entry *
+_scmmac_entry(scmctx *ctx, scmval form)
+{
+  struct _scmmac_state *st = _scmmac_state(ctx);
+  struct _scmmac_entry *e;
+  size_t h;
+
+  if (st->nentries >= 2 * st->nbuckets) {
+    _scmmac_grow(ctx);
+  }
+  h = _scmmac_hash(form, st->nbuckets);
+  for (e = st->cache[h]; e; e = e->next) {
+    if (form == e->form) {
+      return e;
+    }
+  }
+  e = scmmem_alloc(ctx, 1, sizeof(struct _scmmac_entry));
+  memset(e, 0, sizeof(struct _scmmac_entry));
+  e->form = form;
+  e->next = st->cache[h];
+  st->cache[h] = e;
+  st->nentries++;
+  return e;
+}
+
+scmval
+scmmac_expand(scmctx *ctx, struct scmmac *mac, scmval x, scmmac_apply_fn apply)
+{
+  struct _scmmac_entry *e = _scmmac_entry(ctx, x);
+  struct _scmmac_call call;
+  struct scmerr_caught err;
+  scmval *argv;
+  scmval l;
+  int argc, i, failed;
+
+  if ((mac == e->mac) && (mac->version == e->version)) {
+    ctx->mac->stats.hits++;
+    return e->expansion;
+  }
+
+  for (argc = 0, l = SCMVAL_CDR(x); SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    argc++;
+  }
+  if (SCMVAL_NIL != l) {
+    scmerr(SCMERR_BAD_SYNTAX, "%s: improper macro call", SCMVAL_TO_C_STR(mac->name));
+  }
+  argv = scmmem_alloc(ctx, argc + 1, sizeof(scmval));
+  for (i = 0, l = SCMVAL_CDR(x); i < argc; i++, l = SCMVAL_CDR(l)) {
+    argv[i] = SCMVAL_CAR(l);
+  }
+  // an error in the transformer is raised again once argv is released
+  call.ctx = ctx;
+  call.apply = apply;
+  call.proc = mac->proc;
+  call.argc = argc;
+  call.argv = argv;
+  failed = scmerr_catch(_scmmac_call, &call, &err);
+  scmmem_free(ctx, (void **)&argv);
+  if (failed) {
+    scmerr_raise(&err);
+  }
+  l = call.result;
+  ctx->mac->stats.expansions++;
+
+  // the transformer may define macros and grow the cache, look up again
+  e = _scmmac_entry(ctx, x);
+  e->mac = mac;
+  e->version = mac->version;
+  e->expansion = l;
+  return l;
+}
+
+static void
+_scmmac_call(void *arg)
+{
+  struct _scmmac_call *c = arg;
+
+  c->result = c->apply(c->ctx, c->proc, c->argc, c->argv);
+}
+
+void
+scmmac_stats(scmctx *ctx, struct scmmac_stats *st)
+{
+  *st = _scmmac_state(ctx)->stats;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _SCMMAC_H
+#define _SCMMAC_H
+
+/*
+
+scmmac keeps the macros of a context, shared by its interpreters, and the
+expansions of their calls.
+
+a macro is a procedure of the interpreter that defined it, applied to the
+unevaluated operands of a call. the expansion of a call is kept in a side
+table keyed by the cons cell of the call, so the same source form is
+expanded only once however often it is evaluated. the form itself stays
+untouched. redefining a macro gives it a new version, cached expansions of
+an older version are expanded again on their next use.
+
+*/
+
+// a macro binding
+struct scmmac {
+  scmval name;
+  scmval proc;                  // transformer
+  unsigned long version;        // changes with every definition
+  struct scmmac *next;
+};
+
+// expansion counters
+struct scmmac_stats {
+  unsigned long expansions;     // calls of a transformer
+  unsigned long hits;           // expansions found in the cache
+};
+
+// apply a procedure of the calling interpreter
+typedef scmval (*scmmac_apply_fn)(scmctx *ctx, scmval proc, int argc, scmval *argv);
+
+// define or redefine the macro name
+void scmmac_define(scmctx *ctx, scmval name, scmval proc);
+
+// the macro bound to the symbol sym, NULL if there is none
+struct scmmac *scmmac_lookup(scmctx *ctx, scmval sym);
+
+// the expansion of the call x of mac, cached for x
+scmval scmmac_expand(scmctx *ctx, struct scmmac *mac, scmval x, scmmac_apply_fn apply);
+
+// expansion counters
+void scmmac_stats(scmctx *ctx, struct scmmac_stats *);
+
+#endif
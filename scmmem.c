@@ -18,14 +18,100 @@
 
 #include <errno.h>   /* errno */
 #include <stdint.h>  /* SIZE_MAX */
+#include <stdio.h>
 #include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
 #include <string.h>      /* strlen */
 
 #include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
 #include "scmmem.h"
 
 /* heap memory */
-extern void *scmmem_alloc(size_t nmemb, size_t size);
-extern void *scmmem_realloc(void *ptr, size_t nmemb, size_t size);
-extern char *scmmem_strdup(const char *s);
-extern void scmmem_free(void **ptr);
+extern int scmmem_class(size_t size);
+extern void *scmmem_alloc(scmctx *ctx, size_t nmemb, size_t size);
+extern void *scmmem_realloc(scmctx *ctx, void *ptr, size_t nmemb, size_t size);
+extern char *scmmem_strdup(scmctx *ctx, const char *s);
+extern void scmmem_free(scmctx *ctx, void **ptr);
+extern void *scmmem_arena_alloc(scmctx *ctx, size_t size);
+
+// a block of an arena, its bytes follow
+struct _scmmem_block {
+  struct _scmmem_block *next;
+  _Alignas(16) char bytes[];
+};
+
+// allocate from an arena from now on, until scmmem_arena_free
+void
+scmmem_arena_new(scmctx *ctx)
+{
+  struct _scmmem_arena *a = scmmem_alloc(ctx, 1, sizeof(struct _scmmem_arena));
+
+  a->next = a->end = NULL;
+  a->block = a->blocks = NULL;
+  a->resets = 0;
+  a->spl = NULL;
+  ctx->arena = a;
+}
+
+// take back everything allocated in the arena of ctx
+void
+scmmem_arena_reset(scmctx *ctx)
+{
+  struct _scmmem_arena *a = ctx->arena;
+
+  a->resets++;
+  a->block = a->blocks;
+  if (a->block) {
+    a->next = a->block->bytes;
+    a->end = a->next + SCMMEM_ARENA_BLOCK;
+  }
+}
+
+// release the arena of ctx, allocate from the heap again
+void
+scmmem_arena_free(scmctx *ctx)
+{
+  struct _scmmem_arena *a = ctx->arena;
+  struct _scmmem_block *b;
+
+  while (a->blocks) {
+    b = a->blocks;
+    a->blocks = b->next;
+    scmmem_free(ctx, (void **)&b);
+  }
+  if (a->spl) {
+    scmmem_free(ctx, &a->spl);
+  }
+  scmmem_free(ctx, (void **)&ctx->arena);
+}
+
+/*
+ * size bytes in the next block of the arena of ctx, reused after a reset
+ * or allocated. what does not fit into a block comes from the heap and is
+ * never released.
+ */
+void *
+scmmem_arena_grow(scmctx *ctx, size_t size)
+{
+  struct _scmmem_arena *a = ctx->arena;
+  struct _scmmem_block *b;
+
+  if (size > SCMMEM_ARENA_BLOCK) {
+    return scmmem_alloc(ctx, 1, size);
+  }
+  if (a->block && a->block->next) {
+    b = a->block->next;
+  } else {
+    b = scmmem_alloc(ctx, 1, sizeof(struct _scmmem_block) + SCMMEM_ARENA_BLOCK);
+    b->next = NULL;
+    if (a->block) {
+      a->block->next = b;
+    } else {
+      a->blocks = b;
+    }
+  }
+  a->block = b;
+  a->next = b->bytes + size;
+  a->end = b->bytes + SCMMEM_ARENA_BLOCK;
+  return b->bytes;
+}
@@ -17,14 +17,31 @@
 #ifndef _SCMMEM_H
 #define _SCMMEM_H
 
+// Implementation limits:
+#define SCMMEM_ARENA_BLOCK  65536
+
 /*
  * This is sqrt(SIZE_MAX+1), as s1*s2 <= SIZE_MAX
  * if both s1 < MUL_NO_OVERFLOW and s2 < MUL_NO_OVERFLOW
  */
 #define _SCMMEM_MUL_NO_OVERFLOW ((size_t)1 << (sizeof(size_t) * 4))
 
+// size class of a block of size bytes, see struct scmmem_stats
+inline int
+scmmem_class(size_t size)
+{
+  int c;
+
+  if (size <= 16) {
+    return 0;
+  }
+  c = (int)(sizeof(unsigned long) * 8) - __builtin_clzl((unsigned long)(size - 1)) - 4;
+  return (c < SCMMEM_CLASSES) ? c : SCMMEM_CLASSES - 1;
+}
+
+// heap memory of the context ctx, counted in ctx->mem
 inline void *
-scmmem_alloc(size_t nmemb, size_t size)
+scmmem_alloc(scmctx *ctx, size_t nmemb, size_t size)
 {
   void *p;
 
@@ -37,12 +54,18 @@ scmmem_alloc(size_t nmemb, size_t size)
   if (NULL == (p = malloc(nmemb * size))) {
     scmerr(SCMERR_SYSCALL, "scmmem_alloc(%zu, %zu)", nmemb, size);
   }
+  ctx->mem.allocs++;
+  ctx->mem.bytes += nmemb * size;
+  if (ctx->stats) {
+    ctx->mem.class_allocs[scmmem_class(nmemb * size)]++;
+    ctx->mem.class_bytes[scmmem_class(nmemb * size)] += nmemb * size;
+  }
 
   return p;
 }
 
 inline void *
-scmmem_realloc(void *ptr, size_t nmemb, size_t size)
+scmmem_realloc(scmctx *ctx, void *ptr, size_t nmemb, size_t size)
 {
   void *nptr;
 
@@ -55,17 +78,18 @@ scmmem_realloc(void *ptr, size_t nmemb, size_t size)
   if (NULL == (nptr = realloc(ptr, nmemb * size))) {
     scmerr(SCMERR_SYSCALL, "scmmem_realloc(%p, %zu, %zu)", ptr, nmemb, size);
   }
+  ctx->mem.reallocs++;
 
   return nptr;
 }
 
 inline char *
-scmmem_strdup(const char *s)
+scmmem_strdup(scmctx *ctx, const char *s)
 {
   char *new_s;
   size_t len = strlen(s) + 1;
 
-  new_s = scmmem_alloc(1, len);
+  new_s = scmmem_alloc(ctx, 1, len);
   (void)memcpy(new_s, s, len);
 
   return new_s;
@@ -73,13 +97,63 @@ scmmem_strdup(const char *s)
 
 
 inline void
-scmmem_free(void **ptr)
+scmmem_free(scmctx *ctx, void **ptr)
 {
   if (NULL == *ptr) {
     scmerr(SCMERR_SYSCALL, "scmmem_free(%p) contains %p (NULL)", ptr, *ptr);
   }
   free(*ptr);
   *ptr = NULL;
+  ctx->mem.frees++;
+}
+
+/*
+ * an arena of ctx hands out the cons cells of scmval_cons, the closures of
+ * the evaluator and the strings of scmspl_batch_string from blocks of
+ * SCMMEM_ARENA_BLOCK bytes. they are not released one by one:
+ * scmmem_arena_reset takes them all back at once and keeps the blocks, so
+ * a loop resetting the arena after each round runs in the memory of its
+ * largest round. no value allocated in the arena may be used after the
+ * reset.
+ */
+struct _scmmem_arena {
+  char *next;                           // free bytes of the current block
+  char *end;
+  struct _scmmem_block *block;          // current block
+  struct _scmmem_block *blocks;         // first block
+  unsigned long resets;                 // times reset
+  void *spl;                            // of scmspl, released with the arena
+};
+
+// allocate from an arena from now on, until scmmem_arena_free
+void scmmem_arena_new(scmctx *ctx);
+
+// take back everything allocated in the arena of ctx
+void scmmem_arena_reset(scmctx *ctx);
+
+// release the arena of ctx, allocate from the heap again
+void scmmem_arena_free(scmctx *ctx);
+
+// size bytes in a new block of the arena of ctx, see scmmem_arena_alloc
+void *scmmem_arena_grow(scmctx *ctx, size_t size);
+
+// size bytes of the arena of ctx, 16 aligned, or of the heap without one
+inline void *
+scmmem_arena_alloc(scmctx *ctx, size_t size)
+{
+  struct _scmmem_arena *a = ctx->arena;
+  void *p;
+
+  if (NULL == a) {
+    return scmmem_alloc(ctx, 1, size);
+  }
+  size = (size + 15) & ~(size_t)15;
+  if ((size_t)(a->end - a->next) < size) {
+    return scmmem_arena_grow(ctx, size);
+  }
+  p = a->next;
+  a->next += size;
+  return p;
 }
 
 #endif
@@ -0,0 +1,882 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#include <errno.h>   /* errno */
+#include <stdio.h>
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmspl.h"
+#include "scmopt.h"
+
+// Implementation limits:
+#define _SCMOPT_MAXARGS       8     // arguments of a folded call
+#define _SCMOPT_INLINE_SIZE   24    // atoms and pairs of an inlined body
+#define _SCMOPT_INLINE_DEPTH  4     // nested inlining
+
+// folds a call on literal values, returns SCMVAL_UNBOUND if it cannot
+typedef scmval (*_scmopt_fold_fn)(int argc, scmval *argv);
+
+// global variables the program defines or assigns
+struct _scmopt_global {
+  scmval sym;
+  int writes;           // define and set! forms seen
+  int macro;            // define-macro forms seen
+  scmval params;        // of an inlinable procedure
+  scmval body;          // SCMVAL_UNBOUND if not inlinable
+  struct _scmopt_global *next;
+};
+
+// operators of _scmopt_compare
+enum {
+  _SCMOPT_EQ,
+  _SCMOPT_LT,
+  _SCMOPT_GT,
+  _SCMOPT_LE,
+  _SCMOPT_GE
+};
+
+#define _SCMOPT_BOOL(c)  ((c) ? SCMVAL_TRUE : SCMVAL_FALSE)
+
+/* static prototypes */
+static void _scmopt_init(scmctx *ctx);
+static void _scmopt_release(scmctx *ctx);
+static struct _scmopt_global *_scmopt_global(scmctx *ctx, scmval sym, int create);
+static _scmopt_fold_fn _scmopt_builtin(scmctx *ctx, scmval sym);
+static int _scmopt_length(scmval l);
+static int _scmopt_size(scmval x);
+static int _scmopt_literal(scmctx *ctx, scmval x);
+static scmval _scmopt_value(scmval x);
+static scmval _scmopt_quote(scmctx *ctx, scmval v);
+static scmval _scmopt_list2(scmctx *ctx, scmval a, scmval b);
+static scmval _scmopt_lookup(scmval sym, scmval env);
+static int _scmopt_occurs(scmval sym, scmval x);
+static int _scmopt_writes(scmctx *ctx, scmval sym, scmval x);
+static int _scmopt_captured(scmval x, scmval params, scmval env);
+static void _scmopt_scan(scmctx *ctx, scmval x);
+static scmval _scmopt_opt(scmctx *ctx, scmval x, scmval env, int depth);
+static scmval _scmopt_body(scmctx *ctx, scmval body, scmval env, int depth);
+static scmval _scmopt_if(scmctx *ctx, scmval x, scmval env, int depth);
+static scmval _scmopt_define(scmctx *ctx, scmval x, scmval env, int depth);
+static scmval _scmopt_let(scmctx *ctx, scmval x, scmval env, int depth);
+static scmval _scmopt_call(scmctx *ctx, scmval x, scmval env, int depth);
+static scmval _scmopt_inline(scmctx *ctx, scmval params, scmval body, scmval args, scmval env, int depth);
+static scmval _scmopt_add(int argc, scmval *argv);
+static scmval _scmopt_sub(int argc, scmval *argv);
+static scmval _scmopt_mul(int argc, scmval *argv);
+static scmval _scmopt_compare(int argc, scmval *argv, int op);
+static scmval _scmopt_num_eq(int argc, scmval *argv);
+static scmval _scmopt_lt(int argc, scmval *argv);
+static scmval _scmopt_gt(int argc, scmval *argv);
+static scmval _scmopt_le(int argc, scmval *argv);
+static scmval _scmopt_ge(int argc, scmval *argv);
+static scmval _scmopt_car(int argc, scmval *argv);
+static scmval _scmopt_cdr(int argc, scmval *argv);
+static scmval _scmopt_null_p(int argc, scmval *argv);
+static scmval _scmopt_pair_p(int argc, scmval *argv);
+static scmval _scmopt_eq_p(int argc, scmval *argv);
+static scmval _scmopt_not(int argc, scmval *argv);
+
+// pure builtins, cons and list are left out as they allocate fresh cells
+static const struct {
+  const char *name;
+  _scmopt_fold_fn fold;
+} _scmopt_builtins[] = {
+  {"+", _scmopt_add},
+  {"-", _scmopt_sub},
+  {"*", _scmopt_mul},
+  {"=", _scmopt_num_eq},
+  {"<", _scmopt_lt},
+  {">", _scmopt_gt},
+  {"<=", _scmopt_le},
+  {">=", _scmopt_ge},
+  {"car", _scmopt_car},
+  {"cdr", _scmopt_cdr},
+  {"null?", _scmopt_null_p},
+  {"pair?", _scmopt_pair_p},
+  {"eq?", _scmopt_eq_p},
+  {"not", _scmopt_not},
+};
+#define _SCMOPT_NBUILTINS (sizeof(_scmopt_builtins) / sizeof(_scmopt_builtins[0]))
+
+// optimizer state of a context
+struct _scmopt_state {
+  scmval builtin_syms[_SCMOPT_NBUILTINS];
+  struct _scmopt_global *globals;
+  int sealed;                   // every form of the program was scanned
+  int lambdas;                  // lambda bodies around the current form
+  int unknown;                  // a macro call may have rebound any global
+
+  scmval sym_quote;
+  scmval sym_if;
+  scmval sym_define;
+  scmval sym_set;
+  scmval sym_lambda;
+  scmval sym_begin;
+  scmval sym_let;
+  scmval sym_define_macro;
+};
+
+
+// the state of ctx, created on first use
+static void
+_scmopt_init(scmctx *ctx)
+{
+  struct _scmopt_state *st;
+  size_t i;
+
+  if (ctx->opt) {
+    return;
+  }
+  st = ctx->opt = scmmem_alloc(ctx, 1, sizeof(struct _scmopt_state));
+  scmctx_atfree(ctx, _scmopt_release);
+
+  for (i=0; i<_SCMOPT_NBUILTINS; i++) {
+    st->builtin_syms[i] = scmspl_intern_symbol(ctx, _scmopt_builtins[i].name);
+  }
+  st->globals = NULL;
+  st->sealed = 0;
+  st->lambdas = 0;
+  st->unknown = 0;
+  st->sym_quote = scmspl_intern_symbol(ctx, "quote");
+  st->sym_if = scmspl_intern_symbol(ctx, "if");
+  st->sym_define = scmspl_intern_symbol(ctx, "define");
+  st->sym_set = scmspl_intern_symbol(ctx, "set!");
+  st->sym_lambda = scmspl_intern_symbol(ctx, "lambda");
+  st->sym_begin = scmspl_intern_symbol(ctx, "begin");
+  st->sym_let = scmspl_intern_symbol(ctx, "let");
+  st->sym_define_macro = scmspl_intern_symbol(ctx, "define-macro");
+}
+
+static void
+_scmopt_release(scmctx *ctx)
+{
+  struct _scmopt_global *g, *next;
+
+  for (g = ctx->opt->globals; g; g = next) {
+    next = g->next;
+    scmmem_free(ctx, (void **)&g);
+  }
+  scmmem_free(ctx, (void **)&ctx->opt);
+}
+
+static struct _scmopt_global *
+_scmopt_global(scmctx *ctx, scmval sym, int create)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+
+  for (g = st->globals; g; g = g->next) {
+    if (sym == g->sym) {
+      return g;
+    }
+  }
+  if (!create) {
+    return NULL;
+  }
+  g = scmmem_alloc(ctx, 1, sizeof(struct _scmopt_global));
+  g->sym = sym;
+  g->writes = 0;
+  g->macro = 0;
+  g->params = SCMVAL_NIL;
+  g->body = SCMVAL_UNBOUND;
+  g->next = st->globals;
+  st->globals = g;
+  return g;
+}
+
+/*
+ * the fold of a builtin the program has not redefined, NULL otherwise. a
+ * lambda body may run after forms the pass has not seen yet, unless the
+ * program is sealed, and the expansion of a macro call may redefine it.
+ */
+static _scmopt_fold_fn
+_scmopt_builtin(scmctx *ctx, scmval sym)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+  size_t i;
+
+  if (st->unknown || (st->lambdas && !st->sealed)) {
+    return NULL;
+  }
+  for (i=0; i<_SCMOPT_NBUILTINS; i++) {
+    if (sym == st->builtin_syms[i]) {
+      g = _scmopt_global(ctx, sym, 0);
+      return (g && g->writes) ? NULL : _scmopt_builtins[i].fold;
+    }
+  }
+  return NULL;
+}
+
+// length of a proper list, -1 otherwise
+static int
+_scmopt_length(scmval l)
+{
+  int len = 0;
+
+  for (; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    len++;
+  }
+  return (SCMVAL_NIL == l) ? len : -1;
+}
+
+// number of atoms and pairs of x
+static int
+_scmopt_size(scmval x)
+{
+  int size = 1;
+
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    size += _scmopt_size(SCMVAL_CAR(x));
+  }
+  return size;
+}
+
+// x evaluates to itself or is quoted
+static int
+_scmopt_literal(scmctx *ctx, scmval x)
+{
+  struct _scmopt_state *st = ctx->opt;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    return 0;
+  }
+  if (!SCMVAL_IS_LIST(x)) {
+    return 1;
+  }
+  return (st->sym_quote == SCMVAL_CAR(x)) && (2 == _scmopt_length(x));
+}
+
+// value of a literal
+static scmval
+_scmopt_value(scmval x)
+{
+  return SCMVAL_IS_LIST(x) ? SCMVAL_CAR(SCMVAL_CDR(x)) : x;
+}
+
+// literal of a value
+static scmval
+_scmopt_quote(scmctx *ctx, scmval v)
+{
+  struct _scmopt_state *st = ctx->opt;
+
+  if (SCMVAL_IS_SYMBOL(v) || SCMVAL_IS_LIST(v)) {
+    return _scmopt_list2(ctx, st->sym_quote, v);
+  }
+  return v;
+}
+
+static scmval
+_scmopt_list2(scmctx *ctx, scmval a, scmval b)
+{
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, a, SCMVAL_MAKE_LIST(scmval_cons(ctx, b, SCMVAL_NIL))));
+}
+
+/*
+ * environments are lists of bindings (name . literal), innermost first.
+ * locals of unknown value are bound to SCMVAL_UNBOUND. returns the
+ * binding of sym or nil for globals.
+ */
+static scmval
+_scmopt_lookup(scmval sym, scmval env)
+{
+  for (; SCMVAL_NIL != env; env = SCMVAL_CDR(env)) {
+    if (sym == SCMVAL_CAR(SCMVAL_CAR(env))) {
+      return SCMVAL_CAR(env);
+    }
+  }
+  return SCMVAL_NIL;
+}
+
+// sym appears anywhere in x, quoted data included
+static int
+_scmopt_occurs(scmval sym, scmval x)
+{
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    if (_scmopt_occurs(sym, SCMVAL_CAR(x))) {
+      return 1;
+    }
+  }
+  return sym == x;
+}
+
+// x may define or assign a variable named sym, the expansion of a macro
+// call with sym in it is unknown
+static int
+_scmopt_writes(scmctx *ctx, scmval sym, scmval x)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+  scmval target;
+
+  if (!SCMVAL_IS_LIST(x) || (st->sym_quote == SCMVAL_CAR(x))) {
+    return 0;
+  }
+  if (SCMVAL_IS_SYMBOL(SCMVAL_CAR(x)) && (g = _scmopt_global(ctx, SCMVAL_CAR(x), 0)) && g->macro) {
+    return _scmopt_occurs(sym, x);
+  }
+  if (((st->sym_define == SCMVAL_CAR(x)) || (st->sym_set == SCMVAL_CAR(x))) &&
+      SCMVAL_IS_LIST(SCMVAL_CDR(x))) {
+    target = SCMVAL_CAR(SCMVAL_CDR(x));
+    if (sym == (SCMVAL_IS_LIST(target) ? SCMVAL_CAR(target) : target)) {
+      return 1;
+    }
+  }
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    if (_scmopt_writes(ctx, sym, SCMVAL_CAR(x))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// a symbol of x other than params is a local in env
+static int
+_scmopt_captured(scmval x, scmval params, scmval env)
+{
+  scmval p;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    for (p = params; SCMVAL_NIL != p; p = SCMVAL_CDR(p)) {
+      if (x == SCMVAL_CAR(p)) {
+	return 0;
+      }
+    }
+    return SCMVAL_NIL != _scmopt_lookup(x, env);
+  }
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    if (_scmopt_captured(SCMVAL_CAR(x), params, env)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// count the define and set! forms of the globals, locals included, and
+// note the macros. what the expansion of a macro call writes is unknown
+static void
+_scmopt_scan(scmctx *ctx, scmval x)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+  scmval target;
+
+  if (!SCMVAL_IS_LIST(x) || (st->sym_quote == SCMVAL_CAR(x))) {
+    return;
+  }
+  if (SCMVAL_IS_SYMBOL(SCMVAL_CAR(x)) && (g = _scmopt_global(ctx, SCMVAL_CAR(x), 0)) && g->macro) {
+    st->unknown = 1;
+  }
+  if ((st->sym_define_macro == SCMVAL_CAR(x)) && SCMVAL_IS_LIST(SCMVAL_CDR(x)) &&
+      SCMVAL_IS_LIST(SCMVAL_CAR(SCMVAL_CDR(x)))) {
+    _scmopt_global(ctx, SCMVAL_CAR(SCMVAL_CAR(SCMVAL_CDR(x))), 1)->macro = 1;
+    return;
+  }
+  if (((st->sym_define == SCMVAL_CAR(x)) || (st->sym_set == SCMVAL_CAR(x))) &&
+      SCMVAL_IS_LIST(SCMVAL_CDR(x))) {
+    target = SCMVAL_CAR(SCMVAL_CDR(x));
+    if (SCMVAL_IS_LIST(target)) {
+      target = SCMVAL_CAR(target);
+    }
+    if (SCMVAL_IS_SYMBOL(target)) {
+      g = _scmopt_global(ctx, target, 1);
+      g->writes++;
+      g->body = SCMVAL_UNBOUND;
+    }
+  }
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    _scmopt_scan(ctx, SCMVAL_CAR(x));
+  }
+}
+
+// optimize x in the environment env, depth counts nested inlining
+static scmval
+_scmopt_opt(scmctx *ctx, scmval x, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+  scmval b, op, l, forms = SCMVAL_NIL, *tail = &forms;
+  int n;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    b = _scmopt_lookup(x, env);
+    return ((SCMVAL_NIL != b) && (SCMVAL_UNBOUND != SCMVAL_CDR(b))) ? SCMVAL_CDR(b) : x;
+  }
+  // malformed forms are left to the evaluator to report
+  if (!SCMVAL_IS_LIST(x) || ((n = _scmopt_length(x)) < 0)) {
+    return x;
+  }
+
+  op = SCMVAL_CAR(x);
+  if ((st->sym_quote == op) || (st->sym_define_macro == op)) {
+    return x;
+  }
+  if (st->sym_if == op) {
+    return _scmopt_if(ctx, x, env, depth);
+  }
+  if (st->sym_define == op) {
+    return _scmopt_define(ctx, x, env, depth);
+  }
+  if (st->sym_set == op) {
+    if (3 != n) {
+      return x;
+    }
+    return SCMVAL_MAKE_LIST(scmval_cons(ctx, op, _scmopt_list2(ctx, SCMVAL_CAR(SCMVAL_CDR(x)),
+							  _scmopt_opt(ctx, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))),
+								      env, depth))));
+  }
+  if (st->sym_lambda == op) {
+    if ((n < 3) || (_scmopt_length(SCMVAL_CAR(SCMVAL_CDR(x))) < 0)) {
+      return x;
+    }
+    for (l = SCMVAL_CAR(SCMVAL_CDR(x)); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+      env = SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_CAR(l), SCMVAL_UNBOUND)),
+					 env));
+    }
+    st->lambdas++;
+    l = _scmopt_body(ctx, SCMVAL_CDR(SCMVAL_CDR(x)), env, depth);
+    st->lambdas--;
+    return SCMVAL_MAKE_LIST(scmval_cons(ctx, op, SCMVAL_MAKE_LIST(
+      scmval_cons(ctx, SCMVAL_CAR(SCMVAL_CDR(x)), l))));
+  }
+  if (st->sym_begin == op) {
+    // values of all but the last form are dropped, literals need no evaluation
+    for (l = SCMVAL_CDR(x); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+      b = _scmopt_opt(ctx, SCMVAL_CAR(l), env, depth);
+      if ((SCMVAL_NIL != SCMVAL_CDR(l)) && _scmopt_literal(ctx, b)) {
+	continue;
+      }
+      *tail = SCMVAL_MAKE_LIST(scmval_cons(ctx, b, SCMVAL_NIL));
+      tail = &SCMVAL_CDR(*tail);
+    }
+    if (SCMVAL_IS_LIST(forms) && (SCMVAL_NIL == SCMVAL_CDR(forms))) {
+      return SCMVAL_CAR(forms);
+    }
+    return SCMVAL_MAKE_LIST(scmval_cons(ctx, op, forms));
+  }
+  if (st->sym_let == op) {
+    return _scmopt_let(ctx, x, env, depth);
+  }
+  if (SCMVAL_IS_SYMBOL(op) && (SCMVAL_NIL == _scmopt_lookup(op, env)) &&
+      (g = _scmopt_global(ctx, op, 0)) && g->macro) {
+    return x;
+  }
+  return _scmopt_call(ctx, x, env, depth);
+}
+
+// a body, its internal definitions are locals of unknown value
+static scmval
+_scmopt_body(scmctx *ctx, scmval body, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  scmval l, def, target, forms = SCMVAL_NIL, *tail = &forms;
+
+  for (l = body; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    def = SCMVAL_CAR(l);
+    if (SCMVAL_IS_LIST(def) && (st->sym_define == SCMVAL_CAR(def)) &&
+	SCMVAL_IS_LIST(SCMVAL_CDR(def))) {
+      target = SCMVAL_CAR(SCMVAL_CDR(def));
+      target = SCMVAL_IS_LIST(target) ? SCMVAL_CAR(target) : target;
+      env = SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, target, SCMVAL_UNBOUND)), env));
+    }
+  }
+  for (l = body; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    *tail = SCMVAL_MAKE_LIST(scmval_cons(ctx, _scmopt_opt(ctx, SCMVAL_CAR(l), env, depth), SCMVAL_NIL));
+    tail = &SCMVAL_CDR(*tail);
+  }
+  return forms;
+}
+
+// (if test consequent [alternative]), a literal test selects the branch
+static scmval
+_scmopt_if(scmctx *ctx, scmval x, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  scmval test, rest;
+  int n = _scmopt_length(x);
+
+  if ((n < 3) || (n > 4)) {
+    return x;
+  }
+  test = _scmopt_opt(ctx, SCMVAL_CAR(SCMVAL_CDR(x)), env, depth);
+  rest = SCMVAL_CDR(SCMVAL_CDR(x));
+  if (_scmopt_literal(ctx, test)) {
+    if (SCMVAL_FALSE != _scmopt_value(test)) {
+      return _scmopt_opt(ctx, SCMVAL_CAR(rest), env, depth);
+    }
+    return (4 == n) ? _scmopt_opt(ctx, SCMVAL_CAR(SCMVAL_CDR(rest)), env, depth) : SCMVAL_NIL;
+  }
+  rest = (4 == n) ? _scmopt_list2(ctx, _scmopt_opt(ctx, SCMVAL_CAR(rest), env, depth),
+				  _scmopt_opt(ctx, SCMVAL_CAR(SCMVAL_CDR(rest)), env, depth))
+    : SCMVAL_MAKE_LIST(scmval_cons(ctx, _scmopt_opt(ctx, SCMVAL_CAR(rest), env, depth), SCMVAL_NIL));
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, st->sym_if,
+				      SCMVAL_MAKE_LIST(scmval_cons(ctx, test, rest))));
+}
+
+/*
+ * (define name value) or (define (name param ...) body ...). a procedure
+ * defined once at top level with a small body that does not call itself
+ * becomes inlinable.
+ */
+static scmval
+_scmopt_define(scmctx *ctx, scmval x, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+  scmval target, lambda, body;
+  int n = _scmopt_length(x);
+
+  if (n < 3) {
+    return x;
+  }
+  target = SCMVAL_CAR(SCMVAL_CDR(x));
+  if (!SCMVAL_IS_LIST(target)) {
+    if (3 != n) {
+      return x;
+    }
+    return SCMVAL_MAKE_LIST(scmval_cons(ctx, st->sym_define, _scmopt_list2(ctx,
+      target, _scmopt_opt(ctx, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))), env, depth))));
+  }
+
+  lambda = _scmopt_opt(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, st->sym_lambda, SCMVAL_MAKE_LIST(
+    scmval_cons(ctx, SCMVAL_CDR(target), SCMVAL_CDR(SCMVAL_CDR(x)))))), env, depth);
+  body = SCMVAL_CDR(SCMVAL_CDR(lambda));
+
+  g = _scmopt_global(ctx, SCMVAL_CAR(target), 0);
+  if ((SCMVAL_NIL == env) && g && (1 == g->writes) &&
+      (_scmopt_size(body) <= _SCMOPT_INLINE_SIZE) && !_scmopt_occurs(g->sym, body)) {
+    g->params = SCMVAL_CDR(target);
+    g->body = body;
+  }
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, st->sym_define, SCMVAL_MAKE_LIST(scmval_cons(ctx,
+    SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_CAR(target), SCMVAL_CDR(target))), body))));
+}
+
+/*
+ * (let ((name init) ...) body ...). a name bound to a literal and never
+ * assigned in the body is replaced by the literal, a let without bindings
+ * around a single form is that form.
+ */
+static scmval
+_scmopt_let(scmctx *ctx, scmval x, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  scmval l, b, init, body, benv = env;
+  scmval bindings = SCMVAL_NIL, *tail = &bindings;
+
+  if ((_scmopt_length(x) < 3) || (_scmopt_length(SCMVAL_CAR(SCMVAL_CDR(x))) < 0)) {
+    return x;
+  }
+  body = SCMVAL_CDR(SCMVAL_CDR(x));
+  for (l = SCMVAL_CAR(SCMVAL_CDR(x)); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    b = SCMVAL_CAR(l);
+    if ((2 != _scmopt_length(b)) || !SCMVAL_IS_SYMBOL(SCMVAL_CAR(b))) {
+      return x;
+    }
+  }
+
+  for (l = SCMVAL_CAR(SCMVAL_CDR(x)); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    b = SCMVAL_CAR(l);
+    init = _scmopt_opt(ctx, SCMVAL_CAR(SCMVAL_CDR(b)), env, depth);
+    if (_scmopt_literal(ctx, init) && !_scmopt_writes(ctx, SCMVAL_CAR(b), body)) {
+      benv = SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_CAR(b), init)), benv));
+      continue;
+    }
+    benv = SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_CAR(b), SCMVAL_UNBOUND)),
+					benv));
+    *tail = SCMVAL_MAKE_LIST(scmval_cons(ctx, _scmopt_list2(ctx, SCMVAL_CAR(b), init), SCMVAL_NIL));
+    tail = &SCMVAL_CDR(*tail);
+  }
+
+  body = _scmopt_body(ctx, body, benv, depth);
+  if ((SCMVAL_NIL == bindings) && (SCMVAL_NIL == SCMVAL_CDR(body))) {
+    l = SCMVAL_CAR(body);
+    if (!SCMVAL_IS_LIST(l) || ((st->sym_define != SCMVAL_CAR(l)) &&
+			       (st->sym_begin != SCMVAL_CAR(l)) &&
+			       (st->sym_define_macro != SCMVAL_CAR(l)))) {
+      return l;
+    }
+  }
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, st->sym_let, SCMVAL_MAKE_LIST(scmval_cons(ctx, bindings, body))));
+}
+
+// (operator operand ...)
+static scmval
+_scmopt_call(scmctx *ctx, scmval x, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  struct _scmopt_global *g;
+  _scmopt_fold_fn fold;
+  scmval op = SCMVAL_CAR(x);
+  scmval argv[_SCMOPT_MAXARGS];
+  scmval l, v, args = SCMVAL_NIL, *tail = &args;
+  int argc = 0;
+  int literals = 1;
+
+  for (l = SCMVAL_CDR(x); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    v = _scmopt_opt(ctx, SCMVAL_CAR(l), env, depth);
+    if (!_scmopt_literal(ctx, v) || (_SCMOPT_MAXARGS == argc)) {
+      literals = 0;
+    } else {
+      argv[argc] = _scmopt_value(v);
+    }
+    argc++;
+    *tail = SCMVAL_MAKE_LIST(scmval_cons(ctx, v, SCMVAL_NIL));
+    tail = &SCMVAL_CDR(*tail);
+  }
+
+  // ((lambda (param ...) body ...) arg ...)
+  if (SCMVAL_IS_LIST(op) && (st->sym_lambda == SCMVAL_CAR(op)) &&
+      (_scmopt_length(op) >= 3) && (_scmopt_length(SCMVAL_CAR(SCMVAL_CDR(op))) == argc)) {
+    return _scmopt_inline(ctx, SCMVAL_CAR(SCMVAL_CDR(op)), SCMVAL_CDR(SCMVAL_CDR(op)), args, env, depth);
+  }
+  if (!SCMVAL_IS_SYMBOL(op) || (SCMVAL_NIL != _scmopt_lookup(op, env))) {
+    return SCMVAL_MAKE_LIST(scmval_cons(ctx, _scmopt_opt(ctx, op, env, depth), args));
+  }
+
+  if (literals && (fold = _scmopt_builtin(ctx, op))) {
+    v = fold(argc, argv);
+    if (SCMVAL_UNBOUND != v) {
+      return _scmopt_quote(ctx, v);
+    }
+  }
+  // like the fold of a builtin, see _scmopt_builtin
+  g = _scmopt_global(ctx, op, 0);
+  if (g && (1 == g->writes) && (SCMVAL_UNBOUND != g->body) && !st->unknown &&
+      (!st->lambdas || st->sealed) &&
+      (_scmopt_length(g->params) == argc) && (depth < _SCMOPT_INLINE_DEPTH) &&
+      !_scmopt_captured(g->body, g->params, env)) {
+    return _scmopt_inline(ctx, g->params, g->body, args, env, depth + 1);
+  }
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, op, args));
+}
+
+// the call of a lambda is a let binding its parameters to the arguments
+static scmval
+_scmopt_inline(scmctx *ctx, scmval params, scmval body, scmval args, scmval env, int depth)
+{
+  struct _scmopt_state *st = ctx->opt;
+  scmval bindings = SCMVAL_NIL, *tail = &bindings;
+
+  for (; SCMVAL_NIL != params; params = SCMVAL_CDR(params), args = SCMVAL_CDR(args)) {
+    *tail = SCMVAL_MAKE_LIST(scmval_cons(ctx, _scmopt_list2(ctx, SCMVAL_CAR(params), SCMVAL_CAR(args)),
+					 SCMVAL_NIL));
+    tail = &SCMVAL_CDR(*tail);
+  }
+  return _scmopt_let(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, st->sym_let,
+						  SCMVAL_MAKE_LIST(scmval_cons(ctx, bindings, body)))),
+		     env, depth);
+}
+
+scmval
+scmopt_optimize(scmctx *ctx, scmval form)
+{
+  _scmopt_init(ctx);
+
+  if (SCMVAL_EOF == form) {
+    return form;
+  }
+  if (!ctx->opt->sealed) {
+    _scmopt_scan(ctx, form);
+  }
+  // after an error caught in the last form
+  ctx->opt->lambdas = 0;
+  return _scmopt_opt(ctx, form, SCMVAL_NIL, 0);
+}
+
+// note what a form that is not optimized defines and assigns
+void
+scmopt_scan(scmctx *ctx, scmval form)
+{
+  _scmopt_init(ctx);
+
+  if (SCMVAL_EOF != form) {
+    _scmopt_scan(ctx, form);
+  }
+}
+
+// every form of the program has been scanned
+void
+scmopt_seal(scmctx *ctx)
+{
+  _scmopt_init(ctx);
+  ctx->opt->sealed = 1;
+}
+
+
+
+/*
+ * folds of the builtins, see scmprm.c. integers stay tagged.
+ */
+
+static scmval
+_scmopt_add(int argc, scmval *argv)
+{
+  intptr_t sum = 0;
+  int i;
+
+  for (i=0; i<argc; i++) {
+    if (!SCMVAL_IS_INTEGER(argv[i]) ||
+	__builtin_add_overflow(sum, (intptr_t)argv[i], &sum)) {
+      return SCMVAL_UNBOUND;
+    }
+  }
+  return (scmval)sum;
+}
+
+static scmval
+_scmopt_sub(int argc, scmval *argv)
+{
+  intptr_t diff;
+  int i;
+
+  if ((0 == argc) || !SCMVAL_IS_INTEGER(argv[0])) {
+    return SCMVAL_UNBOUND;
+  }
+  diff = (1 == argc) ? 0 : (intptr_t)argv[0];
+  for (i = (1 == argc) ? 0 : 1; i<argc; i++) {
+    if (!SCMVAL_IS_INTEGER(argv[i]) ||
+	__builtin_sub_overflow(diff, (intptr_t)argv[i], &diff)) {
+      return SCMVAL_UNBOUND;
+    }
+  }
+  return (scmval)diff;
+}
+
+static scmval
+_scmopt_mul(int argc, scmval *argv)
+{
+  intptr_t prod = (intptr_t)SCMVAL_MAKE_INTEGER(1);
+  int i;
+
+  for (i=0; i<argc; i++) {
+    if (!SCMVAL_IS_INTEGER(argv[i]) ||
+	__builtin_mul_overflow(prod, SCMVAL_TO_C_INT(argv[i]), &prod)) {
+      return SCMVAL_UNBOUND;
+    }
+  }
+  return (scmval)prod;
+}
+
+static scmval
+_scmopt_compare(int argc, scmval *argv, int op)
+{
+  int i;
+  int res = 1;
+
+  if (0 == argc) {
+    return SCMVAL_UNBOUND;
+  }
+  for (i=0; i<argc; i++) {
+    if (!SCMVAL_IS_INTEGER(argv[i])) {
+      return SCMVAL_UNBOUND;
+    }
+  }
+  for (i=1; i<argc; i++) {
+    switch (op) {
+    case _SCMOPT_EQ:
+      res = res && ((intptr_t)argv[i-1] == (intptr_t)argv[i]);
+      break;
+    case _SCMOPT_LT:
+      res = res && ((intptr_t)argv[i-1] < (intptr_t)argv[i]);
+      break;
+    case _SCMOPT_GT:
+      res = res && ((intptr_t)argv[i-1] > (intptr_t)argv[i]);
+      break;
+    case _SCMOPT_LE:
+      res = res && ((intptr_t)argv[i-1] <= (intptr_t)argv[i]);
+      break;
+    case _SCMOPT_GE:
+      res = res && ((intptr_t)argv[i-1] >= (intptr_t)argv[i]);
+      break;
+    }
+  }
+  return _SCMOPT_BOOL(res);
+}
+
+static scmval
+_scmopt_num_eq(int argc, scmval *argv)
+{
+  return _scmopt_compare(argc, argv, _SCMOPT_EQ);
+}
+
+static scmval
+_scmopt_lt(int argc, scmval *argv)
+{
+  return _scmopt_compare(argc, argv, _SCMOPT_LT);
+}
+
+static scmval
+_scmopt_gt(int argc, scmval *argv)
+{
+  return _scmopt_compare(argc, argv, _SCMOPT_GT);
+}
+
+static scmval
+_scmopt_le(int argc, scmval *argv)
+{
+  return _scmopt_compare(argc, argv, _SCMOPT_LE);
+}
+
+static scmval
+_scmopt_ge(int argc, scmval *argv)
+{
+  return _scmopt_compare(argc, argv, _SCMOPT_GE);
+}
+
+static scmval
+_scmopt_car(int argc, scmval *argv)
+{
+  return ((1 == argc) && SCMVAL_IS_LIST(argv[0])) ? SCMVAL_CAR(argv[0]) : SCMVAL_UNBOUND;
+}
+
+static scmval
+_scmopt_cdr(int argc, scmval *argv)
+{
+  return ((1 == argc) && SCMVAL_IS_LIST(argv[0])) ? SCMVAL_CDR(argv[0]) : SCMVAL_UNBOUND;
+}
+
+static scmval
+_scmopt_null_p(int argc, scmval *argv)
+{
+  return (1 == argc) ? _SCMOPT_BOOL(SCMVAL_NIL == argv[0]) : SCMVAL_UNBOUND;
+}
+
+static scmval
+_scmopt_pair_p(int argc, scmval *argv)
+{
+  return (1 == argc) ? _SCMOPT_BOOL(SCMVAL_IS_LIST(argv[0])) : SCMVAL_UNBOUND;
+}
+
+static scmval
+_scmopt_eq_p(int argc, scmval *argv)
+{
+  return (2 == argc) ? _SCMOPT_BOOL(argv[0] == argv[1]) : SCMVAL_UNBOUND;
+}
+
+static scmval
+_scmopt_not(int argc, scmval *argv)
+{
+  return (1 == argc) ? _SCMOPT_BOOL(SCMVAL_FALSE == argv[0]) : SCMVAL_UNBOUND;
+}
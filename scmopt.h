@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+
+#ifndef _SCMOPT_H
+#define _SCMOPT_H
+
+/*
+
+scmopt rewrites a form as read into a simpler form with the same value,
+before it is evaluated:
+
+  - calls of pure builtins on literal arguments are replaced by their
+    value, (* 60 60) by 3600 and (car (quote (a b))) by (quote a).
+  - small procedures defined at top level are inlined at calls with the
+    right number of arguments, as are lambdas applied directly.
+  - let variables bound to literals and never assigned are replaced by
+    their value.
+  - the dead branch of an if with a literal test is removed.
+
+calls that would fail, such as an overflowing sum, are left to fail at run
+time. the pass knows which globals a program defines or assigns up to the
+current form and leaves those alone. a lambda body may run after later
+forms rebound a global, so builtins are folded and procedures inlined in
+lambda bodies only once the program is sealed: every form of it, the
+forms not optimized included, was passed to scmopt_scan before the first
+is optimized. macro calls are left as they are; their expansions may
+rebind any global, so nothing is folded or inlined once the pass has seen
+a call of a macro.
+
+*/
+
+// optimize a top-level form
+scmval scmopt_optimize(scmctx *ctx, scmval form);
+
+// note what a form defines and assigns, without optimizing it
+void scmopt_scan(scmctx *ctx, scmval form);
+
+// every form of the program has been scanned, scmopt_optimize scans no more
+void scmopt_seal(scmctx *ctx);
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <errno.h>       /* errno */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>      /* sysconf */
+#include <pthread.h>
+
+#include "scmerr.h"
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmpar.h"
+
+// a worker and the deque of its part of the loop, one allocation each so
+// that the deques of different workers do not share a cache line
+struct _scmpar_worker {
+  struct _scmpar *pool;
+  int id;
+  pthread_t thread;
+  unsigned long loop;           // last loop run
+  pthread_mutex_t lock;         // of lo and hi
+  size_t lo;                    // the deque holds the indices [lo, hi)
+  size_t hi;
+  char pad[64];
+};
+
+struct _scmpar {
+  struct _scmpar_worker **workers;
+  int nworkers;
+  pthread_mutex_t lock;
+  pthread_cond_t start;         // a loop starts or the pool stops
+  pthread_cond_t done;          // the last worker finished the loop
+  unsigned long loop;           // number of the current loop
+  int running;                  // workers in the current loop
+  int stop;
+  scmpar_fn fn;
+  void *arg;
+  size_t grain;
+};
+
+
+/* static prototypes */
+static void *_scmpar_thread(void *arg);
+static void _scmpar_run(struct _scmpar_worker *w);
+static int _scmpar_take(struct _scmpar_worker *w, size_t grain, size_t *begin, size_t *end);
+static int _scmpar_steal(struct _scmpar_worker *w);
+
+
+// create a pool of nworkers threads, allocated in ctx
+scmpar *
+scmpar_new(scmctx *ctx, int nworkers)
+{
+  scmpar *pool = scmmem_alloc(ctx, 1, sizeof(struct _scmpar));
+  struct _scmpar_worker *w;
+  int i;
+
+  memset(pool, 0, sizeof(struct _scmpar));
+  if (nworkers < 1) {
+    nworkers = 1;
+  } else if (nworkers > SCMPAR_WORKERS) {
+    nworkers = SCMPAR_WORKERS;
+  }
+  pool->nworkers = nworkers;
+  if (pthread_mutex_init(&pool->lock, NULL) ||
+      pthread_cond_init(&pool->start, NULL) || pthread_cond_init(&pool->done, NULL)) {
+    scmerr(SCMERR_SYSCALL, "scmpar_new");
+  }
+
+  pool->workers = scmmem_alloc(ctx, nworkers, sizeof(struct _scmpar_worker *));
+  for (i=0; i<nworkers; i++) {
+    w = pool->workers[i] = scmmem_alloc(ctx, 1, sizeof(struct _scmpar_worker));
+    memset(w, 0, sizeof(struct _scmpar_worker));
+    w->pool = pool;
+    w->id = i;
+    if (pthread_mutex_init(&w->lock, NULL)) {
+      scmerr(SCMERR_SYSCALL, "scmpar_new");
+    }
+    if ((errno = pthread_create(&w->thread, NULL, _scmpar_thread, w))) {
+      scmerr(SCMERR_SYSCALL, "pthread_create");
+    }
+  }
+  return pool;
+}
+
+// stop the threads and release the pool
+void
+scmpar_free(scmctx *ctx, scmpar *pool)
+{
+  int i;
+
+  (void)pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  (void)pthread_cond_broadcast(&pool->start);
+  (void)pthread_mutex_unlock(&pool->lock);
+
+  for (i=0; i<pool->nworkers; i++) {
+    (void)pthread_join(pool->workers[i]->thread, NULL);
+    (void)pthread_mutex_destroy(&pool->workers[i]->lock);
+    scmmem_free(ctx, (void **)&pool->workers[i]);
+  }
+  (void)pthread_cond_destroy(&pool->done);
+  (void)pthread_cond_destroy(&pool->start);
+  (void)pthread_mutex_destroy(&pool->lock);
+  scmmem_free(ctx, (void **)&pool->workers);
+  scmmem_free(ctx, (void **)&pool);
+}
+
+// number of workers of the pool
+int
+scmpar_workers(scmpar *pool)
+{
+  return pool->nworkers;
+}
+
+// number of processors online
+int
+scmpar_ncpu(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return (n > 0) ? (int)n : 1;
+}
+
+/*
+ * the deques are filled while the workers wait for the pool lock, which
+ * orders the ranges before their first look at them.
+ */
+void
+scmpar_for(scmpar *pool, size_t n, size_t grain, scmpar_fn fn, void *arg)
+{
+  size_t nw = (size_t)pool->nworkers;
+  size_t i;
+
+  if (0 == n) {
+    return;
+  }
+  (void)pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->arg = arg;
+  pool->grain = (grain > 0) ? grain : 1;
+  for (i=0; i<nw; i++) {
+    pool->workers[i]->lo = n * i / nw;
+    pool->workers[i]->hi = n * (i + 1) / nw;
+  }
+  pool->running = pool->nworkers;
+  pool->loop++;
+  (void)pthread_cond_broadcast(&pool->start);
+  while (pool->running > 0) {
+    (void)pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  (void)pthread_mutex_unlock(&pool->lock);
+}
+
+// a worker runs each loop once, until the pool stops
+static void *
+_scmpar_thread(void *arg)
+{
+  struct _scmpar_worker *w = arg;
+  struct _scmpar *pool = w->pool;
+
+  (void)pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && (w->loop == pool->loop)) {
+      (void)pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+    w->loop = pool->loop;
+    (void)pthread_mutex_unlock(&pool->lock);
+
+    _scmpar_run(w);
+
+    (void)pthread_mutex_lock(&pool->lock);
+    if (0 == --pool->running) {
+      (void)pthread_cond_signal(&pool->done);
+    }
+  }
+  (void)pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+// run the own deque, then whatever can be stolen
+static void
+_scmpar_run(struct _scmpar_worker *w)
+{
+  struct _scmpar *pool = w->pool;
+  size_t begin, end;
+
+  do {
+    while (_scmpar_take(w, pool->grain, &begin, &end)) {
+      pool->fn(pool->arg, w->id, begin, end);
+    }
+  } while (_scmpar_steal(w));
+}
+
+// take a piece from the front of the own deque
+static int
+_scmpar_take(struct _scmpar_worker *w, size_t grain, size_t *begin, size_t *end)
+{
+  int found = 0;
+
+  (void)pthread_mutex_lock(&w->lock);
+  if (w->lo < w->hi) {
+    *begin = w->lo;
+    *end = (w->hi - w->lo > grain) ? w->lo + grain : w->hi;
+    w->lo = *end;
+    found = 1;
+  }
+  (void)pthread_mutex_unlock(&w->lock);
+  return found;
+}
+
+/*
+ * move the back half of the deque of the next worker that has indices
+ * left into the own, empty deque. a worker finding nothing is done: the
+ * indices of a loop only ever move between deques.
+ */
+static int
+_scmpar_steal(struct _scmpar_worker *w)
+{
+  struct _scmpar *pool = w->pool;
+  struct _scmpar_worker *v;
+  size_t lo = 0, hi = 0;
+  int i;
+
+  for (i=1; (i<pool->nworkers) && (lo == hi); i++) {
+    v = pool->workers[(w->id + i) % pool->nworkers];
+    (void)pthread_mutex_lock(&v->lock);
+    if (v->lo < v->hi) {
+      hi = v->hi;
+      lo = v->hi - (v->hi - v->lo + 1) / 2;
+      v->hi = lo;
+    }
+    (void)pthread_mutex_unlock(&v->lock);
+  }
+  if (lo == hi) {
+    return 0;
+  }
+  (void)pthread_mutex_lock(&w->lock);
+  w->lo = lo;
+  w->hi = hi;
+  (void)pthread_mutex_unlock(&w->lock);
+  return 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCMPAR_H
+#define _SCMPAR_H
+
+/*
+
+scmpar is a pool of threads running parallel loops over index ranges.
+
+each worker has a deque holding the part of the range it has yet to run.
+the worker takes pieces of at most grain indices from the front of its
+own deque; once it is empty, it steals the back half of the deque of
+another worker. a loop starts with the range divided evenly between the
+workers, so stealing only balances indices of uneven cost.
+
+the threads are created with the pool and wait for the next loop. the
+caller of scmpar_for waits until every index has run.
+
+*/
+
+// Implementation limits:
+#define SCMPAR_WORKERS   64
+
+typedef struct _scmpar scmpar;
+
+// run indices [begin, end) of a loop on worker
+typedef void (*scmpar_fn)(void *arg, int worker, size_t begin, size_t end);
+
+// create a pool of nworkers threads, allocated in ctx
+scmpar *scmpar_new(scmctx *ctx, int nworkers);
+
+// stop the threads and release the pool
+void scmpar_free(scmctx *ctx, scmpar *pool);
+
+// number of workers of the pool
+int scmpar_workers(scmpar *pool);
+
+// run fn on the indices [0, n) in pieces of at most grain indices
+void scmpar_for(scmpar *pool, size_t n, size_t grain, scmpar_fn fn, void *arg);
+
+// number of processors online
+int scmpar_ncpu(void);
+
+#endif
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <errno.h>       /* errno */
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>    /* setitimer */
+
+#include "scmerr.h"
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmspl.h"
+#include "scmprf.h"
+
+// Implementation limits:
+#define _SCMPRF_LABEL      512  // bytes of a frame label
+#define _SCMPRF_MINSIZE    256  // slots of the table of stacks
+
+// the samples of a stack, its frames are labels interned in the profiler
+struct _scmprf_stack {
+  uint64_t hash;
+  unsigned long count;
+  int n;
+  const char *labels[];
+};
+
+/*
+ * the samples counted by stack, in an open addressing table with linear
+ * probing. the labels and the table are allocated in a context of the
+ * profiler, the threads sampling lock it.
+ */
+static struct {
+  pthread_mutex_t lock;
+  scmctx *ctx;                  // NULL unless sampling
+  struct _scmprf_stack **slots;
+  size_t mask;
+  size_t count;
+} _scmprf = { PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0 };
+
+_Atomic int scmprf_pending = 0;
+
+
+/* static prototypes */
+static void _scmprf_tick(int sig);
+static void _scmprf_timer(long usec);
+static struct _scmprf_stack **_scmprf_slot(uint64_t hash, const char **labels, int n);
+static void _scmprf_grow(void);
+
+
+// SIGPROF, the vm takes the sample
+static void
+_scmprf_tick(int sig)
+{
+  (void)sig;
+  atomic_store_explicit(&scmprf_pending, 1, memory_order_relaxed);
+}
+
+// raise SIGPROF every usec microseconds of cpu time, never for 0
+static void
+_scmprf_timer(long usec)
+{
+  struct itimerval it;
+
+  it.it_interval.tv_sec = usec / 1000000;
+  it.it_interval.tv_usec = usec % 1000000;
+  it.it_value = it.it_interval;
+  if (setitimer(ITIMER_PROF, &it, NULL)) {
+    scmerr(SCMERR_SYSCALL, "setitimer");
+  }
+}
+
+// sample hz times per second of cpu time
+void
+scmprf_start(int hz)
+{
+  struct sigaction sa;
+
+  (void)pthread_mutex_lock(&_scmprf.lock);
+  if (!_scmprf.ctx) {
+    _scmprf.ctx = scmctx_new();
+    _scmprf.mask = _SCMPRF_MINSIZE - 1;
+    _scmprf.count = 0;
+    _scmprf.slots = scmmem_alloc(_scmprf.ctx, _SCMPRF_MINSIZE, sizeof(struct _scmprf_stack *));
+    memset(_scmprf.slots, 0, _SCMPRF_MINSIZE * sizeof(struct _scmprf_stack *));
+  }
+  (void)pthread_mutex_unlock(&_scmprf.lock);
+
+  // reads and waits go on after a tick
+  memset(&sa, 0, sizeof(struct sigaction));
+  sa.sa_handler = _scmprf_tick;
+  sa.sa_flags = SA_RESTART;
+  (void)sigemptyset(&sa.sa_mask);
+  if (sigaction(SIGPROF, &sa, NULL)) {
+    scmerr(SCMERR_SYSCALL, "sigaction");
+  }
+  _scmprf_timer((hz > 0) && (hz <= 1000000) ? 1000000 / hz : 1000000);
+}
+
+// the slot of the stack of labels in the table, NULL if it is not counted yet
+static struct _scmprf_stack **
+_scmprf_slot(uint64_t hash, const char **labels, int n)
+{
+  struct _scmprf_stack *s;
+  size_t i;
+
+  for (i = hash & _scmprf.mask; (s = _scmprf.slots[i]); i = (i + 1) & _scmprf.mask) {
+    if ((s->hash == hash) && (s->n == n) && !memcmp(s->labels, labels, n * sizeof(char *))) {
+      break;
+    }
+  }
+  return &_scmprf.slots[i];
+}
+
+// double the table of stacks
+static void
+_scmprf_grow(void)
+{
+  struct _scmprf_stack **old = _scmprf.slots;
+  size_t i, n = _scmprf.mask + 1;
+
+  _scmprf.slots = scmmem_alloc(_scmprf.ctx, 2 * n, sizeof(struct _scmprf_stack *));
+  memset(_scmprf.slots, 0, 2 * n * sizeof(struct _scmprf_stack *));
+  _scmprf.mask = 2 * n - 1;
+  for (i=0; i<n; i++) {
+    if (old[i]) {
+      *_scmprf_slot(old[i]->hash, old[i]->labels, old[i]->n) = old[i];
+    }
+  }
+  scmmem_free(_scmprf.ctx, (void **)&old);
+}
+
+/*
+ * the labels are "name (file:line)", or the name alone. labels are
+ * interned, so a stack is identified by the addresses of its labels.
+ */
+void
+scmprf_sample(struct scmprf_frame *frames, int n)
+{
+  const char *labels[SCMPRF_DEPTH];
+  char buf[_SCMPRF_LABEL];
+  struct _scmprf_stack **slot;
+  uint64_t hash = 14695981039346656037ULL;
+  int i;
+
+  if (n > SCMPRF_DEPTH) {
+    frames += n - SCMPRF_DEPTH;
+    n = SCMPRF_DEPTH;
+  }
+  (void)pthread_mutex_lock(&_scmprf.lock);
+  if (!_scmprf.ctx) {
+    (void)pthread_mutex_unlock(&_scmprf.lock);
+    return;
+  }
+  for (i=0; i<n; i++) {
+    if (frames[i].file) {
+      (void)snprintf(buf, sizeof(buf), "%s (%s:%d)", frames[i].name, frames[i].file, frames[i].line);
+    } else {
+      (void)snprintf(buf, sizeof(buf), "%s", frames[i].name);
+    }
+    labels[i] = SCMVAL_TO_C_STR(scmspl_intern_string(_scmprf.ctx, buf));
+    hash = (hash ^ (uintptr_t)labels[i]) * 1099511628211ULL;
+  }
+  slot = _scmprf_slot(hash, labels, n);
+  if (!*slot) {
+    if (2 * (_scmprf.count + 1) > _scmprf.mask + 1) {
+      _scmprf_grow();
+      slot = _scmprf_slot(hash, labels, n);
+    }
+    *slot = scmmem_alloc(_scmprf.ctx, 1, sizeof(struct _scmprf_stack) + n * sizeof(char *));
+    (*slot)->hash = hash;
+    (*slot)->count = 0;
+    (*slot)->n = n;
+    memcpy((*slot)->labels, labels, n * sizeof(char *));
+    _scmprf.count++;
+  }
+  (*slot)->count++;
+  (void)pthread_mutex_unlock(&_scmprf.lock);
+}
+
+// stop sampling and write the samples as folded stacks to fp
+void
+scmprf_write(FILE *fp)
+{
+  struct _scmprf_stack *s;
+  size_t i;
+  int j;
+
+  _scmprf_timer(0);
+  (void)pthread_mutex_lock(&_scmprf.lock);
+  if (!_scmprf.ctx) {
+    (void)pthread_mutex_unlock(&_scmprf.lock);
+    return;
+  }
+  for (i=0; i<=_scmprf.mask; i++) {
+    if (!(s = _scmprf.slots[i])) {
+      continue;
+    }
+    for (j=0; j<s->n; j++) {
+      fprintf(fp, "%s%s", j ? ";" : "", s->labels[j]);
+    }
+    fprintf(fp, " %lu\n", s->count);
+    scmmem_free(_scmprf.ctx, (void **)&_scmprf.slots[i]);
+  }
+  scmmem_free(_scmprf.ctx, (void **)&_scmprf.slots);
+  scmctx_free(_scmprf.ctx);
+  _scmprf.ctx = NULL;
+  atomic_store_explicit(&scmprf_pending, 0, memory_order_relaxed);
+  (void)pthread_mutex_unlock(&_scmprf.lock);
+}
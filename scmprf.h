@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCMPRF_H
+#define _SCMPRF_H
+
+/*
+
+scmprf is a sampling profiler of the code scmevl runs.
+
+a timer of the cpu time of the process raises SIGPROF, whose handler
+only marks a sample as due. the vm looks at the mark when it enters or
+leaves a procedure and when a primitive returns, and then hands its
+stack to scmprf_sample. a sample thus lands on the next call or return
+after the tick, which costs the vm one load and branch at these points
+while no sample is due.
+
+the samples are counted by stack and written as folded stacks, one line
+per stack: the frames from the outermost, separated by semicolons, and
+the number of samples. this is the input of flamegraph.pl.
+
+*/
+
+// Implementation limits:
+#define SCMPRF_DEPTH    128     // frames of a sample, the innermost are kept
+
+// a frame of a sampled stack, file is NULL if the location is not known
+struct scmprf_frame {
+  const char *name;
+  const char *file;
+  int line;
+};
+
+// set by the timer, a sample is due
+extern _Atomic int scmprf_pending;
+
+// sample hz times per second of cpu time
+void scmprf_start(int hz);
+
+// count a sample of a stack of n frames, ordered from the outermost. the
+// thread taking the sample clears scmprf_pending before
+void scmprf_sample(struct scmprf_frame *frames, int n);
+
+// stop sampling and write the samples as folded stacks to fp
+void scmprf_write(FILE *fp);
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <errno.h>   /* errno */
+#include <stdio.h>
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmprm.h"
+
+/* inlined */
+extern scmval scmprm_fx_add(scmval a, scmval b);
+extern scmval scmprm_fx_sub(scmval a, scmval b);
+extern scmval scmprm_fx_mul(scmval a, scmval b);
+
+/* static prototypes */
+static scmval _scmprm_int(const char *who, scmval v);
+static scmval _scmprm_list(const char *who, scmval v);
+static scmval _scmprm_compare(const char *who, int argc, scmval *argv, int op);
+static scmval _scmprm_add(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_sub(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_mul(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_num_eq(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_lt(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_gt(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_le(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_ge(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_car(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_cdr(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_cons(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_list_new(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_null_p(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_pair_p(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_eq_p(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_not(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmprm_memory_stats(scmctx *ctx, int argc, scmval *argv);
+
+#define _SCMPRM_BOOL(c)  ((c) ? SCMVAL_TRUE : SCMVAL_FALSE)
+
+// operators of _scmprm_compare
+enum {
+  _SCMPRM_EQ,
+  _SCMPRM_LT,
+  _SCMPRM_GT,
+  _SCMPRM_LE,
+  _SCMPRM_GE,
+};
+
+static const struct {
+  const char *name;
+  scmprc_fn fn;
+  int arity;
+} _scmprm_table[] = {
+  { "+",      _scmprm_add,      -1 },
+  { "-",      _scmprm_sub,      -1 },
+  { "*",      _scmprm_mul,      -1 },
+  { "=",      _scmprm_num_eq,   -1 },
+  { "<",      _scmprm_lt,       -1 },
+  { ">",      _scmprm_gt,       -1 },
+  { "<=",     _scmprm_le,       -1 },
+  { ">=",     _scmprm_ge,       -1 },
+  { "car",    _scmprm_car,       1 },
+  { "cdr",    _scmprm_cdr,       1 },
+  { "cons",   _scmprm_cons,      2 },
+  { "list",   _scmprm_list_new, -1 },
+  { "null?",  _scmprm_null_p,    1 },
+  { "pair?",  _scmprm_pair_p,    1 },
+  { "eq?",    _scmprm_eq_p,      2 },
+  { "not",    _scmprm_not,       1 },
+  { "memory-stats", _scmprm_memory_stats, 0 },
+};
+
+// allocate a primitive procedure, arity -1 accepts any number of arguments
+scmval
+scmprm_make(scmctx *ctx, const char *name, scmprc_fn fn, int arity)
+{
+  struct _scmprc *prc = scmmem_alloc(ctx, 1, sizeof(struct _scmprc));
+
+  prc->type = SCMPRC_PRIMITIVE;
+  prc->name = name;
+  prc->u.prim.fn = fn;
+  prc->u.prim.arity = arity;
+
+  return SCMVAL_MAKE_PROCEDURE(prc);
+}
+
+// call define() with name and procedure of every primitive
+void
+scmprm_define_all(scmctx *ctx, void (*define)(scmctx *ctx, const char *name, scmval proc))
+{
+  size_t i;
+
+  for (i=0; i<sizeof(_scmprm_table)/sizeof(_scmprm_table[0]); i++) {
+    define(ctx, _scmprm_table[i].name,
+	   scmprm_make(ctx, _scmprm_table[i].name, _scmprm_table[i].fn,
+		       _scmprm_table[i].arity));
+  }
+}
+
+// check for an integer argument
+static scmval
+_scmprm_int(const char *who, scmval v)
+{
+  if (!SCMVAL_IS_INTEGER(v)) {
+    scmerr(SCMERR_WRONG_TYPE, "%s: integer expected", who);
+  }
+  return v;
+}
+
+// check for a non-empty list argument
+static scmval
+_scmprm_list(const char *who, scmval v)
+{
+  if (!SCMVAL_IS_LIST(v)) {
+    scmerr(SCMERR_WRONG_TYPE, "%s: list expected", who);
+  }
+  return v;
+}
+
+static scmval
+_scmprm_add(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval sum = SCMVAL_MAKE_INTEGER(0);
+  int i;
+
+  for (i=0; i<argc; i++) {
+    sum = scmprm_fx_add(sum, _scmprm_int("+", argv[i]));
+  }
+  return sum;
+}
+
+static scmval
+_scmprm_sub(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval diff;
+  int i;
+
+  if (0 == argc) {
+    scmerr(SCMERR_WRONG_ARITY, "-: at least one argument expected");
+  }
+  if (1 == argc) {
+    return scmprm_fx_sub(SCMVAL_MAKE_INTEGER(0), _scmprm_int("-", argv[0]));
+  }
+  diff = _scmprm_int("-", argv[0]);
+  for (i=1; i<argc; i++) {
+    diff = scmprm_fx_sub(diff, _scmprm_int("-", argv[i]));
+  }
+  return diff;
+}
+
+static scmval
+_scmprm_mul(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval prod = SCMVAL_MAKE_INTEGER(1);
+  int i;
+
+  for (i=0; i<argc; i++) {
+    prod = scmprm_fx_mul(prod, _scmprm_int("*", argv[i]));
+  }
+  return prod;
+}
+
+// chained comparison, (< a b c) is (and (< a b) (< b c))
+static scmval
+_scmprm_compare(const char *who, int argc, scmval *argv, int op)
+{
+  intptr_t a, b;
+  int i;
+  int res = 1;
+
+  if (0 == argc) {
+    scmerr(SCMERR_WRONG_ARITY, "%s: at least one argument expected", who);
+  }
+  // tagged integers compare like the integers they represent
+  b = (intptr_t)_scmprm_int(who, argv[0]);
+  for (i=1; i<argc; i++) {
+    a = b;
+    b = (intptr_t)_scmprm_int(who, argv[i]);
+    switch (op) {
+    case _SCMPRM_EQ:
+      res = res && (a == b);
+      break;
+    case _SCMPRM_LT:
+      res = res && (a < b);
+      break;
+    case _SCMPRM_GT:
+      res = res && (a > b);
+      break;
+    case _SCMPRM_LE:
+      res = res && (a <= b);
+      break;
+    case _SCMPRM_GE:
+      res = res && (a >= b);
+      break;
+    }
+  }
+  return _SCMPRM_BOOL(res);
+}
+
+static scmval
+_scmprm_num_eq(scmctx *ctx, int argc, scmval *argv)
+{
+  return _scmprm_compare("=", argc, argv, _SCMPRM_EQ);
+}
+
+static scmval
+_scmprm_lt(scmctx *ctx, int argc, scmval *argv)
+{
+  return _scmprm_compare("<", argc, argv, _SCMPRM_LT);
+}
+
+static scmval
+_scmprm_gt(scmctx *ctx, int argc, scmval *argv)
+{
+  return _scmprm_compare(">", argc, argv, _SCMPRM_GT);
+}
+
+static scmval
+_scmprm_le(scmctx *ctx, int argc, scmval *argv)
+{
+  return _scmprm_compare("<=", argc, argv, _SCMPRM_LE);
+}
+
+static scmval
+_scmprm_ge(scmctx *ctx, int argc, scmval *argv)
+{
+  return _scmprm_compare(">=", argc, argv, _SCMPRM_GE);
+}
+
+static scmval
+_scmprm_car(scmctx *ctx, int argc, scmval *argv)
+{
+  return SCMVAL_CAR(_scmprm_list("car", argv[0]));
+}
+
+static scmval
+_scmprm_cdr(scmctx *ctx, int argc, scmval *argv)
+{
+  return SCMVAL_CDR(_scmprm_list("cdr", argv[0]));
+}
+
+static scmval
+_scmprm_cons(scmctx *ctx, int argc, scmval *argv)
+{
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, argv[0], argv[1]));
+}
+
+static scmval
+_scmprm_list_new(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval l = SCMVAL_NIL;
+
+  while (argc > 0) {
+    argc--;
+    l = SCMVAL_MAKE_LIST(scmval_cons(ctx, argv[argc], l));
+  }
+  return l;
+}
+
+static scmval
+_scmprm_null_p(scmctx *ctx, int argc, scmval *argv)
+{
+  return _SCMPRM_BOOL(SCMVAL_NIL == argv[0]);
+}
+
+static scmval
+_scmprm_pair_p(scmctx *ctx, int argc, scmval *argv)
+{
+  return _SCMPRM_BOOL(SCMVAL_IS_LIST(argv[0]));
+}
+
+static scmval
+_scmprm_eq_p(scmctx *ctx, int argc, scmval *argv)
+{
+  return _SCMPRM_BOOL(argv[0] == argv[1]);
+}
+
+static scmval
+_scmprm_not(scmctx *ctx, int argc, scmval *argv)
+{
+  return _SCMPRM_BOOL(SCMVAL_FALSE == argv[0]);
+}
+
+// (allocations bytes) of the context so far
+static scmval
+_scmprm_memory_stats(scmctx *ctx, int argc, scmval *argv)
+{
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_INTEGER((intptr_t)ctx->mem.allocs),
+    SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_INTEGER((intptr_t)ctx->mem.bytes),
+      SCMVAL_NIL))));
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _SCMPRM_H
+#define _SCMPRM_H
+
+/*
+ * integer arithmetic on tagged values.
+ *
+ * an integer v is stored as v << 5 with tag 0, so the tagged words add,
+ * subtract and compare like the integers themselves: (a << 5) + (b << 5)
+ * is (a + b) << 5. the tagged sum overflows the machine word exactly when
+ * a + b does not fit into 59 bits. for products only one factor is untagged.
+ * both arguments must be integers.
+ */
+inline scmval
+scmprm_fx_add(scmval a, scmval b)
+{
+  intptr_t r;
+
+  if (__builtin_add_overflow((intptr_t)a, (intptr_t)b, &r)) {
+    scmerr(SCMERR_OVERFLOW, "+");
+  }
+  return (scmval)r;
+}
+
+inline scmval
+scmprm_fx_sub(scmval a, scmval b)
+{
+  intptr_t r;
+
+  if (__builtin_sub_overflow((intptr_t)a, (intptr_t)b, &r)) {
+    scmerr(SCMERR_OVERFLOW, "-");
+  }
+  return (scmval)r;
+}
+
+inline scmval
+scmprm_fx_mul(scmval a, scmval b)
+{
+  intptr_t r;
+
+  if (__builtin_mul_overflow((intptr_t)a, SCMVAL_TO_C_INT(b), &r)) {
+    scmerr(SCMERR_OVERFLOW, "*");
+  }
+  return (scmval)r;
+}
+
+// allocate a primitive procedure, arity -1 accepts any number of arguments
+scmval scmprm_make(scmctx *ctx, const char *name, scmprc_fn fn, int arity);
+
+// call define() with name and procedure of every primitive
+void scmprm_define_all(scmctx *ctx, void (*define)(scmctx *ctx, const char *name, scmval proc));
+
+#endif
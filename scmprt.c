@@ -21,37 +21,65 @@
 #include <string.h>
 
 #include "scmerr.h"
+#include "scmctx.h"
 #include "scmmem.h"
 #include "scmval.h"
 #include "scmprt.h"
 
+/* static prototypes */
+static void _scmprt_count(scmctx *ctx, int n);
+
+
+// bytes written by fprintf, counted in ctx
+static void
+_scmprt_count(scmctx *ctx, int n)
+{
+  if (n > 0) {
+    ctx->prt.bytes += (unsigned long)n;
+  }
+}
+
 void
-scmprt_print(scmval v)
+scmprt_print(scmctx *ctx, scmval v)
 {
+  FILE *fp = ctx->out;
+
   if (SCMVAL_IS_INTEGER(v)) {
-    printf("%li\n", SCMVAL_TO_C_INT(v));
+    _scmprt_count(ctx, fprintf(fp, "%li\n", SCMVAL_TO_C_INT(v)));
   }
   else if (SCMVAL_IS_NIL(v)) {
-    printf("nil ()\n");
+    _scmprt_count(ctx, fprintf(fp, "nil ()\n"));
   }
   else if (SCMVAL_IS_TRUE(v)) {
-    printf("true #t\n");
+    _scmprt_count(ctx, fprintf(fp, "true #t\n"));
   }
   else if (SCMVAL_IS_FALSE(v)) {
-    printf("false #f\n");
+    _scmprt_count(ctx, fprintf(fp, "false #f\n"));
   }
   else if (SCMVAL_IS_STRING(v)) {
-    printf("\"%s\"\n", SCMVAL_TO_C_STR(v));
+    _scmprt_count(ctx, fprintf(fp, "\"%s\"\n", SCMVAL_TO_C_STR(v)));
   }
   else if (SCMVAL_IS_SYMBOL(v)) {
-    printf("%s\n", SCMVAL_TO_C_STR(v));
+    _scmprt_count(ctx, fprintf(fp, "%s\n", SCMVAL_TO_C_STR(v)));
   }
   else if (SCMVAL_IS_LIST(v)) {
-    printf("(\n");
-    for (; v != SCMVAL_NIL; v = SCMVAL_TO_LIST(v)->next) {
-      scmprt_print(SCMVAL_TO_LIST(v)->data);
+    _scmprt_count(ctx, fprintf(fp, "(\n"));
+    for (; SCMVAL_IS_LIST(v); v = SCMVAL_TO_LIST(v)->next) {
+      scmprt_print(ctx, SCMVAL_TO_LIST(v)->data);
+    }
+    // improper list, as built by cons
+    if (v != SCMVAL_NIL) {
+      _scmprt_count(ctx, fprintf(fp, ".\n"));
+      scmprt_print(ctx, v);
+    }
+    _scmprt_count(ctx, fprintf(fp, ")\n"));
+  }
+  else if (SCMVAL_IS_PROCEDURE(v)) {
+    if (SCMVAL_TO_PROCEDURE(v)->name) {
+      _scmprt_count(ctx, fprintf(fp, "#<procedure %s>\n", SCMVAL_TO_PROCEDURE(v)->name));
+    } else {
+      _scmprt_count(ctx, fprintf(fp, "#<procedure>\n"));
     }
-    printf(")\n");
   }
   else if (SCMVAL_IS_EOF(v)) {
     ;
@@ -17,7 +17,7 @@
 #ifndef _SCMPRT_H
 #define _SCMPRT_H
 
-// print a value
-void scmprt_print(scmval val);
+// print a value to the output of ctx
+void scmprt_print(scmctx *ctx, scmval val);
 
 #endif
@@ -17,13 +17,22 @@
 #include <errno.h>   /* errno */
 #include <assert.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
 #include <stdint.h> /**/
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 #include "scmerr.h"
+#include "scmctx.h"
 #include "scmmem.h"
 #include "scmval.h"
 #include "scmspl.h"
@@ -32,6 +41,9 @@
 
 // Implementation limits:
 #define _SCMRDR_BUFFERSIZE 256
+#define _SCMRDR_CHUNKSIZE  (1 << 18)    // bytes a parallel reader splits at least
+#define _SCMRDR_AHEAD      4            // chunks per thread read ahead
+#define _SCMRDR_PREFETCH   (1 << 20)    // bytes of each buffer read ahead
 
 
 
@@ -39,7 +51,9 @@
 enum _scmrdr_type {
   SCMRDR_TYPE_BUFFER,
   SCMRDR_TYPE_FILE,
-  SCMRDR_TYPE_STDIN
+  SCMRDR_TYPE_STDIN,
+  SCMRDR_TYPE_PARALLEL,
+  SCMRDR_TYPE_PREFETCH
 };
 
 
@@ -53,27 +67,129 @@ enum _scmrdr_type {
 
 
 struct _scmrdr {
+  scmctx *ctx;
   enum _scmrdr_type type;
   char *name;
   int peek;
   int line;
   int pos;
   FILE *stream;
+  struct _scmrdr_par *par;
+  struct _scmrdr_pre *pre;
+  const char *cur;      // unread bytes of the buffer of pre
+  const char *end;
+  unsigned long depth;  // of the list being read
+  const char *src;      // the name interned, once lists are tracked
+  scmval *open;         // the list being read at each depth, for recovery
+  unsigned long aopen;
+};
+
+// an error found by a worker, raised when the form at of its chunk is read
+struct _scmrdr_fail {
+  size_t at;
+  struct scmerr_caught err;
+};
+
+/*
+ * a chunk of a mapped file, a sequence of top-level forms. the chunks
+ * are split in order and read by the workers of a parallel reader.
+ */
+struct _scmrdr_chunk {
+  size_t start;
+  size_t end;
+  int line;             // of start
+  scmval *vals;         // the forms, once done
+  size_t nvals;
+  size_t avals;
+  struct _scmrdr_fail *fails;   // the errors between them, in order
+  size_t nfails;
+  size_t afails;
+  int done;
+};
+
+// the forms of a chunk read by a worker until an error or the end
+struct _scmrdr_fill {
+  scmctx *ctx;
+  scmrdr *rdr;
+  struct _scmrdr_chunk *ch;
+};
+
+// worker thread of a parallel reader, its context shares the pool of the reader
+struct _scmrdr_worker {
+  struct _scmrdr_par *par;
+  scmctx *ctx;
+  pthread_t thread;
+};
+
+// parallel reader of a mapped file
+struct _scmrdr_par {
+  scmctx *ctx;
+  char *name;
+  char *map;
+  size_t size;
+
+  struct _scmrdr_worker *workers;
+  int nthreads;
+
+  // chunk k is ring[k % nring] until it is consumed
+  pthread_mutex_t lock;
+  pthread_cond_t cond;  // a chunk is done or consumed
+  struct _scmrdr_chunk *ring;
+  unsigned long nring;
+  unsigned long nsplit; // chunks split so far
+  unsigned long nread;  // chunks consumed by scmrdr_read
+  size_t next;          // start of the next chunk
+  int line;             // of next
+  int splitting;        // a worker looks for the end of the chunk at next
+  int stop;
+
+  // the chunk being consumed, owned by the reading thread
+  struct _scmrdr_chunk *chunk;
+  size_t cur;
+  size_t fail;          // the next error of chunk
+};
+
+/*
+ * input of a reader, read ahead by a thread of its own. the thread fills
+ * one buffer while the reader consumes the other, each read(2) is handed
+ * over as it returns, so that a line typed at a terminal is read at once.
+ * a buffer of length 0 is the end of the input or an error.
+ */
+struct _scmrdr_pre {
+  int fd;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;  // a buffer is filled or consumed
+  char *buf[2];
+  ssize_t len[2];       // bytes in buf[i] once full[i], -1 on an error
+  int full[2];
+  int err;              // errno of the failed read
+  int done;             // the thread has read the end of the input
+  int stop;
+  int cur;              // buffer next consumed by the reader
+  int held;             // the reader consumes buf[cur]
 };
 
 
 // initialize a reader from a buffer in memory
 scmrdr *
-scmrdr_open_buffer(char *buffer, size_t size)
+scmrdr_open_buffer(scmctx *ctx, char *buffer, size_t size)
 {
-  scmrdr *rdr = (scmrdr *) scmmem_alloc(1, sizeof(struct _scmrdr));
+  scmrdr *rdr = (scmrdr *) scmmem_alloc(ctx, 1, sizeof(struct _scmrdr));
+  rdr->ctx = ctx;
   rdr->type = SCMRDR_TYPE_BUFFER;
   // 8 Bytes + 18 ('0x' + 16 nibbles buffer) + 20 
-  rdr->name = (char *) scmmem_alloc(50, sizeof(char));
+  rdr->name = (char *) scmmem_alloc(ctx, 50, sizeof(char));
   snprintf(rdr->name, 50, "<mem:%p:%zu>", buffer, size);
   rdr->peek = SCMRDR_PEEK_INVALID;
+  rdr->depth = 0;
+  rdr->src = NULL;
+  rdr->open = NULL;
+  rdr->aopen = 0;
   rdr->line = 1;
   rdr->pos = 0;
+  rdr->par = NULL;
+  rdr->pre = NULL;
   if (NULL == (rdr->stream = fmemopen(buffer, size, "r"))) {
     scmerr(SCMERR_SYSCALL, "scmrdr_open_buffer(\"%p\", \"%zu\")", buffer, size);
   }
@@ -82,17 +198,24 @@ scmrdr_open_buffer(char *buffer, size_t size)
 
 // initialize a reader from a file
 scmrdr *
-scmrdr_open_file(char *file)
+scmrdr_open_file(scmctx *ctx, char *file)
 {
-  scmrdr *rdr = (scmrdr *) scmmem_alloc(1, sizeof(struct _scmrdr));
+  scmrdr *rdr = (scmrdr *) scmmem_alloc(ctx, 1, sizeof(struct _scmrdr));
+  rdr->ctx = ctx;
   rdr->type = SCMRDR_TYPE_FILE;
-  rdr->name = scmmem_strdup(file);
+  rdr->name = scmmem_strdup(ctx, file);
   /*  if (-1 == asprintf(&rdr->name, "%s", file)) {
     scmerr(SCMERR_SYSCALL, "asprintf");
     }*/
   rdr->peek = SCMRDR_PEEK_INVALID;
+  rdr->depth = 0;
+  rdr->src = NULL;
+  rdr->open = NULL;
+  rdr->aopen = 0;
   rdr->line = 1;
   rdr->pos = 0;
+  rdr->par = NULL;
+  rdr->pre = NULL;
   if (NULL == (rdr->stream = fopen(file, "r"))) {
     scmerr(SCMERR_SYSCALL, "scmrdr_open_file(\"%s\", \"r\")", file);
   }
@@ -101,21 +224,150 @@ scmrdr_open_file(char *file)
 
 // initialize a reader from standard input
 scmrdr *
-scmrdr_open_stdin(void)
+scmrdr_open_stdin(scmctx *ctx)
 {
-  scmrdr *rdr = (scmrdr *) scmmem_alloc(1, sizeof(struct _scmrdr));
+  scmrdr *rdr = (scmrdr *) scmmem_alloc(ctx, 1, sizeof(struct _scmrdr));
+  rdr->ctx = ctx;
   rdr->type = SCMRDR_TYPE_STDIN;
   rdr->name = "<stdin>";
   /*  if (-1 == asprintf(&rdr->name, "<stdin>")) {
     scmerr(SCMERR_SYSCALL, "asprintf");
     }*/
   rdr->peek = SCMRDR_PEEK_INVALID;
+  rdr->depth = 0;
+  rdr->src = NULL;
+  rdr->open = NULL;
+  rdr->aopen = 0;
   rdr->line = 1;
   rdr->pos = 0;
+  rdr->par = NULL;
+  rdr->pre = NULL;
   rdr->stream = stdin;
   return rdr;
 }
 
+static void *_scmrdr_prefetch(void *arg);
+static int _scmrdr_pre_next(scmrdr *rdr);
+static void _scmrdr_pre_close(scmctx *ctx, struct _scmrdr_pre *pre);
+
+/*
+ * initialize a reader of a file, or of standard input if file is NULL,
+ * that a thread reads ahead. the kernel is told to read the file ahead
+ * sequentially, too.
+ */
+scmrdr *
+scmrdr_open_prefetch(scmctx *ctx, char *file)
+{
+  scmrdr *rdr = (scmrdr *) scmmem_alloc(ctx, 1, sizeof(struct _scmrdr));
+  struct _scmrdr_pre *pre;
+  int i;
+
+  memset(rdr, 0, sizeof(struct _scmrdr));
+  rdr->ctx = ctx;
+  rdr->type = SCMRDR_TYPE_PREFETCH;
+  rdr->name = scmmem_strdup(ctx, file ? file : "<stdin>");
+  rdr->peek = SCMRDR_PEEK_INVALID;
+  rdr->line = 1;
+  rdr->pos = 0;
+
+  pre = rdr->pre = scmmem_alloc(ctx, 1, sizeof(struct _scmrdr_pre));
+  memset(pre, 0, sizeof(struct _scmrdr_pre));
+  if (!file) {
+    pre->fd = STDIN_FILENO;
+  } else if (-1 == (pre->fd = open(file, O_RDONLY))) {
+    scmerr(SCMERR_SYSCALL, "scmrdr_open_prefetch(\"%s\")", file);
+  }
+  // fails on pipes and terminals, which are read as they come
+  (void)posix_fadvise(pre->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  for (i=0; i<2; i++) {
+    pre->buf[i] = scmmem_alloc(ctx, _SCMRDR_PREFETCH, sizeof(char));
+  }
+  if (pthread_mutex_init(&pre->lock, NULL) || pthread_cond_init(&pre->cond, NULL)) {
+    scmerr(SCMERR_SYSCALL, "scmrdr_open_prefetch");
+  }
+  if ((errno = pthread_create(&pre->thread, NULL, _scmrdr_prefetch, pre))) {
+    scmerr(SCMERR_SYSCALL, "pthread_create");
+  }
+  return rdr;
+}
+
+static scmrdr *_scmrdr_open_chunk(scmctx *ctx, const char *name, char *map,
+				  struct _scmrdr_chunk *ch);
+static size_t _scmrdr_split(struct _scmrdr_par *par, size_t start, int *line);
+static void *_scmrdr_worker(void *arg);
+static void _scmrdr_fill(void *arg);
+static scmval _scmrdr_par_read(struct _scmrdr_par *par);
+static void _scmrdr_par_close(scmctx *ctx, struct _scmrdr_par *par);
+
+/*
+ * initialize a reader of a file that nthreads threads read ahead. the
+ * file is mapped and split in chunks at top-level forms, which workers
+ * read in contexts of their own, interning into the pool of ctx.
+ * scmrdr_read returns the forms in the order of the file.
+ */
+scmrdr *
+scmrdr_open_parallel(scmctx *ctx, char *file, int nthreads)
+{
+  scmrdr *rdr = (scmrdr *) scmmem_alloc(ctx, 1, sizeof(struct _scmrdr));
+  struct _scmrdr_par *par;
+  struct stat sb;
+  int fd, i;
+
+  rdr->ctx = ctx;
+  rdr->type = SCMRDR_TYPE_PARALLEL;
+  rdr->name = scmmem_strdup(ctx, file);
+  rdr->peek = SCMRDR_PEEK_INVALID;
+  rdr->depth = 0;
+  rdr->src = NULL;
+  rdr->open = NULL;
+  rdr->aopen = 0;
+  rdr->line = 1;
+  rdr->pos = 0;
+  rdr->stream = NULL;
+  rdr->pre = NULL;
+  rdr->par = par = scmmem_alloc(ctx, 1, sizeof(struct _scmrdr_par));
+  memset(par, 0, sizeof(struct _scmrdr_par));
+  par->ctx = ctx;
+  par->name = rdr->name;
+
+  if (-1 == (fd = open(file, O_RDONLY))) {
+    scmerr(SCMERR_SYSCALL, "scmrdr_open_parallel(\"%s\")", file);
+  }
+  if (-1 == fstat(fd, &sb)) {
+    scmerr(SCMERR_SYSCALL, "fstat(\"%s\")", file);
+  }
+  par->size = sb.st_size;
+  if (par->size > 0) {
+    if (MAP_FAILED == (par->map = mmap(NULL, par->size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+      scmerr(SCMERR_SYSCALL, "mmap(\"%s\")", file);
+    }
+    (void)madvise(par->map, par->size, MADV_SEQUENTIAL);
+  }
+  (void)close(fd);
+
+  par->nthreads = (nthreads > 0) ? nthreads : 1;
+  par->nring = par->nthreads * _SCMRDR_AHEAD;
+  par->ring = scmmem_alloc(ctx, par->nring, sizeof(struct _scmrdr_chunk));
+  memset(par->ring, 0, par->nring * sizeof(struct _scmrdr_chunk));
+  par->line = 1;
+  if (pthread_mutex_init(&par->lock, NULL) || pthread_cond_init(&par->cond, NULL)) {
+    scmerr(SCMERR_SYSCALL, "scmrdr_open_parallel");
+  }
+
+  par->workers = scmmem_alloc(ctx, par->nthreads, sizeof(struct _scmrdr_worker));
+  for (i=0; i<par->nthreads; i++) {
+    par->workers[i].par = par;
+    par->workers[i].ctx = scmctx_new();
+    par->workers[i].ctx->stats = ctx->stats;
+    par->workers[i].ctx->srcs = ctx->srcs;
+    scmspl_share(par->workers[i].ctx, ctx);
+    if ((errno = pthread_create(&par->workers[i].thread, NULL, _scmrdr_worker, &par->workers[i]))) {
+      scmerr(SCMERR_SYSCALL, "pthread_create");
+    }
+  }
+  return rdr;
+}
+
 // destroy the reader
 void
 scmrdr_close(scmrdr *rdr)
@@ -124,16 +376,27 @@ scmrdr_close(scmrdr *rdr)
   switch (rdr->type) {
   case SCMRDR_TYPE_STDIN:
     break;
+  case SCMRDR_TYPE_PARALLEL:
+    _scmrdr_par_close(rdr->ctx, rdr->par);
+    scmmem_free(rdr->ctx, (void **) &(rdr->name));
+    break;
+  case SCMRDR_TYPE_PREFETCH:
+    _scmrdr_pre_close(rdr->ctx, rdr->pre);
+    scmmem_free(rdr->ctx, (void **) &(rdr->name));
+    break;
   case SCMRDR_TYPE_FILE:
   case SCMRDR_TYPE_BUFFER:
     if (fclose(rdr->stream)) {
       scmerr(SCMERR_SYSCALL, "fclose(\"%s\")", rdr->name);
     }
-    scmmem_free((void **) &(rdr->name));
+    scmmem_free(rdr->ctx, (void **) &(rdr->name));
     break;
   }
 
-  scmmem_free((void **) &rdr);
+  if (rdr->open) {
+    scmmem_free(rdr->ctx, (void **) &rdr->open);
+  }
+  scmmem_free(rdr->ctx, (void **) &rdr);
 }
 
 
@@ -149,6 +412,12 @@ _scmrdr_getc(scmrdr *rdr)
 {
   int c;
 
+  if (rdr->pre) {
+    if ((rdr->cur == rdr->end) && !_scmrdr_pre_next(rdr)) {
+      return EOF;
+    }
+    return (unsigned char)*rdr->cur++;
+  }
   c = getc(rdr->stream);
   if ((EOF == c) && (ferror(rdr->stream))) {
     scmerr(SCMERR_SYSCALL, "%s", rdr->name);
@@ -173,6 +442,9 @@ _scmrdr_read(scmrdr *rdr)
   }
 
   // advance position and line
+  if (EOF != c) {
+    rdr->ctx->rdr.bytes++;
+  }
   switch (c) {
   case '\n':
     rdr->line++;
@@ -203,10 +475,109 @@ _scmrdr_peek(scmrdr *rdr)
 
 
 
+// where a byte of a token was read
+struct _scmrdr_loc {
+  int line;
+  int pos;
+};
+
+static size_t _scmrdr_utf8(const unsigned char *s, size_t n);
+static void _scmrdr_check_encoding(scmrdr *rdr, const char *buffer, size_t n,
+				   const struct _scmrdr_loc *loc);
 static scmval _scmrdr_read_integer(scmrdr *rdr, int stash);
 static scmval _scmrdr_read_string(scmrdr *rdr);
 static scmval _scmrdr_read_symbol(scmrdr *rdr, int stash);
 static scmval _scmrdr_read_list(scmrdr *rdr);
+static void _scmrdr_release(scmctx *ctx, scmval v);
+static void _scmrdr_track(scmrdr *rdr, scmval v, int line);
+
+
+/*
+ * offset of the first byte of s that does not start a valid utf-8
+ * sequence (rfc 3629: no overlong forms, surrogates or code points above
+ * U+10FFFF), n if all are valid. runs of ascii are skipped 16 bytes at a
+ * time with sse2, 8 bytes at a time elsewhere.
+ */
+static size_t
+_scmrdr_utf8(const unsigned char *s, size_t n)
+{
+  size_t i = 0, len, k;
+  unsigned char lo, hi;
+#if !defined(__SSE2__)
+  uint64_t w;
+#endif
+
+  while (i < n) {
+#if defined(__SSE2__)
+    while ((i + 16 <= n) && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)))) {
+      i += 16;
+    }
+#else
+    while (i + 8 <= n) {
+      memcpy(&w, s + i, sizeof(w));
+      if (w & UINT64_C(0x8080808080808080)) {
+	break;
+      }
+      i += 8;
+    }
+#endif
+    if (i == n) {
+      break;
+    }
+    if (s[i] < 0x80) {
+      i++;
+      continue;
+    }
+
+    // the range of the second byte depends on the first
+    lo = 0x80;
+    hi = 0xbf;
+    if ((s[i] >= 0xc2) && (s[i] <= 0xdf)) {
+      len = 2;
+    } else if ((s[i] & 0xf0) == 0xe0) {
+      len = 3;
+      if (0xe0 == s[i]) {
+	lo = 0xa0;
+      } else if (0xed == s[i]) {
+	hi = 0x9f;
+      }
+    } else if ((s[i] >= 0xf0) && (s[i] <= 0xf4)) {
+      len = 4;
+      if (0xf0 == s[i]) {
+	lo = 0x90;
+      } else if (0xf4 == s[i]) {
+	hi = 0x8f;
+      }
+    } else {
+      return i;
+    }
+    if ((i + len > n) || (s[i + 1] < lo) || (s[i + 1] > hi)) {
+      return i;
+    }
+    for (k=2; k<len; k++) {
+      if ((s[i + k] & 0xc0) != 0x80) {
+	return i;
+      }
+    }
+    i += len;
+  }
+  return n;
+}
+
+/*
+ * raise SCMERR_BAD_ENCODING at the first invalid sequence of a token. loc
+ * holds where each byte above 0x7f of buffer was read.
+ */
+static void
+_scmrdr_check_encoding(scmrdr *rdr, const char *buffer, size_t n,
+		       const struct _scmrdr_loc *loc)
+{
+  size_t k = _scmrdr_utf8((const unsigned char *)buffer, n);
+
+  if (k < n) {
+    scmerr(SCMERR_BAD_ENCODING, "%s:%i:%i", rdr->name, loc[k].line, loc[k].pos);
+  }
+}
 
 
 /*
@@ -263,7 +634,8 @@ _scmrdr_read_string(scmrdr *rdr)
 {
   int peek;
   char buffer[_SCMRDR_BUFFERSIZE];
-  int idx = 0;
+  struct _scmrdr_loc loc[_SCMRDR_BUFFERSIZE];
+  int idx = 0, high = 0;
 
   // XXX buffer overflow
   peek = _scmrdr_peek(rdr);
@@ -296,17 +668,29 @@ _scmrdr_read_string(scmrdr *rdr)
 	scmerr(SCMERR_UNKNOWN_ESCAPE, "%s:%i:%i", rdr->name, rdr->line, rdr->pos);
       }
     } else {
+      if (peek > 0x7f) {
+	loc[idx].line = rdr->line;
+	loc[idx].pos = rdr->pos;
+	high = 1;
+      }
       buffer[idx++] = peek;
       _scmrdr_read(rdr);
     }
     peek = _scmrdr_peek(rdr);
   }
+  if (high) {
+    _scmrdr_check_encoding(rdr, buffer, idx, loc);
+  }
 
   // skip over last " and zero terminate buffer
   _scmrdr_read(rdr);
   buffer[idx++] = '\0';
 
-  return scmspl_intern_string(buffer);
+  // the records of an arena do not grow the pool
+  if (rdr->ctx->arena) {
+    return scmspl_batch_string(rdr->ctx, buffer);
+  }
+  return scmspl_intern_string(rdr->ctx, buffer);
 }
 
 
@@ -316,7 +700,8 @@ _scmrdr_read_symbol(scmrdr *rdr, int stashed)
 {
   int peek;
   char buffer[_SCMRDR_BUFFERSIZE];
-  int idx = 0;
+  struct _scmrdr_loc loc[_SCMRDR_BUFFERSIZE];
+  int idx = 0, high = 0;
 
   if (EOF != stashed) {
     buffer[idx++] = stashed;
@@ -326,13 +711,24 @@ _scmrdr_read_symbol(scmrdr *rdr, int stashed)
 
   // XXX buffer overflow
   while (!isspace(peek) && ('(' != peek) && (')' != peek) && (EOF != peek)) {
+    if (peek > 0x7f) {
+      loc[idx].line = rdr->line;
+      loc[idx].pos = rdr->pos;
+      high = 1;
+    }
     buffer[idx++] = peek;
     (void) _scmrdr_read(rdr);
     peek = _scmrdr_peek(rdr);
   }
+  if (high) {
+    _scmrdr_check_encoding(rdr, buffer, idx, loc);
+  }
   buffer[idx++] = '\0';
 
-  return scmspl_intern_symbol(buffer);
+  if (rdr->ctx->arena) {
+    return scmspl_batch_symbol(rdr->ctx, buffer);
+  }
+  return scmspl_intern_symbol(rdr->ctx, buffer);
 }
 
 
@@ -364,10 +760,11 @@ _scmrdr_read_list(scmrdr *rdr)
       else
 	break;
     } else {
-      v_tmp = scmval_cons(scmrdr_read(rdr), SCMVAL_NIL);
+      v_tmp = scmval_cons(rdr->ctx, scmrdr_read(rdr), SCMVAL_NIL);
       if (SCMVAL_NIL == v_start) {
 	v_start = v_tmp;
 	v_cur = v_start;
+	rdr->open[rdr->depth - 1] = SCMVAL_MAKE_LIST(v_start);
       } else {
 	v_cur->next = SCMVAL_MAKE_LIST(v_tmp);
 	v_cur = v_tmp;
@@ -379,10 +776,30 @@ _scmrdr_read_list(scmrdr *rdr)
 }
 
 
+// free the cells of a list read and of the lists in it
+static void
+_scmrdr_release(scmctx *ctx, scmval v)
+{
+  scmval cell, next;
+
+  while (SCMVAL_IS_LIST(v)) {
+    cell = SCMVAL_TO_LIST(v);
+    next = cell->next;
+    _scmrdr_release(ctx, cell->data);
+    scmmem_free(ctx, (void **)&cell);
+    v = next;
+  }
+}
+
 scmval
 scmrdr_read(scmrdr *rdr)
 {
-  int c;
+  scmval v;
+  int c, line;
+
+  if (SCMRDR_TYPE_PARALLEL == rdr->type) {
+    return _scmrdr_par_read(rdr->par);
+  }
 
   while (isspace(_scmrdr_peek(rdr))) {
     (void) _scmrdr_read(rdr);
@@ -393,6 +810,9 @@ scmrdr_read(scmrdr *rdr)
   if (EOF == c) {
     return SCMVAL_EOF;
   }
+  if (0 == rdr->depth) {
+    rdr->ctx->rdr.datums++;
+  }
   if ('+' == c) {
     (void) _scmrdr_read(rdr);
     c = _scmrdr_peek(rdr);
@@ -419,10 +839,518 @@ scmrdr_read(scmrdr *rdr)
     return _scmrdr_read_string(rdr);
   }
   if ('(' == c) {
+    line = rdr->line;
     (void) _scmrdr_read(rdr);
-    return _scmrdr_read_list(rdr);
+    if (++rdr->depth > rdr->ctx->rdr.max_depth) {
+      rdr->ctx->rdr.max_depth = rdr->depth;
+    }
+    if (rdr->depth > rdr->aopen) {
+      rdr->aopen = rdr->aopen ? 2 * rdr->aopen : 16;
+      rdr->open = scmmem_realloc(rdr->ctx, rdr->open, rdr->aopen, sizeof(scmval));
+    }
+    rdr->open[rdr->depth - 1] = SCMVAL_NIL;
+    v = _scmrdr_read_list(rdr);
+    rdr->depth--;
+    // the cells of an arena are reused, their lists are not tracked
+    if (rdr->ctx->srcs && !rdr->ctx->arena && (SCMVAL_NIL != v)) {
+      _scmrdr_track(rdr, v, line);
+    }
+    return v;
   }
   // XXX was, wenn ')'
 
   return _scmrdr_read_symbol(rdr, EOF);
 }
+
+
+/*
+ * after an error raised by scmrdr_read was caught, release the lists read
+ * so far and skip the rest of the line: the next datum is read from the
+ * next line. the threads of a parallel reader recover by themselves, the
+ * error is raised again where its form is read.
+ */
+void
+scmrdr_recover(scmrdr *rdr)
+{
+  int c;
+
+  if (SCMRDR_TYPE_PARALLEL == rdr->type) {
+    return;
+  }
+  // the outer lists do not hold the inner ones yet, the cells of an
+  // arena are taken back with it
+  while (rdr->depth > 0) {
+    rdr->depth--;
+    if (!rdr->ctx->arena) {
+      _scmrdr_release(rdr->ctx, rdr->open[rdr->depth]);
+    }
+  }
+  while ((EOF != (c = _scmrdr_peek(rdr))) && ('\n' != c)) {
+    (void) _scmrdr_read(rdr);
+  }
+}
+
+// a reader of the chunk ch of the file name mapped at map
+static scmrdr *
+_scmrdr_open_chunk(scmctx *ctx, const char *name, char *map, struct _scmrdr_chunk *ch)
+{
+  scmrdr *rdr = (scmrdr *) scmmem_alloc(ctx, 1, sizeof(struct _scmrdr));
+  rdr->ctx = ctx;
+  rdr->type = SCMRDR_TYPE_BUFFER;
+  rdr->name = scmmem_strdup(ctx, name);
+  rdr->par = NULL;
+  rdr->pre = NULL;
+  rdr->peek = SCMRDR_PEEK_INVALID;
+  rdr->depth = 0;
+  rdr->src = NULL;
+  rdr->open = NULL;
+  rdr->aopen = 0;
+  rdr->line = ch->line;
+  rdr->pos = 0;
+  if (NULL == (rdr->stream = fmemopen(map + ch->start, ch->end - ch->start, "r"))) {
+    scmerr(SCMERR_SYSCALL, "fmemopen(\"%s\")", name);
+  }
+  return rdr;
+}
+
+/*
+ * the end of the chunk at start: the first newline between top-level
+ * forms after _SCMRDR_CHUNKSIZE bytes. tokens are told apart like
+ * scmrdr_read does, a " starts a string only where a form starts. line
+ * is advanced to the line of the end.
+ */
+static size_t
+_scmrdr_split(struct _scmrdr_par *par, size_t start, int *line)
+{
+  enum { SPACE, SYMBOL, INTEGER, STRING } tok = SPACE;
+  const char *p = par->map;
+  size_t min = start + _SCMRDR_CHUNKSIZE;
+  size_t i;
+  int depth = 0;
+  int c;
+
+  for (i = start; i < par->size; i++) {
+    c = (unsigned char)p[i];
+    if (STRING == tok) {
+      if ('\\' == c) {
+	i++;
+	c = (i < par->size) ? (unsigned char)p[i] : EOF;
+      } else if ('"' == c) {
+	tok = SPACE;
+      }
+      if ('\n' == c) {
+	(*line)++;
+      }
+      continue;
+    }
+    if (isspace(c)) {
+      if (('\n' == c) && (0 == depth) && (i >= min)) {
+	return i;
+      }
+      if ('\n' == c) {
+	(*line)++;
+      }
+      tok = SPACE;
+    } else if (('(' == c) || (')' == c)) {
+      depth += ('(' == c) ? 1 : ((depth > 0) ? -1 : 0);
+      tok = SPACE;
+    } else if ((SYMBOL == tok) || ((INTEGER == tok) && isdigit(c))) {
+      continue;
+    } else if ('"' == c) {
+      tok = STRING;
+    } else if (isdigit(c)) {
+      tok = INTEGER;
+    } else if ((('+' == c) || ('-' == c)) && (i + 1 < par->size) && isdigit((unsigned char)p[i + 1])) {
+      tok = INTEGER;
+    } else {
+      tok = SYMBOL;
+    }
+  }
+  return par->size;
+}
+
+/*
+ * split the next chunk and read its forms, while less than nring chunks
+ * wait to be consumed. one worker at a time looks for the end of the next
+ * chunk, without the lock: the others read their chunks meanwhile. an
+ * error is kept in the chunk and the reader recovers like scm -k does.
+ */
+static void *
+_scmrdr_worker(void *arg)
+{
+  struct _scmrdr_par *par = ((struct _scmrdr_worker *)arg)->par;
+  scmctx *ctx = ((struct _scmrdr_worker *)arg)->ctx;
+  struct _scmrdr_chunk *ch;
+  struct _scmrdr_fill f;
+  struct scmerr_caught err;
+  size_t start, end;
+  int line, first;
+
+  (void)pthread_mutex_lock(&par->lock);
+  for (;;) {
+    while (!par->stop && (par->next < par->size) &&
+	   (par->splitting || (par->nsplit - par->nread == par->nring))) {
+      (void)pthread_cond_wait(&par->cond, &par->lock);
+    }
+    if (par->stop || (par->next == par->size)) {
+      break;
+    }
+    par->splitting = 1;
+    start = par->next;
+    first = line = par->line;
+    (void)pthread_mutex_unlock(&par->lock);
+
+    end = _scmrdr_split(par, start, &line);
+
+    (void)pthread_mutex_lock(&par->lock);
+    ch = &par->ring[par->nsplit++ % par->nring];
+    ch->start = start;
+    ch->line = first;
+    ch->end = par->next = end;
+    ch->nvals = 0;
+    ch->nfails = 0;
+    ch->done = 0;
+    par->line = line;
+    par->splitting = 0;
+    (void)pthread_cond_broadcast(&par->cond);
+    (void)pthread_mutex_unlock(&par->lock);
+
+    f.ctx = ctx;
+    f.rdr = _scmrdr_open_chunk(ctx, par->name, par->map, ch);
+    f.ch = ch;
+    while (scmerr_catch(_scmrdr_fill, &f, &err)) {
+      if (ch->nfails == ch->afails) {
+	ch->afails = ch->afails ? 2 * ch->afails : 4;
+	ch->fails = scmmem_realloc(ctx, ch->fails, ch->afails, sizeof(struct _scmrdr_fail));
+      }
+      ch->fails[ch->nfails].at = ch->nvals;
+      ch->fails[ch->nfails++].err = err;
+      scmrdr_recover(f.rdr);
+    }
+    scmrdr_close(f.rdr);
+
+    (void)pthread_mutex_lock(&par->lock);
+    ch->done = 1;
+    (void)pthread_cond_broadcast(&par->cond);
+  }
+  (void)pthread_mutex_unlock(&par->lock);
+  return NULL;
+}
+
+static void
+_scmrdr_fill(void *arg)
+{
+  struct _scmrdr_fill *f = arg;
+  struct _scmrdr_chunk *ch = f->ch;
+  scmval v;
+
+  while (SCMVAL_EOF != (v = scmrdr_read(f->rdr))) {
+    if (ch->nvals == ch->avals) {
+      ch->avals = ch->avals ? 2 * ch->avals : 256;
+      ch->vals = scmmem_realloc(f->ctx, ch->vals, ch->avals, sizeof(scmval));
+    }
+    ch->vals[ch->nvals++] = v;
+  }
+}
+
+// the next form of the file, waiting for its chunk to be read
+static scmval
+_scmrdr_par_read(struct _scmrdr_par *par)
+{
+  struct _scmrdr_chunk *ch;
+
+  for (;;) {
+    if (par->chunk && (par->fail < par->chunk->nfails) &&
+	(par->chunk->fails[par->fail].at == par->cur)) {
+      scmerr_raise(&par->chunk->fails[par->fail++].err);
+    }
+    if (par->chunk && (par->cur < par->chunk->nvals)) {
+      return par->chunk->vals[par->cur++];
+    }
+    (void)pthread_mutex_lock(&par->lock);
+    if (par->chunk) {
+      par->chunk = NULL;
+      par->nread++;
+      (void)pthread_cond_broadcast(&par->cond);
+    }
+    for (;;) {
+      ch = &par->ring[par->nread % par->nring];
+      if ((par->nread < par->nsplit) && ch->done) {
+	break;
+      }
+      if ((par->nread == par->nsplit) && (par->next == par->size)) {
+	(void)pthread_mutex_unlock(&par->lock);
+	return SCMVAL_EOF;
+      }
+      (void)pthread_cond_wait(&par->cond, &par->lock);
+    }
+    (void)pthread_mutex_unlock(&par->lock);
+    par->chunk = ch;
+    par->cur = 0;
+    par->fail = 0;
+  }
+}
+
+// stop the workers, their allocations count to ctx
+static void
+_scmrdr_par_close(scmctx *ctx, struct _scmrdr_par *par)
+{
+  unsigned long k;
+  int i;
+
+  (void)pthread_mutex_lock(&par->lock);
+  par->stop = 1;
+  (void)pthread_cond_broadcast(&par->cond);
+  (void)pthread_mutex_unlock(&par->lock);
+  for (i=0; i<par->nthreads; i++) {
+    (void)pthread_join(par->workers[i].thread, NULL);
+    scmctx_merge(ctx, par->workers[i].ctx);
+    scmctx_free(par->workers[i].ctx);
+  }
+  for (k=0; k<par->nring; k++) {
+    if (par->ring[k].vals) {
+      scmmem_free(ctx, (void **)&par->ring[k].vals);
+    }
+    if (par->ring[k].fails) {
+      scmmem_free(ctx, (void **)&par->ring[k].fails);
+    }
+  }
+  if (par->size > 0) {
+    (void)munmap(par->map, par->size);
+  }
+  (void)pthread_cond_destroy(&par->cond);
+  (void)pthread_mutex_destroy(&par->lock);
+  scmmem_free(ctx, (void **)&par->workers);
+  scmmem_free(ctx, (void **)&par->ring);
+  scmmem_free(ctx, (void **)&par);
+}
+
+/*
+ * the thread of a prefetching reader fills the buffers in turn. it can
+ * only be cancelled in read(2), where it may block on a pipe or terminal
+ * when the reader is closed before the end of its input.
+ */
+static void *
+_scmrdr_prefetch(void *arg)
+{
+  struct _scmrdr_pre *pre = arg;
+  ssize_t n;
+  int i = 0;
+
+  (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+  (void)pthread_mutex_lock(&pre->lock);
+  while (!pre->stop) {
+    if (pre->full[i]) {
+      (void)pthread_cond_wait(&pre->cond, &pre->lock);
+      continue;
+    }
+    (void)pthread_mutex_unlock(&pre->lock);
+
+    (void)pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    do {
+      n = read(pre->fd, pre->buf[i], _SCMRDR_PREFETCH);
+    } while ((-1 == n) && (EINTR == errno));
+    (void)pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    (void)pthread_mutex_lock(&pre->lock);
+    pre->len[i] = n;
+    pre->full[i] = 1;
+    if (n < 0) {
+      pre->err = errno;
+    }
+    (void)pthread_cond_signal(&pre->cond);
+    if (n <= 0) {
+      pre->done = 1;
+      break;
+    }
+    i ^= 1;
+  }
+  (void)pthread_mutex_unlock(&pre->lock);
+  return NULL;
+}
+
+// hand the consumed buffer back and wait for the next, 0 at the end
+static int
+_scmrdr_pre_next(scmrdr *rdr)
+{
+  struct _scmrdr_pre *pre = rdr->pre;
+  ssize_t n;
+
+  (void)pthread_mutex_lock(&pre->lock);
+  if (pre->held) {
+    pre->full[pre->cur] = 0;
+    pre->held = 0;
+    pre->cur ^= 1;
+    (void)pthread_cond_signal(&pre->cond);
+  }
+  while (!pre->full[pre->cur]) {
+    (void)pthread_cond_wait(&pre->cond, &pre->lock);
+  }
+  // the end stays full, to be found again
+  if ((n = pre->len[pre->cur]) > 0) {
+    pre->held = 1;
+    rdr->cur = pre->buf[pre->cur];
+    rdr->end = rdr->cur + n;
+  }
+  (void)pthread_mutex_unlock(&pre->lock);
+
+  if (n < 0) {
+    errno = pre->err;
+    scmerr(SCMERR_SYSCALL, "%s", rdr->name);
+  }
+  return n > 0;
+}
+
+static void
+_scmrdr_pre_close(scmctx *ctx, struct _scmrdr_pre *pre)
+{
+  int i;
+
+  (void)pthread_mutex_lock(&pre->lock);
+  pre->stop = 1;
+  (void)pthread_cond_signal(&pre->cond);
+  if (!pre->done) {
+    (void)pthread_cancel(pre->thread);
+  }
+  (void)pthread_mutex_unlock(&pre->lock);
+  (void)pthread_join(pre->thread, NULL);
+
+  if ((STDIN_FILENO != pre->fd) && (-1 == close(pre->fd))) {
+    scmerr(SCMERR_SYSCALL, "close");
+  }
+  (void)pthread_cond_destroy(&pre->cond);
+  (void)pthread_mutex_destroy(&pre->lock);
+  for (i=0; i<2; i++) {
+    scmmem_free(ctx, (void **)&pre->buf[i]);
+  }
+  scmmem_free(ctx, (void **)&pre);
+}
+
+
+
+/*
+ * source locations. the first cell of each list read is mapped to the
+ * file and line of its opening parenthesis, in an open addressing table
+ * with linear probing. the readers of a parallel reader record into the
+ * table of their owner, under its lock.
+ */
+
+struct _scmrdr_src {
+  scmval list;          // NULL for an empty slot
+  const char *file;
+  int line;
+};
+
+struct _scmrdr_srcs {
+  pthread_mutex_t lock;
+  struct _scmrdr_src *slots;
+  size_t mask;
+  size_t count;
+};
+
+static void _scmrdr_srcs_release(scmctx *ctx);
+static struct _scmrdr_src *_scmrdr_src_slot(struct _scmrdr_srcs *t, scmval list);
+
+
+// record the file and line of each list read in ctx from now on
+void
+scmrdr_track(scmctx *ctx)
+{
+  struct _scmrdr_srcs *t;
+
+  if (ctx->srcs) {
+    return;
+  }
+  t = ctx->srcs = scmmem_alloc(ctx, 1, sizeof(struct _scmrdr_srcs));
+  if (pthread_mutex_init(&t->lock, NULL)) {
+    scmerr(SCMERR_SYSCALL, "scmrdr_track");
+  }
+  t->mask = 1023;
+  t->count = 0;
+  // the readers of other threads grow the slots, which are not counted
+  // in a context for that
+  if (NULL == (t->slots = calloc(t->mask + 1, sizeof(struct _scmrdr_src)))) {
+    scmerr(SCMERR_SYSCALL, "scmrdr_track");
+  }
+  scmctx_atfree(ctx, _scmrdr_srcs_release);
+}
+
+static void
+_scmrdr_srcs_release(scmctx *ctx)
+{
+  (void)pthread_mutex_destroy(&ctx->srcs->lock);
+  free(ctx->srcs->slots);
+  scmmem_free(ctx, (void **)&ctx->srcs);
+}
+
+// the slot of list in t, empty if the list is not in t
+static struct _scmrdr_src *
+_scmrdr_src_slot(struct _scmrdr_srcs *t, scmval list)
+{
+  size_t i;
+
+  for (i = ((uintptr_t)list >> 4) & t->mask; t->slots[i].list && (t->slots[i].list != list);
+       i = (i + 1) & t->mask) {
+  }
+  return &t->slots[i];
+}
+
+// record that the list v starts at line of rdr
+static void
+_scmrdr_track(scmrdr *rdr, scmval v, int line)
+{
+  scmctx *ctx = rdr->ctx;
+  struct _scmrdr_srcs *t = ctx->srcs;
+  struct _scmrdr_src *old, *s;
+  size_t i, n;
+
+  if (!rdr->src) {
+    rdr->src = SCMVAL_TO_C_STR(scmspl_intern_string(ctx, rdr->name));
+  }
+  (void)pthread_mutex_lock(&t->lock);
+  if (2 * (t->count + 1) > t->mask + 1) {
+    old = t->slots;
+    n = t->mask + 1;
+    t->slots = calloc(2 * n, sizeof(struct _scmrdr_src));
+    if (NULL == t->slots) {
+      scmerr(SCMERR_SYSCALL, "_scmrdr_track");
+    }
+    t->mask = 2 * n - 1;
+    for (i=0; i<n; i++) {
+      if (old[i].list) {
+	*_scmrdr_src_slot(t, old[i].list) = old[i];
+      }
+    }
+    free(old);
+  }
+  s = _scmrdr_src_slot(t, SCMVAL_TO_LIST(v));
+  if (!s->list) {
+    t->count++;
+  }
+  s->list = SCMVAL_TO_LIST(v);
+  s->file = rdr->src;
+  s->line = line;
+  (void)pthread_mutex_unlock(&t->lock);
+}
+
+// the file and line where the list v was read, 0 if it is not known
+int
+scmrdr_source(scmctx *ctx, scmval v, const char **file, int *line)
+{
+  struct _scmrdr_srcs *t = ctx->srcs;
+  struct _scmrdr_src *s;
+  int found = 0;
+
+  if (!t || !SCMVAL_IS_LIST(v) || (SCMVAL_NIL == v)) {
+    return 0;
+  }
+  (void)pthread_mutex_lock(&t->lock);
+  s = _scmrdr_src_slot(t, SCMVAL_TO_LIST(v));
+  if (s->list) {
+    *file = s->file;
+    *line = s->line;
+    found = 1;
+  }
+  (void)pthread_mutex_unlock(&t->lock);
+  return found;
+}
@@ -19,14 +19,21 @@
 
 typedef struct _scmrdr scmrdr;
 
-// initialize a reader from a buffer in memory
-scmrdr *scmrdr_open_buffer(char *buffer, size_t size);
+// initialize a reader from a buffer in memory, reading values of ctx
+scmrdr *scmrdr_open_buffer(scmctx *ctx, char *buffer, size_t size);
 
 // initialize a reader from a file
-scmrdr *scmrdr_open_file(char *file);
+scmrdr *scmrdr_open_file(scmctx *ctx, char *file);
 
 // initialize a reader from standard input
-scmrdr *scmrdr_open_stdin(void);
+scmrdr *scmrdr_open_stdin(scmctx *ctx);
+
+// initialize a reader of a file, mapped and read ahead on nthreads threads
+scmrdr *scmrdr_open_parallel(scmctx *ctx, char *file, int nthreads);
+
+// initialize a reader of a file, or standard input if file is NULL, with
+// a thread reading ahead while the forms are parsed
+scmrdr *scmrdr_open_prefetch(scmctx *ctx, char *file);
 
 // destroy the reader
 void scmrdr_close(scmrdr *rdr);
@@ -34,4 +41,14 @@ void scmrdr_close(scmrdr *rdr);
 // read from reader
 scmval scmrdr_read(scmrdr *rdr);
 
+// release the datum being read after an error was caught in scmrdr_read,
+// the next datum is read from the next line
+void scmrdr_recover(scmrdr *rdr);
+
+// record the file and line of each list read in ctx from now on
+void scmrdr_track(scmctx *ctx);
+
+// the file and line where the list v was read, 0 if it is not known
+int scmrdr_source(scmctx *ctx, scmval v, const char **file, int *line);
+
 #endif
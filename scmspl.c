@@ -15,68 +15,426 @@
  */
 
 #include <errno.h>   /* errno */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
 #include <string.h>
 #include <stdint.h>
 
 #include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
 #include "scmmem.h"
 #include "scmval.h"
 #include "scmspl.h"
 
+/*
+ * the pool is split into stripes by the high bits of the hash. each
+ * stripe is an open addressing table with linear probing. lookups take
+ * no lock: a slot is published once, with release order, and never
+ * changes. an insert takes the lock of its stripe and probes again, so
+ * the same string is never interned twice. a grown table is published
+ * the same way, the old one stays valid for lookups in progress until
+ * the pool is released.
+ */
+
+// Implementation limits:
+#define _SCMSPL_STRIPEBITS  6
+#define _SCMSPL_STRIPES     (1 << _SCMSPL_STRIPEBITS)
+#define _SCMSPL_MINSIZE     16          // slots of a new table
+
+// an interned string, the value points to cstr
+struct _scmspl_str {
+  uint64_t hash;
+  char cstr[];
+};
 
-typedef struct string_pool {
-  struct string_pool * next;
-  char *cstr;
-} string_pool;
+struct _scmspl_table {
+  struct _scmspl_table *retired;        // replaced by this table
+  size_t mask;
+  _Atomic(struct _scmspl_str *) slots[];
+};
 
-static string_pool *sp = NULL;
+struct _scmspl_stripe {
+  _Atomic(struct _scmspl_table *) table;
+  size_t count;
+  pthread_mutex_t lock;
+};
 
-static string_pool * _string_pool_cons(const char *cstr, string_pool *old_head);
+// the interned strings of a context, locked once contexts share it
+struct _scmspl_pool {
+  struct _scmspl_stripe stripes[_SCMSPL_STRIPES];
+  int shared;
+};
+
+/*
+ * the strings of an arena that are not in the pool, cleared once the arena
+ * is reset. only the context of the arena interns into it.
+ */
+struct _scmspl_batch {
+  unsigned long resets;                 // of the arena, when last cleared
+  size_t count;
+  size_t mask;
+  struct _scmspl_str *slots[];
+};
 
-string_pool *
-_string_pool_cons(const char *cstr, string_pool *old_head) {
-  string_pool *_pair = (string_pool *)scmmem_alloc(1, sizeof (string_pool));
-  _pair->cstr = scmmem_strdup(cstr);
-  _pair->next = old_head;
-  return _pair;
+static struct _scmspl_pool *_scmspl_pool(scmctx *ctx);
+static void _scmspl_release(scmctx *ctx);
+static struct _scmspl_table *_scmspl_table(scmctx *ctx, size_t size);
+static uint64_t _scmspl_hash(const char *cstr);
+static struct _scmspl_str *_scmspl_lookup(struct _scmspl_table *t,
+					  const char *cstr, uint64_t hash, unsigned long *n);
+static void _scmspl_probed(scmctx *ctx, unsigned long n);
+static void _scmspl_grow(scmctx *ctx, struct _scmspl_stripe *st);
+static char *_scmspl_intern(scmctx *ctx, const char *cstr);
+static struct _scmspl_batch *_scmspl_batch_table(scmctx *ctx, size_t size);
+static struct _scmspl_str **_scmspl_batch_slot(struct _scmspl_batch *b,
+					       const char *cstr, uint64_t hash, unsigned long *n);
+static char *_scmspl_batch(scmctx *ctx, const char *cstr);
+static int _scmspl_constant(const char *cstr, scmval *v);
+
+
+// the pool of ctx, created on first use
+static struct _scmspl_pool *
+_scmspl_pool(scmctx *ctx)
+{
+  struct _scmspl_pool *sp;
+  int i;
+
+  if (!ctx->spl) {
+    sp = ctx->spl = scmmem_alloc(ctx, 1, sizeof(struct _scmspl_pool));
+    for (i=0; i<_SCMSPL_STRIPES; i++) {
+      atomic_init(&sp->stripes[i].table, _scmspl_table(ctx, _SCMSPL_MINSIZE));
+      sp->stripes[i].count = 0;
+      if (pthread_mutex_init(&sp->stripes[i].lock, NULL)) {
+	scmerr(SCMERR_SYSCALL, "pthread_mutex_init");
+      }
+    }
+    sp->shared = 0;
+    scmctx_atfree(ctx, _scmspl_release);
+  }
+  return ctx->spl;
 }
 
-scmval
-scmspl_intern_string(const char *cstr)
+static void
+_scmspl_release(scmctx *ctx)
 {
-  string_pool *_sp = sp;
+  struct _scmspl_table *t, *retired;
+  struct _scmspl_str *s;
+  size_t j;
+  int i;
 
-  for (;_sp; _sp=_sp->next) {
-    if (!strcmp(cstr, _sp->cstr)) {
-      return SCMVAL_MAKE_STRING(_sp->cstr);
+  for (i=0; i<_SCMSPL_STRIPES; i++) {
+    t = atomic_load_explicit(&ctx->spl->stripes[i].table, memory_order_relaxed);
+    for (j=0; j<=t->mask; j++) {
+      if ((s = atomic_load_explicit(&t->slots[j], memory_order_relaxed))) {
+	scmmem_free(ctx, (void **)&s);
+      }
+    }
+    for (; t; t = retired) {
+      retired = t->retired;
+      scmmem_free(ctx, (void **)&t);
     }
+    (void)pthread_mutex_destroy(&ctx->spl->stripes[i].lock);
   }
+  scmmem_free(ctx, (void **)&ctx->spl);
+}
 
-  sp = _string_pool_cons(cstr, sp);
-  return SCMVAL_MAKE_STRING(sp->cstr);
+// an empty table of size slots, a power of two
+static struct _scmspl_table *
+_scmspl_table(scmctx *ctx, size_t size)
+{
+  struct _scmspl_table *t;
+  size_t i;
+
+  t = scmmem_alloc(ctx, 1, sizeof(struct _scmspl_table) + size * sizeof(t->slots[0]));
+  t->retired = NULL;
+  t->mask = size - 1;
+  for (i=0; i<size; i++) {
+    atomic_init(&t->slots[i], NULL);
+  }
+  return t;
 }
 
+// FNV-1a
+static uint64_t
+_scmspl_hash(const char *cstr)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  for (; *cstr; cstr++) {
+    h = (h ^ (unsigned char)*cstr) * 0x100000001b3ULL;
+  }
+  return h;
+}
 
+// the interned string cstr in t, NULL if there is none, the slots compared in n
+static struct _scmspl_str *
+_scmspl_lookup(struct _scmspl_table *t, const char *cstr, uint64_t hash, unsigned long *n)
+{
+  struct _scmspl_str *s;
+  size_t i;
 
-scmval
-scmspl_intern_symbol(const char *cstr)
+  *n = 0;
+  for (i = hash & t->mask; ; i = (i + 1) & t->mask) {
+    (*n)++;
+    s = atomic_load_explicit(&t->slots[i], memory_order_acquire);
+    if (!s || ((s->hash == hash) && !strcmp(s->cstr, cstr))) {
+      break;
+    }
+  }
+  return s;
+}
+
+// count the probes of the final lookup of an intern
+static void
+_scmspl_probed(scmctx *ctx, unsigned long n)
 {
-  string_pool *_sp = sp;
+  ctx->splst.probes += n;
+  if (n > ctx->splst.max_probes) {
+    ctx->splst.max_probes = n;
+  }
+}
 
-  if (!strcmp("false", cstr))
-    return SCMVAL_FALSE;
-  if (!strcmp("true", cstr))
-    return SCMVAL_TRUE;
-  if (!strcmp("nil", cstr))
-    return SCMVAL_NIL;
+// double the table of the stripe, with the lock of the stripe held
+static void
+_scmspl_grow(scmctx *ctx, struct _scmspl_stripe *st)
+{
+  struct _scmspl_table *t = atomic_load_explicit(&st->table, memory_order_relaxed);
+  struct _scmspl_table *n = _scmspl_table(ctx, 2 * (t->mask + 1));
+  struct _scmspl_str *s;
+  size_t i, j;
 
-  for (;_sp; _sp=_sp->next) {
-    if (!strcmp(cstr, _sp->cstr)) {
-      return SCMVAL_MAKE_SYMBOL(_sp->cstr);
+  for (i=0; i<=t->mask; i++) {
+    if ((s = atomic_load_explicit(&t->slots[i], memory_order_relaxed))) {
+      for (j = s->hash & n->mask; atomic_load_explicit(&n->slots[j], memory_order_relaxed);
+	   j = (j + 1) & n->mask) {
+      }
+      atomic_store_explicit(&n->slots[j], s, memory_order_relaxed);
     }
   }
+  n->retired = t;
+  atomic_store_explicit(&st->table, n, memory_order_release);
+}
+
+// the interned copy of cstr, a string of ctx counts to the context interning it
+static char *
+_scmspl_intern(scmctx *ctx, const char *cstr)
+{
+  struct _scmspl_pool *sp = _scmspl_pool(ctx);
+  uint64_t hash = _scmspl_hash(cstr);
+  struct _scmspl_stripe *st = &sp->stripes[hash >> (64 - _SCMSPL_STRIPEBITS)];
+  struct _scmspl_table *t;
+  struct _scmspl_str *s;
+  unsigned long n;
+  size_t i, len;
+
+  ctx->splst.lookups++;
+  t = atomic_load_explicit(&st->table, memory_order_acquire);
+  if ((s = _scmspl_lookup(t, cstr, hash, &n))) {
+    _scmspl_probed(ctx, n);
+    ctx->splst.hits++;
+    return s->cstr;
+  }
+
+  // a miss on a shared pool probes again under the lock, only that counts
+  if (sp->shared) {
+    (void)pthread_mutex_lock(&st->lock);
+    t = atomic_load_explicit(&st->table, memory_order_relaxed);
+    if ((s = _scmspl_lookup(t, cstr, hash, &n))) {
+      (void)pthread_mutex_unlock(&st->lock);
+      _scmspl_probed(ctx, n);
+      ctx->splst.hits++;
+      return s->cstr;
+    }
+  }
+  _scmspl_probed(ctx, n);
+  if (2 * (st->count + 1) > t->mask + 1) {
+    _scmspl_grow(ctx, st);
+    t = atomic_load_explicit(&st->table, memory_order_relaxed);
+  }
+  len = strlen(cstr);
+  s = scmmem_alloc(ctx, 1, sizeof(struct _scmspl_str) + len + 1);
+  s->hash = hash;
+  memcpy(s->cstr, cstr, len + 1);
+  for (i = hash & t->mask; atomic_load_explicit(&t->slots[i], memory_order_relaxed);
+       i = (i + 1) & t->mask) {
+  }
+  atomic_store_explicit(&t->slots[i], s, memory_order_release);
+  st->count++;
+  if (sp->shared) {
+    (void)pthread_mutex_unlock(&st->lock);
+  }
+  return s->cstr;
+}
+
+// an empty batch table of size slots, a power of two
+static struct _scmspl_batch *
+_scmspl_batch_table(scmctx *ctx, size_t size)
+{
+  struct _scmspl_batch *b;
+
+  b = scmmem_alloc(ctx, 1, sizeof(struct _scmspl_batch) + size * sizeof(b->slots[0]));
+  b->resets = ctx->arena->resets;
+  b->count = 0;
+  b->mask = size - 1;
+  memset(b->slots, 0, size * sizeof(b->slots[0]));
+  return b;
+}
+
+// the slot of cstr in b, empty if it is not in b, the slots compared in n
+static struct _scmspl_str **
+_scmspl_batch_slot(struct _scmspl_batch *b, const char *cstr, uint64_t hash, unsigned long *n)
+{
+  struct _scmspl_str *s;
+  size_t i;
 
-  sp = _string_pool_cons(cstr, sp);
-  return SCMVAL_MAKE_SYMBOL(sp->cstr);
+  *n = 0;
+  for (i = hash & b->mask; ; i = (i + 1) & b->mask) {
+    (*n)++;
+    s = b->slots[i];
+    if (!s || ((s->hash == hash) && !strcmp(s->cstr, cstr))) {
+      return &b->slots[i];
+    }
+  }
+}
+
+/*
+ * the string of the pool equal to cstr if there is one, else a copy in
+ * the arena of ctx, the same for the same cstr until the arena is reset.
+ * the pool does not grow.
+ */
+static char *
+_scmspl_batch(scmctx *ctx, const char *cstr)
+{
+  struct _scmmem_arena *a = ctx->arena;
+  struct _scmspl_pool *sp = _scmspl_pool(ctx);
+  struct _scmspl_batch *b = a->spl, *old;
+  uint64_t hash = _scmspl_hash(cstr);
+  struct _scmspl_table *t;
+  struct _scmspl_str *s, **slot;
+  unsigned long n;
+  size_t i, len;
+
+  ctx->splst.lookups++;
+  t = atomic_load_explicit(&sp->stripes[hash >> (64 - _SCMSPL_STRIPEBITS)].table,
+			   memory_order_acquire);
+  if ((s = _scmspl_lookup(t, cstr, hash, &n))) {
+    _scmspl_probed(ctx, n);
+    ctx->splst.hits++;
+    return s->cstr;
+  }
+
+  if (!b) {
+    b = a->spl = _scmspl_batch_table(ctx, _SCMSPL_MINSIZE);
+  } else if (b->resets != a->resets) {
+    memset(b->slots, 0, (b->mask + 1) * sizeof(b->slots[0]));
+    b->count = 0;
+    b->resets = a->resets;
+  }
+  slot = _scmspl_batch_slot(b, cstr, hash, &n);
+  _scmspl_probed(ctx, n);
+  if (*slot) {
+    ctx->splst.hits++;
+    return (*slot)->cstr;
+  }
+  if (2 * (b->count + 1) > b->mask + 1) {
+    old = b;
+    b = a->spl = _scmspl_batch_table(ctx, 2 * (old->mask + 1));
+    for (i=0; i<=old->mask; i++) {
+      if (old->slots[i]) {
+	*_scmspl_batch_slot(b, old->slots[i]->cstr, old->slots[i]->hash, &n) = old->slots[i];
+      }
+    }
+    b->count = old->count;
+    scmmem_free(ctx, (void **)&old);
+    slot = _scmspl_batch_slot(b, cstr, hash, &n);
+  }
+  len = strlen(cstr);
+  s = scmmem_arena_alloc(ctx, sizeof(struct _scmspl_str) + len + 1);
+  s->hash = hash;
+  memcpy(s->cstr, cstr, len + 1);
+  *slot = s;
+  b->count++;
+  return s->cstr;
+}
+
+// intern into the pool of from, which must outlive ctx
+void
+scmspl_share(scmctx *ctx, scmctx *from)
+{
+  ctx->spl = _scmspl_pool(from);
+  if (!ctx->spl->shared) {
+    ctx->spl->shared = 1;
+  }
+}
+
+// number of strings interned in the pool of ctx and of its slots, while
+// no other context interns into it
+void
+scmspl_size(scmctx *ctx, size_t *count, size_t *slots)
+{
+  struct _scmspl_pool *sp = _scmspl_pool(ctx);
+  struct _scmspl_table *t;
+  int i;
+
+  *count = 0;
+  *slots = 0;
+  for (i=0; i<_SCMSPL_STRIPES; i++) {
+    t = atomic_load_explicit(&sp->stripes[i].table, memory_order_acquire);
+    *count += sp->stripes[i].count;
+    *slots += t->mask + 1;
+  }
+}
+
+scmval
+scmspl_intern_string(scmctx *ctx, const char *cstr)
+{
+  return SCMVAL_MAKE_STRING(_scmspl_intern(ctx, cstr));
+}
+
+
+
+// the constant named cstr in v, 0 if cstr names a symbol
+static int
+_scmspl_constant(const char *cstr, scmval *v)
+{
+  if (!strcmp("false", cstr)) {
+    *v = SCMVAL_FALSE;
+  } else if (!strcmp("true", cstr)) {
+    *v = SCMVAL_TRUE;
+  } else if (!strcmp("nil", cstr)) {
+    *v = SCMVAL_NIL;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+scmval
+scmspl_intern_symbol(scmctx *ctx, const char *cstr)
+{
+  scmval v;
+
+  if (_scmspl_constant(cstr, &v)) {
+    return v;
+  }
+  return SCMVAL_MAKE_SYMBOL(_scmspl_intern(ctx, cstr));
+}
+
+scmval
+scmspl_batch_string(scmctx *ctx, const char *cstr)
+{
+  return SCMVAL_MAKE_STRING(_scmspl_batch(ctx, cstr));
+}
+
+scmval
+scmspl_batch_symbol(scmctx *ctx, const char *cstr)
+{
+  scmval v;
+
+  if (_scmspl_constant(cstr, &v)) {
+    return v;
+  }
+  return SCMVAL_MAKE_SYMBOL(_scmspl_batch(ctx, cstr));
 }
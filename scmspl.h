@@ -17,10 +17,25 @@
 #ifndef _SCMSPL_H
 #define _SCMSPL_H
 
-// internalize a c string as scmval string
-scmval scmspl_intern_string(const char *cstr);
+// internalize a c string as scmval string of the context ctx
+scmval scmspl_intern_string(scmctx *ctx, const char *cstr);
 
-// internalize a c string as scmval string
-scmval scmspl_intern_symbol(const char *cstr);
+// internalize a c string as scmval symbol of the context ctx
+scmval scmspl_intern_symbol(scmctx *ctx, const char *cstr);
+
+// like scmspl_intern_string for the arena of ctx: a string not in the
+// pool is copied into the arena instead, and taken back with it
+scmval scmspl_batch_string(scmctx *ctx, const char *cstr);
+
+// like scmspl_intern_symbol for the arena of ctx, see scmspl_batch_string
+scmval scmspl_batch_symbol(scmctx *ctx, const char *cstr);
+
+// intern into the pool of from, which must outlive ctx. the contexts
+// sharing a pool may intern concurrently, their values are compatible
+void scmspl_share(scmctx *ctx, scmctx *from);
+
+// number of strings interned in the pool of ctx and of its slots, while
+// no other context interns into it
+void scmspl_size(scmctx *ctx, size_t *count, size_t *slots);
 
 #endif
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2019 Jan Niemann <jan.niemann@beet5.de>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <errno.h>   /* errno */
+#include <stdio.h>
+#include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
+#include <string.h>
+#include <stdint.h>
+
+#include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
+#include "scmmem.h"
+#include "scmval.h"
+#include "scmspl.h"
+#include "scmprm.h"
+#include "scmmac.h"
+#include "scmtwi.h"
+
+// Implementation limits:
+#define _SCMTWI_MAXARGS 64
+
+/*
+ * an environment is a list of bindings, innermost first.
+ * a binding is a cell with the symbol as data and the value as next.
+ */
+struct _scmtwi_state {
+  scmval globals;
+
+  scmval sym_quote;
+  scmval sym_if;
+  scmval sym_define;
+  scmval sym_set;
+  scmval sym_lambda;
+  scmval sym_begin;
+  scmval sym_let;
+  scmval sym_define_macro;
+};
+
+/* static prototypes */
+static void _scmtwi_init(scmctx *ctx);
+static void _scmtwi_release(scmctx *ctx);
+static void _scmtwi_define_primitive(scmctx *ctx, const char *name, scmval proc);
+static scmval _scmtwi_bind(scmctx *ctx, scmval sym, scmval val, scmval env);
+static scmval _scmtwi_binding(scmctx *ctx, scmval sym, scmval env);
+static struct scmmac *_scmtwi_macro(scmctx *ctx, scmval sym, scmval env);
+static void _scmtwi_syntax(scmval x, int min, int max);
+static scmval _scmtwi_eval(scmctx *ctx, scmval x, scmval env);
+static scmval _scmtwi_body(scmctx *ctx, scmval body, scmval env);
+static scmval _scmtwi_define(scmctx *ctx, scmval x, scmval *env);
+static scmval _scmtwi_lambda(scmctx *ctx, const char *name, scmval params, scmval body, scmval env);
+static scmval _scmtwi_apply(scmctx *ctx, scmval f, int argc, scmval *argv);
+static scmval _scmtwi_pmap(scmctx *ctx, int argc, scmval *argv);
+static scmval _scmtwi_pfor_each(scmctx *ctx, int argc, scmval *argv);
+
+// the state of ctx, created on first use
+static void
+_scmtwi_init(scmctx *ctx)
+{
+  struct _scmtwi_state *st;
+
+  if (ctx->twi) {
+    return;
+  }
+  st = ctx->twi = scmmem_alloc(ctx, 1, sizeof(struct _scmtwi_state));
+  scmctx_atfree(ctx, _scmtwi_release);
+
+  st->globals = SCMVAL_NIL;
+  st->sym_quote = scmspl_intern_symbol(ctx, "quote");
+  st->sym_if = scmspl_intern_symbol(ctx, "if");
+  st->sym_define = scmspl_intern_symbol(ctx, "define");
+  st->sym_set = scmspl_intern_symbol(ctx, "set!");
+  st->sym_lambda = scmspl_intern_symbol(ctx, "lambda");
+  st->sym_begin = scmspl_intern_symbol(ctx, "begin");
+  st->sym_let = scmspl_intern_symbol(ctx, "let");
+  st->sym_define_macro = scmspl_intern_symbol(ctx, "define-macro");
+
+  scmprm_define_all(ctx, _scmtwi_define_primitive);
+  _scmtwi_define_primitive(ctx, "pmap", scmprm_make(ctx, "pmap", _scmtwi_pmap, 2));
+  _scmtwi_define_primitive(ctx, "pfor-each",
+			   scmprm_make(ctx, "pfor-each", _scmtwi_pfor_each, 2));
+}
+
+// the bindings are cells of the heap of ctx
+static void
+_scmtwi_release(scmctx *ctx)
+{
+  scmmem_free(ctx, (void **)&ctx->twi);
+}
+
+static void
+_scmtwi_define_primitive(scmctx *ctx, const char *name, scmval proc)
+{
+  ctx->twi->globals = _scmtwi_bind(ctx, scmspl_intern_symbol(ctx, name), proc, ctx->twi->globals);
+}
+
+// prepend a binding to an environment
+static scmval
+_scmtwi_bind(scmctx *ctx, scmval sym, scmval val, scmval env)
+{
+  return SCMVAL_MAKE_LIST(scmval_cons(ctx, SCMVAL_MAKE_LIST(scmval_cons(ctx, sym, val)), env));
+}
+
+// the binding of sym, searching env and then the globals
+static scmval
+_scmtwi_binding(scmctx *ctx, scmval sym, scmval env)
+{
+  struct _scmtwi_state *st = ctx->twi;
+  scmval l;
+  int pass;
+
+  for (pass = 0; pass < 2; pass++) {
+    for (l = pass ? st->globals : env; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+      if (sym == SCMVAL_CAR(SCMVAL_CAR(l))) {
+	return SCMVAL_CAR(l);
+      }
+    }
+  }
+  scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(sym));
+}
+
+// the macro named by an operator sym that is not a local variable
+static struct scmmac *
+_scmtwi_macro(scmctx *ctx, scmval sym, scmval env)
+{
+  struct scmmac *mac;
+
+  if (!SCMVAL_IS_SYMBOL(sym) || !(mac = scmmac_lookup(ctx, sym))) {
+    return NULL;
+  }
+  for (; SCMVAL_NIL != env; env = SCMVAL_CDR(env)) {
+    if (sym == SCMVAL_CAR(SCMVAL_CAR(env))) {
+      return NULL;
+    }
+  }
+  return mac;
+}
+
+// check the length of a special form, max -1 for no limit
+static void
+_scmtwi_syntax(scmval x, int min, int max)
+{
+  int len = 0;
+
+  for (; SCMVAL_IS_LIST(x); x = SCMVAL_CDR(x)) {
+    len++;
+  }
+  if ((SCMVAL_NIL != x) || (len < min) || ((max >= 0) && (len > max))) {
+    scmerr(SCMERR_BAD_SYNTAX, "special form of length %i", len);
+  }
+}
+
+static scmval
+_scmtwi_eval(scmctx *ctx, scmval x, scmval env)
+{
+  struct _scmtwi_state *st = ctx->twi;
+  scmval op, b, f, l;
+  scmval argv[_SCMTWI_MAXARGS];
+  struct scmmac *mac;
+  int argc;
+
+  if (SCMVAL_IS_SYMBOL(x)) {
+    b = _scmtwi_binding(ctx, x, env);
+    if (SCMVAL_UNBOUND == SCMVAL_CDR(b)) {
+      scmerr(SCMERR_UNBOUND_VARIABLE, "%s", SCMVAL_TO_C_STR(x));
+    }
+    return SCMVAL_CDR(b);
+  }
+  if (!SCMVAL_IS_LIST(x)) {
+    return x;
+  }
+
+  op = SCMVAL_CAR(x);
+  if (st->sym_quote == op) {
+    _scmtwi_syntax(x, 2, 2);
+    return SCMVAL_CAR(SCMVAL_CDR(x));
+  }
+  if (st->sym_if == op) {
+    _scmtwi_syntax(x, 3, 4);
+    x = SCMVAL_CDR(x);
+    if (SCMVAL_FALSE != _scmtwi_eval(ctx, SCMVAL_CAR(x), env)) {
+      return _scmtwi_eval(ctx, SCMVAL_CAR(SCMVAL_CDR(x)), env);
+    }
+    x = SCMVAL_CDR(SCMVAL_CDR(x));
+    return (SCMVAL_NIL == x) ? SCMVAL_NIL : _scmtwi_eval(ctx, SCMVAL_CAR(x), env);
+  }
+  if (st->sym_define == op) {
+    _scmtwi_syntax(x, 3, -1);
+    return _scmtwi_define(ctx, x, NULL);
+  }
+  if (st->sym_set == op) {
+    _scmtwi_syntax(x, 3, 3);
+    b = _scmtwi_binding(ctx, SCMVAL_CAR(SCMVAL_CDR(x)), env);
+    SCMVAL_CDR(b) = _scmtwi_eval(ctx, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))), env);
+    return SCMVAL_CDR(b);
+  }
+  if (st->sym_lambda == op) {
+    _scmtwi_syntax(x, 3, -1);
+    return _scmtwi_lambda(ctx, NULL, SCMVAL_CAR(SCMVAL_CDR(x)), SCMVAL_CDR(SCMVAL_CDR(x)), env);
+  }
+  if (st->sym_begin == op) {
+    // at top level the definitions of a begin are globals
+    if (SCMVAL_NIL == env) {
+      for (l = SCMVAL_CDR(x), b = SCMVAL_NIL; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+	b = _scmtwi_eval(ctx, SCMVAL_CAR(l), env);
+      }
+      return b;
+    }
+    return _scmtwi_body(ctx, SCMVAL_CDR(x), env);
+  }
+  if (st->sym_let == op) {
+    _scmtwi_syntax(x, 3, -1);
+    for (l = SCMVAL_CAR(SCMVAL_CDR(x)), b = env; SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+      b = _scmtwi_bind(ctx, SCMVAL_CAR(SCMVAL_CAR(l)),
+		       _scmtwi_eval(ctx, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CAR(l))), env), b);
+    }
+    return _scmtwi_body(ctx, SCMVAL_CDR(SCMVAL_CDR(x)), b);
+  }
+  if (st->sym_define_macro == op) {
+    _scmtwi_syntax(x, 3, -1);
+    l = SCMVAL_CAR(SCMVAL_CDR(x));
+    if (!SCMVAL_IS_LIST(l) || !SCMVAL_IS_SYMBOL(SCMVAL_CAR(l))) {
+      scmerr(SCMERR_BAD_SYNTAX, "define-macro: (name param ...) expected");
+    }
+    if (SCMVAL_NIL != env) {
+      scmerr(SCMERR_BAD_SYNTAX, "define-macro: %s not at top level",
+	     SCMVAL_TO_C_STR(SCMVAL_CAR(l)));
+    }
+    scmmac_define(ctx, SCMVAL_CAR(l), _scmtwi_lambda(ctx, SCMVAL_TO_C_STR(SCMVAL_CAR(l)), SCMVAL_CDR(l),
+						SCMVAL_CDR(SCMVAL_CDR(x)), SCMVAL_NIL));
+    return SCMVAL_CAR(l);
+  }
+  // evaluating a body again finds the expansions of its macro calls cached
+  if ((mac = _scmtwi_macro(ctx, op, env))) {
+    return _scmtwi_eval(ctx, scmmac_expand(ctx, mac, x, _scmtwi_apply), env);
+  }
+
+  f = _scmtwi_eval(ctx, op, env);
+  for (argc = 0, l = SCMVAL_CDR(x); SCMVAL_NIL != l; l = SCMVAL_CDR(l)) {
+    if (_SCMTWI_MAXARGS == argc) {
+      scmerr(SCMERR_WRONG_ARITY, "more than %i arguments", _SCMTWI_MAXARGS);
+    }
+    argv[argc++] = _scmtwi_eval(ctx, SCMVAL_CAR(l), env);
+  }
+  return _scmtwi_apply(ctx, f, argc, argv);
+}
+
+// internal definitions extend the environment of the rest of the body
+static scmval
+_scmtwi_body(scmctx *ctx, scmval body, scmval env)
+{
+  struct _scmtwi_state *st = ctx->twi;
+  scmval x, v = SCMVAL_NIL;
+
+  for (; SCMVAL_NIL != body; body = SCMVAL_CDR(body)) {
+    x = SCMVAL_CAR(body);
+    if (SCMVAL_IS_LIST(x) && (st->sym_define == SCMVAL_CAR(x))) {
+      _scmtwi_syntax(x, 3, -1);
+      v = _scmtwi_define(ctx, x, &env);
+    } else {
+      v = _scmtwi_eval(ctx, x, env);
+    }
+  }
+  return v;
+}
+
+// define a global, or a local in *env if env is not NULL
+static scmval
+_scmtwi_define(scmctx *ctx, scmval x, scmval *env)
+{
+  struct _scmtwi_state *st = ctx->twi;
+  scmval target = SCMVAL_CAR(SCMVAL_CDR(x));
+  scmval name, val, b;
+
+  if (env) {
+    b = SCMVAL_CAR(*env = _scmtwi_bind(ctx, SCMVAL_IS_LIST(target) ? SCMVAL_CAR(target) : target,
+				       SCMVAL_UNBOUND, *env));
+  } else {
+    b = SCMVAL_NIL;
+  }
+
+  if (SCMVAL_IS_LIST(target)) {
+    name = SCMVAL_CAR(target);
+    val = _scmtwi_lambda(ctx, SCMVAL_TO_C_STR(name), SCMVAL_CDR(target),
+			 SCMVAL_CDR(SCMVAL_CDR(x)), env ? *env : SCMVAL_NIL);
+  } else {
+    name = target;
+    val = _scmtwi_eval(ctx, SCMVAL_CAR(SCMVAL_CDR(SCMVAL_CDR(x))), env ? *env : SCMVAL_NIL);
+  }
+
+  if (env) {
+    SCMVAL_CDR(b) = val;
+  } else {
+    for (b = st->globals; SCMVAL_NIL != b; b = SCMVAL_CDR(b)) {
+      if (name == SCMVAL_CAR(SCMVAL_CAR(b))) {
+	SCMVAL_CDR(SCMVAL_CAR(b)) = val;
+	return name;
+      }
+    }
+    st->globals = _scmtwi_bind(ctx, name, val, st->globals);
+  }
+  return name;
+}
+
+static scmval
+_scmtwi_lambda(scmctx *ctx, const char *name, scmval params, scmval body, scmval env)
+{
+  struct _scmprc *prc = scmmem_alloc(ctx, 1, sizeof(struct _scmprc));
+
+  prc->type = SCMPRC_TREE;
+  prc->name = name;
+  prc->u.tree.params = params;
+  prc->u.tree.body = body;
+  prc->u.tree.env = env;
+  return SCMVAL_MAKE_PROCEDURE(prc);
+}
+
+static scmval
+_scmtwi_apply(scmctx *ctx, scmval f, int argc, scmval *argv)
+{
+  struct _scmprc *prc;
+  scmval env, params;
+  int i;
+
+  if (!SCMVAL_IS_PROCEDURE(f)) {
+    scmerr(SCMERR_WRONG_TYPE, "procedure expected");
+  }
+  prc = SCMVAL_TO_PROCEDURE(f);
+  switch (prc->type) {
+  case SCMPRC_PRIMITIVE:
+    if ((prc->u.prim.arity >= 0) && (prc->u.prim.arity != argc)) {
+      scmerr(SCMERR_WRONG_ARITY, "%s", prc->name);
+    }
+    return prc->u.prim.fn(ctx, argc, argv);
+  case SCMPRC_TREE:
+    env = prc->u.tree.env;
+    for (i = 0, params = prc->u.tree.params; SCMVAL_NIL != params; i++, params = SCMVAL_CDR(params)) {
+      if (i == argc) {
+	break;
+      }
+      env = _scmtwi_bind(ctx, SCMVAL_CAR(params), argv[i], env);
+    }
+    if ((i != argc) || (SCMVAL_NIL != params)) {
+      scmerr(SCMERR_WRONG_ARITY, "%s", prc->name ? prc->name : "lambda");
+    }
+    return _scmtwi_body(ctx, prc->u.tree.body, env);
+  default:
+    scmerr(SCMERR_WRONG_TYPE, "procedure of another interpreter");
+  }
+}
+
+// (pmap proc list) of the reference, a sequential map
+static scmval
+_scmtwi_pmap(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval head = SCMVAL_NIL, tail = SCMVAL_NIL, cell, l;
+
+  for (l = argv[1]; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    cell = SCMVAL_MAKE_LIST(scmval_cons(ctx, _scmtwi_apply(ctx, argv[0], 1, &SCMVAL_CAR(l)),
+					SCMVAL_NIL));
+    if (SCMVAL_NIL == head) {
+      head = cell;
+    } else {
+      SCMVAL_CDR(tail) = cell;
+    }
+    tail = cell;
+  }
+  if (SCMVAL_NIL != l) {
+    scmerr(SCMERR_WRONG_TYPE, "pmap: list expected");
+  }
+  return head;
+}
+
+// (pfor-each proc list) of the reference
+static scmval
+_scmtwi_pfor_each(scmctx *ctx, int argc, scmval *argv)
+{
+  scmval l;
+
+  for (l = argv[1]; SCMVAL_IS_LIST(l); l = SCMVAL_CDR(l)) {
+    (void)_scmtwi_apply(ctx, argv[0], 1, &SCMVAL_CAR(l));
+  }
+  if (SCMVAL_NIL != l) {
+    scmerr(SCMERR_WRONG_TYPE, "pfor-each: list expected");
+  }
+  return SCMVAL_NIL;
+}
+
+// eval()
+scmval
+scmtwi_eval(scmctx *ctx, scmval v)
+{
+  _scmtwi_init(ctx);
+
+  if (SCMVAL_EOF == v) {
+    return v;
+  }
+  return _scmtwi_eval(ctx, v, SCMVAL_NIL);
+}
@@ -15,14 +15,16 @@
  */
 
 #include <errno.h>  /* errno */
+#include <stdio.h>
 #include <stdlib.h>      /* exit, malloc, realloc, free, NULL */
 #include <string.h>
 #include <stdint.h>
 
 #include "scmerr.h"      /* scmerr */
+#include "scmctx.h"
 #include "scmmem.h"
 
 #include "scmval.h"
 
 /* inlined */
-extern scmval scmval_cons(scmval data, scmval next);
+extern scmval scmval_cons(scmctx *ctx, scmval data, scmval next);
@@ -67,13 +67,13 @@ note that amd64 pointer are only 48 bit wide and sign extend from bit 47.
  +-----------------------------------------------------------+--+---+
  | list, struct _scmval *                                       |011|
  +-----------------------------------------------------------+--+---+
- | currently unused                                             |100|
+ | procedure, struct _scmprc *                                  |100|
  +-----------------------------------------------------------+--+---+
  | currently unused                                             |101|
  +-----------------------------------------------------------+--+---+
  | currently unused                                             |110|
  +-----------------------------------------------------------+--+---+
- | SCMVAL_EOF                                                   |111|
+ | SCMVAL_EOF (-1), SCMVAL_UNBOUND (internal marker)            |111|
  +-----------------------------------------------------------+--+---+
 
 
@@ -87,33 +87,85 @@ note that amd64 pointer are only 48 bit wide and sign extend from bit 47.
 #define SCMVAL_IS_SYMBOL(x)     (((intptr_t)(x) & 0x07) == 0x01)
 #define SCMVAL_IS_STRING(x)     (((intptr_t)(x) & 0x07) == 0x02)
 #define SCMVAL_IS_LIST(x)       (((intptr_t)(x) & 0x07) == 0x03)
+#define SCMVAL_IS_PROCEDURE(x)  (((intptr_t)(x) & 0x07) == 0x04)
 #define SCMVAL_IS_EOF(x)        ((intptr_t)(x) == -1)
+#define SCMVAL_ARE_INTEGERS(x, y) ((((intptr_t)(x) | (intptr_t)(y)) & 0x1f) == 0x00)
 
 /* conversion to c native types */
 #define SCMVAL_TO_C_INT(v)        ( (intptr_t)     (((intptr_t)(v) & ~0x07)>>5) )
 #define SCMVAL_TO_C_STR(v)        ( (const char *) ((intptr_t)(v) & ~0x07) )
 #define SCMVAL_TO_LIST(v)         ( (scmval)       ((intptr_t)(v) & ~0x07) )
+#define SCMVAL_TO_PROCEDURE(v)    ( (struct _scmprc *) ((intptr_t)(v) & ~0x07) )
 
 /* tag and cast */
 #define SCMVAL_MAKE_INTEGER(v)    ( (scmval) ((intptr_t)((v)<<5) | 0x00))
 #define SCMVAL_MAKE_SYMBOL(v)     ( (scmval) ((intptr_t)(v) | 0x01))
 #define SCMVAL_MAKE_STRING(v)     ( (scmval) ((intptr_t)(v) | 0x02))
 #define SCMVAL_MAKE_LIST(v)       ( (scmval) ((intptr_t)(v) | 0x03))
+#define SCMVAL_MAKE_PROCEDURE(v)  ( (scmval) ((intptr_t)(v) | 0x04))
 
 #define SCMVAL_NIL                  (scmval)0x08
 #define SCMVAL_TRUE                 (scmval)0x10
 #define SCMVAL_FALSE                (scmval)0x18
 #define SCMVAL_EOF                  (scmval)-1
 
+// marks a variable that has no value yet, never seen by programs
+#define SCMVAL_UNBOUND              (scmval)0x07
+
 // for 59bit integers the max integer is represented by the lowest 58 bits set
 // ranges from +288230376151711743 to -288230376151711744
 #define SCMVAL_INT_MAX          0x03ffffffffffffffL
 #define SCMVAL_INT_MIN          (-SCMVAL_INT_MAX - 1L)
 
+// access to list cells
+#define SCMVAL_CAR(v)             ( SCMVAL_TO_LIST(v)->data )
+#define SCMVAL_CDR(v)             ( SCMVAL_TO_LIST(v)->next )
+
+// procedures
+
+// primitive procedures are c functions on an argument vector
+typedef scmval (*scmprc_fn)(scmctx *ctx, int argc, scmval *argv);
+
+// procedures compiled to c by scmc, self holds the free variables
+struct _scmprc;
+typedef scmval (*scmprc_native_fn)(struct _scmprc *self, scmval *argv);
+
+enum scmprc_type {
+  SCMPRC_PRIMITIVE,     // c function
+  SCMPRC_CLOSURE,       // bytecode compiled by scmevl
+  SCMPRC_TREE,          // s-expression interpreted by scmtwi
+  SCMPRC_NATIVE,        // c function compiled by scmc
+};
+
+struct _scmprc {
+  enum scmprc_type type;
+  const char *name;     // NULL for anonymous lambdas
+  union {
+    struct {
+      scmprc_fn fn;
+      int arity;        // -1 for any number of arguments
+    } prim;
+    struct {
+      struct _scmcod *cod;
+      scmval *free;     // captured variables, allocated after the struct
+    } clo;
+    struct {
+      scmval params;
+      scmval body;
+      scmval env;
+    } tree;
+    struct {
+      scmprc_native_fn fn;
+      int arity;
+      scmval *free;     // captured variables, allocated after the struct
+    } nat;
+  } u;
+};
+
 // allocate a cons cell
 inline scmval
-scmval_cons(scmval data, scmval next) {
-  scmval pair = (scmval) scmmem_alloc(1, sizeof(struct _scmval));
+scmval_cons(scmctx *ctx, scmval data, scmval next) {
+  scmval pair = (scmval) scmmem_arena_alloc(ctx, sizeof(struct _scmval));
   pair->data = data;
   pair->next = next;
   return pair;
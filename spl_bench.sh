@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# intern table benchmark, the wall clock time of scmrpl -t reading a file
+# of many distinct names on 1, 2, 4 and 8 threads. best of three runs.
+# speedup is relative to scmrpl reading the file on one thread, without -t.
+#
+
+FILE=$(mktemp)
+trap 'rm -f ${FILE}' EXIT
+
+_wall() {
+    local _start _end
+
+    _start=$(date +%s.%N)
+    "$@" > /dev/null
+    _end=$(date +%s.%N)
+    echo "$_start $_end" | awk '{ print $2 - $1 }'
+}
+
+_best() {
+    local _run _t _best=""
+
+    for _run in 1 2 3; do
+	_t=$(_wall "$@")
+	if [ -z "$_best" ] || [ $(echo "$_t $_best" | awk '{ print ($1 < $2) }') = 1 ]; then
+	    _best=$_t
+	fi
+    done
+    echo $_best
+}
+
+awk 'BEGIN { srand(1);
+    for (i = 0; i < 500000; i++) {
+	printf "(s%d t%d \"s%d\" (u%d 1 2))\n", int(rand() * 250000), i, i % 5000, i % 1000 } }' > ${FILE}
+SIZE=$(wc -c < ${FILE})
+SERIAL=$(_best scmrpl ${FILE})
+
+printf "%-8s %9s %9s %7s\n" threads time MB/s speedup
+echo "- $SERIAL $SIZE $SERIAL" | awk '{ printf "%-8s %8.2fs %9.1f %6.1fx\n", $1, $2, $3 / $2 / 1e6, $4 / $2 }'
+for _threads in 1 2 4 8; do
+    echo "$_threads $(_best scmrpl -t $_threads ${FILE}) $SIZE $SERIAL" |
+	awk '{ printf "%-8s %8.2fs %9.1f %6.1fx\n", $1, $2, $3 / $2 / 1e6, $4 / $2 }'
+done
@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# intern table test, threads of scm -t and scmrpl -t intern the same
+# names concurrently and must get the same symbols
+#
+
+FILE=$(mktemp)
+OUT=$(mktemp)
+trap 'rm -f ${FILE} ${OUT}' EXIT
+
+_test_spl() {
+    local _num=$1
+    local _desc=$2
+    local _bin=$3
+    local _exp_output=$4
+
+    echo [TEST] $_desc >&2
+
+    OUTPUT=$(${_bin} -t 8 ${FILE} | tail -n 1)
+    STATUS=$?
+    if [ X"${STATUS}" != X"0" ] ; then
+	echo "not ok $_num - unexpected status [${STATUS}] $_desc [${_bin}]"
+    elif [ X"${OUTPUT}" != X"${_exp_output}" ] ; then
+	echo "not ok $_num - unexpected output [${OUTPUT}] $_desc [${_bin}]"
+    else
+	echo "ok $_num - $_desc [${_bin}]"
+    fi
+}
+
+# scmrpl -t prints what scmrpl prints
+_test_spl_rpl() {
+    local _num=$1
+    local _desc=$2
+
+    echo [TEST] $_desc >&2
+
+    scmrpl ${FILE} > ${OUT}
+    if scmrpl -t 8 ${FILE} | cmp -s ${OUT} - ; then
+	echo "ok $_num - $_desc [scmrpl]"
+    else
+	echo "not ok $_num - unexpected output $_desc [scmrpl]"
+    fi
+}
+
+
+echo "1..4"
+
+# the symbols x0 ... x19999 are defined in the first chunks and compared
+# in all others, the chunks are read by different threads at once
+awk 'BEGIN { print "(define bad 0)";
+    for (i = 0; i < 20000; i++) printf "(define p%d (quote x%d))\n", i, i;
+    for (i = 0; i < 120000; i++) {
+	j = (i * 7919) % 20000;
+	printf "(set! bad (+ bad (if (eq? p%d (quote x%d)) 0 1)))\n", j, j }
+    print "bad" }' > ${FILE}
+_test_spl 1 same_symbol scm 0
+_test_spl 2 same_symbol scmref 0
+
+# many distinct names, strings and symbols of the same name
+awk 'BEGIN { srand(1);
+    for (i = 0; i < 200000; i++) {
+	printf "(s%d t%d \"s%d\" (u%d))\n", int(rand() * 100000), i, i % 5000, i % 1000 } }' > ${FILE}
+_test_spl_rpl 3 distinct_names
+
+# a pool shared by the threads of -t counts the probes of a miss once,
+# one thread interning reports what scm reports
+awk 'BEGIN { for (i = 0; i < 2000; i++) printf "(define y%d %d)\n", i, i }' > ${FILE}
+_probes() {
+    scm $1 --stats ${FILE} 2>&1 >/dev/null | tail -n 1 |
+	sed -n 's/.*"probes": \([0-9]*\).*/\1/p'
+}
+OUTPUT=$(_probes "-t 4")
+if [ X"${OUTPUT}" != X"$(_probes)" ] ; then
+    echo "not ok 4 - unexpected probes [${OUTPUT}] shared_probes [scm]"
+else
+    echo "ok 4 - shared_probes [scm]"
+fi